@@ -1174,6 +1174,19 @@ core.register_chatcommand("shutdown", {
 	end,
 })
 
+core.register_chatcommand("trace", {
+	description = S("Write the recorded engine trace to a file"),
+	privs = {server=true},
+	func = function(name, param)
+		local path = core.write_trace()
+		if not path then
+			return false, S("Failed to write the trace. Is profiler_trace_buffer_size set?")
+		end
+		core.log("action", name .. " wrote the engine trace to " .. path)
+		return true, S("Trace written to @1", path)
+	end,
+})
+
 core.register_chatcommand("ban", {
 	params = S("[<name>]"),
 	description = S("Ban the IP of a player or show the ban list"),
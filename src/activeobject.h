@@ -55,6 +55,21 @@ struct ActiveObjectMessage
 	std::string datastring;
 };
 
+/*
+	Movement of an active object as last sent to clients, see
+	AO_CMD_UPDATE_POSITION and TOCLIENT_ACTIVE_OBJECT_POSITIONS
+*/
+struct ObjectPosition
+{
+	v3f position;
+	v3f velocity;
+	v3f acceleration;
+	v3f rotation;
+	bool do_interpolate = false;
+	// Whether the object stops at this position (for interpolation)
+	bool is_end_position = false;
+};
+
 enum ActiveObjectCommand {
 	AO_CMD_SET_PROPERTIES,
 	AO_CMD_UPDATE_POSITION,
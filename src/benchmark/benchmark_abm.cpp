@@ -0,0 +1,147 @@
+/*
+Minetest
+Copyright (C) 2022 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "noise.h"
+#include <cmath>
+
+static content_t addContent(NodeDefManager *ndef, const char *name)
+{
+	ContentFeatures f;
+	f.name = name;
+	return ndef->set(f.name, f);
+}
+
+// What the ABM pass does with a matching node before triggering it:
+// look for a required neighbor (here: air above)
+static bool hasNeighbor(MapBlock *block, v3s16 p0)
+{
+	if (p0.Y + 1 >= MAP_BLOCKSIZE)
+		return true;
+	return block->getNodeNoCheck(p0 + v3s16(0, 1, 0)).getContent() == CONTENT_AIR;
+}
+
+TEST_CASE("benchmark_abm")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t c_stone = addContent(ndef, "stone");
+	content_t c_ore = addContent(ndef, "stone_with_coal");
+	content_t c_dirt = addContent(ndef, "dirt");
+	content_t c_grass = addContent(ndef, "dirt_with_grass");
+	content_t c_water = addContent(ndef, "water_source");
+	content_t c_leaves = addContent(ndef, "leaves");
+
+	// Terrain similar to a generated world: stone with ores, a dirt layer
+	// with grass on top, lakes and scattered trees
+	v3s16 bpmin(-4, -2, -4), bpmax(3, 1, 3);
+	DummyMap map(&gamedef, bpmin, bpmax);
+	v3s16 pmin = bpmin * MAP_BLOCKSIZE;
+	v3s16 pmax = (bpmax + 1) * MAP_BLOCKSIZE - 1;
+	for (s16 z = pmin.Z; z <= pmax.Z; z++)
+	for (s16 x = pmin.X; x <= pmax.X; x++) {
+		s16 surface = 4 * std::sin(x * 0.1f) + 4 * std::cos(z * 0.13f);
+		for (s16 y = pmin.Y; y <= pmax.Y; y++) {
+			content_t c = CONTENT_AIR;
+			if (y < surface - 3)
+				c = (noise3d(x, y, z, 1) > 0.9f) ? c_ore : c_stone;
+			else if (y < surface)
+				c = c_dirt;
+			else if (y == surface)
+				c = surface < -2 ? c_dirt : c_grass;
+			else if (y <= -2)
+				c = c_water;
+			else if (y > surface + 3 && y < surface + 7 &&
+					((x & 7) < 3) && ((z & 7) < 3))
+				c = c_leaves;
+			map.setNode(v3s16(x, y, z), MapNode(c));
+		}
+	}
+
+	std::vector<MapBlock *> blocks;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 y = bpmin.Y; y <= bpmax.Y; y++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++)
+		blocks.push_back(map.getBlockNoCreateNoEx(v3s16(x, y, z)));
+
+	// Typical ABM triggers: grass spread, leaf decay, water
+	auto filter = std::make_shared<std::vector<bool>>(c_leaves + 1, false);
+	(*filter)[c_grass] = (*filter)[c_water] = (*filter)[c_leaves] = true;
+	MapBlock::ContentFilter cfilter = filter;
+
+	BENCHMARK("abm_pass_scan_all_nodes") {
+		u32 matched = 0;
+		for (MapBlock *block : blocks) {
+			v3s16 p0;
+			for (p0.X = 0; p0.X < MAP_BLOCKSIZE; p0.X++)
+			for (p0.Y = 0; p0.Y < MAP_BLOCKSIZE; p0.Y++)
+			for (p0.Z = 0; p0.Z < MAP_BLOCKSIZE; p0.Z++) {
+				content_t c = block->getNodeNoCheck(p0).getContent();
+				if (c >= filter->size() || !(*filter)[c])
+					continue;
+				if (hasNeighbor(block, p0))
+					matched++;
+			}
+		}
+		return matched;
+	};
+
+	BENCHMARK("abm_pass_content_index") {
+		u32 matched = 0;
+		for (MapBlock *block : blocks) {
+			const MapBlock::ContentIndex &index = block->getContentIndex(cfilter);
+			for (const auto &it : index) {
+				for (u16 i : it.second) {
+					if (hasNeighbor(block, MapBlock::getNodePosFromIndex(i)))
+						matched++;
+				}
+			}
+		}
+		return matched;
+	};
+
+	BENCHMARK("abm_pass_content_index_rebuild") {
+		u32 matched = 0;
+		for (MapBlock *block : blocks) {
+			block->invalidateContentIndex();
+			const MapBlock::ContentIndex &index = block->getContentIndex(cfilter);
+			for (const auto &it : index)
+				matched += it.second.size();
+		}
+		return matched;
+	};
+
+	BENCHMARK_ADVANCED("setNode_with_content_index")(Catch::Benchmark::Chronometer meter) {
+		MapBlock *block = blocks.front();
+		block->getContentIndex(cfilter);
+		meter.measure([&] {
+			for (u16 i = 0; i < 64; i++) {
+				v3s16 p = MapBlock::getNodePosFromIndex(i * 61);
+				MapNode n = block->getNodeNoCheck(p);
+				block->setNodeNoCheck(p, MapNode(c_grass));
+				block->setNodeNoCheck(p, n);
+			}
+		});
+	};
+}
@@ -0,0 +1,135 @@
+/*
+Minetest
+Copyright (C) 2022 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "server/activeobjectmgr.h"
+#include "util/numeric.h"
+#include <queue>
+#include <set>
+
+class BenchServerActiveObject : public ServerActiveObject
+{
+public:
+	BenchServerActiveObject(const v3f &p) : ServerActiveObject(nullptr, p) {}
+
+	ActiveObjectType getType() const { return ACTIVEOBJECT_TYPE_TEST; }
+	bool getCollisionBox(aabb3f *toset) const { return false; }
+	bool getSelectionBox(aabb3f *toset) const { return false; }
+	bool collideWithObjects() const { return false; }
+};
+
+// Objects are spread over 2000x200x2000 nodes, like units on a large map
+static v3f randomPos()
+{
+	return v3f(myrand_range(-1000.0f, 1000.0f),
+		myrand_range(-100.0f, 100.0f),
+		myrand_range(-1000.0f, 1000.0f)) * BS;
+}
+
+static void fill(server::ActiveObjectMgr &mgr,
+		std::vector<ServerActiveObject *> &all, u32 count)
+{
+	for (u32 i = 0; i < count; i++) {
+		auto *obj = new BenchServerActiveObject(randomPos());
+		mgr.registerObject(obj);
+		all.push_back(obj);
+	}
+}
+
+// What every query did before the spatial index existed
+static size_t scanInsideRadius(const std::vector<ServerActiveObject *> &all,
+		const v3f &pos, float radius)
+{
+	float r2 = radius * radius;
+	size_t count = 0;
+	for (ServerActiveObject *obj : all) {
+		if (obj->getBasePosition().getDistanceFromSQ(pos) <= r2)
+			count++;
+	}
+	return count;
+}
+
+static void benchInsideRadius(Catch::Benchmark::Chronometer &meter, u32 count,
+		float radius, bool use_index)
+{
+	server::ActiveObjectMgr mgr;
+	std::vector<ServerActiveObject *> all;
+	fill(mgr, all, count);
+
+	std::vector<ServerActiveObject *> result;
+	meter.measure([&] {
+		v3f pos = randomPos();
+		if (!use_index)
+			return scanInsideRadius(all, pos, radius);
+		result.clear();
+		mgr.getObjectsInsideRadius(pos, radius, result, nullptr);
+		return result.size();
+	});
+
+	mgr.clear([](ServerActiveObject *obj, u16 id) {
+		delete obj;
+		return true;
+	});
+}
+
+static void benchAddedAroundPos(Catch::Benchmark::Chronometer &meter, u32 count)
+{
+	server::ActiveObjectMgr mgr;
+	std::vector<ServerActiveObject *> all;
+	fill(mgr, all, count);
+
+	// Default active_object_send_range_blocks
+	const f32 radius = 8 * MAP_BLOCKSIZE * BS;
+	std::set<u16> current_objects;
+	meter.measure([&] {
+		std::queue<u16> added_objects;
+		mgr.getAddedActiveObjectsAroundPos(randomPos(), radius, 0,
+				current_objects, added_objects);
+		return added_objects.size();
+	});
+
+	mgr.clear([](ServerActiveObject *obj, u16 id) {
+		delete obj;
+		return true;
+	});
+}
+
+#define BENCH_COUNT(_count, _label) \
+	BENCHMARK_ADVANCED("scan_inside_radius_" _label)(Catch::Benchmark::Chronometer meter) { \
+		benchInsideRadius(meter, _count, 10 * BS, false); \
+	}; \
+	BENCHMARK_ADVANCED("getObjectsInsideRadius_" _label)(Catch::Benchmark::Chronometer meter) { \
+		benchInsideRadius(meter, _count, 10 * BS, true); \
+	}; \
+	BENCHMARK_ADVANCED("scan_inside_send_range_" _label)(Catch::Benchmark::Chronometer meter) { \
+		benchInsideRadius(meter, _count, 8 * MAP_BLOCKSIZE * BS, false); \
+	}; \
+	BENCHMARK_ADVANCED("getObjectsInsideRadius_send_range_" _label)(Catch::Benchmark::Chronometer meter) { \
+		benchInsideRadius(meter, _count, 8 * MAP_BLOCKSIZE * BS, true); \
+	}; \
+	BENCHMARK_ADVANCED("getAddedActiveObjectsAroundPos_" _label)(Catch::Benchmark::Chronometer meter) { \
+		benchAddedAroundPos(meter, _count); \
+	};
+
+TEST_CASE("benchmark_activeobjectmgr")
+{
+	BENCH_COUNT(1000, "1k")
+	BENCH_COUNT(10000, "10k")
+	BENCH_COUNT(50000, "50k")
+}
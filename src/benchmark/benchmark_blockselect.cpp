@@ -0,0 +1,127 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "clientiface.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "nodedef.h"
+#include "threading/thread_pool.h"
+#include <cmath>
+#include <memory>
+#include <thread>
+
+/*
+	The block selection of Server::SendBlocks() for simulated clients
+	standing on hilly terrain and looking around, without emerging.
+	Nothing is sent, so every step selects the same blocks again.
+*/
+
+static const v3s16 BPMIN(-8, -4, -8);
+static const v3s16 BPMAX(7, 3, 7);
+
+static s16 surfaceHeight(s16 x, s16 z)
+{
+	return 6 * std::sin(x * 0.05f) + 6 * std::cos(z * 0.07f);
+}
+
+static void makeTerrain(DummyMap *map, content_t c_stone,
+		const NodeDefManager *ndef)
+{
+	MapNode air(CONTENT_AIR);
+	air.setLight(LIGHTBANK_DAY, LIGHT_SUN, ndef->getLightingFlags(air));
+
+	for (s16 bz = BPMIN.Z; bz <= BPMAX.Z; bz++)
+	for (s16 by = BPMIN.Y; by <= BPMAX.Y; by++)
+	for (s16 bx = BPMIN.X; bx <= BPMAX.X; bx++) {
+		v3s16 bp(bx, by, bz);
+		MapBlock *block = map->getBlockNoCreateNoEx(bp);
+		v3s16 base = bp * MAP_BLOCKSIZE;
+		for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+			s16 surface = surfaceHeight(base.X + x, base.Z + z);
+			for (s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+				block->setNodeNoCheck(x, y, z, base.Y + y < surface ?
+					MapNode(c_stone) : air);
+			}
+		}
+		block->setGenerated(true);
+		block->setIsUnderground(by < 0);
+	}
+}
+
+TEST_CASE("benchmark_blockselect")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+	ContentFeatures f;
+	f.name = "stone";
+	content_t c_stone = ndef->set(f.name, f);
+
+	DummyMap map(&gamedef, BPMIN, BPMAX);
+	makeTerrain(&map, c_stone, ndef);
+
+	// One iteration is one step of SendBlocks() for every client
+	u32 max_threads = std::max(1U, std::thread::hardware_concurrency());
+	for (u32 num_clients : {1, 8, 32, 128}) {
+		std::vector<std::unique_ptr<RemoteClient>> clients;
+		std::vector<BlockSendViewer> viewers(num_clients);
+		for (u32 i = 0; i < num_clients; i++) {
+			clients.emplace_back(new RemoteClient());
+			clients[i]->peer_id = i + 1;
+
+			float angle = i * 2.4f;
+			float radius = (i % 4 + 1) * 8.0f;
+			v3s16 pos(std::cos(angle) * radius, 0, std::sin(angle) * radius);
+			pos.Y = surfaceHeight(pos.X, pos.Z) + 1;
+
+			BlockSendViewer &viewer = viewers[i];
+			viewer.position = intToFloat(pos, BS);
+			viewer.camera_pos = viewer.position + v3f(0, 1.5f * BS, 0);
+			viewer.camera_dir = v3f(std::cos(angle), -0.2f, std::sin(angle));
+			viewer.camera_dir.normalize();
+			viewer.fov = 72.0f * core::DEGTORAD;
+			viewer.wanted_range = 6;
+		}
+
+		// Counts num_block_select_threads, the server thread takes part too
+		for (u32 threads = 0; threads <= max_threads; threads = threads * 2 + 1) {
+			ThreadPool pool("BlockSelect", threads);
+			std::vector<BlockSelection> selections(num_clients);
+			std::vector<PrioritySortedBlockTransfer> queue;
+			BENCHMARK_ADVANCED(std::string("select_") + std::to_string(num_clients) +
+					"_clients_" + std::to_string(threads) + "_threads")
+					(Catch::Benchmark::Chronometer meter) {
+				meter.measure([&] {
+					// The pause after finding nothing is always over
+					pool.parallelFor(num_clients, [&] (size_t i) {
+						selections[i].clear();
+						clients[i]->SelectNextBlocks(viewers[i], &map, nullptr,
+								2.5f, selections[i]);
+					});
+					queue.clear();
+					for (BlockSelection &selection : selections)
+						selection.merge(queue);
+					return queue.size();
+				});
+			};
+		}
+	}
+}
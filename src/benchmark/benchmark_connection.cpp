@@ -0,0 +1,129 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "network/connection.h"
+#include "network/networkpacket.h"
+#include "network/socket.h"
+#include "porting.h"
+#include <string>
+#include <vector>
+
+/*
+	Loopback throughput of the UDP socket, one system call per datagram
+	against batches, and of a whole client connection.
+*/
+
+static const u16 SOCKET_PORT = 30020;
+static const u16 CONNECTION_PORT = 30021;
+static const int DATAGRAM_COUNT = 64;
+static const int DATAGRAM_SIZE = 512;
+static const int PACKET_COUNT = 256;
+
+struct BenchHandler : public con::PeerHandler
+{
+	void peerAdded(con::Peer *peer) { last_id = peer->id; }
+	void deletingPeer(con::Peer *peer, bool timeout) {}
+
+	session_t last_id = 0;
+};
+
+// Receives until count datagrams arrived or the socket times out
+static int receiveAll(UDPSocket &socket, int count, bool batch)
+{
+	char buffers[UDPSocket::BATCH_SIZE][DATAGRAM_SIZE];
+	int received = 0;
+	while (received < count) {
+		if (batch) {
+			UDPDatagram datagrams[UDPSocket::BATCH_SIZE];
+			for (int i = 0; i < UDPSocket::BATCH_SIZE; i++)
+				datagrams[i] = {Address(), buffers[i], DATAGRAM_SIZE};
+			int n = socket.ReceiveBatch(datagrams, UDPSocket::BATCH_SIZE);
+			if (n == 0)
+				break;
+			received += n;
+		} else {
+			Address sender;
+			if (socket.Receive(sender, buffers[0], DATAGRAM_SIZE) < 0)
+				break;
+			received++;
+		}
+	}
+	return received;
+}
+
+TEST_CASE("benchmark_connection")
+{
+	Address address(127, 0, 0, 1, SOCKET_PORT);
+	UDPSocket receiver(false);
+	receiver.Bind(address);
+	receiver.setTimeoutMs(100);
+	UDPSocket sender(false);
+
+	std::string data(DATAGRAM_SIZE, 'x');
+	std::vector<UDPDatagram> datagrams(DATAGRAM_COUNT,
+		UDPDatagram{address, &data[0], DATAGRAM_SIZE});
+
+	const std::string suffix = "_" + std::to_string(DATAGRAM_COUNT) + "_datagrams";
+	BENCHMARK(std::string("udp_single") + suffix)
+	{
+		for (const UDPDatagram &datagram : datagrams)
+			sender.Send(datagram.address, datagram.data, datagram.size);
+		return receiveAll(receiver, DATAGRAM_COUNT, false);
+	};
+
+	BENCHMARK(std::string("udp_batch") + suffix)
+	{
+		sender.SendBatch(datagrams.data(), datagrams.size());
+		return receiveAll(receiver, DATAGRAM_COUNT, true);
+	};
+
+	// A client connected to a server over loopback
+	const u32 proto_id = 0xad26846a;
+	BenchHandler server_handler, client_handler;
+	con::Connection server(proto_id, 512, 5.0, false, &server_handler);
+	server.Serve(Address(0, 0, 0, 0, CONNECTION_PORT));
+	con::Connection client(proto_id, 512, 5.0, false, &client_handler);
+	client.Connect(Address(127, 0, 0, 1, CONNECTION_PORT));
+
+	NetworkPacket pkt;
+	u64 start = porting::getTimeMs();
+	while (!client.Connected() || server_handler.last_id == 0) {
+		REQUIRE(porting::getTimeMs() - start < 5000);
+		client.TryReceive(&pkt);
+		server.TryReceive(&pkt);
+		sleep_ms(10);
+	}
+	server.SetTimeoutMs(1000);
+	client.SetTimeoutMs(1000);
+	session_t client_id = server_handler.last_id;
+
+	BENCHMARK(std::string("connection_reliable_") + std::to_string(PACKET_COUNT) +
+			"_packets")
+	{
+		for (int i = 0; i < PACKET_COUNT; i++) {
+			NetworkPacket out;
+			out.putRawPacket((const u8 *)&data[0], DATAGRAM_SIZE - 20, client_id);
+			server.Send(client_id, 0, &out, true);
+		}
+		for (int i = 0; i < PACKET_COUNT; i++)
+			client.Receive(&pkt);
+		return pkt.getSize();
+	};
+}
@@ -0,0 +1,172 @@
+/*
+Minetest
+Copyright (C) 2022 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "dummygamedef.h"
+#include "dummymap.h"
+#include "mapblock.h"
+#include "noise.h"
+#include "serialization.h"
+#include "server/mapsaver.h"
+#include "server/regionlocks.h"
+#include <atomic>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+/*
+	Emerge pipeline of EmergeThread without the Lua and the database:
+	the blocks of the chunk area are deserialized from blobs, copied into
+	a voxel manipulator, filled from a 3D noise and blitted back.
+
+	Without region locking, deserialization and copying happen under the
+	environment lock like in ServerMap::initBlockMake(). With it, only
+	the copying does.
+*/
+
+// Chunk size in mapblocks, and number of chunks along each axis
+static const s16 CHUNK_BLOCKS = 2;
+static const v3s16 CHUNK_GRID(4, 2, 4);
+
+struct EmergeBench
+{
+	EmergeBench(IGameDef *gamedef, v3s16 bpmin, v3s16 bpmax) :
+		map(gamedef, bpmin, bpmax)
+	{}
+
+	DummyMap map;
+	std::map<v3s16, std::string> blobs;
+	std::mutex env_mutex;
+	RegionLocks region_locks;
+	std::vector<v3s16> chunks;
+	std::atomic<size_t> next_chunk;
+};
+
+static void loadChunkArea(EmergeBench *bench, IGameDef *gamedef,
+	const VoxelArea &area)
+{
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y; y++)
+	for (s16 x = area.MinEdge.X; x <= area.MaxEdge.X; x++) {
+		v3s16 p(x, y, z);
+		std::istringstream is(bench->blobs.at(p), std::ios_base::binary);
+		u8 version = readU8(is);
+		MapBlock block(&bench->map, p, gamedef);
+		block.deSerialize(is, version, true);
+	}
+}
+
+static void makeChunk(EmergeBench *bench, IGameDef *gamedef, Noise *noise,
+	v3s16 bpmin, bool region_locking)
+{
+	v3s16 bpmax = bpmin + CHUNK_BLOCKS - 1;
+	VoxelArea area(bpmin - 1, bpmax + 1);
+
+	std::unique_ptr<RegionLockGuard> region_lock;
+	if (region_locking) {
+		region_lock.reset(new RegionLockGuard(&bench->region_locks, area));
+		loadChunkArea(bench, gamedef, area);
+	}
+
+	MMVManip vm(&bench->map);
+	{
+		std::lock_guard<std::mutex> envlock(bench->env_mutex);
+		if (!region_locking)
+			loadChunkArea(bench, gamedef, area);
+		vm.initialEmerge(area.MinEdge, area.MaxEdge, false);
+	}
+
+	v3s16 nmin = bpmin * MAP_BLOCKSIZE;
+	v3s16 nmax = (bpmax + 1) * MAP_BLOCKSIZE - 1;
+	noise->perlinMap3D(nmin.X, nmin.Y, nmin.Z);
+	u32 index = 0;
+	for (s16 z = nmin.Z; z <= nmax.Z; z++)
+	for (s16 y = nmin.Y; y <= nmax.Y; y++) {
+		u32 vi = vm.m_area.index(nmin.X, y, z);
+		for (s16 x = nmin.X; x <= nmax.X; x++, vi++, index++) {
+			vm.m_data[vi] = MapNode(noise->result[index] > 0.0f ?
+				CONTENT_AIR : CONTENT_IGNORE);
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> envlock(bench->env_mutex);
+		vm.blitBackAll(nullptr, false);
+	}
+}
+
+static void emergeAll(EmergeBench *bench, IGameDef *gamedef, u32 num_threads,
+	bool region_locking)
+{
+	static const NoiseParams np(0, 1, v3f(32, 32, 32), 5900033, 3, 0.5, 2.0);
+	const s16 csize = CHUNK_BLOCKS * MAP_BLOCKSIZE;
+
+	bench->next_chunk = 0;
+	std::vector<std::thread> threads;
+	for (u32 i = 0; i < num_threads; i++) {
+		threads.emplace_back([=] {
+			Noise noise(&np, 1337, csize, csize, csize);
+			size_t n;
+			while ((n = bench->next_chunk++) < bench->chunks.size())
+				makeChunk(bench, gamedef, &noise, bench->chunks[n], region_locking);
+		});
+	}
+	for (std::thread &thread : threads)
+		thread.join();
+}
+
+TEST_CASE("benchmark_emerge")
+{
+	DummyGameDef gamedef;
+
+	v3s16 bpmax = CHUNK_GRID * CHUNK_BLOCKS - 1;
+	EmergeBench bench(&gamedef, v3s16(-1, -1, -1), bpmax + 1);
+
+	for (s16 z = -1; z <= bpmax.Z + 1; z++)
+	for (s16 y = -1; y <= bpmax.Y + 1; y++)
+	for (s16 x = -1; x <= bpmax.X + 1; x++) {
+		v3s16 p(x, y, z);
+		MapBlock *block = bench.map.getBlockNoCreateNoEx(p);
+		block->setGenerated(true);
+		bench.blobs[p] = MapSaver::serialize(block, -1);
+	}
+
+	for (s16 z = 0; z < CHUNK_GRID.Z; z++)
+	for (s16 y = 0; y < CHUNK_GRID.Y; y++)
+	for (s16 x = 0; x < CHUNK_GRID.X; x++)
+		bench.chunks.emplace_back(v3s16(x, y, z) * CHUNK_BLOCKS);
+
+	// One iteration emerges every chunk; divide its count by the mean
+	// time for chunks per second
+	const std::string suffix = "_" + std::to_string(bench.chunks.size()) + "_chunks";
+	u32 max_threads = std::max(1U, std::thread::hardware_concurrency());
+	for (u32 threads = 1; threads <= max_threads; threads *= 2) {
+		for (bool region_locking : {false, true}) {
+			BENCHMARK_ADVANCED(std::string(region_locking ? "region" : "env") +
+					"_lock_" + std::to_string(threads) + "_threads" + suffix)
+					(Catch::Benchmark::Chronometer meter) {
+				meter.measure([&] {
+					emergeAll(&bench, &gamedef, threads, region_locking);
+				});
+			};
+		}
+	}
+}
@@ -21,6 +21,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "voxelalgorithms.h"
 #include "dummygamedef.h"
 #include "dummymap.h"
+#include "noise.h"
+#include "threading/thread_pool.h"
+#include <thread>
 
 TEST_CASE("benchmark_lighting")
 {
@@ -84,3 +87,97 @@ TEST_CASE("benchmark_lighting")
 		});
 	};
 }
+
+namespace {
+
+class PooledMap : public DummyMap
+{
+public:
+	PooledMap(IGameDef *gamedef, v3s16 bpmin, v3s16 bpmax, ThreadPool *pool) :
+		DummyMap(gamedef, bpmin, bpmax), m_pool(pool)
+	{}
+
+	ThreadPool *getLightingThreadPool() override { return m_pool; }
+
+private:
+	ThreadPool *m_pool;
+};
+
+}
+
+// Lights a mapchunk of caves with scattered lights like after mapgen, with
+// spread_light() and with the flat array at each number of threads
+TEST_CASE("benchmark_lighting_chunk")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t content_wall;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		content_wall = ndef->set(f.name, f);
+	}
+
+	content_t content_light;
+	{
+		ContentFeatures f;
+		f.name = "light";
+		f.param_type = CPT_LIGHT;
+		f.light_propagates = true;
+		f.light_source = 14;
+		content_light = ndef->set(f.name, f);
+	}
+
+	// The default chunk size and its border of one block
+	v3s16 bpmin(-1, -1, -1);
+	v3s16 bpmax(5, 5, 5);
+	v3s16 nmin = (bpmin + 1) * MAP_BLOCKSIZE;
+	v3s16 nmax = bpmax * MAP_BLOCKSIZE - 1;
+	v3s16 csize = nmax - nmin + 1;
+
+	static const NoiseParams np(0, 1, v3f(24, 24, 24), 5900033, 3, 0.5, 2.0);
+	Noise noise(&np, 1337, csize.X, csize.Y, csize.Z);
+	noise.perlinMap3D(nmin.X, nmin.Y, nmin.Z);
+
+	PcgRandom pr(1337);
+	std::vector<MapNode> nodes(noise.sx * noise.sy * noise.sz);
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (noise.result[i] < 0.0f)
+			nodes[i] = MapNode(content_wall);
+		else if (pr.range(500) == 0)
+			nodes[i] = MapNode(content_light);
+		else
+			nodes[i] = MapNode(CONTENT_AIR);
+	}
+
+	auto bench = [&] (const std::string &name, bool use_volume, u32 threads) {
+		std::unique_ptr<ThreadPool> pool;
+		if (threads > 0)
+			pool.reset(new ThreadPool("LightBench", threads));
+		PooledMap map(&gamedef, bpmin, bpmax, pool.get());
+
+		BENCHMARK_ADVANCED(std::string(name))(Catch::Benchmark::Chronometer meter) {
+			std::map<v3s16, MapBlock*> modified_blocks;
+			MMVManip vm(&map);
+			vm.initialEmerge(bpmin + 1, bpmax - 1, false);
+			u32 i = 0;
+			for (s16 z = nmin.Z; z <= nmax.Z; z++)
+			for (s16 y = nmin.Y; y <= nmax.Y; y++) {
+				u32 vi = vm.m_area.index(nmin.X, y, z);
+				for (s16 x = nmin.X; x <= nmax.X; x++)
+					vm.m_data[vi++] = nodes[i++];
+			}
+			voxalgo::set_light_volume_enabled(use_volume);
+			meter.measure([&] {
+				voxalgo::blit_back_with_light(&map, &vm, &modified_blocks);
+			});
+			voxalgo::set_light_volume_enabled(true);
+		};
+	};
+
+	bench("spread_light", false, 0);
+	u32 max_threads = std::max(1U, std::thread::hardware_concurrency());
+	for (u32 threads = 0; threads <= max_threads; threads = threads ? threads * 2 : 1)
+		bench("light_volume_" + std::to_string(threads) + "_threads", true, threads);
+}
@@ -0,0 +1,127 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "dummygamedef.h"
+#include "mapblock.h"
+#include "noise.h"
+#include <algorithm>
+#include <memory>
+
+/*
+	Memory and node access of mapblocks kept as full node arrays and as
+	compact palettes. The blocks hold a noise terrain of stone below
+	water level, water and air with daylight fading towards the ground.
+*/
+
+static const v3s16 BLOCK_GRID(4, 4, 4);
+
+static void makeTerrain(MapBlock *block, Noise *noise, content_t c_stone,
+	content_t c_water)
+{
+	v3s16 relpos = block->getPosRelative();
+	noise->perlinMap2D(relpos.X, relpos.Z);
+	MapNode *data = block->getData();
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+	for (s16 x = 0; x < MAP_BLOCKSIZE; x++) {
+		s16 height = noise->result[z * MAP_BLOCKSIZE + x];
+		s16 ny = relpos.Y + y;
+		MapNode &n = data[z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + y * MAP_BLOCKSIZE + x];
+		if (ny <= height)
+			n = MapNode(c_stone);
+		else if (ny <= 0)
+			n = MapNode(c_water, 15 - std::min(-ny, 15));
+		else
+			n = MapNode(CONTENT_AIR, std::min(ny - height, 15));
+	}
+}
+
+TEST_CASE("benchmark_mapblock")
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	content_t c_stone, c_water;
+	{
+		ContentFeatures f;
+		f.name = "stone";
+		c_stone = ndef->set(f.name, f);
+		f.name = "water";
+		f.param_type = CPT_LIGHT;
+		c_water = ndef->set(f.name, f);
+	}
+
+	static const NoiseParams np(0, 24, v3f(64, 64, 64), 7244, 3, 0.5, 2.0);
+	Noise noise(&np, 1337, MAP_BLOCKSIZE, MAP_BLOCKSIZE);
+
+	std::vector<std::unique_ptr<MapBlock>> full, compact;
+	size_t full_memory = 0, compact_memory = 0;
+	v3s16 offset = BLOCK_GRID / 2;
+	for (s16 z = 0; z < BLOCK_GRID.Z; z++)
+	for (s16 y = 0; y < BLOCK_GRID.Y; y++)
+	for (s16 x = 0; x < BLOCK_GRID.X; x++) {
+		v3s16 bp = v3s16(x, y, z) - offset;
+		full.emplace_back(new MapBlock(nullptr, bp, &gamedef));
+		makeTerrain(full.back().get(), &noise, c_stone, c_water);
+		full_memory += full.back()->getNodeStorage().getMemoryUsage();
+
+		compact.emplace_back(new MapBlock(nullptr, bp, &gamedef));
+		compact.back()->copyNodesFrom(*full.back());
+		compact.back()->compactNodes();
+		compact_memory += compact.back()->getNodeStorage().getMemoryUsage();
+	}
+
+	WARN("Node memory per block: full " << full_memory / full.size() <<
+		" bytes, compact " << compact_memory / compact.size() << " bytes");
+
+	auto readAll = [] (const std::vector<std::unique_ptr<MapBlock>> &blocks) {
+		u32 stone = 0;
+		for (const auto &block : blocks) {
+			for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+			for (s16 y = 0; y < MAP_BLOCKSIZE; y++)
+			for (s16 x = 0; x < MAP_BLOCKSIZE; x++)
+				stone += block->getNodeNoCheck(x, y, z).getContent() != CONTENT_AIR;
+		}
+		return stone;
+	};
+
+	BENCHMARK("get_node_full")
+	{
+		return readAll(full);
+	};
+
+	BENCHMARK("get_node_compact")
+	{
+		return readAll(compact);
+	};
+
+	BENCHMARK_ADVANCED("compact_nodes")(Catch::Benchmark::Chronometer meter)
+	{
+		std::vector<MapBlock *> blocks;
+		for (const auto &block : compact)
+			blocks.push_back(block.get());
+		meter.measure([&] {
+			for (MapBlock *block : blocks) {
+				block->getData();
+				block->compactNodes();
+			}
+		});
+	};
+}
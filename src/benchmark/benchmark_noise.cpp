@@ -0,0 +1,123 @@
+/*
+Minetest
+Copyright (C) 2022 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "benchmark_setup.h"
+#include "noise.h"
+#include "noise_simd.h"
+#include "mapgen/mapgen_carpathian.h"
+#include "mapgen/mapgen_v7.h"
+#include "mapgen/mapgen_valleys.h"
+#include <memory>
+
+struct ChunkNoise
+{
+	const NoiseParams *np;
+	bool is3d;
+};
+
+// Computes the noises of one mapchunk with the default chunk size, once
+// with each instruction set the CPU supports
+static void benchChunkNoise(const std::string &mapgen,
+	const std::vector<ChunkNoise> &params)
+{
+	const v3s16 csize(80, 80, 80);
+
+	std::vector<std::unique_ptr<Noise>> noises;
+	for (const ChunkNoise &p : params) {
+		// 3D noises have one node of overgeneration up and down
+		noises.emplace_back(p.is3d ?
+			new Noise(p.np, 1337, csize.X, csize.Y + 2, csize.Z) :
+			new Noise(p.np, 1337, csize.X, csize.Z));
+	}
+
+	noise_simd::Level max_level = noise_simd::getMaxLevel();
+	for (int i = noise_simd::LEVEL_SCALAR; i <= max_level; i++) {
+		noise_simd::Level level = (noise_simd::Level)i;
+		noise_simd::setLevel(level);
+
+		BENCHMARK_ADVANCED(mapgen + "_chunk_noise_" +
+				noise_simd::getLevelName(level))(Catch::Benchmark::Chronometer meter) {
+			s16 x = 0;
+			meter.measure([&] {
+				for (auto &noise : noises) {
+					if (noise->sz > 1)
+						noise->perlinMap3D(x, -41, 0);
+					else
+						noise->perlinMap2D(x, 0);
+				}
+				x += csize.X;
+			});
+		};
+	}
+
+	noise_simd::setLevel(max_level);
+}
+
+TEST_CASE("benchmark_noise")
+{
+	// Noises used with the default mapgen flags
+	MapgenV7Params v7;
+	benchChunkNoise("v7", {
+		{&v7.np_terrain_base, false},
+		{&v7.np_terrain_alt, false},
+		{&v7.np_terrain_persist, false},
+		{&v7.np_height_select, false},
+		{&v7.np_filler_depth, false},
+		{&v7.np_mount_height, false},
+		{&v7.np_ridge_uwater, false},
+		{&v7.np_mountain, true},
+		{&v7.np_ridge, true},
+		{&v7.np_cave1, true},
+		{&v7.np_cave2, true},
+		{&v7.np_cavern, true},
+	});
+
+	MapgenValleysParams valleys;
+	benchChunkNoise("valleys", {
+		{&valleys.np_filler_depth, false},
+		{&valleys.np_inter_valley_slope, false},
+		{&valleys.np_rivers, false},
+		{&valleys.np_terrain_height, false},
+		{&valleys.np_valley_depth, false},
+		{&valleys.np_valley_profile, false},
+		{&valleys.np_inter_valley_fill, true},
+		{&valleys.np_cave1, true},
+		{&valleys.np_cave2, true},
+		{&valleys.np_cavern, true},
+	});
+
+	MapgenCarpathianParams carpathian;
+	benchChunkNoise("carpathian", {
+		{&carpathian.np_filler_depth, false},
+		{&carpathian.np_height1, false},
+		{&carpathian.np_height2, false},
+		{&carpathian.np_height3, false},
+		{&carpathian.np_height4, false},
+		{&carpathian.np_hills_terrain, false},
+		{&carpathian.np_ridge_terrain, false},
+		{&carpathian.np_step_terrain, false},
+		{&carpathian.np_hills, false},
+		{&carpathian.np_ridge_mnt, false},
+		{&carpathian.np_step_mnt, false},
+		{&carpathian.np_mnt_var, true},
+		{&carpathian.np_cave1, true},
+		{&carpathian.np_cave2, true},
+		{&carpathian.np_cavern, true},
+	});
+}
@@ -37,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mesh_generator_thread.h"
 #include "network/address.h"
 #include "network/peerhandler.h"
+#include "objectsnapshot.h"
 #include "gameparams.h"
 #include <fstream>
 
@@ -187,6 +188,7 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	void handleCommand_ChatMessage(NetworkPacket *pkt);
 	void handleCommand_ActiveObjectRemoveAdd(NetworkPacket* pkt);
 	void handleCommand_ActiveObjectMessages(NetworkPacket* pkt);
+	void handleCommand_ActiveObjectPositions(NetworkPacket *pkt);
 	void handleCommand_Movement(NetworkPacket* pkt);
 	void handleCommand_Fov(NetworkPacket *pkt);
 	void handleCommand_HP(NetworkPacket* pkt);
@@ -503,6 +505,10 @@ class Client : public con::PeerHandler, public InventoryManager, public IGameDef
 	// If 0, server init hasn't been received yet.
 	u16 m_proto_ver = 0;
 
+	// Object positions received with TOCLIENT_ACTIVE_OBJECT_POSITIONS
+	ObjectSnapshotHistory m_object_snapshots;
+	u16 m_object_snapshot_received = 0;
+
 	bool m_update_wielded_item = false;
 	Inventory *m_inventory_from_server = nullptr;
 	float m_inventory_from_server_age = 0.0f;
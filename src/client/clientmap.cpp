@@ -667,15 +667,30 @@ void ClientMap::touchMapBlocks()
 	g_profiler->avg("MapBlocks loaded [#]", blocks_loaded);
 }
 
+// Profiler counters of a render pass, looked up once
+struct RenderPassProfilerIds
+{
+	RenderPassProfilerIds(const std::string &prefix) :
+		draw_meshes(g_profiler->getId(prefix + "draw meshes [ms]")),
+		vertices(g_profiler->getId(prefix + "vertices drawn [#]")),
+		drawcalls(g_profiler->getId(prefix + "drawcalls [#]")),
+		material_swaps(g_profiler->getId(prefix + "material swaps [#]"))
+	{}
+
+	Profiler::Id draw_meshes;
+	Profiler::Id vertices;
+	Profiler::Id drawcalls;
+	Profiler::Id material_swaps;
+};
+
 void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 {
 	bool is_transparent_pass = pass == scene::ESNRP_TRANSPARENT;
 
-	std::string prefix;
-	if (pass == scene::ESNRP_SOLID)
-		prefix = "renderMap(SOLID): ";
-	else
-		prefix = "renderMap(TRANSPARENT): ";
+	static const RenderPassProfilerIds solid_ids("renderMap(SOLID): ");
+	static const RenderPassProfilerIds transparent_ids("renderMap(TRANSPARENT): ");
+	const RenderPassProfilerIds &profiler_ids =
+		pass == scene::ESNRP_SOLID ? solid_ids : transparent_ids;
 
 	/*
 		This is called two times per frame, reset on the non-transparent one
@@ -855,7 +870,7 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		vertex_count += buf->getIndexCount();
 	}
 
-	g_profiler->avg(prefix + "draw meshes [ms]", draw.stop(true));
+	g_profiler->avg(profiler_ids.draw_meshes, draw.stop(true));
 
 	// Log only on solid pass because values are the same
 	if (pass == scene::ESNRP_SOLID) {
@@ -866,9 +881,9 @@ void ClientMap::renderMap(video::IVideoDriver* driver, s32 pass)
 		g_profiler->avg("renderMap(): transparent buffers [#]", draw_order.size());
 	}
 
-	g_profiler->avg(prefix + "vertices drawn [#]", vertex_count);
-	g_profiler->avg(prefix + "drawcalls [#]", drawcall_count);
-	g_profiler->avg(prefix + "material swaps [#]", material_swaps);
+	g_profiler->avg(profiler_ids.vertices, vertex_count);
+	g_profiler->avg(profiler_ids.drawcalls, drawcall_count);
+	g_profiler->avg(profiler_ids.material_swaps, material_swaps);
 }
 
 static bool getVisibleBrightness(Map *map, const v3f &p0, v3f dir, float step,
@@ -1063,11 +1078,10 @@ void ClientMap::renderMapShadows(video::IVideoDriver *driver,
 		const video::SMaterial &material, s32 pass, int frame, int total_frames)
 {
 	bool is_transparent_pass = pass != scene::ESNRP_SOLID;
-	std::string prefix;
-	if (is_transparent_pass)
-		prefix = "renderMap(SHADOW TRANS): ";
-	else
-		prefix = "renderMap(SHADOW SOLID): ";
+	static const RenderPassProfilerIds solid_ids("renderMap(SHADOW SOLID): ");
+	static const RenderPassProfilerIds transparent_ids("renderMap(SHADOW TRANS): ");
+	const RenderPassProfilerIds &profiler_ids =
+		is_transparent_pass ? transparent_ids : solid_ids;
 
 	u32 drawcall_count = 0;
 	u32 vertex_count = 0;
@@ -1187,10 +1201,10 @@ void ClientMap::renderMapShadows(video::IVideoDriver *driver,
 	driver->setMaterial(clean); // reset material to defaults
 	driver->draw3DLine(v3f(), v3f(), video::SColor(0));
 
-	g_profiler->avg(prefix + "draw meshes [ms]", draw.stop(true));
-	g_profiler->avg(prefix + "vertices drawn [#]", vertex_count);
-	g_profiler->avg(prefix + "drawcalls [#]", drawcall_count);
-	g_profiler->avg(prefix + "material swaps [#]", material_swaps);
+	g_profiler->avg(profiler_ids.draw_meshes, draw.stop(true));
+	g_profiler->avg(profiler_ids.vertices, vertex_count);
+	g_profiler->avg(profiler_ids.drawcalls, drawcall_count);
+	g_profiler->avg(profiler_ids.material_swaps, material_swaps);
 }
 
 /*
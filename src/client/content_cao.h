@@ -268,6 +268,8 @@ class GenericCAO : public ClientActiveObject
 
 	void processMessage(const std::string &data);
 
+	void updatePosition(const ObjectPosition &pos, float update_interval);
+
 	bool directReportPunch(v3f dir, const ItemStack *punchitem=NULL,
 			float time_from_last_punch=1000000);
 
@@ -193,8 +193,7 @@ CachedMapBlockData* MeshUpdateQueue::cacheBlock(Map *map, v3s16 p, UpdateMode mo
 		if (!cached_block->data)
 			cached_block->data =
 					new MapNode[MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE];
-		memcpy(cached_block->data, b->getData(),
-				MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE * sizeof(MapNode));
+		b->getNodeStorage().copyTo(cached_block->data);
 	} else {
 		delete[] cached_block->data;
 		cached_block->data = nullptr;
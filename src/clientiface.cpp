@@ -91,25 +91,54 @@ LuaEntitySAO *getAttachedObject(PlayerSAO *sao, ServerEnvironment *env)
 	return dynamic_cast<LuaEntitySAO *>(ao);
 }
 
-void RemoteClient::GetNextBlocks (
-		ServerEnvironment *env,
-		EmergeManager * emerge,
-		float dtime,
-		std::vector<PrioritySortedBlockTransfer> &dest)
+bool RemoteClient::GetBlockSendViewer(ServerEnvironment *env,
+		BlockSendViewer *viewer) const
 {
-	// Increment timers
-	m_nothing_to_send_pause_timer -= dtime;
-
-	if (m_nothing_to_send_pause_timer >= 0)
-		return;
-
 	RemotePlayer *player = env->getPlayer(peer_id);
 	// This can happen sometimes; clients and players are not in perfect sync.
 	if (!player)
-		return;
+		return false;
 
 	PlayerSAO *sao = player->getPlayerSAO();
 	if (!sao)
+		return false;
+
+	viewer->position = sao->getBasePosition();
+	// if the player is attached, get the velocity from the attached object
+	LuaEntitySAO *lsao = getAttachedObject(sao, env);
+	viewer->speed = lsao ? lsao->getVelocity() : player->getSpeed();
+
+	// Camera position and direction
+	viewer->camera_pos = sao->getEyePosition();
+	viewer->camera_dir = v3f(0,0,1);
+	viewer->camera_dir.rotateYZBy(sao->getLookPitch());
+	viewer->camera_dir.rotateXZBy(sao->getRotation().Y);
+
+	// Get view range and camera fov (radians) from the client
+	viewer->wanted_range = sao->getWantedRange() + 1;
+	viewer->fov = sao->getFov();
+
+	// Distrust client-sent FOV and get server-set player object property
+	// zoom FOV (degrees) as a check to avoid hacked clients using FOV to load
+	// distant world.
+	// (zoom is disabled by value 0)
+	viewer->zoom_fov = sao->getZoomFOV() < 0.001f ?
+		0.0f :
+		std::max(viewer->fov, sao->getZoomFOV() * core::DEGTORAD);
+	return true;
+}
+
+void RemoteClient::SelectNextBlocks(
+		const BlockSendViewer &viewer,
+		const Map *map,
+		EmergeManager *emerge,
+		float dtime,
+		BlockSelection &selection)
+{
+	// Increment timers
+	m_nothing_to_send_pause_timer -= dtime;
+
+	if (m_nothing_to_send_pause_timer >= 0)
 		return;
 
 	// Won't send anything if already sending
@@ -118,25 +147,20 @@ void RemoteClient::GetNextBlocks (
 		return;
 	}
 
-	v3f playerpos = sao->getBasePosition();
-	// if the player is attached, get the velocity from the attached object
-	LuaEntitySAO *lsao = getAttachedObject(sao, env);
-	const v3f &playerspeed = lsao? lsao->getVelocity() : player->getSpeed();
+	const v3f &playerspeed = viewer.speed;
 	v3f playerspeeddir(0,0,0);
 	if (playerspeed.getLength() > 1.0f * BS)
 		playerspeeddir = playerspeed / playerspeed.getLength();
 	// Predict to next block
-	v3f playerpos_predicted = playerpos + playerspeeddir * (MAP_BLOCKSIZE * BS);
+	v3f playerpos_predicted = viewer.position + playerspeeddir * (MAP_BLOCKSIZE * BS);
 
 	v3s16 center_nodepos = floatToInt(playerpos_predicted, BS);
 
 	v3s16 center = getNodeBlockPos(center_nodepos);
 
 	// Camera position and direction
-	v3f camera_pos = sao->getEyePosition();
-	v3f camera_dir = v3f(0,0,1);
-	camera_dir.rotateYZBy(sao->getLookPitch());
-	camera_dir.rotateXZBy(sao->getRotation().Y);
+	const v3f &camera_pos = viewer.camera_pos;
+	const v3f &camera_dir = viewer.camera_dir;
 
 	u16 max_simul_sends_usually = m_max_simul_sends;
 
@@ -165,9 +189,8 @@ void RemoteClient::GetNextBlocks (
 	*/
 	s32 new_nearest_unsent_d = -1;
 
-	// Get view range and camera fov (radians) from the client
-	s16 wanted_range = sao->getWantedRange() + 1;
-	float camera_fov = sao->getFov();
+	s16 wanted_range = viewer.wanted_range;
+	float camera_fov = viewer.fov;
 
 	/*
 		Get the starting value of the block finder radius.
@@ -192,13 +215,7 @@ void RemoteClient::GetNextBlocks (
 
 	s16 d_start = m_nearest_unsent_d;
 
-	// Distrust client-sent FOV and get server-set player object property
-	// zoom FOV (degrees) as a check to avoid hacked clients using FOV to load
-	// distant world.
-	// (zoom is disabled by value 0)
-	float prop_zoom_fov = sao->getZoomFOV() < 0.001f ?
-		0.0f :
-		std::max(camera_fov, sao->getZoomFOV() * core::DEGTORAD);
+	float prop_zoom_fov = viewer.zoom_fov;
 
 	const s16 full_d_max = std::min(adjustDist(m_max_send_distance, prop_zoom_fov),
 		wanted_range);
@@ -231,17 +248,18 @@ void RemoteClient::GetNextBlocks (
 
 	const v3s16 cam_pos_nodes = floatToInt(camera_pos, BS);
 
+	MapReadView view(map);
+
 	s16 d;
 	for (d = d_start; d <= d_max; d++) {
 		/*
 			Get the border/face dot coordinates of a "d-radiused"
 			box
 		*/
-		std::vector<v3s16> list = FacePositionCache::getFacePositions(d);
+		const std::vector<v3s16> &list = FacePositionCache::getFacePositions(d);
 
-		std::vector<v3s16>::iterator li;
-		for (li = list.begin(); li != list.end(); ++li) {
-			v3s16 p = *li + center;
+		for (const v3s16 &offset : list) {
+			v3s16 p = offset + center;
 
 			/*
 				Send throttling
@@ -303,12 +321,12 @@ void RemoteClient::GetNextBlocks (
 			/*
 				Check if map has this block
 			*/
-			MapBlock *block = env->getMap().getBlockNoCreateNoEx(p);
+			MapBlock *block = view.getBlock(p);
 
 			bool block_not_found = false;
 			if (block) {
 				// Reset usage timer, this block will be of use in the future.
-				block->resetUsageTimer();
+				selection.used_blocks.push_back(block);
 
 				// Check whether the block exists (with data)
 				if (!block->isGenerated())
@@ -321,13 +339,17 @@ void RemoteClient::GetNextBlocks (
 					Block is near ground level if night-time mesh
 					differs from day-time mesh.
 				*/
-				if (d >= d_opt) {
-					if (!block->getIsUnderground() && !block->getDayNightDiff())
+				if (d >= d_opt && !block->getIsUnderground()) {
+					bool expired;
+					bool day_night_diff = block->getDayNightDiffNoUpdate(&expired);
+					if (expired)
+						selection.expired_blocks.push_back(block);
+					if (!day_night_diff)
 						continue;
 				}
 
 				if (m_occ_cull && !block_not_found &&
-						env->getMap().isBlockOccluded(block, cam_pos_nodes)) {
+						map->isBlockOccluded(block, cam_pos_nodes)) {
 					continue;
 				}
 			}
@@ -345,6 +367,8 @@ void RemoteClient::GetNextBlocks (
 				Add inexistent block to emerge queue.
 			*/
 			if (block == NULL || block_not_found) {
+				if (!emerge)
+					continue;
 				if (emerge->enqueueBlockEmerge(peer_id, p, generate)) {
 					if (nearest_emerged_d == -1)
 						nearest_emerged_d = d;
@@ -364,9 +388,7 @@ void RemoteClient::GetNextBlocks (
 			/*
 				Add block to send queue
 			*/
-			PrioritySortedBlockTransfer q((float)dist, p, peer_id);
-
-			dest.push_back(q);
+			selection.blocks.emplace_back((float)dist, p, peer_id);
 
 			num_blocks_selected += 1;
 		}
@@ -395,6 +417,22 @@ void RemoteClient::GetNextBlocks (
 		m_nearest_unsent_d = new_nearest_unsent_d;
 }
 
+void BlockSelection::clear()
+{
+	blocks.clear();
+	used_blocks.clear();
+	expired_blocks.clear();
+}
+
+void BlockSelection::merge(std::vector<PrioritySortedBlockTransfer> &dest)
+{
+	dest.insert(dest.end(), blocks.begin(), blocks.end());
+	for (MapBlock *block : used_blocks)
+		block->resetUsageTimer();
+	for (MapBlock *block : expired_blocks)
+		block->getDayNightDiff();
+}
+
 void RemoteClient::GotBlock(v3s16 p)
 {
 	if (m_blocks_sending.find(p) != m_blocks_sending.end()) {
@@ -26,7 +26,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "network/networkpacket.h"
 #include "network/networkprotocol.h"
 #include "network/address.h"
+#include "objectsnapshot.h"
 #include "porting.h"
+#include "server/interestmanager.h"
 #include "threading/mutex_auto_lock.h"
 
 #include <list>
@@ -35,6 +37,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <memory>
 #include <mutex>
 
+class Map;
 class MapBlock;
 class ServerEnvironment;
 class EmergeManager;
@@ -222,6 +225,39 @@ struct PrioritySortedBlockTransfer
 	session_t peer_id;
 };
 
+/*
+	Where a client looks from, taken from its player while the environment
+	is locked, so its blocks can be selected without the environment
+*/
+struct BlockSendViewer
+{
+	v3f position;
+	v3f speed;
+	v3f camera_pos;
+	v3f camera_dir;
+	// Radians
+	float fov = 0.0f;
+	// Radians, 0 if zooming is not allowed
+	float zoom_fov = 0.0f;
+	s16 wanted_range = 0;
+};
+
+/*
+	Result of RemoteClient::SelectNextBlocks(), merged on the server thread
+*/
+struct BlockSelection
+{
+	std::vector<PrioritySortedBlockTransfer> blocks;
+	// Blocks which are of use to the client, their usage timers are reset
+	std::vector<MapBlock *> used_blocks;
+	// Blocks whose day-night difference had to be computed, it is updated
+	std::vector<MapBlock *> expired_blocks;
+
+	void clear();
+	// Appends the blocks to dest and updates the map blocks
+	void merge(std::vector<PrioritySortedBlockTransfer> &dest);
+};
+
 class RemoteClient
 {
 public:
@@ -254,12 +290,20 @@ class RemoteClient
 	~RemoteClient() = default;
 
 	/*
-		Finds block that should be sent next to the client.
-		Environment should be locked when this is called.
+		Gets where the client looks from. Environment should be locked
+		when this is called. Returns false if the client has no player.
+	*/
+	bool GetBlockSendViewer(ServerEnvironment *env, BlockSendViewer *viewer) const;
+
+	/*
+		Finds blocks that should be sent next to the client and emerges
+		missing ones, unless emerge is nullptr.
+		The map is only read, so blocks may be selected for several
+		clients at once on different threads while the map is locked.
 		dtime is used for resetting send radius at slow interval
 	*/
-	void GetNextBlocks(ServerEnvironment *env, EmergeManager* emerge,
-			float dtime, std::vector<PrioritySortedBlockTransfer> &dest);
+	void SelectNextBlocks(const BlockSendViewer &viewer, const Map *map,
+			EmergeManager *emerge, float dtime, BlockSelection &selection);
 
 	void GotBlock(v3s16 p);
 
@@ -307,6 +351,18 @@ class RemoteClient
 	*/
 	std::set<u16> m_known_objects;
 
+	/*
+		Positions of the known objects sent with
+		TOCLIENT_ACTIVE_OBJECT_POSITIONS, kept until the client acknowledges
+		a newer snapshot.
+	*/
+	ObjectSnapshotHistory m_object_snapshots;
+	u16 m_object_snapshot_sent = 0;
+	u16 m_object_snapshot_acked = 0;
+
+	// Which objects are added and updated first
+	InterestManager m_object_interest;
+
 	ClientState getState() const { return m_state; }
 
 	std::string getName() const { return m_name; }
@@ -32,6 +32,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/string.h"
 
 #include "leveldb/db.h"
+#include <algorithm>
 
 
 #define ENSURE_STATUS_OK(s) \
@@ -77,6 +78,29 @@ void Database_LevelDB::loadBlock(const v3s16 &pos, std::string *block)
 		block->clear();
 }
 
+void Database_LevelDB::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(pos.size());
+
+	// Seek in key order, so one iterator walks forward through the table
+	std::vector<std::pair<std::string, size_t>> keys;
+	keys.reserve(pos.size());
+	for (size_t i = 0; i < pos.size(); i++)
+		keys.emplace_back(i64tos(getBlockAsInteger(pos[i])), i);
+	std::sort(keys.begin(), keys.end());
+
+	leveldb::Iterator *it = m_database->NewIterator(leveldb::ReadOptions());
+	for (const auto &key : keys) {
+		it->Seek(key.first);
+		if (it->Valid() && it->key() == key.first)
+			(*blocks)[key.second] = it->value().ToString();
+	}
+	ENSURE_STATUS_OK(it->status());
+	delete it;
+}
+
 bool Database_LevelDB::deleteBlock(const v3s16 &pos)
 {
 	leveldb::Status status = m_database->Delete(leveldb::WriteOptions(),
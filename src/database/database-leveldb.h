@@ -35,6 +35,7 @@ class Database_LevelDB : public MapDatabase
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
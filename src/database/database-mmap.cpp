@@ -0,0 +1,556 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "database-mmap.h"
+
+#include "debug.h"
+#include "exceptions.h"
+#include "filesys.h"
+#include "log.h"
+#include "porting.h"
+#include "threading/thread.h"
+#include "util/serialize.h"
+#include "util/string.h"
+
+#include <algorithm>
+#include <cstring>
+#include <zlib.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+/*
+	Record: u32 magic, u32 crc32 of the rest, s64 position, u32 size, data
+	A size of RECORD_TOMBSTONE marks a deleted block.
+*/
+#define RECORD_MAGIC 0x4d424c4b // "MBLK"
+#define RECORD_HEADER_SIZE 20
+#define RECORD_TOMBSTONE 0xffffffff
+
+#define SEGMENT_EXTENSION ".seg"
+
+// Share of outdated records from which the thread compacts a segment
+#define COMPACTION_MIN_GARBAGE 0.5f
+#define COMPACTION_INTERVAL_MS 10000
+
+/*
+	A file mapped into memory as a whole, created with the given minimum size
+*/
+class MappedFile
+{
+public:
+	MappedFile(const std::string &path, size_t min_size);
+	~MappedFile();
+
+	u8 *data() { return m_data; }
+	size_t size() const { return m_size; }
+
+	// Writes the range to disk
+	void sync(size_t offset, size_t size);
+
+private:
+	std::string m_path;
+	u8 *m_data = nullptr;
+	size_t m_size = 0;
+#ifdef _WIN32
+	HANDLE m_file = INVALID_HANDLE_VALUE;
+	HANDLE m_mapping = NULL;
+#else
+	int m_fd = -1;
+#endif
+};
+
+#ifdef _WIN32
+
+MappedFile::MappedFile(const std::string &path, size_t min_size) :
+	m_path(path)
+{
+	m_file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+		FILE_SHARE_READ, NULL, OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (m_file == INVALID_HANDLE_VALUE)
+		throw DatabaseException("Failed to open " + path);
+
+	LARGE_INTEGER size;
+	GetFileSizeEx(m_file, &size);
+	m_size = std::max<size_t>(size.QuadPart, min_size);
+
+	m_mapping = CreateFileMappingA(m_file, NULL, PAGE_READWRITE,
+		(DWORD)((u64)m_size >> 32), (DWORD)(m_size & 0xffffffff), NULL);
+	if (m_mapping)
+		m_data = (u8 *)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_size);
+	if (!m_data) {
+		if (m_mapping)
+			CloseHandle(m_mapping);
+		CloseHandle(m_file);
+		throw DatabaseException("Failed to map " + path);
+	}
+}
+
+MappedFile::~MappedFile()
+{
+	UnmapViewOfFile(m_data);
+	CloseHandle(m_mapping);
+	CloseHandle(m_file);
+}
+
+void MappedFile::sync(size_t offset, size_t size)
+{
+	if (!FlushViewOfFile(m_data + offset, size) || !FlushFileBuffers(m_file))
+		errorstream << "Database_MMap: Failed to sync " << m_path << std::endl;
+}
+
+#else
+
+MappedFile::MappedFile(const std::string &path, size_t min_size) :
+	m_path(path)
+{
+	m_fd = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+	if (m_fd < 0)
+		throw DatabaseException("Failed to open " + path);
+
+	struct stat st;
+	if (fstat(m_fd, &st) == 0)
+		m_size = st.st_size;
+	if (m_size < min_size) {
+		// New space reads as zeroes, which is no valid record
+		if (ftruncate(m_fd, min_size) != 0) {
+			close(m_fd);
+			throw DatabaseException("Failed to resize " + path);
+		}
+		m_size = min_size;
+	}
+
+	void *data = mmap(nullptr, m_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, 0);
+	if (data == MAP_FAILED) {
+		close(m_fd);
+		throw DatabaseException("Failed to map " + path);
+	}
+	m_data = (u8 *)data;
+}
+
+MappedFile::~MappedFile()
+{
+	munmap(m_data, m_size);
+	close(m_fd);
+}
+
+void MappedFile::sync(size_t offset, size_t size)
+{
+	// msync needs a page aligned start
+	static const size_t page_size = sysconf(_SC_PAGESIZE);
+	size_t start = offset - offset % page_size;
+	if (msync(m_data + start, offset + size - start, MS_SYNC) != 0)
+		errorstream << "Database_MMap: Failed to sync " << m_path << std::endl;
+}
+
+#endif
+
+class MapCompactionThread : public Thread
+{
+public:
+	MapCompactionThread(Database_MMap *db) :
+		Thread("MapCompaction"),
+		m_db(db)
+	{}
+
+	void *run()
+	{
+		BEGIN_DEBUG_EXCEPTION_HANDLER
+
+		while (!stopRequested()) {
+			for (u32 i = 0; i < COMPACTION_INTERVAL_MS / 100 && !stopRequested(); i++)
+				sleep_ms(100);
+
+			while (!stopRequested() && m_db->compact(COMPACTION_MIN_GARBAGE))
+				;
+		}
+
+		END_DEBUG_EXCEPTION_HANDLER
+
+		return nullptr;
+	}
+
+private:
+	Database_MMap *m_db;
+};
+
+Database_MMap::Database_MMap(const std::string &savedir, bool background_compaction,
+		u32 segment_size) :
+	m_dir(savedir + DIR_DELIM + "map.mmap"),
+	m_segment_size(segment_size)
+{
+	if (!fs::CreateAllDirs(m_dir))
+		throw DatabaseException("Failed to create directory " + m_dir);
+
+	openSegments();
+
+	if (background_compaction) {
+		m_compaction_thread = new MapCompactionThread(this);
+		m_compaction_thread->start();
+	}
+}
+
+Database_MMap::~Database_MMap()
+{
+	if (m_compaction_thread) {
+		m_compaction_thread->stop();
+		m_compaction_thread->wait();
+		delete m_compaction_thread;
+	}
+
+	endSave();
+	for (auto &it : m_segments)
+		delete it.second.file;
+}
+
+void Database_MMap::openSegments()
+{
+	std::vector<u32> ids;
+	for (const fs::DirListNode &node : fs::GetDirListing(m_dir)) {
+		if (node.dir || !str_ends_with(node.name, SEGMENT_EXTENSION))
+			continue;
+		u32 id = mystoi(node.name.substr(0,
+			node.name.size() - strlen(SEGMENT_EXTENSION)));
+		if (id != 0)
+			ids.push_back(id);
+	}
+
+	// Newer records replace older ones
+	std::sort(ids.begin(), ids.end());
+	for (u32 id : ids) {
+		Segment &segment = m_segments[id];
+		segment.file = new MappedFile(m_dir + DIR_DELIM + itos(id) +
+			SEGMENT_EXTENSION, m_segment_size);
+		segment.size = 0;
+		segment.live = 0;
+		segment.dirty_begin = segment.dirty_end = 0;
+		scanSegment(id, segment);
+	}
+
+	verbosestream << "Database_MMap: Opened " << m_segments.size()
+		<< " segments with " << m_index.size() << " blocks" << std::endl;
+}
+
+void Database_MMap::scanSegment(u32 id, Segment &segment)
+{
+	const u8 *data = segment.file->data();
+	size_t file_size = segment.file->size();
+	u32 offset = 0;
+
+	while (offset + RECORD_HEADER_SIZE <= file_size) {
+		const u8 *record = data + offset;
+		if (readU32(record) != RECORD_MAGIC)
+			break;
+
+		u32 size = readU32(record + 16);
+		u32 data_size = size == RECORD_TOMBSTONE ? 0 : size;
+		if (data_size > file_size - offset - RECORD_HEADER_SIZE)
+			break;
+
+		// An interrupted write ends the log
+		uLong crc = crc32(0, record + 8, RECORD_HEADER_SIZE - 8 + data_size);
+		if (readU32(record + 4) != (u32)crc)
+			break;
+
+		s64 key = readU64(record + 8);
+		auto it = m_index.find(key);
+		if (it != m_index.end())
+			forget(it->second);
+		if (size == RECORD_TOMBSTONE) {
+			if (it != m_index.end())
+				m_index.erase(it);
+		} else {
+			Location loc = {id, offset, size};
+			m_index[key] = loc;
+			segment.live += RECORD_HEADER_SIZE + size;
+		}
+
+		offset += RECORD_HEADER_SIZE + data_size;
+		segment.size = offset;
+	}
+}
+
+Database_MMap::Segment &Database_MMap::createSegment(u32 min_size)
+{
+	u32 id = m_segments.empty() ? 1 : m_segments.rbegin()->first + 1;
+
+	Segment &segment = m_segments[id];
+	try {
+		segment.file = new MappedFile(m_dir + DIR_DELIM + itos(id) +
+			SEGMENT_EXTENSION, std::max(min_size, m_segment_size));
+	} catch (DatabaseException &e) {
+		m_segments.erase(id);
+		throw;
+	}
+	segment.size = 0;
+	segment.live = 0;
+	segment.dirty_begin = segment.dirty_end = 0;
+	return segment;
+}
+
+Database_MMap::Location Database_MMap::append(s64 key, const char *data,
+	u32 size, bool tombstone)
+{
+	u32 record_size = RECORD_HEADER_SIZE + size;
+	auto last = m_segments.rbegin();
+	u32 id;
+	if (last == m_segments.rend() ||
+			last->second.size + (size_t)record_size > last->second.file->size()) {
+		if (last != m_segments.rend())
+			sync(last->second);
+		createSegment(record_size);
+		last = m_segments.rbegin();
+	}
+	id = last->first;
+	Segment &segment = last->second;
+
+	u8 *record = segment.file->data() + segment.size;
+	writeU64(record + 8, key);
+	writeU32(record + 16, tombstone ? RECORD_TOMBSTONE : size);
+	memcpy(record + RECORD_HEADER_SIZE, data, size);
+	writeU32(record + 4, crc32(0, record + 8, RECORD_HEADER_SIZE - 8 + size));
+	writeU32(record, RECORD_MAGIC);
+
+	Location loc = {id, segment.size, size};
+	if (segment.dirty_end == segment.dirty_begin)
+		segment.dirty_begin = segment.size;
+	segment.size += record_size;
+	segment.dirty_end = segment.size;
+	if (!tombstone)
+		segment.live += record_size;
+	return loc;
+}
+
+void Database_MMap::forget(const Location &loc)
+{
+	auto it = m_segments.find(loc.segment);
+	if (it != m_segments.end())
+		it->second.live -= RECORD_HEADER_SIZE + loc.size;
+}
+
+void Database_MMap::read(const Location &loc, std::string *block)
+{
+	const u8 *data = m_segments.at(loc.segment).file->data() +
+		loc.offset + RECORD_HEADER_SIZE;
+	block->assign((const char *)data, loc.size);
+}
+
+void Database_MMap::sync(Segment &segment)
+{
+	if (segment.dirty_end == segment.dirty_begin)
+		return;
+	segment.file->sync(segment.dirty_begin, segment.dirty_end - segment.dirty_begin);
+	segment.dirty_begin = segment.dirty_end = 0;
+}
+
+bool Database_MMap::saveBlock(const v3s16 &pos, const std::string &data)
+{
+	if (data.size() >= RECORD_TOMBSTONE - RECORD_HEADER_SIZE) {
+		errorstream << "Database_MMap: Block " << PP(pos)
+			<< " is too large to save" << std::endl;
+		return false;
+	}
+
+	s64 key = getBlockAsInteger(pos);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	try {
+		Location loc = append(key, data.c_str(), data.size(), false);
+		auto it = m_index.find(key);
+		if (it != m_index.end()) {
+			forget(it->second);
+			it->second = loc;
+		} else {
+			m_index.emplace(key, loc);
+		}
+	} catch (DatabaseException &e) {
+		errorstream << "Database_MMap: Failed to save block " << PP(pos)
+			<< ": " << e.what() << std::endl;
+		return false;
+	}
+	return true;
+}
+
+void Database_MMap::loadBlock(const v3s16 &pos, std::string *block)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_index.find(getBlockAsInteger(pos));
+	if (it == m_index.end()) {
+		block->clear();
+		return;
+	}
+	read(it->second, block);
+}
+
+void Database_MMap::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(pos.size());
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (size_t i = 0; i < pos.size(); i++) {
+		auto it = m_index.find(getBlockAsInteger(pos[i]));
+		if (it != m_index.end())
+			read(it->second, &(*blocks)[i]);
+	}
+}
+
+bool Database_MMap::deleteBlock(const v3s16 &pos)
+{
+	s64 key = getBlockAsInteger(pos);
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_index.find(key);
+	if (it == m_index.end())
+		return true;
+
+	try {
+		append(key, nullptr, 0, true);
+	} catch (DatabaseException &e) {
+		errorstream << "Database_MMap: Failed to delete block " << PP(pos)
+			<< ": " << e.what() << std::endl;
+		return false;
+	}
+	forget(it->second);
+	m_index.erase(it);
+	return true;
+}
+
+void Database_MMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	dst.reserve(dst.size() + m_index.size());
+	for (const auto &it : m_index)
+		dst.push_back(getIntegerAsBlock(it.first));
+}
+
+void Database_MMap::endSave()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	for (auto &it : m_segments)
+		sync(it.second);
+}
+
+u32 Database_MMap::getSegmentCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_segments.size();
+}
+
+bool Database_MMap::compact(float min_garbage)
+{
+	std::lock_guard<std::mutex> compact_lock(m_compact_mutex);
+
+	u32 id;
+	const u8 *data;
+	u32 size;
+	bool has_older;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_segments.size() < 2)
+			return false;
+
+		// The newest segment is still written to
+		float max_garbage = 0.0f;
+		auto best = m_segments.end();
+		for (auto it = m_segments.begin(); it != std::prev(m_segments.end()); ++it) {
+			const Segment &segment = it->second;
+			float garbage = segment.size ?
+				1.0f - (float)segment.live / segment.size : 1.0f;
+			if (garbage >= min_garbage && (best == m_segments.end() ||
+					garbage > max_garbage)) {
+				best = it;
+				max_garbage = garbage;
+			}
+		}
+		if (best == m_segments.end())
+			return false;
+
+		id = best->first;
+		data = best->second.file->data();
+		size = best->second.size;
+		has_older = best != m_segments.begin();
+	}
+
+	// Nothing appends to the segment anymore and only this removes segments,
+	// so it can be read without the lock
+	u32 moved = 0;
+	u32 offset = 0;
+	try {
+		while (offset < size) {
+			std::lock_guard<std::mutex> lock(m_mutex);
+			// Give others a chance to take the lock between batches
+			for (u32 n = 0; n < 64 && offset < size; n++) {
+				const u8 *record = data + offset;
+				s64 key = readU64(record + 8);
+				u32 record_size = readU32(record + 16);
+				bool tombstone = record_size == RECORD_TOMBSTONE;
+				if (tombstone)
+					record_size = 0;
+
+				auto it = m_index.find(key);
+				if (tombstone) {
+					// Still hides a record in an older segment
+					if (has_older && it == m_index.end())
+						append(key, nullptr, 0, true);
+				} else if (it != m_index.end() && it->second.segment == id &&
+						it->second.offset == offset) {
+					Location loc = append(key,
+						(const char *)record + RECORD_HEADER_SIZE, record_size, false);
+					forget(it->second);
+					it->second = loc;
+					moved++;
+				}
+				offset += RECORD_HEADER_SIZE + record_size;
+			}
+		}
+	} catch (DatabaseException &e) {
+		// Try again later, the records moved so far are fine
+		errorstream << "Database_MMap: Failed to compact segment " << id
+			<< ": " << e.what() << std::endl;
+		return false;
+	}
+
+	std::lock_guard<std::mutex> lock(m_mutex);
+	// The copies have to be on disk before the originals are gone
+	for (auto &it : m_segments)
+		sync(it.second);
+
+	auto it = m_segments.find(id);
+	if (it->second.live != 0) {
+		errorstream << "Database_MMap: Segment " << id
+			<< " still in use after compaction" << std::endl;
+		return false;
+	}
+	delete it->second.file;
+	m_segments.erase(it);
+
+	std::string path = m_dir + DIR_DELIM + itos(id) + SEGMENT_EXTENSION;
+	if (!fs::DeleteSingleFileOrEmptyDirectory(path))
+		errorstream << "Database_MMap: Failed to delete " << path << std::endl;
+
+	verbosestream << "Database_MMap: Compacted segment " << id << ", moved "
+		<< moved << " blocks" << std::endl;
+	return true;
+}
@@ -0,0 +1,107 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "database.h"
+#include <map>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MappedFile;
+class MapCompactionThread;
+
+/*
+	Stores mapblocks in an append-only log of memory-mapped segment files,
+	map.mmap/<number>.seg in the world directory.
+
+	Saving a block appends a record to the newest segment, deleting one
+	appends a tombstone. An index in memory, rebuilt on startup by
+	scanning the segments, points to the newest record of every block.
+	A background thread compacts segments which mostly hold outdated
+	records by moving the records still in use to the end of the log.
+
+	All methods may be called from any thread.
+	See doc/world_format.txt for the record format.
+*/
+class Database_MMap : public MapDatabase
+{
+public:
+	Database_MMap(const std::string &savedir, bool background_compaction = true,
+		u32 segment_size = 64 * 1024 * 1024);
+	~Database_MMap();
+
+	bool saveBlock(const v3s16 &pos, const std::string &data);
+	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blocks);
+	bool deleteBlock(const v3s16 &pos);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	void beginSave() {}
+	// Writes the records appended since the last call to disk
+	void endSave();
+
+	// Compacts the segment with the largest share of outdated records,
+	// if that share is at least min_garbage. Returns whether it did.
+	bool compact(float min_garbage);
+
+	u32 getSegmentCount();
+
+private:
+	struct Segment
+	{
+		MappedFile *file;
+		// Bytes of records
+		u32 size;
+		// Bytes of the records the index points to
+		u32 live;
+		// Range written since the last sync
+		u32 dirty_begin;
+		u32 dirty_end;
+	};
+
+	struct Location
+	{
+		u32 segment;
+		u32 offset;
+		// Of the block data
+		u32 size;
+	};
+
+	void openSegments();
+	void scanSegment(u32 id, Segment &segment);
+	Segment &createSegment(u32 min_size);
+	Location append(s64 key, const char *data, u32 size, bool tombstone);
+	void forget(const Location &loc);
+	void read(const Location &loc, std::string *block);
+	void sync(Segment &segment);
+
+	std::string m_dir;
+	const u32 m_segment_size;
+
+	std::mutex m_mutex;
+	std::map<u32, Segment> m_segments;
+	std::unordered_map<s64, Location> m_index;
+
+	// Only one compaction at a time
+	std::mutex m_compact_mutex;
+	MapCompactionThread *m_compaction_thread = nullptr;
+};
@@ -220,6 +220,15 @@ void MapDatabasePostgreSQL::initStatements()
 				"UPDATE SET data = $4::bytea");
 	}
 
+	// unnest() with several arrays needs 9.4
+	if (getPGVersion() >= 90400) {
+		prepareStatement("read_blocks",
+			"SELECT p.i::int4, b.data FROM blocks b "
+				"JOIN unnest($1::int4[], $2::int4[], $3::int4[]) "
+				"WITH ORDINALITY AS p(x, y, z, i) "
+				"ON b.posX = p.x AND b.posY = p.y AND b.posZ = p.z");
+	}
+
 	prepareStatement("delete_block", "DELETE FROM blocks WHERE "
 		"posX = $1::int4 AND posY = $2::int4 AND posZ = $3::int4");
 
@@ -283,6 +292,48 @@ void MapDatabasePostgreSQL::loadBlock(const v3s16 &pos, std::string *block)
 	PQclear(results);
 }
 
+void MapDatabasePostgreSQL::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	if (getPGVersion() < 90400) {
+		MapDatabase::loadBlocks(pos, blocks);
+		return;
+	}
+
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(pos.size());
+	if (pos.empty())
+		return;
+
+	// Array literals like {1,2,3}
+	std::string x = "{", y = "{", z = "{";
+	for (size_t i = 0; i < pos.size(); i++) {
+		const char *sep = i ? "," : "";
+		x.append(sep).append(itos(pos[i].X));
+		y.append(sep).append(itos(pos[i].Y));
+		z.append(sep).append(itos(pos[i].Z));
+	}
+	x += "}";
+	y += "}";
+	z += "}";
+
+	const char *args[] = { x.c_str(), y.c_str(), z.c_str() };
+
+	PGresult *results = execPrepared("read_blocks", ARRLEN(args), args, false);
+
+	int numrows = PQntuples(results);
+	for (int row = 0; row < numrows; ++row) {
+		// Binary results, the ordinality starts at 1
+		u32 i = ntohl(*(const u32 *)PQgetvalue(results, row, 0)) - 1;
+		if (i < pos.size())
+			(*blocks)[i] = pg_to_string(results, row, 1);
+	}
+
+	PQclear(results);
+}
+
 bool MapDatabasePostgreSQL::deleteBlock(const v3s16 &pos)
 {
 	verifyDatabase();
@@ -154,6 +154,66 @@ void Database_Redis::loadBlock(const v3s16 &pos, std::string *block)
 		"Redis command 'HGET %s %s' gave invalid reply."));
 }
 
+void Database_Redis::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->clear();
+	blocks->resize(pos.size());
+	if (pos.empty())
+		return;
+
+	// HMGET hash field...
+	std::vector<std::string> fields;
+	fields.reserve(pos.size());
+	for (const v3s16 &p : pos)
+		fields.push_back(i64tos(getBlockAsInteger(p)));
+
+	std::vector<const char *> argv;
+	std::vector<size_t> argvlen;
+	argv.reserve(fields.size() + 2);
+	argvlen.reserve(fields.size() + 2);
+	argv.push_back("HMGET");
+	argvlen.push_back(5);
+	argv.push_back(hash.c_str());
+	argvlen.push_back(hash.size());
+	for (const std::string &field : fields) {
+		argv.push_back(field.c_str());
+		argvlen.push_back(field.size());
+	}
+
+	redisReply *reply = static_cast<redisReply *>(redisCommandArgv(ctx,
+			argv.size(), argv.data(), argvlen.data()));
+	if (!reply) {
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s' failed: ") + ctx->errstr);
+	}
+
+	if (reply->type == REDIS_REPLY_ERROR) {
+		std::string errstr(reply->str, reply->len);
+		freeReplyObject(reply);
+		errorstream << "loadBlocks: loading " << pos.size()
+			<< " blocks failed: " << errstr << std::endl;
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s' errored: ") + errstr);
+	}
+
+	if (reply->type != REDIS_REPLY_ARRAY || reply->elements != pos.size()) {
+		errorstream << "loadBlocks: loading " << pos.size()
+			<< " blocks returned invalid reply type " << reply->type << std::endl;
+		freeReplyObject(reply);
+		throw DatabaseException(std::string(
+			"Redis command 'HMGET %s' gave invalid reply."));
+	}
+
+	for (size_t i = 0; i < reply->elements; i++) {
+		redisReply *element = reply->element[i];
+		// Missing fields are REDIS_REPLY_NIL
+		if (element->type == REDIS_REPLY_STRING)
+			(*blocks)[i].assign(element->str, element->len);
+	}
+	freeReplyObject(reply);
+}
+
 bool Database_Redis::deleteBlock(const v3s16 &pos)
 {
 	std::string tmp = i64tos(getBlockAsInteger(pos));
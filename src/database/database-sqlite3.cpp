@@ -37,6 +37,7 @@ SQLite format specification:
 #include "server/player_sao.h"
 
 #include <cassert>
+#include <unordered_map>
 
 // When to print messages when the database is being held locked by another process
 // Note: I've seen occasional delays of over 250ms while running minetestmapper.
@@ -64,6 +65,9 @@ SQLite format specification:
 			<< sqlite3_errmsg(m_database) << std::endl; \
 	}
 
+// Number of positions in the read_batch statement
+#define READ_BATCH_SIZE 16
+
 #define FINALIZE_STATEMENT(statement) SQLOK_ERRSTREAM(sqlite3_finalize(statement), \
 	"Failed to finalize " #statement)
 
@@ -206,6 +210,7 @@ MapDatabaseSQLite3::MapDatabaseSQLite3(const std::string &savedir):
 MapDatabaseSQLite3::~MapDatabaseSQLite3()
 {
 	FINALIZE_STATEMENT(m_stmt_read)
+	FINALIZE_STATEMENT(m_stmt_read_batch)
 	FINALIZE_STATEMENT(m_stmt_write)
 	FINALIZE_STATEMENT(m_stmt_list)
 	FINALIZE_STATEMENT(m_stmt_delete)
@@ -228,6 +233,9 @@ void MapDatabaseSQLite3::createDatabase()
 void MapDatabaseSQLite3::initStatements()
 {
 	PREPARE_STATEMENT(read, "SELECT `data` FROM `blocks` WHERE `pos` = ? LIMIT 1");
+	// READ_BATCH_SIZE parameters
+	PREPARE_STATEMENT(read_batch, "SELECT `pos`, `data` FROM `blocks` WHERE `pos` IN "
+		"(?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
 	PREPARE_STATEMENT(write, "REPLACE INTO `blocks` (`pos`, `data`) VALUES (?, ?)");
 	PREPARE_STATEMENT(delete, "DELETE FROM `blocks` WHERE `pos` = ?");
 	PREPARE_STATEMENT(list, "SELECT `pos` FROM `blocks`");
@@ -295,6 +303,48 @@ void MapDatabaseSQLite3::loadBlock(const v3s16 &pos, std::string *block)
 	sqlite3_reset(m_stmt_read);
 }
 
+void MapDatabaseSQLite3::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	verifyDatabase();
+
+	blocks->clear();
+	blocks->resize(pos.size());
+
+	std::unordered_map<s64, size_t> indices;
+	for (size_t start = 0; start < pos.size(); start += READ_BATCH_SIZE) {
+		indices.clear();
+		for (int i = 0; i < READ_BATCH_SIZE; i++) {
+			if (start + i < pos.size()) {
+				s64 key = getBlockAsInteger(pos[start + i]);
+				indices[key] = start + i;
+				SQLOK(sqlite3_bind_int64(m_stmt_read_batch, i + 1, key),
+					"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+			} else {
+				// Matches nothing
+				SQLOK(sqlite3_bind_null(m_stmt_read_batch, i + 1),
+					"Internal error: failed to bind query at " __FILE__ ":" TOSTRING(__LINE__));
+			}
+		}
+
+		while (sqlite3_step(m_stmt_read_batch) == SQLITE_ROW) {
+			auto it = indices.find(sqlite3_column_int64(m_stmt_read_batch, 0));
+			const char *data = (const char *) sqlite3_column_blob(m_stmt_read_batch, 1);
+			size_t len = sqlite3_column_bytes(m_stmt_read_batch, 1);
+			if (it != indices.end() && data)
+				(*blocks)[it->second].assign(data, len);
+		}
+		sqlite3_reset(m_stmt_read_batch);
+
+		// Duplicate positions only got one of their slots filled
+		for (int i = 0; i < READ_BATCH_SIZE && start + i < pos.size(); i++) {
+			size_t first = indices[getBlockAsInteger(pos[start + i])];
+			if (first != start + i)
+				(*blocks)[start + i] = (*blocks)[first];
+		}
+	}
+}
+
 void MapDatabaseSQLite3::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
 	verifyDatabase();
@@ -148,6 +148,7 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	bool saveBlock(const v3s16 &pos, const std::string &data);
 	void loadBlock(const v3s16 &pos, std::string *block);
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *blocks);
 	bool deleteBlock(const v3s16 &pos);
 	void listAllLoadableBlocks(std::vector<v3s16> &dst);
 
@@ -162,6 +163,7 @@ class MapDatabaseSQLite3 : private Database_SQLite3, public MapDatabase
 
 	// Map
 	sqlite3_stmt *m_stmt_read = nullptr;
+	sqlite3_stmt *m_stmt_read_batch = nullptr;
 	sqlite3_stmt *m_stmt_write = nullptr;
 	sqlite3_stmt *m_stmt_list = nullptr;
 	sqlite3_stmt *m_stmt_delete = nullptr;
@@ -56,6 +56,15 @@ s64 MapDatabase::getBlockAsInteger(const v3s16 &pos)
 }
 
 
+void MapDatabase::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *blocks)
+{
+	blocks->resize(pos.size());
+	for (size_t i = 0; i < pos.size(); i++)
+		loadBlock(pos[i], &(*blocks)[i]);
+}
+
+
 v3s16 MapDatabase::getIntegerAsBlock(s64 i)
 {
 	v3s16 pos;
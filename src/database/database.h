@@ -42,6 +42,11 @@ class MapDatabase : public Database
 
 	virtual bool saveBlock(const v3s16 &pos, const std::string &data) = 0;
 	virtual void loadBlock(const v3s16 &pos, std::string *block) = 0;
+	// Loads several blocks at once, blocks->at(i) belongs to pos[i] and is
+	// empty if the block does not exist. Backends override this to save
+	// round trips, the default loads one block after the other.
+	virtual void loadBlocks(const std::vector<v3s16> &pos,
+		std::vector<std::string> *blocks);
 	virtual bool deleteBlock(const v3s16 &pos) = 0;
 
 	static s64 getBlockAsInteger(const v3s16 &pos);
@@ -401,7 +401,10 @@ void set_default_settings()
 
 	settings->setDefault("chat_message_format", "<@name> @message");
 	settings->setDefault("profiler_print_interval", "0");
+	settings->setDefault("profiler_trace_buffer_size", "0");
 	settings->setDefault("active_object_send_range_blocks", "8");
+	settings->setDefault("active_object_send_budget", "65536");
+	settings->setDefault("active_object_far_send_interval", "1.0");
 	settings->setDefault("active_block_range", "4");
 	//settings->setDefault("max_simultaneous_block_sends_per_client", "1");
 	// This causes frametime jitter on client side, or does it?
@@ -421,12 +424,19 @@ void set_default_settings()
 	settings->setDefault("chat_message_limit_trigger_kick", "50");
 	settings->setDefault("sqlite_synchronous", "2");
 	settings->setDefault("map_compression_level_disk", "-1");
+	settings->setDefault("map_save_queue_size", "1024");
+	settings->setDefault("compact_mapblocks", "false");
 	settings->setDefault("map_compression_level_net", "-1");
+	settings->setDefault("serialized_block_cache_size", "32");
+	settings->setDefault("num_block_send_threads", "2");
+	settings->setDefault("num_block_select_threads", "2");
 	settings->setDefault("full_block_send_enable_min_time_from_building", "2.0");
 	settings->setDefault("dedicated_server_step", "0.09");
 	settings->setDefault("active_block_mgmt_interval", "2.0");
 	settings->setDefault("abm_interval", "1.0");
 	settings->setDefault("abm_time_budget", "0.2");
+	settings->setDefault("num_abm_threads", "2");
+	settings->setDefault("num_lighting_threads", "2");
 	settings->setDefault("nodetimer_interval", "0.2");
 	settings->setDefault("ignore_world_load_errors", "false");
 	settings->setDefault("remote_media", "");
@@ -437,6 +447,9 @@ void set_default_settings()
 	settings->setDefault("emergequeue_limit_diskonly", "128");
 	settings->setDefault("emergequeue_limit_generate", "128");
 	settings->setDefault("num_emerge_threads", "1");
+	settings->setDefault("emerge_region_locking", "false");
+	settings->setDefault("emerge_cancel_distance", "0");
+	settings->setDefault("num_pathfinder_threads", "2");
 	settings->setDefault("secure.enable_security", "true");
 	settings->setDefault("secure.trusted_mods", "");
 	settings->setDefault("secure.http_mods", "");
@@ -457,6 +470,8 @@ void set_default_settings()
 
 	// Liquids
 	settings->setDefault("liquid_loop_max", "100000");
+	settings->setDefault("liquid_time_budget", "0.1");
+	settings->setDefault("num_liquid_threads", "2");
 	settings->setDefault("liquid_queue_purge_time", "0");
 	settings->setDefault("liquid_update", "1.0");
 
@@ -468,6 +483,7 @@ void set_default_settings()
 	settings->setDefault("fixed_map_seed", "");
 	settings->setDefault("max_block_generate_distance", "10");
 	settings->setDefault("enable_mapgen_debug_info", "false");
+	settings->setDefault("mapgen_noise_cache_size", "256");
 	Mapgen::setDefaultSettings(settings);
 
 	// Server list announcing
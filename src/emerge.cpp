@@ -21,8 +21,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "emerge.h"
 
+#include <algorithm>
 #include <iostream>
-#include <queue>
+#include <deque>
+#include <memory>
 
 #include "util/container.h"
 #include "util/thread.h"
@@ -39,12 +41,16 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mg_decoration.h"
 #include "mapgen/mg_schematic.h"
 #include "nodedef.h"
+#include "noise.h"
 #include "profiler.h"
 #include "scripting_server.h"
 #include "server.h"
 #include "settings.h"
 #include "voxel.h"
 
+// Number of queued blocks read from the database at once
+#define EMERGE_PREFETCH_MAX 64
+
 class EmergeThread : public Thread {
 public:
 	bool enable_mapgen_debug_info;
@@ -57,7 +63,7 @@ class EmergeThread : public Thread {
 	void signal();
 
 	// Requires queue mutex held
-	bool pushBlock(const v3s16 &pos);
+	bool pushBlock(const v3s16 &pos, s32 priority);
 
 	void cancelPendingItems();
 
@@ -73,11 +79,27 @@ class EmergeThread : public Thread {
 	EmergeManager *m_emerge;
 	Mapgen *m_mapgen;
 
+	struct QueuedBlock {
+		v3s16 pos;
+		// See EmergeManager::getPriority(), lowest first
+		s32 priority;
+	};
+
 	Event m_queue_event;
-	std::queue<v3s16> m_block_queue;
+	std::deque<QueuedBlock> m_block_queue;
+
+	// Blocks read from the database before they are emerged
+	std::map<v3s16, std::string> m_prefetched;
+	u64 m_prefetch_write_count = 0;
+
+	// 2D noise shared by the chunks of a column
+	NoiseCache m_noise_cache;
 
 	bool popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata);
+	void reportNoiseCacheStats();
+	void prefetchBlocks(const v3s16 &pos);
 
+	void prepareGen(BlockMakeData *bmdata);
 	EmergeAction getBlockOrStartGen(
 		const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *data);
 	MapBlock *finishGen(v3s16 pos, BlockMakeData *bmdata,
@@ -111,6 +133,13 @@ class MapEditEventAreaIgnorer
 	VoxelArea *m_ignorevariable;
 };
 
+BlockMakeData::~BlockMakeData()
+{
+	delete vmanip;
+	for (MapBlock *block : loaded_blocks)
+		delete block;
+}
+
 EmergeParams::~EmergeParams()
 {
 	infostream << "EmergeParams: destroying " << this << std::endl;
@@ -157,6 +186,7 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	// EmergeThreads should be the ServerThread.
 
 	enable_mapgen_debug_info = g_settings->getBool("enable_mapgen_debug_info");
+	m_region_locking = g_settings->getBool("emerge_region_locking");
 
 	STATIC_ASSERT(ARRLEN(emergeActionStrs) == ARRLEN(m_completed_emerge_counter),
 		enum_size_mismatches);
@@ -168,6 +198,12 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 			{{"status", emergeActionStrs[i]}}
 		);
 	}
+	m_noise_cache_hit_counter = mb->addCounter(
+		"minetest_emerge_noise_cache_hits",
+		"Number of 2D noise maps copied from the mapgen noise cache");
+	m_noise_cache_miss_counter = mb->addCounter(
+		"minetest_emerge_noise_cache_misses",
+		"Number of 2D noise maps computed by mapgens");
 
 	s16 nthreads = 1;
 	g_settings->getS16NoEx("num_emerge_threads", nthreads);
@@ -190,6 +226,11 @@ EmergeManager::EmergeManager(Server *server, MetricsBackend *mb)
 	m_qlimit_diskonly = rangelim(m_qlimit_diskonly, 1, 1000000);
 	m_qlimit_generate = rangelim(m_qlimit_generate, 1, 1000000);
 
+	s32 cancel_distance = g_settings->getS16("emerge_cancel_distance");
+	if (cancel_distance <= 0)
+		cancel_distance = g_settings->getS16("max_block_send_distance") + 2;
+	m_cancel_distance_sq = cancel_distance * cancel_distance;
+
 	for (s16 i = 0; i < nthreads; i++)
 		m_threads.push_back(new EmergeThread(server, i));
 
@@ -360,7 +401,7 @@ bool EmergeManager::enqueueBlockEmergeEx(
 			return true;
 
 		thread = getOptimalThread();
-		thread->pushBlock(blockpos);
+		thread->pushBlock(blockpos, getPriority(blockpos));
 	}
 
 	thread->signal();
@@ -376,6 +417,44 @@ bool EmergeManager::isBlockInQueue(v3s16 pos)
 }
 
 
+void EmergeManager::updatePriorities(const std::vector<v3s16> &interest_points)
+{
+	ScopeProfiler sp(g_profiler, "EmergeManager: update priorities", SPT_AVG);
+	MutexAutoLock queuelock(m_queue_mutex);
+
+	m_interest_points = interest_points;
+
+	for (EmergeThread *thread : m_threads) {
+		std::deque<EmergeThread::QueuedBlock> queue;
+		for (EmergeThread::QueuedBlock &queued : thread->m_block_queue) {
+			queued.priority = getPriority(queued.pos);
+
+			// Clients request such blocks again when they come near.
+			// Blocks with callbacks are waited for and never cancelled.
+			auto it = m_blocks_enqueued.find(queued.pos);
+			if (it != m_blocks_enqueued.end() &&
+					!m_interest_points.empty() &&
+					queued.priority > m_cancel_distance_sq &&
+					it->second.peer_requested != PEER_ID_INEXISTENT &&
+					it->second.callbacks.empty() &&
+					!(it->second.flags & BLOCK_EMERGE_FORCE_QUEUE)) {
+				cancelBlock(queued.pos);
+				continue;
+			}
+
+			queue.push_back(queued);
+		}
+
+		std::stable_sort(queue.begin(), queue.end(),
+			[] (const EmergeThread::QueuedBlock &a,
+					const EmergeThread::QueuedBlock &b) {
+				return a.priority < b.priority;
+			});
+		thread->m_block_queue.swap(queue);
+	}
+}
+
+
 //
 // Mapgen-related helper functions
 //
@@ -419,6 +498,17 @@ bool EmergeManager::pushBlockEmergeData(
 	void *callback_param,
 	bool *entry_already_exists)
 {
+	// Requests for queued blocks are merged, they take no more space
+	auto it = m_blocks_enqueued.find(pos);
+	*entry_already_exists = it != m_blocks_enqueued.end();
+	if (*entry_already_exists) {
+		BlockEmergeData &bedata = it->second;
+		if (callback)
+			bedata.callbacks.emplace_back(callback, callback_param);
+		bedata.flags |= flags;
+		return true;
+	}
+
 	u32 &count_peer = m_peer_queue_count[peer_requested];
 
 	if ((flags & BLOCK_EMERGE_FORCE_QUEUE) == 0) {
@@ -428,7 +518,9 @@ bool EmergeManager::pushBlockEmergeData(
 		if (peer_requested != PEER_ID_INEXISTENT) {
 			u32 qlimit_peer = (flags & BLOCK_EMERGE_ALLOW_GEN) ?
 				m_qlimit_generate : m_qlimit_diskonly;
-			if (count_peer >= qlimit_peer)
+			// A client which moved on gets its new blocks before the old ones
+			if (count_peer >= qlimit_peer &&
+					!replaceFarthestBlock(peer_requested, getPriority(pos)))
 				return false;
 		} else {
 			// limit block enqueue requests for active blocks to 1/2 of total
@@ -437,23 +529,13 @@ bool EmergeManager::pushBlockEmergeData(
 		}
 	}
 
-	std::pair<std::map<v3s16, BlockEmergeData>::iterator, bool> findres;
-	findres = m_blocks_enqueued.insert(std::make_pair(pos, BlockEmergeData()));
-
-	BlockEmergeData &bedata = findres.first->second;
-	*entry_already_exists   = !findres.second;
-
+	BlockEmergeData &bedata = m_blocks_enqueued[pos];
 	if (callback)
 		bedata.callbacks.emplace_back(callback, callback_param);
+	bedata.flags = flags;
+	bedata.peer_requested = peer_requested;
 
-	if (*entry_already_exists) {
-		bedata.flags |= flags;
-	} else {
-		bedata.flags = flags;
-		bedata.peer_requested = peer_requested;
-
-		count_peer++;
-	}
+	count_peer++;
 
 	return true;
 }
@@ -502,6 +584,73 @@ EmergeThread *EmergeManager::getOptimalThread()
 	return m_threads[index];
 }
 
+s32 EmergeManager::getPriority(v3s16 pos) const
+{
+	// Squared distance to the nearest interest point
+	s32 priority = 0;
+	for (size_t i = 0; i < m_interest_points.size(); i++) {
+		const v3s16 &p = m_interest_points[i];
+		s32 dx = pos.X - p.X;
+		s32 dy = pos.Y - p.Y;
+		s32 dz = pos.Z - p.Z;
+		s32 d = dx * dx + dy * dy + dz * dz;
+		if (i == 0 || d < priority)
+			priority = d;
+	}
+
+	return priority;
+}
+
+
+bool EmergeManager::replaceFarthestBlock(u16 peer_id, s32 priority)
+{
+	EmergeThread *farthest_thread = nullptr;
+	size_t farthest_index = 0;
+	s32 farthest_priority = priority;
+
+	for (EmergeThread *thread : m_threads) {
+		const std::deque<EmergeThread::QueuedBlock> &queue = thread->m_block_queue;
+		// Queues are sorted, so the first match from the back is the farthest
+		for (size_t i = queue.size(); i-- > 0;) {
+			if (queue[i].priority <= farthest_priority)
+				break;
+
+			auto it = m_blocks_enqueued.find(queue[i].pos);
+			if (it == m_blocks_enqueued.end() ||
+					it->second.peer_requested != peer_id ||
+					!it->second.callbacks.empty() ||
+					(it->second.flags & BLOCK_EMERGE_FORCE_QUEUE))
+				continue;
+
+			farthest_thread = thread;
+			farthest_index = i;
+			farthest_priority = queue[i].priority;
+			break;
+		}
+	}
+
+	if (!farthest_thread)
+		return false;
+
+	std::deque<EmergeThread::QueuedBlock> &queue = farthest_thread->m_block_queue;
+	v3s16 pos = queue[farthest_index].pos;
+	queue.erase(queue.begin() + farthest_index);
+	cancelBlock(pos);
+
+	return true;
+}
+
+
+void EmergeManager::cancelBlock(v3s16 pos)
+{
+	// Only used for blocks without callbacks, which were already removed
+	// from the queue of their thread
+	BlockEmergeData bedata;
+	if (popBlockEmergeData(pos, &bedata))
+		reportCompletedEmerge(EMERGE_CANCELLED);
+}
+
+
 void EmergeManager::reportCompletedEmerge(EmergeAction action)
 {
 	assert((size_t)action < ARRLEN(m_completed_emerge_counter));
@@ -519,7 +668,8 @@ EmergeThread::EmergeThread(Server *server, int ethreadid) :
 	m_server(server),
 	m_map(NULL),
 	m_emerge(NULL),
-	m_mapgen(NULL)
+	m_mapgen(NULL),
+	m_noise_cache(g_settings->getU32("mapgen_noise_cache_size"))
 {
 	m_name = "Emerge-" + itos(ethreadid);
 }
@@ -531,9 +681,14 @@ void EmergeThread::signal()
 }
 
 
-bool EmergeThread::pushBlock(const v3s16 &pos)
+bool EmergeThread::pushBlock(const v3s16 &pos, s32 priority)
 {
-	m_block_queue.push(pos);
+	// After the queued blocks of the same priority
+	auto it = std::upper_bound(m_block_queue.begin(), m_block_queue.end(),
+		priority, [] (s32 priority, const QueuedBlock &queued) {
+			return priority < queued.priority;
+		});
+	m_block_queue.insert(it, {pos, priority});
 	return true;
 }
 
@@ -546,8 +701,8 @@ void EmergeThread::cancelPendingItems()
 		BlockEmergeData bedata;
 		v3s16 pos;
 
-		pos = m_block_queue.front();
-		m_block_queue.pop();
+		pos = m_block_queue.front().pos;
+		m_block_queue.pop_front();
 
 		m_emerge->popBlockEmergeData(pos, &bedata);
 
@@ -580,8 +735,8 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 	if (m_block_queue.empty())
 		return false;
 
-	*pos = m_block_queue.front();
-	m_block_queue.pop();
+	*pos = m_block_queue.front().pos;
+	m_block_queue.pop_front();
 
 	m_emerge->popBlockEmergeData(*pos, bedata);
 
@@ -589,6 +744,35 @@ bool EmergeThread::popBlockEmerge(v3s16 *pos, BlockEmergeData *bedata)
 }
 
 
+void EmergeThread::prefetchBlocks(const v3s16 &pos)
+{
+	// Outdated blocks are skipped when they are used
+	if (m_prefetched.find(pos) != m_prefetched.end())
+		return;
+
+	// Read the blocks which are emerged next along with this one
+	std::vector<v3s16> positions;
+	positions.push_back(pos);
+	{
+		MutexAutoLock queuelock(m_emerge->m_queue_mutex);
+		for (const QueuedBlock &queued : m_block_queue) {
+			if (positions.size() >= EMERGE_PREFETCH_MAX)
+				break;
+			positions.push_back(queued.pos);
+		}
+	}
+
+	ScopeProfiler sp(g_profiler, "EmergeThread: prefetch blocks", SPT_AVG);
+
+	m_prefetched.clear();
+	m_prefetch_write_count = m_map->getBlockWriteCount();
+	std::vector<std::string> blobs;
+	m_map->readBlocks(positions, &blobs);
+	for (size_t i = 0; i < positions.size(); i++)
+		m_prefetched[positions[i]] = std::move(blobs[i]);
+}
+
+
 EmergeAction EmergeThread::getBlockOrStartGen(
 	const v3s16 &pos, bool allow_gen, MapBlock **block, BlockMakeData *bmdata)
 {
@@ -601,20 +785,47 @@ EmergeAction EmergeThread::getBlockOrStartGen(
 			return EMERGE_FROM_MEMORY;
 	} else {
 		// 2). Attempt to load block from disk if it was not in the memory
-		*block = m_map->loadBlock(pos);
+		auto it = m_prefetched.find(pos);
+		if (it != m_prefetched.end() &&
+				!m_map->blockWrittenSince(pos, m_prefetch_write_count))
+			*block = m_map->loadBlock(pos, &it->second);
+		else
+			*block = m_map->loadBlock(pos);
+		if (it != m_prefetched.end())
+			m_prefetched.erase(it);
 		if (*block && (*block)->isGenerated())
 			return EMERGE_FROM_DISK;
 	}
 
-	// 3). Attempt to start generation
-	if (allow_gen && m_map->initBlockMake(pos, bmdata))
-		return EMERGE_GENERATED;
+	// 3). Attempt to start generation, see prepareGen() for region locking
+	if (allow_gen) {
+		bool started = m_emerge->m_region_locking ?
+			m_map->reserveBlockMake(pos, bmdata) :
+			m_map->initBlockMake(pos, bmdata);
+		if (started)
+			return EMERGE_GENERATED;
+	}
 
 	// All attempts failed; cancel this block emerge
 	return EMERGE_CANCELLED;
 }
 
 
+void EmergeThread::prepareGen(BlockMakeData *bmdata)
+{
+	{
+		ScopeProfiler sp(g_profiler,
+			"EmergeThread: read chunk area", SPT_AVG);
+		m_map->readBlockMake(bmdata);
+	}
+
+	MutexAutoLock envlock(m_server->m_env_mutex);
+	ScopeProfiler sp(g_profiler,
+		"EmergeThread: prepare chunk area", SPT_AVG);
+	m_map->prepareBlockMake(bmdata);
+}
+
+
 MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 	std::map<v3s16, MapBlock *> *modified_blocks)
 {
@@ -673,6 +884,21 @@ MapBlock *EmergeThread::finishGen(v3s16 pos, BlockMakeData *bmdata,
 }
 
 
+void EmergeThread::reportNoiseCacheStats()
+{
+	u64 hits = m_noise_cache.getHits();
+	u64 misses = m_noise_cache.getMisses();
+	m_noise_cache.resetStats();
+	if (hits + misses == 0)
+		return;
+
+	m_emerge->m_noise_cache_hit_counter->increment(hits);
+	m_emerge->m_noise_cache_miss_counter->increment(misses);
+	g_profiler->avg("EmergeThread: noise cache hit rate [%]",
+		100.0f * hits / (hits + misses));
+}
+
+
 void *EmergeThread::run()
 {
 	BEGIN_DEBUG_EXCEPTION_HANDLER
@@ -684,6 +910,7 @@ void *EmergeThread::run()
 	m_emerge = m_server->m_emerge;
 	m_mapgen = m_emerge->m_mapgens[id];
 	enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
+	NoiseCache::setThreadCache(&m_noise_cache);
 
 	try {
 	while (!stopRequested()) {
@@ -703,14 +930,31 @@ void *EmergeThread::run()
 		bool allow_gen = bedata.flags & BLOCK_EMERGE_ALLOW_GEN;
 		EMERGE_DBG_OUT("pos=" PP(pos) " allow_gen=" << allow_gen);
 
+		prefetchBlocks(pos);
+
 		action = getBlockOrStartGen(pos, allow_gen, &block, &bmdata);
 		if (action == EMERGE_GENERATED) {
+			// Held until the chunk is written back. Taken without the
+			// environment lock, whose holders may be waiting for it.
+			std::unique_ptr<RegionLockGuard> region;
+			if (m_emerge->m_region_locking) {
+				{
+					ScopeProfiler sp(g_profiler,
+						"EmergeThread: wait for chunk area", SPT_AVG);
+					region.reset(new RegionLockGuard(&m_emerge->m_region_locks,
+						VoxelArea(bmdata.blockpos_min - v3s16(1, 1, 1),
+							bmdata.blockpos_max + v3s16(1, 1, 1))));
+				}
+				prepareGen(&bmdata);
+			}
+
 			{
 				ScopeProfiler sp(g_profiler,
 					"EmergeThread: Mapgen::makeChunk", SPT_AVG);
 
 				m_mapgen->makeChunk(&bmdata);
 			}
+			reportNoiseCacheStats();
 
 			block = finishGen(pos, &bmdata, &modified_blocks);
 			if (!block)
@@ -752,6 +996,7 @@ void *EmergeThread::run()
 	}
 
 	cancelPendingItems();
+	NoiseCache::setThreadCache(NULL);
 
 	END_DEBUG_EXCEPTION_HANDLER
 	return NULL;
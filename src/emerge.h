@@ -27,6 +27,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/metricsbackend.h"
 #include "mapgen/mapgen.h" // for MapgenParams
 #include "map.h"
+#include "server/regionlocks.h"
 
 #define BLOCK_EMERGE_ALLOW_GEN   (1 << 0)
 #define BLOCK_EMERGE_FORCE_QUEUE (1 << 1)
@@ -56,9 +57,14 @@ struct BlockMakeData {
 	UniqueQueue<v3s16> transforming_liquid;
 	const NodeDefManager *nodedef = nullptr;
 
+	// See ServerMap::reserveBlockMake()
+	std::vector<v3s16> missing_blocks;
+	std::vector<MapBlock *> loaded_blocks;
+	u64 block_write_count = 0;
+
 	BlockMakeData() = default;
 
-	~BlockMakeData() { delete vmanip; }
+	~BlockMakeData();
 };
 
 // Result from processing an item on the emerge queue
@@ -185,6 +191,11 @@ class EmergeManager {
 
 	bool isBlockInQueue(v3s16 pos);
 
+	// Reorders the queued blocks by distance to the nearest of the given
+	// mapblock positions, and cancels the blocks requested by clients
+	// which are too far from all of them
+	void updatePriorities(const std::vector<v3s16> &interest_points);
+
 	Mapgen *getCurrentMapgen();
 
 	// Mapgen helpers methods
@@ -206,8 +217,19 @@ class EmergeManager {
 	u32 m_qlimit_diskonly;
 	u32 m_qlimit_generate;
 
+	// Where blocks are wanted, from the last updatePriorities()
+	std::vector<v3s16> m_interest_points;
+	// Squared distance in mapblocks, see emerge_cancel_distance
+	s32 m_cancel_distance_sq;
+
 	// Emerge metrics
 	MetricCounterPtr m_completed_emerge_counter[5];
+	MetricCounterPtr m_noise_cache_hit_counter;
+	MetricCounterPtr m_noise_cache_miss_counter;
+
+	// Chunks being generated, with their borders, in region locking mode
+	bool m_region_locking;
+	RegionLocks m_region_locks;
 
 	// Managers of various map generation-related components
 	// Note that each Mapgen gets a copy(!) of these to work with
@@ -219,6 +241,12 @@ class EmergeManager {
 
 	// Requires m_queue_mutex held
 	EmergeThread *getOptimalThread();
+	// Requires m_queue_mutex held
+	s32 getPriority(v3s16 pos) const;
+	// Requires m_queue_mutex held
+	bool replaceFarthestBlock(u16 peer_id, s32 priority);
+	// Requires m_queue_mutex held
+	void cancelBlock(v3s16 pos);
 
 	bool pushBlockEmergeData(
 		v3s16 pos,
@@ -67,6 +67,8 @@ class Logger {
 
 	void registerThread(const std::string &name);
 	void deregisterThread();
+	// Name of the calling thread as registered, or its id
+	const std::string getThreadName();
 
 	void log(LogLevel lev, const std::string &text);
 	// Logs without a prefix
@@ -87,8 +89,6 @@ class Logger {
 		const std::string &time, const std::string &thread_name,
 		const std::string &payload_text);
 
-	const std::string getThreadName();
-
 	std::vector<ILogOutput *> m_outputs[LL_MAX];
 	std::atomic<bool> m_has_outputs[LL_MAX];
 
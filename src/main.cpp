@@ -38,6 +38,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "config.h"
 #include "player.h"
 #include "porting.h"
+#include "profiler.h"
 #include "network/socket.h"
 #include "mapblock.h"
 #if USE_CURSES
@@ -204,6 +205,8 @@ int main(int argc, char *argv[])
 	if (!init_common(cmd_args, argc, argv))
 		return 1;
 
+	g_profiler->startTracing(g_settings->getU32("profiler_trace_buffer_size"));
+
 	if (g_settings->getBool("enable_console"))
 		porting::attachOrCreateConsole();
 
@@ -1039,7 +1042,7 @@ static bool migrate_map_database(const GameParams &game_params, const Settings &
 	if (!world_mt.exists("backend")) {
 		errorstream << "Please specify your current backend in world.mt:"
 			<< std::endl
-			<< "	backend = {sqlite3|leveldb|redis|dummy|postgresql}"
+			<< "	backend = {sqlite3|leveldb|redis|mmap|dummy|postgresql}"
 			<< std::endl;
 		return false;
 	}
@@ -41,12 +41,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "mapgen/mg_biome.h"
 #include "config.h"
 #include "server.h"
+#include "server/liquidregion.h"
+#include "server/mapsaver.h"
 #include "database/database.h"
 #include "database/database-dummy.h"
+#include "database/database-mmap.h"
 #include "database/database-sqlite3.h"
 #include "script/scripting_server.h"
+#include "threading/thread_pool.h"
 #include <deque>
 #include <queue>
+#include <unordered_map>
 #if USE_LEVELDB
 #include "database/database-leveldb.h"
 #endif
@@ -131,6 +136,12 @@ MapBlock * Map::getBlockNoCreateNoEx(v3s16 p3d)
 	return block;
 }
 
+MapSector *Map::findSector(v2s16 p) const
+{
+	auto n = m_sectors.find(p);
+	return n != m_sectors.end() ? n->second : nullptr;
+}
+
 MapBlock * Map::getBlockNoCreate(v3s16 p3d)
 {
 	MapBlock *block = getBlockNoCreateNoEx(p3d);
@@ -475,39 +486,8 @@ void Map::PrintInfo(std::ostream &out)
 	out<<"Map: ";
 }
 
-#define WATER_DROP_BOOST 4
-
-const static v3s16 liquid_6dirs[6] = {
-	// order: upper before same level before lower
-	v3s16( 0, 1, 0),
-	v3s16( 0, 0, 1),
-	v3s16( 1, 0, 0),
-	v3s16( 0, 0,-1),
-	v3s16(-1, 0, 0),
-	v3s16( 0,-1, 0)
-};
-
-enum NeighborType : u8 {
-	NEIGHBOR_UPPER,
-	NEIGHBOR_SAME_LEVEL,
-	NEIGHBOR_LOWER
-};
-
-struct NodeNeighbor {
-	MapNode n;
-	NeighborType t;
-	v3s16 p;
-
-	NodeNeighbor()
-		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
-	{ }
-
-	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
-		: n(node),
-		  t(n_type),
-		  p(pos)
-	{ }
-};
+// Fewest nodes a liquid step processes within liquid_time_budget
+#define LIQUID_BUDGET_MIN 100
 
 void ServerMap::transforming_liquid_add(v3s16 p) {
         m_transforming_liquid.push_back(p);
@@ -516,322 +496,138 @@ void ServerMap::transforming_liquid_add(v3s16 p) {
 void ServerMap::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 		ServerEnvironment *env)
 {
+	u64 start_time = porting::getTimeUs();
 	u32 loopcount = 0;
 	u32 initial_size = m_transforming_liquid.size();
 
 	/*if(initial_size != 0)
 		infostream<<"transformLiquids(): initial_size="<<initial_size<<std::endl;*/
 
-	// list of nodes that due to viscosity have not reached their max level height
-	std::vector<v3s16> must_reflow;
-
 	std::vector<std::pair<v3s16, MapNode> > changed_nodes;
 
 	std::vector<v3s16> check_for_falling;
 
 	u32 liquid_loop_max = g_settings->getS32("liquid_loop_max");
+	// In microseconds
+	u32 time_budget = g_settings->getFloat("liquid_update") *
+		g_settings->getFloat("liquid_time_budget") * 1000000;
 	u32 loop_max = liquid_loop_max;
+	if (time_budget > 0)
+		loop_max = MYMIN(m_liquid_budget, liquid_loop_max);
 
-	while (m_transforming_liquid.size() != 0)
-	{
-		// This should be done here so that it is done when continue is used
-		if (loopcount >= initial_size || loopcount >= loop_max)
-			break;
+	/*
+		Sort the queued nodes into regions of one mapblock
+	 */
+	std::vector<std::unique_ptr<LiquidRegion>> regions;
+	std::unordered_map<v3s16, LiquidRegion *> region_of_block;
+	while (m_transforming_liquid.size() != 0 &&
+			loopcount < initial_size && loopcount < loop_max) {
 		loopcount++;
-
-		/*
-			Get a queued transforming liquid node
-		*/
 		v3s16 p0 = m_transforming_liquid.front();
 		m_transforming_liquid.pop_front();
 
-		MapNode n0 = getNode(p0);
-
-		/*
-			Collect information about current node
-		 */
-		s8 liquid_level = -1;
-		// The liquid node which will be placed there if
-		// the liquid flows into this node.
-		content_t liquid_kind = CONTENT_IGNORE;
-		// The node which will be placed there if liquid
-		// can't flow into this node.
-		content_t floodable_node = CONTENT_AIR;
-		const ContentFeatures &cf = m_nodedef->get(n0);
-		LiquidType liquid_type = cf.liquid_type;
-		switch (liquid_type) {
-			case LIQUID_SOURCE:
-				liquid_level = LIQUID_LEVEL_SOURCE;
-				liquid_kind = cf.liquid_alternative_flowing_id;
-				break;
-			case LIQUID_FLOWING:
-				liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
-				liquid_kind = n0.getContent();
-				break;
-			case LIQUID_NONE:
-				// if this node is 'floodable', it *could* be transformed
-				// into a liquid, otherwise, continue with the next node.
-				if (!cf.floodable)
-					continue;
-				floodable_node = n0.getContent();
-				liquid_kind = CONTENT_AIR;
-				break;
-		}
-
-		/*
-			Collect information about the environment
-		 */
-		NodeNeighbor sources[6]; // surrounding sources
-		int num_sources = 0;
-		NodeNeighbor flows[6]; // surrounding flowing liquid nodes
-		int num_flows = 0;
-		NodeNeighbor airs[6]; // surrounding air
-		int num_airs = 0;
-		NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
-		int num_neutrals = 0;
-		bool flowing_down = false;
-		bool ignored_sources = false;
-		bool floating_node_above = false;
-		for (u16 i = 0; i < 6; i++) {
-			NeighborType nt = NEIGHBOR_SAME_LEVEL;
-			switch (i) {
-				case 0:
-					nt = NEIGHBOR_UPPER;
-					break;
-				case 5:
-					nt = NEIGHBOR_LOWER;
-					break;
-				default:
-					break;
-			}
-			v3s16 npos = p0 + liquid_6dirs[i];
-			NodeNeighbor nb(getNode(npos), nt, npos);
-			const ContentFeatures &cfnb = m_nodedef->get(nb.n);
-			if (nt == NEIGHBOR_UPPER && cfnb.floats)
-				floating_node_above = true;
-			switch (cfnb.liquid_type) {
-				case LIQUID_NONE:
-					if (cfnb.floodable) {
-						airs[num_airs++] = nb;
-						// if the current node is a water source the neighbor
-						// should be enqueded for transformation regardless of whether the
-						// current node changes or not.
-						if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
-							m_transforming_liquid.push_back(npos);
-						// if the current node happens to be a flowing node, it will start to flow down here.
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					} else {
-						neutrals[num_neutrals++] = nb;
-						if (nb.n.getContent() == CONTENT_IGNORE) {
-							// If node below is ignore prevent water from
-							// spreading outwards and otherwise prevent from
-							// flowing away as ignore node might be the source
-							if (nb.t == NEIGHBOR_LOWER)
-								flowing_down = true;
-							else
-								ignored_sources = true;
-						}
-					}
-					break;
-				case LIQUID_SOURCE:
-					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-					if (liquid_kind == CONTENT_AIR)
-						liquid_kind = cfnb.liquid_alternative_flowing_id;
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						// Do not count bottom source, it will screw things up
-						if(nt != NEIGHBOR_LOWER)
-							sources[num_sources++] = nb;
-					}
-					break;
-				case LIQUID_FLOWING:
-					if (nb.t != NEIGHBOR_SAME_LEVEL ||
-						(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
-						// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
-						// but exclude falling liquids on the same level, they cannot flow here anyway
-						if (liquid_kind == CONTENT_AIR)
-							liquid_kind = cfnb.liquid_alternative_flowing_id;
-					}
-					if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
-						neutrals[num_neutrals++] = nb;
-					} else {
-						flows[num_flows++] = nb;
-						if (nb.t == NEIGHBOR_LOWER)
-							flowing_down = true;
-					}
-					break;
-			}
+		v3s16 blockpos = getNodeBlockPos(p0);
+		LiquidRegion *&region = region_of_block[blockpos];
+		if (!region) {
+			regions.emplace_back(new LiquidRegion(this, blockpos));
+			region = regions.back().get();
 		}
+		region->queue.push_back(p0);
+	}
 
-		/*
-			decide on the type (and possibly level) of the current node
-		 */
-		content_t new_node_content;
-		s8 new_node_level = -1;
-		s8 max_node_level = -1;
-
-		u8 range = m_nodedef->get(liquid_kind).liquid_range;
-		if (range > LIQUID_LEVEL_MAX + 1)
-			range = LIQUID_LEVEL_MAX + 1;
-
-		if ((num_sources >= 2 && m_nodedef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
-			// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
-			// or the flowing alternative of the first of the surrounding sources (if it's air), so
-			// it's perfectly safe to use liquid_kind here to determine the new node content.
-			new_node_content = m_nodedef->get(liquid_kind).liquid_alternative_source_id;
-		} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
-			// liquid_kind is set properly, see above
-			max_node_level = new_node_level = LIQUID_LEVEL_MAX;
-			if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
-		} else if (ignored_sources && liquid_level >= 0) {
-			// Maybe there are neighboring sources that aren't loaded yet
-			// so prevent flowing away.
-			new_node_level = liquid_level;
-			new_node_content = liquid_kind;
-		} else {
-			// no surrounding sources, so get the maximum level that can flow into this node
-			for (u16 i = 0; i < num_flows; i++) {
-				u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
-				switch (flows[i].t) {
-					case NEIGHBOR_UPPER:
-						if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
-							max_node_level = LIQUID_LEVEL_MAX;
-							if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
-								max_node_level = nb_liquid_level + WATER_DROP_BOOST;
-						} else if (nb_liquid_level > max_node_level) {
-							max_node_level = nb_liquid_level;
-						}
-						break;
-					case NEIGHBOR_LOWER:
-						break;
-					case NEIGHBOR_SAME_LEVEL:
-						if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
-								nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
-							max_node_level = nb_liquid_level - 1;
-						break;
-				}
-			}
-
-			u8 viscosity = m_nodedef->get(liquid_kind).liquid_viscosity;
-			if (viscosity > 1 && max_node_level != liquid_level) {
-				// amount to gain, limited by viscosity
-				// must be at least 1 in absolute value
-				s8 level_inc = max_node_level - liquid_level;
-				if (level_inc < -viscosity || level_inc > viscosity)
-					new_node_level = liquid_level + level_inc/viscosity;
-				else if (level_inc < 0)
-					new_node_level = liquid_level - 1;
-				else if (level_inc > 0)
-					new_node_level = liquid_level + 1;
-				if (new_node_level != max_node_level)
-					must_reflow.push_back(p0);
-			} else {
-				new_node_level = max_node_level;
-			}
-
-			if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
-				new_node_content = liquid_kind;
-			else
-				new_node_content = floodable_node;
+	// list of nodes that due to viscosity have not reached their max level height
+	std::vector<v3s16> must_reflow;
 
+	/*
+		Transform the regions of one color at a time on the worker threads,
+		then make their changes here
+	 */
+	std::vector<LiquidRegion *> pass;
+	for (u8 color = 0; color < LiquidRegion::COLOR_COUNT; color++) {
+		pass.clear();
+		for (auto &region : regions) {
+			if (region->getBlock() &&
+					LiquidRegion::getColor(region->getBlockPos()) == color)
+				pass.push_back(region.get());
 		}
-
-		/*
-			check if anything has changed. if not, just continue with the next node.
-		 */
-		if (new_node_content == n0.getContent() &&
-				(m_nodedef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
-				((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
-				((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
-				== flowing_down)))
+		if (pass.empty())
 			continue;
 
-		/*
-			check if there is a floating node above that needs to be updated.
-		 */
-		if (floating_node_above && new_node_content == CONTENT_AIR)
-			check_for_falling.push_back(p0);
-
-		/*
-			update the current node
-		 */
-		MapNode n00 = n0;
-		//bool flow_down_enabled = (flowing_down && ((n0.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK));
-		if (m_nodedef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
-			// set level to last 3 bits, flowing down bit to 4th bit
-			n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
-		} else {
-			// set the liquid level and flow bits to 0
-			n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
-		}
-
-		// change the node.
-		n0.setContent(new_node_content);
+		m_liquid_thread_pool->parallelFor(pass.size(), [&] (size_t i) {
+			pass[i]->transform();
+		});
+
+		for (LiquidRegion *region : pass) {
+			for (v3s16 p : region->next)
+				m_transforming_liquid.push_back(p);
+			must_reflow.insert(must_reflow.end(), region->must_reflow.begin(),
+				region->must_reflow.end());
+			check_for_falling.insert(check_for_falling.end(),
+				region->check_for_falling.begin(), region->check_for_falling.end());
+
+			// Once a change is not made the rest of the region's changes
+			// are outdated, its nodes are transformed again next step
+			bool outdated = false;
+			for (const LiquidRegion::Change &change : region->changes) {
+				v3s16 p0 = change.p;
+				if (outdated) {
+					m_transforming_liquid.push_back(p0);
+					continue;
+				}
+				MapNode n00 = change.old_node;
+				MapNode n0 = change.new_node;
+
+				// Callbacks of the changes before may have modified the map,
+				// light is updated separately
+				MapNode n_map = getNode(p0);
+				if (n_map.getContent() != n00.getContent() ||
+						n_map.getParam2() != n00.getParam2()) {
+					m_transforming_liquid.push_back(p0);
+					outdated = true;
+					continue;
+				}
 
-		// on_flood() the node
-		if (floodable_node != CONTENT_AIR) {
-			if (env->getScriptIface()->node_on_flood(p0, n00, n0))
-				continue;
-		}
+				// on_flood() the node
+				if (change.flood) {
+					if (env->getScriptIface()->node_on_flood(p0, n00, n0)) {
+						outdated = true;
+						continue;
+					}
+				}
 
-		// Ignore light (because calling voxalgo::update_lighting_nodes)
-		ContentLightingFlags f0 = m_nodedef->getLightingFlags(n0);
-		n0.setLight(LIGHTBANK_DAY, 0, f0);
-		n0.setLight(LIGHTBANK_NIGHT, 0, f0);
-
-		// Find out whether there is a suspect for this action
-		std::string suspect;
-		if (m_gamedef->rollback())
-			suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
-
-		if (m_gamedef->rollback() && !suspect.empty()) {
-			// Blame suspect
-			RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
-			// Get old node for rollback
-			RollbackNode rollback_oldnode(this, p0, m_gamedef);
-			// Set node
-			setNode(p0, n0);
-			// Report
-			RollbackNode rollback_newnode(this, p0, m_gamedef);
-			RollbackAction action;
-			action.setSetNode(p0, rollback_oldnode, rollback_newnode);
-			m_gamedef->rollback()->reportAction(action);
-		} else {
-			// Set node
-			setNode(p0, n0);
-		}
+				// Ignore light (because calling voxalgo::update_lighting_nodes)
+				ContentLightingFlags f0 = m_nodedef->getLightingFlags(n0);
+				n0.setLight(LIGHTBANK_DAY, 0, f0);
+				n0.setLight(LIGHTBANK_NIGHT, 0, f0);
+
+				// Find out whether there is a suspect for this action
+				std::string suspect;
+				if (m_gamedef->rollback())
+					suspect = m_gamedef->rollback()->getSuspect(p0, 83, 1);
+
+				if (m_gamedef->rollback() && !suspect.empty()) {
+					// Blame suspect
+					RollbackScopeActor rollback_scope(m_gamedef->rollback(), suspect, true);
+					// Get old node for rollback
+					RollbackNode rollback_oldnode(this, p0, m_gamedef);
+					// Set node
+					setNode(p0, n0);
+					// Report
+					RollbackNode rollback_newnode(this, p0, m_gamedef);
+					RollbackAction action;
+					action.setSetNode(p0, rollback_oldnode, rollback_newnode);
+					m_gamedef->rollback()->reportAction(action);
+				} else {
+					// Set node
+					setNode(p0, n0);
+				}
 
-		v3s16 blockpos = getNodeBlockPos(p0);
-		MapBlock *block = getBlockNoCreateNoEx(blockpos);
-		if (block != NULL) {
-			modified_blocks[blockpos] =  block;
-			changed_nodes.emplace_back(p0, n00);
-		}
+				modified_blocks[region->getBlockPos()] = region->getBlock();
+				changed_nodes.emplace_back(p0, n00);
 
-		/*
-			enqueue neighbors for update if necessary
-		 */
-		switch (m_nodedef->get(n0.getContent()).liquid_type) {
-			case LIQUID_SOURCE:
-			case LIQUID_FLOWING:
-				// make sure source flows into all neighboring nodes
-				for (u16 i = 0; i < num_flows; i++)
-					if (flows[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(flows[i].p);
-				for (u16 i = 0; i < num_airs; i++)
-					if (airs[i].t != NEIGHBOR_UPPER)
-						m_transforming_liquid.push_back(airs[i].p);
-				break;
-			case LIQUID_NONE:
-				// this flow has turned to air; neighboring flows might need to do the same
-				for (u16 i = 0; i < num_flows; i++)
-					m_transforming_liquid.push_back(flows[i].p);
-				break;
+				for (u8 i = 0; i < change.next_count; i++)
+					m_transforming_liquid.push_back(change.next[i]);
+			}
 		}
 	}
 	//infostream<<"Map::transformLiquids(): loopcount="<<loopcount<<std::endl;
@@ -847,6 +643,23 @@ void ServerMap::transformLiquids(std::map<v3s16, MapBlock*> &modified_blocks,
 
 	env->getScriptIface()->on_liquid_transformed(changed_nodes);
 
+	/* ----------------------------------------------------------------------
+	 * Fit the number of nodes of the next step into the time budget
+	 */
+	u64 step_time = porting::getTimeUs() - start_time;
+	m_liquid_time_counter->increment(step_time);
+	m_liquid_step_gauge->set(loopcount);
+	m_liquid_queue_gauge->set(m_transforming_liquid.size());
+
+	if (time_budget > 0 && loopcount > 0 &&
+			(loopcount == loop_max || step_time > time_budget)) {
+		// Nodes this step would have processed in the budget
+		u64 fitting = (u64)loopcount * time_budget / MYMAX(step_time, 1);
+		// Go halfway there, single slow steps should not stall the liquids
+		u64 budget = ((u64)m_liquid_budget + fitting) / 2;
+		m_liquid_budget = MYMIN(MYMAX(budget, LIQUID_BUDGET_MIN), liquid_loop_max);
+	}
+
 	/* ----------------------------------------------------------------------
 	 * Manage the queue so that it does not grow indefinitely
 	 */
@@ -1044,7 +857,7 @@ void Map::removeNodeTimer(v3s16 p)
 }
 
 bool Map::determineAdditionalOcclusionCheck(const v3s16 &pos_camera,
-	const core::aabbox3d<s16> &block_bounds, v3s16 &check)
+	const core::aabbox3d<s16> &block_bounds, v3s16 &check) const
 {
 	/*
 		This functions determines the node inside the target block that is
@@ -1107,8 +920,9 @@ bool Map::determineAdditionalOcclusionCheck(const v3s16 &pos_camera,
 	return false;
 }
 
-bool Map::isOccluded(const v3s16 &pos_camera, const v3s16 &pos_target,
-	float step, float stepfac, float offset, float end_offset, u32 needed_count)
+bool Map::isOccluded(MapReadView &view, const v3s16 &pos_camera,
+	const v3s16 &pos_target, float step, float stepfac, float offset,
+	float end_offset, u32 needed_count) const
 {
 	v3f direction = intToFloat(pos_target - pos_camera, BS);
 	float distance = direction.getLength();
@@ -1125,7 +939,7 @@ bool Map::isOccluded(const v3s16 &pos_camera, const v3s16 &pos_target,
 		v3f pos_node_f = pos_origin_f + direction * offset;
 		v3s16 pos_node = floatToInt(pos_node_f, BS);
 
-		MapNode node = getNode(pos_node, &is_valid_position);
+		MapNode node = view.getNode(pos_node, &is_valid_position);
 
 		if (is_valid_position &&
 				!m_nodedef->getLightingFlags(node).light_propagates) {
@@ -1139,7 +953,7 @@ bool Map::isOccluded(const v3s16 &pos_camera, const v3s16 &pos_target,
 	return false;
 }
 
-bool Map::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
+bool Map::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes) const
 {
 	// Check occlusion for center and all 8 corners of the mapblock
 	// Overshoot a little for less flickering
@@ -1177,23 +991,53 @@ bool Map::isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes)
 	// this is a HACK, we should think of a more precise algorithm
 	u32 needed_count = 2;
 
+	MapReadView view(this);
+
 	// Additional occlusion check, see comments in that function
 	v3s16 check;
 	if (determineAdditionalOcclusionCheck(cam_pos_nodes, block->getBox(), check)) {
 		// node is always on a side facing the camera, end_offset can be lower
-		if (!isOccluded(cam_pos_nodes, check, step, stepfac, start_offset,
+		if (!isOccluded(view, cam_pos_nodes, check, step, stepfac, start_offset,
 				-1.0f, needed_count))
 			return false;
 	}
 
 	for (const v3s16 &dir : dir9) {
-		if (!isOccluded(cam_pos_nodes, pos_blockcenter + dir, step, stepfac,
+		if (!isOccluded(view, cam_pos_nodes, pos_blockcenter + dir, step, stepfac,
 				start_offset, end_offset, needed_count))
 			return false;
 	}
 	return true;
 }
 
+/*
+	MapReadView
+*/
+
+MapBlock *MapReadView::getBlock(v3s16 p)
+{
+	v2s16 p2d(p.X, p.Z);
+	if (!m_sector || m_sector_p != p2d) {
+		MapSector *sector = m_map->findSector(p2d);
+		if (!sector)
+			return nullptr;
+		m_sector = sector;
+		m_sector_p = p2d;
+	}
+	return m_sector->findBlock(p.Y);
+}
+
+MapNode MapReadView::getNode(v3s16 p, bool *is_valid_position)
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	MapBlock *block = getBlock(blockpos);
+	if (is_valid_position)
+		*is_valid_position = block != nullptr;
+	if (!block)
+		return {CONTENT_IGNORE};
+	return block->getNodeNoCheck(p - blockpos * MAP_BLOCKSIZE);
+}
+
 /*
 	ServerMap
 */
@@ -1238,8 +1082,23 @@ ServerMap::ServerMap(const std::string &savedir, IGameDef *gamedef,
 		"minetest_map_saved_blocks", "Number of blocks saved");
 	m_loaded_blocks_gauge = mb->addGauge(
 		"minetest_map_loaded_blocks", "Number of loaded blocks");
+	m_liquid_queue_gauge = mb->addGauge(
+		"minetest_map_liquid_queue_length", "Number of liquid nodes waiting for an update");
+	m_liquid_step_gauge = mb->addGauge(
+		"minetest_map_liquid_step_nodes", "Number of liquid nodes updated in the last liquid step");
+	m_liquid_time_counter = mb->addCounter(
+		"minetest_map_liquid_time", "Time spent updating liquids (in microseconds)");
 
 	m_map_compression_level = rangelim(g_settings->getS16("map_compression_level_disk"), -1, 9);
+	m_compact_blocks = g_settings->getBool("compact_mapblocks");
+
+	m_saver.reset(new MapSaver(dbase, m_map_compression_level, mb));
+	m_saver->start(g_settings->getU32("map_save_queue_size"));
+
+	m_lighting_thread_pool.reset(new ThreadPool("Lighting",
+		g_settings->getU16("num_lighting_threads")));
+	m_liquid_thread_pool.reset(new ThreadPool("Liquid",
+		g_settings->getU16("num_liquid_threads")));
 
 	try {
 		// If directory exists, check contents and load if possible
@@ -1301,6 +1160,9 @@ ServerMap::~ServerMap()
 				<<", exception: "<<e.what()<<std::endl;
 	}
 
+	// Write the queued blocks
+	m_saver.reset();
+
 	/*
 		Close database if it was opened
 	*/
@@ -1334,17 +1196,21 @@ bool ServerMap::blockpos_over_mapgen_limit(v3s16 p)
 }
 
 bool ServerMap::initBlockMake(v3s16 blockpos, BlockMakeData *data)
+{
+	if (!reserveBlockMake(blockpos, data))
+		return false;
+
+	// Loads the missing blocks itself
+	prepareBlockMake(data);
+	return true;
+}
+
+bool ServerMap::reserveBlockMake(v3s16 blockpos, BlockMakeData *data)
 {
 	s16 csize = getMapgenParams()->chunksize;
 	v3s16 bpmin = EmergeManager::getContainingChunk(blockpos, csize);
 	v3s16 bpmax = bpmin + v3s16(1, 1, 1) * (csize - 1);
 
-	if (!m_chunks_in_progress.insert(bpmin).second)
-		return false;
-
-	bool enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
-	EMERGE_DBG_OUT("initBlockMake(): " PP(bpmin) " - " PP(bpmax));
-
 	v3s16 extra_borders(1, 1, 1);
 	v3s16 full_bpmin = bpmin - extra_borders;
 	v3s16 full_bpmax = bpmax + extra_borders;
@@ -1354,11 +1220,59 @@ bool ServerMap::initBlockMake(v3s16 blockpos, BlockMakeData *data)
 			blockpos_over_mapgen_limit(full_bpmax))
 		return false;
 
+	if (!m_chunks_in_progress.insert(bpmin).second)
+		return false;
+
+	bool enable_mapgen_debug_info = m_emerge->enable_mapgen_debug_info;
+	EMERGE_DBG_OUT("reserveBlockMake(): " PP(bpmin) " - " PP(bpmax));
+
 	data->seed = getSeed();
 	data->blockpos_min = bpmin;
 	data->blockpos_max = bpmax;
 	data->nodedef = m_nodedef;
 
+	data->missing_blocks.clear();
+	for (s16 x = full_bpmin.X; x <= full_bpmax.X; x++)
+	for (s16 z = full_bpmin.Z; z <= full_bpmax.Z; z++)
+	for (s16 y = full_bpmin.Y; y <= full_bpmax.Y; y++) {
+		v3s16 p(x, y, z);
+		if (!getBlockNoCreateNoEx(p))
+			data->missing_blocks.push_back(p);
+	}
+	data->block_write_count = getBlockWriteCount();
+
+	return true;
+}
+
+void ServerMap::readBlockMake(BlockMakeData *data)
+{
+	std::vector<std::string> blobs;
+	readBlocks(data->missing_blocks, &blobs);
+
+	for (size_t i = 0; i < blobs.size(); i++) {
+		if (blobs[i].empty())
+			continue;
+		MapBlock *block = deSerializeBlock(data->missing_blocks[i], blobs[i]);
+		if (block)
+			data->loaded_blocks.push_back(block);
+	}
+}
+
+void ServerMap::prepareBlockMake(BlockMakeData *data)
+{
+	// Blocks saved or deleted meanwhile are loaded again below
+	for (MapBlock *block : data->loaded_blocks) {
+		if (blockWrittenSince(block->getPos(), data->block_write_count))
+			delete block;
+		else
+			insertLoadedBlock(block);
+	}
+	data->loaded_blocks.clear();
+
+	v3s16 extra_borders(1, 1, 1);
+	v3s16 full_bpmin = data->blockpos_min - extra_borders;
+	v3s16 full_bpmax = data->blockpos_max + extra_borders;
+
 	/*
 		Create the whole area of this and the neighboring blocks
 	*/
@@ -1393,9 +1307,6 @@ bool ServerMap::initBlockMake(v3s16 blockpos, BlockMakeData *data)
 
 	data->vmanip = new MMVManip(this);
 	data->vmanip->initialEmerge(full_bpmin, full_bpmax);
-
-	// Data is ready now.
-	return true;
 }
 
 void ServerMap::finishBlockMake(BlockMakeData *data,
@@ -1428,6 +1339,8 @@ void ServerMap::finishBlockMake(BlockMakeData *data,
 		MapBlock *block = changed_block.second;
 		if (!block)
 			continue;
+		if (m_compact_blocks)
+			block->compactNodes();
 		/*
 			Update day/night difference cache of the MapBlocks
 		*/
@@ -1665,6 +1578,10 @@ void ServerMap::save(ModifiedState save_level)
 
 				saveBlock(block);
 				block_count++;
+
+				// Modified blocks may have grown to the full node array
+				if (m_compact_blocks)
+					block->compactNodes();
 			}
 		}
 	}
@@ -1692,7 +1609,7 @@ void ServerMap::save(ModifiedState save_level)
 
 void ServerMap::listAllLoadableBlocks(std::vector<v3s16> &dst)
 {
-	dbase->listAllLoadableBlocks(dst);
+	m_saver->listAllLoadableBlocks(dst);
 	if (dbase_ro)
 		dbase_ro->listAllLoadableBlocks(dst);
 }
@@ -1721,6 +1638,8 @@ MapDatabase *ServerMap::createDatabase(
 		return new MapDatabaseSQLite3(savedir);
 	if (name == "dummy")
 		return new Database_Dummy();
+	if (name == "mmap")
+		return new Database_MMap(savedir);
 	#if USE_LEVELDB
 	if (name == "leveldb")
 		return new Database_LevelDB(savedir);
@@ -1742,35 +1661,23 @@ MapDatabase *ServerMap::createDatabase(
 
 void ServerMap::beginSave()
 {
-	dbase->beginSave();
+	m_saver->beginSave();
 }
 
 void ServerMap::endSave()
 {
-	dbase->endSave();
+	m_saver->endSave();
 }
 
 bool ServerMap::saveBlock(MapBlock *block)
 {
-	return saveBlock(block, dbase, m_map_compression_level);
+	return m_saver->saveBlock(block);
 }
 
 bool ServerMap::saveBlock(MapBlock *block, MapDatabase *db, int compression_level)
 {
-	v3s16 p3d = block->getPos();
-
-	// Format used for writing
-	u8 version = SER_FMT_VER_HIGHEST_WRITE;
-
-	/*
-		[0] u8 serialization version
-		[1] data
-	*/
-	std::ostringstream o(std::ios_base::binary);
-	o.write((char*) &version, 1);
-	block->serialize(o, version, true, compression_level);
-
-	bool ret = db->saveBlock(p3d, o.str());
+	bool ret = db->saveBlock(block->getPos(),
+		MapSaver::serialize(block, compression_level));
 	if (ret) {
 		// We just wrote it to the disk so clear modified flag
 		block->resetModified();
@@ -1801,6 +1708,8 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 
 		// Read basic data
 		block->deSerialize(is, version, true);
+		if (m_compact_blocks)
+			block->compactNodes();
 
 		// If it's a new block, insert it to the map
 		if (created_new) {
@@ -1839,44 +1748,144 @@ void ServerMap::loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool
 	}
 }
 
-MapBlock* ServerMap::loadBlock(v3s16 blockpos)
+void ServerMap::readBlocks(const std::vector<v3s16> &positions,
+	std::vector<std::string> *blobs)
 {
-	bool created_new = (getBlockNoCreateNoEx(blockpos) == NULL);
+	m_saver->loadBlocks(positions, blobs);
+	if (!dbase_ro)
+		return;
+
+	std::vector<v3s16> missing;
+	std::vector<size_t> indices;
+	for (size_t i = 0; i < positions.size(); i++) {
+		if ((*blobs)[i].empty()) {
+			missing.push_back(positions[i]);
+			indices.push_back(i);
+		}
+	}
+	if (missing.empty())
+		return;
 
-	v2s16 p2d(blockpos.X, blockpos.Z);
+	std::vector<std::string> readonly_blobs;
+	{
+		MutexAutoLock lock(m_dbase_ro_mutex);
+		dbase_ro->loadBlocks(missing, &readonly_blobs);
+	}
+	for (size_t i = 0; i < indices.size(); i++)
+		(*blobs)[indices[i]] = std::move(readonly_blobs[i]);
+}
 
+u64 ServerMap::getBlockWriteCount()
+{
+	return m_saver->getWriteCount();
+}
+
+bool ServerMap::blockWrittenSince(v3s16 pos, u64 write_count)
+{
+	return m_saver->wasWrittenSince(pos, write_count);
+}
+
+MapBlock* ServerMap::loadBlock(v3s16 blockpos)
+{
 	std::string ret;
-	dbase->loadBlock(blockpos, &ret);
-	if (!ret.empty()) {
-		loadBlock(&ret, blockpos, createSector(p2d), false);
-	} else if (dbase_ro) {
+	m_saver->loadBlock(blockpos, &ret);
+	if (ret.empty() && dbase_ro) {
+		MutexAutoLock lock(m_dbase_ro_mutex);
 		dbase_ro->loadBlock(blockpos, &ret);
-		if (!ret.empty()) {
-			loadBlock(&ret, blockpos, createSector(p2d), false);
-		}
-	} else {
+	}
+
+	return loadBlock(blockpos, &ret);
+}
+
+MapBlock *ServerMap::loadBlock(v3s16 blockpos, std::string *blob)
+{
+	if (blob->empty())
 		return NULL;
+
+	if (getBlockNoCreateNoEx(blockpos)) {
+		// Replace the contents of the loaded block
+		v2s16 p2d(blockpos.X, blockpos.Z);
+		loadBlock(blob, blockpos, createSector(p2d), false);
+		return getBlockNoCreateNoEx(blockpos);
 	}
 
-	MapBlock *block = getBlockNoCreateNoEx(blockpos);
-	if (created_new && (block != NULL)) {
-		std::map<v3s16, MapBlock*> modified_blocks;
-		// Fix lighting if necessary
-		voxalgo::update_block_border_lighting(this, block, modified_blocks);
-		if (!modified_blocks.empty()) {
-			//Modified lighting, send event
-			MapEditEvent event;
-			event.type = MEET_OTHER;
-			event.setModifiedBlocks(modified_blocks);
-			dispatchEvent(event);
+	MapBlock *block = deSerializeBlock(blockpos, *blob);
+	if (!block)
+		return NULL;
+	return insertLoadedBlock(block);
+}
+
+MapBlock *ServerMap::deSerializeBlock(v3s16 p3d, const std::string &blob)
+{
+	MapBlock *block = new MapBlock(this, p3d, m_gamedef);
+	try {
+		std::istringstream is(blob, std::ios_base::binary);
+
+		u8 version = SER_FMT_VER_INVALID;
+		is.read((char*)&version, 1);
+
+		if(is.fail())
+			throw SerializationError("ServerMap::deSerializeBlock(): Failed"
+					" to read MapBlock version");
+
+		block->deSerialize(is, version, true);
+		if (m_compact_blocks)
+			block->compactNodes();
+
+		// We just loaded it from, so it's up-to-date.
+		block->resetModified();
+	} catch (SerializationError &e) {
+		delete block;
+		errorstream << "Invalid block data in database"
+				<< " (" << p3d.X << "," << p3d.Y << "," << p3d.Z << ")"
+				<< " (SerializationError): " << e.what() << std::endl;
+
+		if (g_settings->getBool("ignore_world_load_errors")) {
+			errorstream << "Ignoring block load error. Duck and cover! "
+					<< "(ignore_world_load_errors)" << std::endl;
+			return NULL;
 		}
+		throw SerializationError("Invalid block data in database");
+	}
+	return block;
+}
+
+MapBlock *ServerMap::insertLoadedBlock(MapBlock *block)
+{
+	v3s16 blockpos = block->getPos();
+	if (getBlockNoCreateNoEx(blockpos)) {
+		delete block;
+		return getBlockNoCreateNoEx(blockpos);
+	}
+
+	MapSector *sector;
+	try {
+		sector = createSector(v2s16(blockpos.X, blockpos.Z));
+	} catch (InvalidPositionException &e) {
+		delete block;
+		throw;
+	}
+	sector->insertBlock(block);
+
+	ReflowScan scanner(this, m_emerge->ndef);
+	scanner.scan(block, &m_transforming_liquid);
+
+	std::map<v3s16, MapBlock*> modified_blocks;
+	// Fix lighting if necessary
+	voxalgo::update_block_border_lighting(this, block, modified_blocks);
+	if (!modified_blocks.empty()) {
+		//Modified lighting, send event
+		MapEditEvent event;
+		event.type = MEET_OTHER;
+		event.setModifiedBlocks(modified_blocks);
+		dispatchEvent(event);
 	}
 	return block;
 }
 
 bool ServerMap::deleteBlock(v3s16 blockpos)
 {
-	if (!dbase->deleteBlock(blockpos))
+	if (!m_saver->deleteBlock(blockpos))
 		return false;
 
 	MapBlock *block = getBlockNoCreateNoEx(blockpos);
@@ -24,6 +24,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <set>
 #include <map>
 #include <list>
+#include <memory>
+#include <mutex>
 
 #include "irrlichttypes_bloated.h"
 #include "mapblock.h"
@@ -40,6 +42,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 class Settings;
 class MapDatabase;
+class MapSaver;
 class ClientMap;
 class MapSector;
 class ServerMapSector;
@@ -50,6 +53,8 @@ class IRollbackManager;
 class EmergeManager;
 class MetricsBackend;
 class ServerEnvironment;
+class ThreadPool;
+class MapReadView;
 struct BlockMakeData;
 
 /*
@@ -163,6 +168,9 @@ class Map /*: public NodeContainer*/
 	// Returns NULL if not found
 	MapBlock * getBlockNoCreateNoEx(v3s16 p);
 
+	// Same as getSectorNoGenerateNoLock(), but leaves the cache alone
+	MapSector *findSector(v2s16 p2d) const;
+
 	/* Server overrides */
 	virtual MapBlock * emergeBlock(v3s16 p, bool create_blank=true)
 	{ return getBlockNoCreateNoEx(p); }
@@ -207,6 +215,13 @@ class Map /*: public NodeContainer*/
 	*/
 	virtual bool maySaveBlocks() { return true; }
 
+	/*
+		Worker threads for the light updates of many blocks at once, or NULL
+		to do them on the calling thread. Only used by whoever may modify
+		the map, which is one thread at a time.
+	*/
+	virtual ThreadPool *getLightingThreadPool() { return nullptr; }
+
 	// Server implements these.
 	// Client leaves them as no-op.
 	virtual bool saveBlock(MapBlock *block) { return false; }
@@ -305,7 +320,8 @@ class Map /*: public NodeContainer*/
 		}
 	}
 
-	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes);
+	// Only reads the map, several threads may call this at once
+	bool isBlockOccluded(MapBlock *block, v3s16 cam_pos_nodes) const;
 protected:
 	IGameDef *m_gamedef;
 
@@ -324,10 +340,34 @@ class Map /*: public NodeContainer*/
 	virtual void reportMetrics(u64 save_time_us, u32 saved_blocks, u32 all_blocks) {}
 
 	bool determineAdditionalOcclusionCheck(const v3s16 &pos_camera,
-		const core::aabbox3d<s16> &block_bounds, v3s16 &check);
-	bool isOccluded(const v3s16 &pos_camera, const v3s16 &pos_target,
-		float step, float stepfac, float start_offset, float end_offset,
-		u32 needed_count);
+		const core::aabbox3d<s16> &block_bounds, v3s16 &check) const;
+	bool isOccluded(MapReadView &view, const v3s16 &pos_camera,
+		const v3s16 &pos_target, float step, float stepfac,
+		float start_offset, float end_offset, u32 needed_count) const;
+};
+
+/*
+	Looks up the loaded blocks of a map without touching the caches of the
+	map and its sectors. Several threads may each use their own view at
+	once, as long as nobody changes the map meanwhile.
+*/
+class MapReadView
+{
+public:
+	MapReadView(const Map *map) : m_map(map) {}
+
+	// Returns nullptr if not found
+	MapBlock *getBlock(v3s16 p);
+	MapNode getNode(v3s16 p, bool *is_valid_position = nullptr);
+
+	const Map *getMap() const { return m_map; }
+
+private:
+	const Map *m_map;
+
+	// Last used sector
+	MapSector *m_sector = nullptr;
+	v2s16 m_sector_p;
 };
 
 /*
@@ -355,9 +395,18 @@ class ServerMap : public Map
 
 	/*
 		Blocks are generated by using these and makeBlock().
+
+		initBlockMake() prepares everything with the environment locked.
+		Alternatively reserveBlockMake() (locked) claims the chunk,
+		readBlockMake() (not locked) reads the missing blocks of the
+		area from the database and prepareBlockMake() (locked) sets up
+		the voxel manipulator.
 	*/
 	bool blockpos_over_mapgen_limit(v3s16 p);
 	bool initBlockMake(v3s16 blockpos, BlockMakeData *data);
+	bool reserveBlockMake(v3s16 blockpos, BlockMakeData *data);
+	void readBlockMake(BlockMakeData *data);
+	void prepareBlockMake(BlockMakeData *data);
 	void finishBlockMake(BlockMakeData *data,
 		std::map<v3s16, MapBlock*> *changed_blocks);
 
@@ -409,8 +458,23 @@ class ServerMap : public Map
 	bool saveBlock(MapBlock *block) override;
 	static bool saveBlock(MapBlock *block, MapDatabase *db, int compression_level = -1);
 	MapBlock* loadBlock(v3s16 p);
+	// From data read by readBlocks(), returns NULL if it is empty
+	MapBlock *loadBlock(v3s16 p, std::string *blob);
 	// Database version
 	void loadBlock(std::string *blob, v3s16 p3d, MapSector *sector, bool save_after_load=false);
+	// Creates a block from database data without adding it to the map,
+	// does not need the environment lock. NULL if the data is invalid.
+	MapBlock *deSerializeBlock(v3s16 p3d, const std::string &blob);
+	// Adds a block from deSerializeBlock(), deletes it if the map has
+	// one at its position already.
+	MapBlock *insertLoadedBlock(MapBlock *block);
+
+	// Reads blocks from the databases, does not need the environment lock.
+	// Data read after getBlockWriteCount() returned write_count is outdated
+	// if blockWrittenSince(pos, write_count).
+	void readBlocks(const std::vector<v3s16> &positions, std::vector<std::string> *blobs);
+	u64 getBlockWriteCount();
+	bool blockWrittenSince(v3s16 pos, u64 write_count);
 
 	bool deleteBlock(v3s16 blockpos) override;
 
@@ -444,6 +508,11 @@ class ServerMap : public Map
 
 	void reportMetrics(u64 save_time_us, u32 saved_blocks, u32 all_blocks) override;
 
+	ThreadPool *getLightingThreadPool() override
+	{
+		return m_lighting_thread_pool.get();
+	}
+
 private:
 	friend class LuaVoxelManip;
 
@@ -454,6 +523,8 @@ class ServerMap : public Map
 	bool m_map_saving_enabled;
 
 	int m_map_compression_level;
+	// Keep blocks in compact node storage, see NodeStorage
+	bool m_compact_blocks;
 
 	std::set<v3s16> m_chunks_in_progress;
 
@@ -463,6 +534,9 @@ class ServerMap : public Map
 	u32 m_unprocessed_count = 0;
 	u64 m_inc_trending_up_start_time = 0; // milliseconds
 	bool m_queue_size_timer_started = false;
+	// Nodes per step that fit into liquid_time_budget, adapted every step
+	u32 m_liquid_budget = 1000;
+	std::unique_ptr<ThreadPool> m_liquid_thread_pool;
 
 	/*
 		Metadata is re-written on disk only if this is true.
@@ -471,9 +545,17 @@ class ServerMap : public Map
 	bool m_map_metadata_changed = true;
 	MapDatabase *dbase = nullptr;
 	MapDatabase *dbase_ro = nullptr;
+	// All access to dbase goes through here
+	std::unique_ptr<MapSaver> m_saver;
+	std::mutex m_dbase_ro_mutex;
+
+	std::unique_ptr<ThreadPool> m_lighting_thread_pool;
 
 	// Map metrics
 	MetricGaugePtr m_loaded_blocks_gauge;
+	MetricGaugePtr m_liquid_queue_gauge;
+	MetricGaugePtr m_liquid_step_gauge;
+	MetricCounterPtr m_liquid_time_counter;
 	MetricCounterPtr m_save_time_counter;
 	MetricCounterPtr m_save_count_counter;
 };
@@ -19,6 +19,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "mapblock.h"
 
+#include <algorithm>
 #include <sstream>
 #include "map.h"
 #include "light.h"
@@ -65,6 +66,8 @@ static const char *modified_reason_strings[] = {
 	MapBlock
 */
 
+std::atomic<u64> MapBlock::s_modification_counter(0);
+
 MapBlock::MapBlock(Map *parent, v3s16 pos, IGameDef *gamedef):
 		m_parent(parent),
 		m_pos(pos),
@@ -157,7 +160,7 @@ MapNode MapBlock::getNodeParent(v3s16 p, bool *is_valid_position)
 
 	if (is_valid_position)
 		*is_valid_position = true;
-	return data[p.Z * zstride + p.Y * ystride + p.X];
+	return m_nodes.get(p.Z * zstride + p.Y * ystride + p.X);
 }
 
 std::string MapBlock::getModifiedReasonString()
@@ -188,8 +191,15 @@ void MapBlock::copyTo(VoxelManipulator &dst)
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
 	// Copy from data to VoxelManipulator
-	dst.copyFrom(data, data_area, v3s16(0,0,0),
-			getPosRelative(), data_size);
+	if (m_nodes.isCompact()) {
+		MapNode data[nodecount];
+		m_nodes.copyTo(data);
+		dst.copyFrom(data, data_area, v3s16(0,0,0),
+				getPosRelative(), data_size);
+	} else {
+		dst.copyFrom(m_nodes.getFull(), data_area, v3s16(0,0,0),
+				getPosRelative(), data_size);
+	}
 }
 
 void MapBlock::copyFrom(VoxelManipulator &dst)
@@ -198,16 +208,106 @@ void MapBlock::copyFrom(VoxelManipulator &dst)
 	VoxelArea data_area(v3s16(0,0,0), data_size - v3s16(1,1,1));
 
 	// Copy from VoxelManipulator to data
-	dst.copyTo(data, data_area, v3s16(0,0,0),
+	dst.copyTo(m_nodes.getFull(), data_area, v3s16(0,0,0),
 			getPosRelative(), data_size);
+	invalidateContentIndex();
 }
 
-void MapBlock::actuallyUpdateDayNightDiff()
+MapBlock *MapBlock::createSnapshot(bool disk)
 {
-	const NodeDefManager *nodemgr = m_gamedef->ndef();
+	MapBlock *block = new MapBlock(nullptr, m_pos, m_gamedef);
+	block->m_nodes = m_nodes;
+
+	block->is_underground = is_underground;
+	block->m_lighting_complete = m_lighting_complete;
+	block->m_day_night_differs = m_day_night_differs;
+	block->m_day_night_differs_expired = m_day_night_differs_expired;
+	block->m_generated = m_generated;
+
+	for (const auto &it : m_node_metadata)
+		block->m_node_metadata.set(it.first, new NodeMetadata(*it.second));
+
+	if (disk) {
+		block->m_static_objects = m_static_objects;
+		block->m_node_timers = m_node_timers;
+		block->m_timestamp = m_timestamp;
+		block->m_disk_timestamp = m_disk_timestamp;
+	}
+
+	// Serializes to the same data as this block
+	block->m_modification_counter = m_modification_counter;
+	return block;
+}
+
+const MapBlock::ContentIndex &MapBlock::getContentIndex(
+	const ContentFilter &filter, bool *cached)
+{
+	bool reuse = m_content_index_valid && m_content_filter == filter;
+	if (cached)
+		*cached = reuse;
+	if (reuse)
+		return m_content_index;
+
+	m_content_filter = filter;
+	m_content_index.clear();
+
+	const std::vector<bool> &f = *filter;
+	// Most compact blocks have none of the filtered contents
+	if (const std::vector<MapNode> *palette = m_nodes.getPalette()) {
+		bool any = false;
+		for (MapNode n : *palette) {
+			content_t c = n.getContent();
+			any |= c < f.size() && f[c];
+		}
+		if (!any) {
+			m_content_index_valid = true;
+			return m_content_index;
+		}
+	}
+	for (u32 i = 0; i < nodecount; i++) {
+		content_t c = m_nodes.get(i).getContent();
+		if (c < f.size() && f[c])
+			m_content_index[c].push_back(i);
+	}
+	m_content_index_valid = true;
+
+	return m_content_index;
+}
 
+void MapBlock::updateContentIndex(u32 i, content_t old_c, content_t new_c)
+{
+	if (old_c == new_c)
+		return;
+
+	const std::vector<bool> &f = *m_content_filter;
+	if (old_c < f.size() && f[old_c]) {
+		auto it = m_content_index.find(old_c);
+		if (it != m_content_index.end()) {
+			std::vector<u16> &positions = it->second;
+			auto pos = std::find(positions.begin(), positions.end(), i);
+			if (pos != positions.end()) {
+				*pos = positions.back();
+				positions.pop_back();
+			}
+			if (positions.empty())
+				m_content_index.erase(it);
+		}
+	}
+
+	if (new_c < f.size() && f[new_c])
+		m_content_index[new_c].push_back(i);
+}
+
+void MapBlock::actuallyUpdateDayNightDiff()
+{
 	// Running this function un-expires m_day_night_differs
 	m_day_night_differs_expired = false;
+	m_day_night_differs = computeDayNightDiff();
+}
+
+bool MapBlock::computeDayNightDiff() const
+{
+	const NodeDefManager *nodemgr = m_gamedef->ndef();
 
 	bool differs = false;
 
@@ -215,9 +315,13 @@ void MapBlock::actuallyUpdateDayNightDiff()
 		Check if any lighting value differs
 	*/
 
+	// A compact block has each distinct node in its palette
+	const std::vector<MapNode> *palette = m_nodes.getPalette();
+	u32 count = palette ? palette->size() : nodecount;
+
 	MapNode previous_n(CONTENT_IGNORE);
-	for (u32 i = 0; i < nodecount; i++) {
-		MapNode n = data[i];
+	for (u32 i = 0; i < count; i++) {
+		MapNode n = palette ? (*palette)[i] : m_nodes.get(i);
 
 		// If node is identical to previous node, don't verify if it differs
 		if (n == previous_n)
@@ -235,8 +339,8 @@ void MapBlock::actuallyUpdateDayNightDiff()
 	*/
 	if (differs) {
 		bool only_air = true;
-		for (u32 i = 0; i < nodecount; i++) {
-			MapNode &n = data[i];
+		for (u32 i = 0; i < count; i++) {
+			MapNode n = palette ? (*palette)[i] : m_nodes.get(i);
 			if (n.getContent() != CONTENT_AIR) {
 				only_air = false;
 				break;
@@ -246,8 +350,7 @@ void MapBlock::actuallyUpdateDayNightDiff()
 			differs = false;
 	}
 
-	// Set member variable
-	m_day_night_differs = differs;
+	return differs;
 }
 
 void MapBlock::expireDayNightDiff()
@@ -404,7 +507,7 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
  	if(disk)
 	{
 		MapNode *tmp_nodes = new MapNode[nodecount];
-		memcpy(tmp_nodes, data, nodecount * sizeof(MapNode));
+		m_nodes.copyTo(tmp_nodes);
 		getBlockNodeIdMapping(&nimap, tmp_nodes, m_gamedef->ndef());
 
 		buf = MapNode::serializeBulk(version, tmp_nodes, nodecount,
@@ -418,9 +521,17 @@ void MapBlock::serialize(std::ostream &os_compressed, u8 version, bool disk, int
 			nimap.serialize(os);
 		}
 	}
+	else if (m_nodes.isCompact())
+	{
+		MapNode *tmp_nodes = new MapNode[nodecount];
+		m_nodes.copyTo(tmp_nodes);
+		buf = MapNode::serializeBulk(version, tmp_nodes, nodecount,
+				content_width, params_width);
+		delete[] tmp_nodes;
+	}
 	else
 	{
-		buf = MapNode::serializeBulk(version, data, nodecount,
+		buf = MapNode::serializeBulk(version, m_nodes.getFull(), nodecount,
 				content_width, params_width);
 	}
 
@@ -490,6 +601,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	TRACESTREAM(<<"MapBlock::deSerialize "<<PP(getPos())<<std::endl);
 
 	m_day_night_differs_expired = false;
+	invalidateContentIndex();
 
 	if(version <= 21)
 	{
@@ -538,6 +650,7 @@ void MapBlock::deSerialize(std::istream &in_compressed, u8 version, bool disk)
 	/*
 		Bulk node data
 	*/
+	MapNode *data = m_nodes.getFull();
 	if (version >= 29) {
 		MapNode::deSerializeBulk(is, version, data, nodecount,
 			content_width, params_width);
@@ -661,6 +774,8 @@ u32 MapBlock::clearObjects()
 
 void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 {
+	invalidateContentIndex();
+
 	// Initialize default flags
 	is_underground = false;
 	m_day_night_differs = false;
@@ -777,6 +892,7 @@ void MapBlock::deSerialize_pre22(std::istream &is, u8 version, bool disk)
 	}
 
 	// Deserialize node data
+	MapNode *data = m_nodes.getFull();
 	for (u32 i = 0; i < nodecount; i++) {
 		data[i].deSerialize(&databuf_nodelist[i * ser_length], version);
 	}
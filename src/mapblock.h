@@ -19,13 +19,17 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #pragma once
 
+#include <atomic>
+#include <memory>
 #include <set>
+#include <unordered_map>
 #include "irr_v3d.h"
 #include "mapnode.h"
 #include "exceptions.h"
 #include "constants.h"
 #include "staticobject.h"
 #include "nodemetadata.h"
+#include "nodestorage.h"
 #include "nodetimer.h"
 #include "modifiedstate.h"
 #include "util/numeric.h" // getContainerPos
@@ -66,6 +70,14 @@ class VoxelManipulator;
 #define MOD_REASON_VMANIP                    (1 << 19)
 #define MOD_REASON_UNKNOWN                   (1 << 20)
 
+// Reasons which only concern data that is not sent to clients
+#define MOD_REASON_DISK_ONLY (MOD_REASON_SET_TIMESTAMP | \
+	MOD_REASON_CLEAR_ALL_OBJECTS | MOD_REASON_BLOCK_EXPIRED | \
+	MOD_REASON_ADD_ACTIVE_OBJECT_RAW | MOD_REASON_REMOVE_OBJECTS_REMOVE | \
+	MOD_REASON_REMOVE_OBJECTS_DEACTIVATE | MOD_REASON_TOO_MANY_OBJECTS | \
+	MOD_REASON_STATIC_DATA_ADDED | MOD_REASON_STATIC_DATA_REMOVED | \
+	MOD_REASON_STATIC_DATA_CHANGED)
+
 ////
 //// MapBlock itself
 ////
@@ -88,14 +100,35 @@ class MapBlock
 
 	void reallocate()
 	{
-		for (u32 i = 0; i < nodecount; i++)
-			data[i] = MapNode(CONTENT_IGNORE);
+		m_nodes.fill(MapNode(CONTENT_IGNORE));
+		invalidateContentIndex();
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_REALLOCATE);
 	}
 
+	// Callers may write to the data, which drops the content index.
+	// Makes the node storage the full array.
 	MapNode* getData()
 	{
-		return data;
+		invalidateContentIndex();
+		return m_nodes.getFull();
+	}
+
+	// Makes the node storage compact if that is smaller, see NodeStorage
+	void compactNodes()
+	{
+		m_nodes.compact();
+	}
+
+	const NodeStorage &getNodeStorage() const
+	{
+		return m_nodes;
+	}
+
+	// Copies the nodes of another block, keeping their storage
+	void copyNodesFrom(const MapBlock &other)
+	{
+		m_nodes = other.m_nodes;
+		invalidateContentIndex();
 	}
 
 	////
@@ -103,6 +136,8 @@ class MapBlock
 	////
 	void raiseModified(u32 mod, u32 reason=MOD_REASON_UNKNOWN)
 	{
+		if (reason & ~MOD_REASON_DISK_ONLY)
+			m_modification_counter = ++s_modification_counter;
 		if (mod > m_modified) {
 			m_modified = mod;
 			m_modified_reason = reason;
@@ -111,8 +146,6 @@ class MapBlock
 		} else if (mod == m_modified) {
 			m_modified_reason |= reason;
 		}
-		if (mod == MOD_STATE_WRITE_NEEDED)
-			contents_cached = false;
 	}
 
 	inline u32 getModified()
@@ -127,6 +160,13 @@ class MapBlock
 
 	std::string getModifiedReasonString();
 
+	// Changes whenever the data sent to clients may have changed.
+	// Unique across all blocks and never reused.
+	inline u64 getModificationCounter() const
+	{
+		return m_modification_counter;
+	}
+
 	inline void resetModified()
 	{
 		m_modified = MOD_STATE_CLEAN;
@@ -204,12 +244,12 @@ class MapBlock
 	//// Position stuff
 	////
 
-	inline v3s16 getPos()
+	inline v3s16 getPos() const
 	{
 		return m_pos;
 	}
 
-	inline v3s16 getPosRelative()
+	inline v3s16 getPosRelative() const
 	{
 		return m_pos_relative;
 	}
@@ -245,7 +285,7 @@ class MapBlock
 		if (!*valid_position)
 			return {CONTENT_IGNORE};
 
-		return data[z * zstride + y * ystride + x];
+		return m_nodes.get(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNode(v3s16 p, bool *valid_position)
@@ -264,7 +304,10 @@ class MapBlock
 		if (!isValidPosition(x, y, z))
 			throw InvalidPositionException();
 
-		data[z * zstride + y * ystride + x] = n;
+		u32 i = z * zstride + y * ystride + x;
+		if (m_content_index_valid)
+			updateContentIndex(i, m_nodes.get(i).getContent(), n.getContent());
+		m_nodes.set(i, n);
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE);
 	}
 
@@ -279,7 +322,7 @@ class MapBlock
 
 	inline MapNode getNodeNoCheck(s16 x, s16 y, s16 z)
 	{
-		return data[z * zstride + y * ystride + x];
+		return m_nodes.get(z * zstride + y * ystride + x);
 	}
 
 	inline MapNode getNodeNoCheck(v3s16 p)
@@ -289,7 +332,10 @@ class MapBlock
 
 	inline void setNodeNoCheck(s16 x, s16 y, s16 z, MapNode n)
 	{
-		data[z * zstride + y * ystride + x] = n;
+		u32 i = z * zstride + y * ystride + x;
+		if (m_content_index_valid)
+			updateContentIndex(i, m_nodes.get(i).getContent(), n.getContent());
+		m_nodes.set(i, n);
 		raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_SET_NODE_NO_CHECK);
 	}
 
@@ -298,6 +344,36 @@ class MapBlock
 		setNodeNoCheck(p.X, p.Y, p.Z, n);
 	}
 
+	////
+	//// Content index (ABM optimization)
+	////
+
+	// Positions (indices into the node data) of each content type
+	typedef std::unordered_map<content_t, std::vector<u16>> ContentIndex;
+	// filter[c] is true for the content types to put into the index
+	typedef std::shared_ptr<const std::vector<bool>> ContentFilter;
+
+	// Returns the positions of all nodes whose content passes the filter,
+	// building the index if it's missing or was built with another filter.
+	// The index is kept up to date by setNode() until the node data is
+	// replaced otherwise. If given, cached is set to whether the index
+	// could be reused.
+	const ContentIndex &getContentIndex(const ContentFilter &filter,
+		bool *cached = nullptr);
+
+	// Called whenever the node data may have been replaced as a whole
+	inline void invalidateContentIndex()
+	{
+		m_content_index_valid = false;
+		m_modification_counter = ++s_modification_counter;
+	}
+
+	static inline v3s16 getNodePosFromIndex(u16 i)
+	{
+		return v3s16(i % MAP_BLOCKSIZE, (i / ystride) % MAP_BLOCKSIZE,
+			i / zstride);
+	}
+
 	// These functions consult the parent container if the position
 	// is not valid on this MapBlock.
 	bool isValidPositionParent(v3s16 p);
@@ -309,10 +385,16 @@ class MapBlock
 	// Copies data from VoxelManipulator getPosRelative()
 	void copyFrom(VoxelManipulator &dst);
 
+	// Copies everything sent to clients into a new block which belongs to
+	// no map, so it can be serialized on another thread.
+	// disk: also copy the data which is only saved (objects, timers)
+	MapBlock *createSnapshot(bool disk = false);
+
 	// Update day-night lighting difference flag.
 	// Sets m_day_night_differs to appropriate value.
 	// These methods don't care about neighboring blocks.
 	void actuallyUpdateDayNightDiff();
+	bool computeDayNightDiff() const;
 
 	// Call this to schedule what the previous function does to be done
 	// when the value is actually needed.
@@ -325,6 +407,16 @@ class MapBlock
 		return m_day_night_differs;
 	}
 
+	// Same as getDayNightDiff(), but an expired value stays expired, so
+	// several threads may call this at once
+	inline bool getDayNightDiffNoUpdate(bool *expired) const
+	{
+		*expired = m_day_night_differs_expired;
+		if (m_day_night_differs_expired)
+			return computeDayNightDiff();
+		return m_day_night_differs;
+	}
+
 	bool onObjectsActivation();
 	bool saveStaticObject(u16 id, const StaticObject &obj, u32 reason);
 
@@ -445,6 +537,8 @@ class MapBlock
 
 	void deSerialize_pre22(std::istream &is, u8 version, bool disk);
 
+	void updateContentIndex(u32 i, content_t old_c, content_t new_c);
+
 public:
 	/*
 		Public member variables
@@ -462,13 +556,6 @@ class MapBlock
 
 	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
 
-	//// ABM optimizations ////
-	// Cache of content types
-	std::unordered_set<content_t> contents;
-	// True if content types are cached
-	bool contents_cached = false;
-	// True if we never want to cache content types for this block
-	bool do_not_cache_contents = false;
 	// marks the sides which are opaque: 00+Z-Z+Y-Y+X-X
 	u8 solid_sides {0};
 
@@ -500,6 +587,10 @@ class MapBlock
 	u32 m_modified = MOD_STATE_WRITE_NEEDED;
 	u32 m_modified_reason = MOD_REASON_INITIAL;
 
+	// See getModificationCounter()
+	u64 m_modification_counter = 0;
+	static std::atomic<u64> s_modification_counter;
+
 	/*
 		When propagating sunlight and the above block doesn't exist,
 		sunlight is assumed if this is false.
@@ -546,8 +637,12 @@ class MapBlock
 	*/
 	int m_refcount = 0;
 
-	MapNode data[nodecount];
+	NodeStorage m_nodes;
 	NodeTimerList m_node_timers;
+
+	ContentFilter m_content_filter;
+	ContentIndex m_content_index;
+	bool m_content_index_valid = false;
 };
 
 typedef std::vector<MapBlock*> MapBlockVect;
@@ -51,6 +51,8 @@ class MapSector
 	}
 
 	MapBlock * getBlockNoCreateNoEx(s16 y);
+	// Same as the above, but leaves the cache alone
+	MapBlock *findBlock(s16 y) const;
 	MapBlock * createBlankBlockNoInsert(s16 y);
 	MapBlock * createBlankBlock(s16 y);
 
@@ -23,6 +23,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "client/camera.h"
 #include "chatmessage.h"
 #include "client/clientmedia.h"
+#include "client/content_cao.h"
 #include "log.h"
 #include "map.h"
 #include "mapsector.h"
@@ -517,6 +518,59 @@ void Client::handleCommand_ActiveObjectMessages(NetworkPacket* pkt)
 	}
 }
 
+void Client::handleCommand_ActiveObjectPositions(NetworkPacket *pkt)
+{
+	u16 seqnum, baseline_seqnum;
+	f32 update_interval;
+	*pkt >> seqnum >> baseline_seqnum >> update_interval;
+
+	// Unreliable, it may be late
+	if (!objectSnapshotNewer(seqnum, m_object_snapshot_received))
+		return;
+
+	const ObjectSnapshot *baseline = m_object_snapshots.get(baseline_seqnum);
+	if (!baseline) {
+		infostream << "Client::handleCommand_ActiveObjectPositions: "
+			<< "baseline " << baseline_seqnum << " is unknown" << std::endl;
+		return;
+	}
+
+	ObjectSnapshot snapshot = *baseline;
+	std::vector<u16> changed;
+	std::string datastring(pkt->getRemainingString(), pkt->getRemainingBytes());
+	std::istringstream is(datastring, std::ios_base::binary);
+	try {
+		deSerializeObjectSnapshotDelta(is, snapshot, &changed);
+	} catch (SerializationError &e) {
+		errorstream << "Client::handleCommand_ActiveObjectPositions: "
+			<< "caught SerializationError: " << e.what() << std::endl;
+		return;
+	}
+
+	// Objects which changed since the baseline may already be up to date
+	const ObjectSnapshot *latest = m_object_snapshots.get(m_object_snapshot_received);
+	for (u16 id : changed) {
+		const QuantizedObjectPosition &pos = snapshot[id];
+		if (latest) {
+			auto it = latest->find(id);
+			if (it != latest->end() && it->second == pos)
+				continue;
+		}
+		GenericCAO *obj = m_env.getGenericCAO(id);
+		if (obj)
+			obj->updatePosition(pos.get(), update_interval);
+	}
+
+	// The server will not use anything older as baseline again
+	m_object_snapshots.forgetBefore(baseline_seqnum);
+	m_object_snapshots.add(seqnum, std::move(snapshot));
+	m_object_snapshot_received = seqnum;
+
+	NetworkPacket resp_pkt(TOSERVER_ACTIVE_OBJECT_POSITIONS_ACK, 2);
+	resp_pkt << seqnum;
+	Send(&resp_pkt);
+}
+
 void Client::handleCommand_Movement(NetworkPacket* pkt)
 {
 	LocalPlayer *player = m_env.getLocalPlayer();
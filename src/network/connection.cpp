@@ -59,39 +59,38 @@ u16 BufferedPacket::getSeqnum() const
 	return readU16(&data[BASE_HEADER_SIZE + 1]);
 }
 
-BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
+BufferedPacketPtr makePacket(Address &address, const PacketView &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 packet_size = data.getSize() + BASE_HEADER_SIZE;
-
-	auto p = std::make_shared<BufferedPacket>(packet_size);
-	p->address = address;
+	PacketView packet = data;
+	u8 *header = packet.prepend(BASE_HEADER_SIZE);
 
-	writeU32(&p->data[0], protocol_id);
-	writeU16(&p->data[4], sender_peer_id);
-	writeU8(&p->data[6], channel);
-
-	memcpy(&p->data[BASE_HEADER_SIZE], *data, data.getSize());
+	writeU32(&header[0], protocol_id);
+	writeU16(&header[4], sender_peer_id);
+	writeU8(&header[6], channel);
 
+	auto p = std::make_shared<BufferedPacket>(std::move(packet));
+	p->address = address;
 	return p;
 }
 
-SharedBuffer<u8> makeOriginalPacket(const SharedBuffer<u8> &data)
+BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel)
 {
-	u32 header_size = 1;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
+	return makePacket(address, PacketView(*data, data.getSize()),
+		protocol_id, sender_peer_id, channel);
+}
 
-	writeU8(&(b[0]), PACKET_TYPE_ORIGINAL);
-	if (data.getSize() > 0) {
-		memcpy(&(b[header_size]), *data, data.getSize());
-	}
+PacketView makeOriginalPacket(const PacketView &data)
+{
+	PacketView b = data;
+	writeU8(b.prepend(ORIGINAL_HEADER_SIZE), PACKET_TYPE_ORIGINAL);
 	return b;
 }
 
 // Split data in chunks and add TYPE_SPLIT headers to them
-void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum,
-		std::list<SharedBuffer<u8>> *chunks)
+void makeSplitPacket(const PacketView &data, u32 chunksize_max, u16 seqnum,
+		std::list<PacketView> *chunks)
 {
 	// Chunk packets, containing the TYPE_SPLIT header
 	u32 chunk_header_size = 7;
@@ -108,15 +107,16 @@ void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum
 		u32 payload_size = end - start + 1;
 		u32 packet_size = chunk_header_size + payload_size;
 
-		SharedBuffer<u8> chunk(packet_size);
+		PacketView chunk(packet_size);
+		u8 *chunkdata = chunk.getWritable();
 
-		writeU8(&chunk[0], PACKET_TYPE_SPLIT);
-		writeU16(&chunk[1], seqnum);
+		writeU8(&chunkdata[0], PACKET_TYPE_SPLIT);
+		writeU16(&chunkdata[1], seqnum);
 		// [3] u16 chunk_count is written at next stage
-		writeU16(&chunk[5], chunk_num);
-		memcpy(&chunk[chunk_header_size], &data[start], payload_size);
+		writeU16(&chunkdata[5], chunk_num);
+		memcpy(&chunkdata[chunk_header_size], &data[start], payload_size);
 
-		chunks->push_back(chunk);
+		chunks->push_back(std::move(chunk));
 		chunk_count++;
 
 		start = end + 1;
@@ -124,14 +124,14 @@ void makeSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max, u16 seqnum
 	}
 	while (end != data.getSize() - 1);
 
-	for (SharedBuffer<u8> &chunk : *chunks) {
+	for (PacketView &chunk : *chunks) {
 		// Write chunk_count
-		writeU16(&(chunk[3]), chunk_count);
+		writeU16(&chunk.getWritable()[3], chunk_count);
 	}
 }
 
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list)
+void makeAutoSplitPacket(const PacketView &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketView> *list)
 {
 	u32 original_header_size = 1;
 
@@ -144,16 +144,13 @@ void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
 	list->push_back(makeOriginalPacket(data));
 }
 
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum)
+PacketView makeReliablePacket(const PacketView &data, u16 seqnum)
 {
-	u32 header_size = 3;
-	u32 packet_size = data.getSize() + header_size;
-	SharedBuffer<u8> b(packet_size);
-
-	writeU8(&b[0], PACKET_TYPE_RELIABLE);
-	writeU16(&b[1], seqnum);
+	PacketView b = data;
+	u8 *header = b.prepend(RELIABLE_HEADER_SIZE);
 
-	memcpy(&b[header_size], *data, data.getSize());
+	writeU8(&header[0], PACKET_TYPE_RELIABLE);
+	writeU16(&header[1], seqnum);
 
 	return b;
 }
@@ -555,7 +552,7 @@ ConnectionCommandPtr ConnectionCommand::send(session_t peer_id, u8 channelnum,
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = reliable;
-	c->data = pkt->oldForgePacket();
+	c->data = pkt->getWireData();
 	return c;
 }
 
@@ -565,7 +562,7 @@ ConnectionCommandPtr ConnectionCommand::ack(session_t peer_id, u8 channelnum, co
 	c->peer_id = peer_id;
 	c->channelnum = channelnum;
 	c->reliable = false;
-	data.copyTo(c->data);
+	c->data = PacketView(*data, data.getSize());
 	return c;
 }
 
@@ -576,7 +573,7 @@ ConnectionCommandPtr ConnectionCommand::createPeer(session_t peer_id, const Buff
 	c->channelnum = 0;
 	c->reliable = true;
 	c->raw = true;
-	data.copyTo(c->data);
+	c->data = PacketView(*data, data.getSize());
 	return c;
 }
 
@@ -904,8 +901,13 @@ void Peer::RTTStatistics(float rtt, const std::string &profiler_id,
 								jitter * (1/num_samples);
 
 		if (!profiler_id.empty()) {
-			g_profiler->graphAdd(profiler_id + " RTT [ms]", rtt * 1000.f);
-			g_profiler->graphAdd(profiler_id + " jitter [ms]", jitter * 1000.f);
+			if (profiler_id != m_rtt_profiler_name) {
+				m_rtt_profiler_name = profiler_id;
+				m_rtt_profiler_id = g_profiler->getId(profiler_id + " RTT [ms]");
+				m_jitter_profiler_id = g_profiler->getId(profiler_id + " jitter [ms]");
+			}
+			g_profiler->graphAdd(m_rtt_profiler_id, rtt * 1000.f);
+			g_profiler->graphAdd(m_jitter_profiler_id, jitter * 1000.f);
 		}
 	}
 	/* save values required for next loop */
@@ -1042,7 +1044,7 @@ bool UDPPeer::processReliableSendCommand(
 
 	sanity_check(c.data.getSize() < MAX_RELIABLE_WINDOW_SIZE*512);
 
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketView> originals;
 	u16 split_sequence_number = chan.readNextSplitSeqNum();
 
 	if (c.raw) {
@@ -1057,7 +1059,7 @@ bool UDPPeer::processReliableSendCommand(
 	std::queue<BufferedPacketPtr> toadd;
 	volatile u16 initial_sequence_number = 0;
 
-	for (SharedBuffer<u8> &original : originals) {
+	for (PacketView &original : originals) {
 		u16 seqnum = chan.getOutgoingSequenceNumber(have_sequence_number);
 
 		/* oops, we don't have enough sequence numbers to send this packet */
@@ -1070,7 +1072,7 @@ bool UDPPeer::processReliableSendCommand(
 			have_initial_sequence_number = true;
 		}
 
-		SharedBuffer<u8> reliable = makeReliablePacket(original, seqnum);
+		PacketView reliable = makeReliablePacket(original, seqnum);
 
 		// Add base headers and make a packet
 		BufferedPacketPtr p = con::makePacket(address, reliable,
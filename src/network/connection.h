@@ -28,6 +28,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/thread.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
+#include "profiler.h"
 #include <iostream>
 #include <vector>
 #include <map>
@@ -181,22 +183,22 @@ static inline float CALC_DTIME(u64 lasttime, u64 curtime)
 /*
 	Struct for all kinds of packets. Includes following data:
 		BASE_HEADER
-		u8[] packet data (usually copied from SharedBuffer<u8>)
+		u8[] packet data (sharing the buffer of the NetworkPacket)
 */
 struct BufferedPacket {
-	BufferedPacket(u32 a_size)
+	BufferedPacket(PacketView view) :
+		m_view(std::move(view))
 	{
-		m_data.resize(a_size);
-		data = &m_data[0];
+		data = m_view.getData();
 	}
 
 	DISABLE_CLASS_COPY(BufferedPacket)
 
 	u16 getSeqnum() const;
 
-	inline size_t size() const { return m_data.size(); }
+	inline size_t size() const { return m_view.getSize(); }
 
-	u8 *data; // Direct memory access
+	const u8 *data; // Direct memory access
 	float time = 0.0f; // Seconds from buffering the packet or re-sending
 	float totaltime = 0.0f; // Seconds from buffering the packet
 	u64 absolute_send_time = -1;
@@ -204,23 +206,26 @@ struct BufferedPacket {
 	unsigned int resend_count = 0;
 
 private:
-	std::vector<u8> m_data; // Data of the packet, including headers
+	PacketView m_view; // Data of the packet, including headers
 };
 
 typedef std::shared_ptr<BufferedPacket> BufferedPacketPtr;
 
 
-// This adds the base headers to the data and makes a packet out of it
+// This adds the base headers to the data and makes a packet out of it.
+// The headers go into the headroom of the buffer if possible, see PacketView.
+BufferedPacketPtr makePacket(Address &address, const PacketView &data,
+		u32 protocol_id, session_t sender_peer_id, u8 channel);
 BufferedPacketPtr makePacket(Address &address, const SharedBuffer<u8> &data,
 		u32 protocol_id, session_t sender_peer_id, u8 channel);
 
 // Depending on size, make a TYPE_ORIGINAL or TYPE_SPLIT packet
 // Increments split_seqnum if a split packet is made
-void makeAutoSplitPacket(const SharedBuffer<u8> &data, u32 chunksize_max,
-		u16 &split_seqnum, std::list<SharedBuffer<u8>> *list);
+void makeAutoSplitPacket(const PacketView &data, u32 chunksize_max,
+		u16 &split_seqnum, std::list<PacketView> *list);
 
 // Add the TYPE_RELIABLE header to the data
-SharedBuffer<u8> makeReliablePacket(const SharedBuffer<u8> &data, u16 seqnum);
+PacketView makeReliablePacket(const PacketView &data, u16 seqnum);
 
 struct IncomingSplitPacket
 {
@@ -326,7 +331,7 @@ struct ConnectionCommand
 	Address address;
 	session_t peer_id = PEER_ID_INEXISTENT;
 	u8 channelnum = 0;
-	Buffer<u8> data;
+	PacketView data;
 	bool reliable = false;
 	bool raw = false;
 
@@ -590,6 +595,11 @@ class Peer {
 		rttstats m_rtt;
 		float m_last_rtt = -1.0f;
 
+		// Profiler counters of RTTStatistics(), looked up for this profiler_id
+		std::string m_rtt_profiler_name;
+		Profiler::Id m_rtt_profiler_id = 0;
+		Profiler::Id m_jitter_profiler_id = 0;
+
 		// current usage count
 		unsigned int m_usage = 0;
 
@@ -123,6 +123,8 @@ void *ConnectionSendThread::run()
 		/* send queued packets */
 		sendPackets(dtime);
 
+		flushSendBatch();
+
 		END_DEBUG_EXCEPTION_HANDLER
 	}
 
@@ -237,7 +239,7 @@ void ConnectionSendThread::runTimeouts(float dtime)
 					<< ", seqnum=" << seqnum
 					<< std::endl);
 
-				rawSend(k.get());
+				rawSend(k);
 
 				// do not handle rtt here as we can't decide if this packet was
 				// lost or really takes more time to transmit
@@ -251,7 +253,8 @@ void ConnectionSendThread::runTimeouts(float dtime)
 			LOG(dout_con << m_connection->getDesc()
 				<< "Sending ping for peer_id: " << udpPeer->id << std::endl);
 			/* this may fail if there ain't a sequence number left */
-			if (!rawSendAsPacket(udpPeer->id, 0, data, true)) {
+			if (!rawSendAsPacket(udpPeer->id, 0,
+					PacketView(*data, data.getSize()), true)) {
 				//retrigger with reduced ping interval
 				udpPeer->Ping(4.0, data);
 			}
@@ -270,18 +273,36 @@ void ConnectionSendThread::runTimeouts(float dtime)
 	}
 }
 
-void ConnectionSendThread::rawSend(const BufferedPacket *p)
+void ConnectionSendThread::rawSend(const ConstSharedPtr<BufferedPacket> &p)
 {
-	try {
-		m_connection->m_udpSocket.Send(p->address, p->data, p->size());
-		LOG(dout_con << m_connection->getDesc()
-			<< " rawSend: " << p->size()
-			<< " bytes sent" << std::endl);
-	} catch (SendFailedException &e) {
+	m_send_batch.push_back(p);
+	if (m_send_batch.size() >= (size_t)UDPSocket::BATCH_SIZE)
+		flushSendBatch();
+}
+
+void ConnectionSendThread::flushSendBatch()
+{
+	if (m_send_batch.empty())
+		return;
+
+	UDPDatagram datagrams[UDPSocket::BATCH_SIZE];
+	size_t bytes = 0;
+	for (size_t i = 0; i < m_send_batch.size(); i++) {
+		const ConstSharedPtr<BufferedPacket> &p = m_send_batch[i];
+		datagrams[i] = {p->address, const_cast<u8 *>(p->data), (int)p->size()};
+		bytes += p->size();
+	}
+
+	int failed = m_connection->m_udpSocket.SendBatch(datagrams, m_send_batch.size());
+	LOG(dout_con << m_connection->getDesc()
+		<< " rawSend: " << m_send_batch.size() << " packets, "
+		<< bytes << " bytes sent" << std::endl);
+	if (failed > 0) {
 		LOG(derr_con << m_connection->getDesc()
-			<< "Connection::rawSend(): SendFailedException: "
-			<< p->address.serializeString() << std::endl);
+			<< "Connection::rawSend(): failed to send " << failed
+			<< " of " << m_send_batch.size() << " packets" << std::endl);
 	}
+	m_send_batch.clear();
 }
 
 void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel)
@@ -300,11 +321,11 @@ void ConnectionSendThread::sendAsPacketReliable(BufferedPacketPtr &p, Channel *c
 	}
 
 	// Send the packet
-	rawSend(p.get());
+	rawSend(p);
 }
 
 bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool reliable)
+	const PacketView &data, bool reliable)
 {
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
 	if (!peer) {
@@ -322,7 +343,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 		if (!have_seqnum)
 			return false;
 
-		SharedBuffer<u8> reliable = makeReliablePacket(data, seqnum);
+		PacketView reliable = makeReliablePacket(data, seqnum);
 		Address peer_address;
 		peer->getAddress(MTP_MINETEST_RELIABLE_UDP, peer_address);
 
@@ -357,7 +378,7 @@ bool ConnectionSendThread::rawSendAsPacket(session_t peer_id, u8 channelnum,
 			channelnum);
 
 		// Send the packet
-		rawSend(p.get());
+		rawSend(p);
 		return true;
 	}
 
@@ -509,9 +530,9 @@ void ConnectionSendThread::disconnect()
 	LOG(dout_con << m_connection->getDesc() << " disconnecting" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
-	writeU8(&data[0], PACKET_TYPE_CONTROL);
-	writeU8(&data[1], CONTROLTYPE_DISCO);
+	PacketView data(2);
+	writeU8(&data.getWritable()[0], PACKET_TYPE_CONTROL);
+	writeU8(&data.getWritable()[1], CONTROLTYPE_DISCO);
 
 
 	// Send to all
@@ -527,9 +548,9 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 	LOG(dout_con << m_connection->getDesc() << " disconnecting peer" << std::endl);
 
 	// Create and send DISCO packet
-	SharedBuffer<u8> data(2);
-	writeU8(&data[0], PACKET_TYPE_CONTROL);
-	writeU8(&data[1], CONTROLTYPE_DISCO);
+	PacketView data(2);
+	writeU8(&data.getWritable()[0], PACKET_TYPE_CONTROL);
+	writeU8(&data.getWritable()[1], CONTROLTYPE_DISCO);
 	sendAsPacket(peer_id, 0, data, false);
 
 	PeerHelper peer = m_connection->getPeerNoEx(peer_id);
@@ -545,7 +566,7 @@ void ConnectionSendThread::disconnect_peer(session_t peer_id)
 }
 
 void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data)
+	const PacketView &data)
 {
 	assert(channelnum < CHANNEL_COUNT); // Pre-condition
 
@@ -565,13 +586,13 @@ void ConnectionSendThread::send(session_t peer_id, u8 channelnum,
 	u16 split_sequence_number = peer->getNextSplitSequenceNumber(channelnum);
 
 	u32 chunksize_max = m_max_packet_size - BASE_HEADER_SIZE;
-	std::list<SharedBuffer<u8>> originals;
+	std::list<PacketView> originals;
 
 	makeAutoSplitPacket(data, chunksize_max, split_sequence_number, &originals);
 
 	peer->setNextSplitSequenceNumber(channelnum, split_sequence_number);
 
-	for (const SharedBuffer<u8> &original : originals) {
+	for (const PacketView &original : originals) {
 		sendAsPacket(peer_id, channelnum, original);
 	}
 }
@@ -585,7 +606,7 @@ void ConnectionSendThread::sendReliable(ConnectionCommandPtr &c)
 	peer->PutReliableSendCommand(c, m_max_packet_size);
 }
 
-void ConnectionSendThread::sendToAll(u8 channelnum, const SharedBuffer<u8> &data)
+void ConnectionSendThread::sendToAll(u8 channelnum, const PacketView &data)
 {
 	std::vector<session_t> peerids = m_connection->getPeerIDs();
 
@@ -761,7 +782,7 @@ void ConnectionSendThread::sendPackets(float dtime)
 }
 
 void ConnectionSendThread::sendAsPacket(session_t peer_id, u8 channelnum,
-	const SharedBuffer<u8> &data, bool ack)
+	const PacketView &data, bool ack)
 {
 	OutgoingPacket packet(peer_id, channelnum, data, false, ack);
 	m_outgoing_queue.push(packet);
@@ -787,7 +808,7 @@ void *ConnectionReceiveThread::run()
 	// theoretical reliable upper boundary of a udp packet for all IPv6 enabled
 	// infrastructure
 	const unsigned int packet_maxsize = 1500;
-	SharedBuffer<u8> packetdata(packet_maxsize);
+	SharedBuffer<u8> packetdata(packet_maxsize * UDPSocket::BATCH_SIZE);
 
 	bool packet_queued = true;
 
@@ -809,7 +830,7 @@ void *ConnectionReceiveThread::run()
 #endif
 
 		/* receive packets */
-		receive(packetdata, packet_queued);
+		receive(packetdata, packet_maxsize, packet_queued);
 
 #ifdef DEBUG_CONNECTION_KBPS
 		debug_print_timer += dtime;
@@ -870,7 +891,7 @@ void *ConnectionReceiveThread::run()
 
 // Receive packets from the network and buffers and create ConnectionEvents
 void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
-		bool &packet_queued)
+		u32 packet_maxsize, bool &packet_queued)
 {
 	try {
 		// First, see if there any buffered packets we can process now
@@ -890,14 +911,28 @@ void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 			}
 			packet_queued = false;
 		}
+	}
+	catch (InvalidIncomingDataException &e) {
+		return;
+	}
 
-		// Call Receive() to wait for incoming data
-		Address sender;
-		s32 received_size = m_connection->m_udpSocket.Receive(sender,
-			*packetdata, packetdata.getSize());
-		if (received_size < 0)
-			return;
+	// Wait for incoming data, then take all that arrived
+	UDPDatagram datagrams[UDPSocket::BATCH_SIZE];
+	for (int i = 0; i < UDPSocket::BATCH_SIZE; i++)
+		datagrams[i] = {Address(), &packetdata[i * packet_maxsize], (int)packet_maxsize};
 
+	int count = m_connection->m_udpSocket.ReceiveBatch(datagrams,
+		UDPSocket::BATCH_SIZE);
+	for (int i = 0; i < count; i++) {
+		processDatagram(datagrams[i].address, (const u8 *)datagrams[i].data,
+			datagrams[i].size, packet_queued);
+	}
+}
+
+void ConnectionReceiveThread::processDatagram(Address &sender,
+		const u8 *packetdata, s32 received_size, bool &packet_queued)
+{
+	try {
 		if ((received_size < BASE_HEADER_SIZE) ||
 				(readU32(&packetdata[0]) != m_connection->GetProtocolID())) {
 			LOG(derr_con << m_connection->getDesc()
@@ -909,8 +944,8 @@ void ConnectionReceiveThread::receive(SharedBuffer<u8> &packetdata,
 			return;
 		}
 
-		session_t peer_id = readPeerId(*packetdata);
-		u8 channelnum = readChannel(*packetdata);
+		session_t peer_id = readPeerId(packetdata);
+		u8 channelnum = readChannel(packetdata);
 
 		if (channelnum > CHANNEL_COUNT - 1) {
 			LOG(derr_con << m_connection->getDesc()
@@ -33,11 +33,11 @@ struct OutgoingPacket
 {
 	session_t peer_id;
 	u8 channelnum;
-	SharedBuffer<u8> data;
+	PacketView data;
 	bool reliable;
 	bool ack;
 
-	OutgoingPacket(session_t peer_id_, u8 channelnum_, const SharedBuffer<u8> &data_,
+	OutgoingPacket(session_t peer_id_, u8 channelnum_, const PacketView &data_,
 			bool reliable_,bool ack_=false):
 		peer_id(peer_id_),
 		channelnum(channelnum_),
@@ -70,9 +70,11 @@ class ConnectionSendThread : public Thread
 
 private:
 	void runTimeouts(float dtime);
-	void rawSend(const BufferedPacket *p);
+	// Queues the packet, flushSendBatch() sends it
+	void rawSend(const ConstSharedPtr<BufferedPacket> &p);
+	void flushSendBatch();
 	bool rawSendAsPacket(session_t peer_id, u8 channelnum,
-			const SharedBuffer<u8> &data, bool reliable);
+			const PacketView &data, bool reliable);
 
 	void processReliableCommand(ConnectionCommandPtr &c);
 	void processNonReliableCommand(ConnectionCommandPtr &c);
@@ -80,14 +82,14 @@ class ConnectionSendThread : public Thread
 	void connect(Address address);
 	void disconnect();
 	void disconnect_peer(session_t peer_id);
-	void send(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data);
+	void send(session_t peer_id, u8 channelnum, const PacketView &data);
 	void sendReliable(ConnectionCommandPtr &c);
-	void sendToAll(u8 channelnum, const SharedBuffer<u8> &data);
+	void sendToAll(u8 channelnum, const PacketView &data);
 	void sendToAllReliable(ConnectionCommandPtr &c);
 
 	void sendPackets(float dtime);
 
-	void sendAsPacket(session_t peer_id, u8 channelnum, const SharedBuffer<u8> &data,
+	void sendAsPacket(session_t peer_id, u8 channelnum, const PacketView &data,
 			bool ack = false);
 
 	void sendAsPacketReliable(BufferedPacketPtr &p, Channel *channel);
@@ -98,6 +100,8 @@ class ConnectionSendThread : public Thread
 	unsigned int m_max_packet_size;
 	float m_timeout;
 	std::queue<OutgoingPacket> m_outgoing_queue;
+	// Packets of this iteration not sent to the socket yet
+	std::vector<ConstSharedPtr<BufferedPacket>> m_send_batch;
 	Semaphore m_send_sleep_semaphore;
 
 	unsigned int m_iteration_packets_avaialble;
@@ -120,7 +124,12 @@ class ConnectionReceiveThread : public Thread
 	}
 
 private:
-	void receive(SharedBuffer<u8> &packetdata, bool &packet_queued);
+	// Receives a batch of datagrams into packetdata, which has room for
+	// UDPSocket::BATCH_SIZE of packet_maxsize bytes
+	void receive(SharedBuffer<u8> &packetdata, u32 packet_maxsize,
+			bool &packet_queued);
+	void processDatagram(Address &sender, const u8 *packetdata,
+			s32 received_size, bool &packet_queued);
 
 	// Returns next data from a buffer if possible
 	// If found, returns true; if not, false.
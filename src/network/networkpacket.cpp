@@ -24,20 +24,28 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "networkprotocol.h"
 
 NetworkPacket::NetworkPacket(u16 command, u32 datasize, session_t peer_id):
-m_datasize(datasize), m_command(command), m_peer_id(peer_id)
+m_command(command), m_peer_id(peer_id)
 {
-	m_data.resize(m_datasize);
+	resizeData(datasize);
 }
 
 NetworkPacket::NetworkPacket(u16 command, u32 datasize):
-m_datasize(datasize), m_command(command)
+m_command(command)
 {
-	m_data.resize(m_datasize);
+	resizeData(datasize);
 }
 
 NetworkPacket::~NetworkPacket()
 {
-	m_data.clear();
+}
+
+void NetworkPacket::resizeData(u32 datasize)
+{
+	bool empty = m_buffer.getSize() == 0;
+	m_data = m_buffer.resize(datasize + 2) + 2;
+	m_datasize = datasize;
+	if (empty)
+		writeU16(m_data - 2, m_command);
 }
 
 void NetworkPacket::checkReadOffset(u32 from_offset, u32 field_size)
@@ -56,19 +64,19 @@ void NetworkPacket::putRawPacket(const u8 *data, u32 datasize, session_t peer_id
 	// This is not permitted
 	assert(m_command == 0);
 
-	m_datasize = datasize - 2;
 	m_peer_id = peer_id;
 
-	m_data.resize(m_datasize);
-
 	// split command and datas
 	m_command = readU16(&data[0]);
-	memcpy(m_data.data(), &data[2], m_datasize);
+	m_buffer = PacketView(data, datasize);
+	m_data = m_buffer.getWritable() + 2;
+	m_datasize = datasize - 2;
 }
 
 void NetworkPacket::clear()
 {
-	m_data.clear();
+	m_buffer = PacketView();
+	m_data = nullptr;
 	m_datasize = 0;
 	m_read_offset = 0;
 	m_command = 0;
@@ -84,10 +92,7 @@ const char* NetworkPacket::getString(u32 from_offset)
 
 void NetworkPacket::putRawString(const char* src, u32 len)
 {
-	if (m_read_offset + len > m_datasize) {
-		m_datasize = m_read_offset + len;
-		m_data.resize(m_datasize);
-	}
+	checkDataSize(len);
 
 	if (len == 0)
 		return;
@@ -553,7 +558,14 @@ Buffer<u8> NetworkPacket::oldForgePacket()
 {
 	Buffer<u8> sb(m_datasize + 2);
 	writeU16(&sb[0], m_command);
-	memcpy(&sb[2], m_data.data(), m_datasize);
+	memcpy(&sb[2], m_data, m_datasize);
 
 	return sb;
 }
+
+PacketView NetworkPacket::getWireData()
+{
+	if (m_buffer.getSize() == 0)
+		resizeData(0);
+	return m_buffer;
+}
@@ -22,7 +22,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/pointer.h"
 #include "util/numeric.h"
 #include "networkprotocol.h"
+#include "packetbuffer.h"
 #include <SColor.h>
+#include <algorithm>
 
 class NetworkPacket
 {
@@ -118,18 +120,25 @@ class NetworkPacket
 	// ^ this comment has been here for 4 years
 	Buffer<u8> oldForgePacket();
 
+	// The command and the data as sent, sharing the buffer of the packet
+	PacketView getWireData();
+
 private:
 	void checkReadOffset(u32 from_offset, u32 field_size);
 
+	// Makes room for a field at the read offset and the data writable
 	inline void checkDataSize(u32 field_size)
 	{
-		if (m_read_offset + field_size > m_datasize) {
-			m_datasize = m_read_offset + field_size;
-			m_data.resize(m_datasize);
-		}
+		resizeData(std::max(m_datasize, m_read_offset + field_size));
 	}
 
-	std::vector<u8> m_data;
+	void resizeData(u32 datasize);
+
+	// The command followed by the data. Sending shares it, so it is copied
+	// before being written to again.
+	PacketView m_buffer;
+	// The data in m_buffer
+	u8 *m_data = nullptr;
 	u32 m_datasize = 0;
 	u32 m_read_offset = 0;
 	u16 m_command = 0;
@@ -209,9 +209,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 		TOCLIENT_MEDIA_PUSH changed, TOSERVER_HAVE_MEDIA added
 		Added new particlespawner parameters
 		[scheduled bump for 5.6.0]
+	PROTOCOL VERSION 42:
+		Add TOCLIENT_ACTIVE_OBJECT_POSITIONS and
+		TOSERVER_ACTIVE_OBJECT_POSITIONS_ACK, object positions are no
+		longer sent with AO_CMD_UPDATE_POSITION
 */
 
-#define LATEST_PROTOCOL_VERSION 41
+#define LATEST_PROTOCOL_VERSION 42
 #define LATEST_PROTOCOL_VERSION_STRING TOSTRING(LATEST_PROTOCOL_VERSION)
 
 // Server's supported network protocol range
@@ -840,7 +844,23 @@ enum ToClientCommand
 			f32 center_weight_power
 	*/
 
-	TOCLIENT_NUM_MSG_TYPES = 0x64,
+	TOCLIENT_ACTIVE_OBJECT_POSITIONS = 0x64,
+	/*
+		Positions of the objects known to the client, as changes to an
+		earlier snapshot which the client acknowledged.
+
+		u16 snapshot seqnum
+		u16 baseline seqnum (0 = no baseline)
+		f32 update_interval (for interpolation)
+		u16 count
+		for each object changed since the baseline {
+			u16 id
+			u8 flags
+			changed values, see serializeObjectSnapshotDelta()
+		}
+	*/
+
+	TOCLIENT_NUM_MSG_TYPES = 0x65,
 };
 
 enum ToServerCommand
@@ -1061,7 +1081,12 @@ enum ToServerCommand
 		std::string bytes_M
 	*/
 
-	TOSERVER_NUM_MSG_TYPES = 0x53,
+	TOSERVER_ACTIVE_OBJECT_POSITIONS_ACK = 0x53,
+	/*
+		u16 snapshot seqnum of TOCLIENT_ACTIVE_OBJECT_POSITIONS
+	*/
+
+	TOSERVER_NUM_MSG_TYPES = 0x54,
 };
 
 enum AuthMechanism
@@ -0,0 +1,237 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "packetbuffer.h"
+#include "util/basic_macros.h"
+#include <cstring>
+#include <mutex>
+#include <new>
+#include <vector>
+
+// Pooled capacities are powers of two between these
+#define MIN_CLASS_BITS 8
+#define MAX_CLASS_BITS 16
+#define CLASS_COUNT (MAX_CLASS_BITS - MIN_CLASS_BITS + 1)
+#define UNPOOLED 0xFF
+// Free storage kept per size class
+#define MAX_POOLED_BYTES (1 << 20)
+#define MAX_POOLED_COUNT 256
+
+struct PacketBufferPool
+{
+	std::mutex mutex;
+	std::vector<PacketBuffer *> free[CLASS_COUNT];
+	std::atomic<u64> allocations{0};
+};
+
+static PacketBufferPool &get_pool()
+{
+	// Never destroyed, buffers may be dropped during static destruction
+	static PacketBufferPool *pool = new PacketBufferPool();
+	return *pool;
+}
+
+PacketBuffer *PacketBuffer::create(u32 size)
+{
+	PacketBufferPool &pool = get_pool();
+	u32 capacity = size + HEADROOM;
+	u8 size_class = UNPOOLED;
+	if (capacity <= (1U << MAX_CLASS_BITS)) {
+		size_class = 0;
+		while ((1U << (size_class + MIN_CLASS_BITS)) < capacity)
+			size_class++;
+		capacity = 1U << (size_class + MIN_CLASS_BITS);
+
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		std::vector<PacketBuffer *> &free = pool.free[size_class];
+		if (!free.empty()) {
+			PacketBuffer *buffer = free.back();
+			free.pop_back();
+			buffer->m_refcount.store(1, std::memory_order_relaxed);
+			buffer->m_front.store(HEADROOM, std::memory_order_relaxed);
+			return buffer;
+		}
+	}
+
+	pool.allocations.fetch_add(1, std::memory_order_relaxed);
+	void *mem = ::operator new(sizeof(PacketBuffer) + capacity);
+	return new (mem) PacketBuffer(capacity, size_class);
+}
+
+void PacketBuffer::drop()
+{
+	if (m_refcount.fetch_sub(1, std::memory_order_acq_rel) != 1)
+		return;
+
+	if (m_size_class != UNPOOLED) {
+		PacketBufferPool &pool = get_pool();
+		std::lock_guard<std::mutex> lock(pool.mutex);
+		std::vector<PacketBuffer *> &free = pool.free[m_size_class];
+		if (free.size() < MYMIN(MAX_POOLED_COUNT, MAX_POOLED_BYTES / m_capacity)) {
+			free.push_back(this);
+			return;
+		}
+	}
+
+	this->~PacketBuffer();
+	::operator delete(this);
+}
+
+bool PacketBuffer::claimFront(u32 offset, u32 size)
+{
+	if (offset < size)
+		return false;
+	if (m_front.compare_exchange_strong(offset, offset - size,
+			std::memory_order_relaxed))
+		return true;
+	// Bytes claimed by views which are gone are free again
+	if (isShared())
+		return false;
+	m_front.store(offset - size, std::memory_order_relaxed);
+	return true;
+}
+
+u64 PacketBuffer::getAllocationCount()
+{
+	return get_pool().allocations.load(std::memory_order_relaxed);
+}
+
+/*
+	PacketView
+*/
+
+PacketView::PacketView(u32 size) :
+	m_buffer(PacketBuffer::create(size)),
+	m_offset(PacketBuffer::HEADROOM),
+	m_size(size)
+{
+}
+
+PacketView::PacketView(const u8 *data, u32 size) :
+	PacketView(size)
+{
+	if (size > 0)
+		memcpy(m_buffer->getStorage() + m_offset, data, size);
+}
+
+PacketView::PacketView(const PacketView &other) :
+	m_buffer(other.m_buffer),
+	m_offset(other.m_offset),
+	m_size(other.m_size)
+{
+	if (m_buffer)
+		m_buffer->grab();
+}
+
+PacketView::PacketView(PacketView &&other) noexcept :
+	m_buffer(other.m_buffer),
+	m_offset(other.m_offset),
+	m_size(other.m_size)
+{
+	other.m_buffer = nullptr;
+	other.m_offset = 0;
+	other.m_size = 0;
+}
+
+PacketView &PacketView::operator=(const PacketView &other)
+{
+	if (other.m_buffer)
+		other.m_buffer->grab();
+	if (m_buffer)
+		m_buffer->drop();
+	m_buffer = other.m_buffer;
+	m_offset = other.m_offset;
+	m_size = other.m_size;
+	return *this;
+}
+
+PacketView &PacketView::operator=(PacketView &&other) noexcept
+{
+	if (this == &other)
+		return *this;
+	if (m_buffer)
+		m_buffer->drop();
+	m_buffer = other.m_buffer;
+	m_offset = other.m_offset;
+	m_size = other.m_size;
+	other.m_buffer = nullptr;
+	other.m_offset = 0;
+	other.m_size = 0;
+	return *this;
+}
+
+PacketView::~PacketView()
+{
+	if (m_buffer)
+		m_buffer->drop();
+}
+
+u8 *PacketView::getWritable()
+{
+	if (!m_buffer)
+		return nullptr;
+	if (m_buffer->isShared())
+		reallocate(m_size);
+	return m_buffer->getStorage() + m_offset;
+}
+
+u8 *PacketView::resize(u32 size)
+{
+	if (!m_buffer || m_buffer->isShared() ||
+			m_offset + size > m_buffer->getCapacity())
+		reallocate(MYMAX(size, m_size * 2));
+	m_size = size;
+	return m_buffer->getStorage() + m_offset;
+}
+
+u8 *PacketView::prepend(u32 size)
+{
+	if (m_buffer && m_buffer->claimFront(m_offset, size)) {
+		m_offset -= size;
+		m_size += size;
+		return m_buffer->getStorage() + m_offset;
+	}
+
+	// Copy into a new buffer, after room for the prepended bytes
+	PacketBuffer *buffer = PacketBuffer::create(size + m_size);
+	u8 *front = buffer->getStorage() + PacketBuffer::HEADROOM;
+	if (m_buffer) {
+		if (m_size > 0)
+			memcpy(front + size, m_buffer->getStorage() + m_offset, m_size);
+		m_buffer->drop();
+	}
+	m_buffer = buffer;
+	m_offset = PacketBuffer::HEADROOM;
+	m_size += size;
+	return front;
+}
+
+void PacketView::reallocate(u32 capacity)
+{
+	PacketBuffer *buffer = PacketBuffer::create(capacity);
+	if (m_buffer) {
+		u32 size = MYMIN(m_size, capacity);
+		if (size > 0)
+			memcpy(buffer->getStorage() + PacketBuffer::HEADROOM,
+				m_buffer->getStorage() + m_offset, size);
+		m_buffer->drop();
+	}
+	m_buffer = buffer;
+	m_offset = PacketBuffer::HEADROOM;
+}
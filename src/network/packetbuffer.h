@@ -0,0 +1,112 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include <atomic>
+
+/*
+	Reference counted storage of network packets, recycled through a pool
+	of a few size classes.
+
+	The storage keeps HEADROOM bytes free in front of the data it is
+	created for. Whoever holds the view starting at the front may claim
+	bytes of the headroom to write protocol headers there, even while the
+	data is shared, since nobody else sees those bytes.
+*/
+class PacketBuffer
+{
+public:
+	// Base, reliable and original headers of the connection protocol
+	static const u32 HEADROOM = 11;
+
+	// Storage for at least size bytes after the headroom, with one reference
+	static PacketBuffer *create(u32 size);
+
+	void grab() { m_refcount.fetch_add(1, std::memory_order_relaxed); }
+	// Returns the buffer to the pool with the last reference
+	void drop();
+	bool isShared() const { return m_refcount.load(std::memory_order_acquire) > 1; }
+
+	u8 *getStorage() { return reinterpret_cast<u8 *>(this + 1); }
+	u32 getCapacity() const { return m_capacity; }
+
+	// Moves the front from offset to offset - size if nobody did yet
+	bool claimFront(u32 offset, u32 size);
+
+	// Storage allocated from the heap so far, buffers taken from the pool
+	// do not count
+	static u64 getAllocationCount();
+
+private:
+	PacketBuffer(u32 capacity, u8 size_class) :
+		m_capacity(capacity), m_size_class(size_class)
+	{}
+
+	std::atomic<u32> m_refcount{1};
+	// Offset of the first byte in use
+	std::atomic<u32> m_front{HEADROOM};
+	u32 m_capacity;
+	u8 m_size_class;
+};
+
+/*
+	A range of a PacketBuffer, holding a reference to it.
+
+	Copies share the buffer. Writing to the data through getWritable() or
+	resize() copies it first if it is shared, prepend() only does if it
+	cannot claim the headroom.
+*/
+class PacketView
+{
+public:
+	PacketView() = default;
+	// Uninitialized data
+	explicit PacketView(u32 size);
+	// A copy of data
+	PacketView(const u8 *data, u32 size);
+
+	PacketView(const PacketView &other);
+	PacketView(PacketView &&other) noexcept;
+	PacketView &operator=(const PacketView &other);
+	PacketView &operator=(PacketView &&other) noexcept;
+	~PacketView();
+
+	u32 getSize() const { return m_size; }
+	const u8 *getData() const
+	{
+		return m_buffer ? m_buffer->getStorage() + m_offset : nullptr;
+	}
+	const u8 &operator[](u32 i) const { return getData()[i]; }
+
+	u8 *getWritable();
+	// Keeps the first bytes, the new ones are uninitialized
+	u8 *resize(u32 size);
+	// Adds size bytes in front of the data and returns them for writing
+	u8 *prepend(u32 size);
+
+private:
+	// Copies the data into a new buffer of at least capacity bytes
+	void reallocate(u32 capacity);
+
+	PacketBuffer *m_buffer = nullptr;
+	u32 m_offset = 0;
+	u32 m_size = 0;
+};
@@ -330,7 +330,7 @@ void Server::handleCommand_Init2(NetworkPacket* pkt)
 	{
 		PlayerSAO *sao = getPlayerSAO(peer_id);
 		if (sao)
-			SendActiveObjectRemoveAdd(client, sao);
+			SendActiveObjectRemoveAdd(client, sao, 0.0f);
 	}
 
 	// Send detached inventories
@@ -1841,3 +1841,24 @@ void Server::handleCommand_HaveMedia(NetworkPacket *pkt)
 		}
 	}
 }
+
+void Server::handleCommand_ActiveObjectPositionsAck(NetworkPacket *pkt)
+{
+	u16 seqnum;
+	*pkt >> seqnum;
+
+	ClientInterface::AutoLock lock(m_clients);
+	RemoteClient *client = m_clients.lockedGetClientNoEx(pkt->getPeerId());
+	if (!client)
+		return;
+
+	// Acknowledgements may arrive out of order, or for snapshots which
+	// are forgotten already
+	if (!objectSnapshotAckNewer(seqnum, client->m_object_snapshot_acked,
+				client->m_object_snapshot_sent) ||
+			!client->m_object_snapshots.get(seqnum))
+		return;
+
+	client->m_object_snapshot_acked = seqnum;
+	client->m_object_snapshots.forgetBefore(seqnum);
+}
@@ -26,6 +26,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <iomanip>
 #include "util/string.h"
 #include "util/numeric.h"
+#include "config.h"
 #include "constants.h"
 #include "debug.h"
 #include "log.h"
@@ -54,6 +55,40 @@ typedef int socklen_t;
 #define SOCKET_ERR_STR(e) strerror(e)
 #endif
 
+#if HAVE_SENDMMSG || HAVE_RECVMMSG
+// Fills storage with the socket address, returns its length
+static socklen_t to_sockaddr(const Address &address, struct sockaddr_storage *storage)
+{
+	memset(storage, 0, sizeof(*storage));
+	if (address.getFamily() == AF_INET6) {
+		auto *sa = reinterpret_cast<struct sockaddr_in6 *>(storage);
+		sa->sin6_family = AF_INET6;
+		sa->sin6_addr = address.getAddress6();
+		sa->sin6_port = htons(address.getPort());
+		return sizeof(struct sockaddr_in6);
+	}
+
+	auto *sa = reinterpret_cast<struct sockaddr_in *>(storage);
+	sa->sin_family = AF_INET;
+	sa->sin_addr = address.getAddress();
+	sa->sin_port = htons(address.getPort());
+	return sizeof(struct sockaddr_in);
+}
+
+static Address from_sockaddr(const struct sockaddr_storage &storage)
+{
+	if (storage.ss_family == AF_INET6) {
+		const auto *sa = reinterpret_cast<const struct sockaddr_in6 *>(&storage);
+		const auto *bytes = reinterpret_cast<const IPv6AddressBytes *>
+			(sa->sin6_addr.s6_addr);
+		return Address(bytes, ntohs(sa->sin6_port));
+	}
+
+	const auto *sa = reinterpret_cast<const struct sockaddr_in *>(&storage);
+	return Address(ntohl(sa->sin_addr.s_addr), ntohs(sa->sin_port));
+}
+#endif
+
 // Set to true to enable verbose debug output
 bool socket_enable_debug_output = false; // yuck
 
@@ -315,6 +350,116 @@ int UDPSocket::Receive(Address &sender, void *data, int size)
 	return received;
 }
 
+int UDPSocket::SendBatch(const UDPDatagram *datagrams, int count)
+{
+	int failed = 0;
+
+#if HAVE_SENDMMSG
+	// The simulator and the debug output work per datagram
+	if (!INTERNET_SIMULATOR && !socket_enable_debug_output) {
+		struct mmsghdr msgs[BATCH_SIZE];
+		struct iovec iovs[BATCH_SIZE];
+		struct sockaddr_storage addresses[BATCH_SIZE];
+
+		int i = 0;
+		while (i < count) {
+			int n = 0;
+			for (; i < count && n < BATCH_SIZE; i++) {
+				const UDPDatagram &datagram = datagrams[i];
+				if (datagram.address.getFamily() != m_addr_family) {
+					failed++;
+					continue;
+				}
+				iovs[n].iov_base = datagram.data;
+				iovs[n].iov_len = datagram.size;
+				memset(&msgs[n], 0, sizeof(msgs[n]));
+				msgs[n].msg_hdr.msg_name = &addresses[n];
+				msgs[n].msg_hdr.msg_namelen = to_sockaddr(datagram.address, &addresses[n]);
+				msgs[n].msg_hdr.msg_iov = &iovs[n];
+				msgs[n].msg_hdr.msg_iovlen = 1;
+				n++;
+			}
+
+			// sendmmsg() stops at the first datagram that fails and only
+			// reports the error when that one is first, so skip it then
+			int sent = 0;
+			while (sent < n) {
+				int result = sendmmsg(m_handle, &msgs[sent], n - sent, 0);
+				if (result < 0) {
+					if (errno != EINTR) {
+						failed++;
+						sent++;
+					}
+					continue;
+				}
+				sent += result;
+			}
+		}
+		return failed;
+	}
+#endif
+
+	for (int i = 0; i < count; i++) {
+		try {
+			Send(datagrams[i].address, datagrams[i].data, datagrams[i].size);
+		} catch (SendFailedException &e) {
+			failed++;
+		}
+	}
+	return failed;
+}
+
+int UDPSocket::ReceiveBatch(UDPDatagram *datagrams, int count)
+{
+#if HAVE_RECVMMSG
+	if (!socket_enable_debug_output) {
+		// Return on timeout
+		if (!WaitData(m_timeout_ms))
+			return 0;
+
+		struct mmsghdr msgs[BATCH_SIZE];
+		struct iovec iovs[BATCH_SIZE];
+		struct sockaddr_storage addresses[BATCH_SIZE];
+
+		count = MYMIN(count, BATCH_SIZE);
+		for (int i = 0; i < count; i++) {
+			iovs[i].iov_base = datagrams[i].data;
+			iovs[i].iov_len = datagrams[i].size;
+			memset(&msgs[i], 0, sizeof(msgs[i]));
+			msgs[i].msg_hdr.msg_name = &addresses[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(addresses[i]);
+			msgs[i].msg_hdr.msg_iov = &iovs[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+		}
+
+		// Only take what is there already
+		int received = recvmmsg(m_handle, msgs, count, MSG_DONTWAIT, nullptr);
+		if (received < 0)
+			return 0;
+
+		for (int i = 0; i < received; i++) {
+			datagrams[i].address = from_sockaddr(addresses[i]);
+			datagrams[i].size = msgs[i].msg_len;
+		}
+		return received;
+	}
+#endif
+
+	int received = 0;
+	for (; received < count; received++) {
+		// Only wait for the first datagram
+		if (received > 0 && !WaitData(0))
+			break;
+
+		UDPDatagram &datagram = datagrams[received];
+		int size = Receive(datagram.address, datagram.data, datagram.size);
+		if (size < 0)
+			break;
+		datagram.size = size;
+	}
+	return received;
+}
+
 int UDPSocket::GetHandle()
 {
 	return m_handle;
@@ -30,9 +30,21 @@ extern bool socket_enable_debug_output;
 void sockets_init();
 void sockets_cleanup();
 
+// A datagram to send, or a buffer to receive one into
+struct UDPDatagram
+{
+	Address address;
+	void *data;
+	// When receiving, the size of the buffer and then of the datagram
+	int size;
+};
+
 class UDPSocket
 {
 public:
+	// Most datagrams of a single system call in SendBatch() and ReceiveBatch()
+	static const int BATCH_SIZE = 32;
+
 	UDPSocket() = default;
 
 	UDPSocket(bool ipv6);
@@ -44,6 +56,12 @@ class UDPSocket
 	void Send(const Address &destination, const void *data, int size);
 	// Returns -1 if there is no data
 	int Receive(Address &sender, void *data, int size);
+	// Sends each datagram, with one system call per BATCH_SIZE datagrams
+	// where the platform allows. Returns the number that failed to send.
+	int SendBatch(const UDPDatagram *datagrams, int count);
+	// Waits for data like Receive(), then takes up to count datagrams
+	// which are there. Returns the number received, 0 if there is no data.
+	int ReceiveBatch(UDPDatagram *datagrams, int count);
 	int GetHandle(); // For debugging purposes only
 	void setTimeoutMs(int timeout_ms);
 	// Returns true if there is data, false if timeout occurred
@@ -0,0 +1,218 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "nodestorage.h"
+#include <algorithm>
+#include <cstring>
+
+// Most distinct nodes of a compact block
+#define MAX_PALETTE_SIZE 256
+
+static u8 bits_for_palette_size(size_t size)
+{
+	if (size <= 1)
+		return 0;
+	if (size <= 2)
+		return 1;
+	if (size <= 4)
+		return 2;
+	if (size <= 16)
+		return 4;
+	return 8;
+}
+
+NodeStorage::NodeStorage() :
+	m_full(new MapNode[nodecount])
+{
+	std::fill(m_full.get(), m_full.get() + nodecount, MapNode(CONTENT_IGNORE));
+}
+
+NodeStorage::NodeStorage(const NodeStorage &other)
+{
+	*this = other;
+}
+
+NodeStorage &NodeStorage::operator=(const NodeStorage &other)
+{
+	if (this == &other)
+		return *this;
+
+	if (other.m_full) {
+		if (!m_full)
+			m_full.reset(new MapNode[nodecount]);
+		memcpy(m_full.get(), other.m_full.get(), nodecount * sizeof(MapNode));
+		m_palette.clear();
+		m_palette.shrink_to_fit();
+		m_indices.reset();
+		m_bits = 0;
+		return *this;
+	}
+
+	m_full.reset();
+	m_palette = other.m_palette;
+	m_bits = other.m_bits;
+	if (m_bits > 0) {
+		u32 size = nodecount * m_bits / 8;
+		m_indices.reset(new u8[size]);
+		memcpy(m_indices.get(), other.m_indices.get(), size);
+	} else {
+		m_indices.reset();
+	}
+	return *this;
+}
+
+void NodeStorage::fill(MapNode n)
+{
+	if (m_full) {
+		std::fill(m_full.get(), m_full.get() + nodecount, n);
+		return;
+	}
+
+	m_palette.assign(1, n);
+	m_palette.shrink_to_fit();
+	m_indices.reset();
+	m_bits = 0;
+}
+
+MapNode *NodeStorage::getFull()
+{
+	if (m_full)
+		return m_full.get();
+
+	MapNode *full = new MapNode[nodecount];
+	copyTo(full);
+	m_full.reset(full);
+	m_palette.clear();
+	m_palette.shrink_to_fit();
+	m_indices.reset();
+	m_bits = 0;
+	return full;
+}
+
+void NodeStorage::compact()
+{
+	// Palette index + 1 of each node seen so far by its value, in an open
+	// addressing table at most half full
+	const u32 table_size = MAX_PALETTE_SIZE * 2;
+	u32 keys[table_size];
+	u16 values[table_size] = {};
+
+	std::vector<MapNode> palette;
+	u8 indices[nodecount];
+	MapNode last;
+	u8 last_index = 0;
+	for (u32 i = 0; i < nodecount; i++) {
+		MapNode n = get(i);
+		// Runs of the same node are common
+		if (i > 0 && n == last) {
+			indices[i] = last_index;
+			continue;
+		}
+
+		u32 key = (u32)n.param0 << 16 | (u32)n.param1 << 8 | n.param2;
+		u32 slot = (key * 2654435761U) >> 23;
+		while (values[slot] != 0 && keys[slot] != key)
+			slot = (slot + 1) & (table_size - 1);
+		if (values[slot] == 0) {
+			// Too diverse, the full array is smaller
+			if (palette.size() == MAX_PALETTE_SIZE)
+				return;
+			keys[slot] = key;
+			palette.push_back(n);
+			values[slot] = palette.size();
+		}
+		last = n;
+		last_index = values[slot] - 1;
+		indices[i] = last_index;
+	}
+
+	m_full.reset();
+	m_palette = std::move(palette);
+	m_palette.shrink_to_fit();
+	m_bits = bits_for_palette_size(m_palette.size());
+	if (m_bits == 0) {
+		m_indices.reset();
+		return;
+	}
+	m_indices.reset(new u8[nodecount * m_bits / 8]());
+	for (u32 i = 0; i < nodecount; i++)
+		setIndex(i, indices[i]);
+}
+
+void NodeStorage::copyTo(MapNode *dst) const
+{
+	if (m_full)
+		memcpy(dst, m_full.get(), nodecount * sizeof(MapNode));
+	else if (m_bits == 0)
+		std::fill(dst, dst + nodecount, m_palette[0]);
+	else
+		for (u32 i = 0; i < nodecount; i++)
+			dst[i] = get(i);
+}
+
+size_t NodeStorage::getMemoryUsage() const
+{
+	if (m_full)
+		return sizeof(*this) + nodecount * sizeof(MapNode);
+	return sizeof(*this) + m_palette.capacity() * sizeof(MapNode) +
+		nodecount * m_bits / 8;
+}
+
+void NodeStorage::setCompact(u32 i, MapNode n)
+{
+	for (u32 index = 0; index < m_palette.size(); index++) {
+		if (m_palette[index] == n) {
+			if (m_bits > 0)
+				setIndex(i, index);
+			return;
+		}
+	}
+
+	if (m_palette.size() == MAX_PALETTE_SIZE) {
+		getFull()[i] = n;
+		return;
+	}
+	if (m_palette.size() == (1U << m_bits))
+		widen(m_bits == 0 ? 1 : m_bits * 2);
+	m_palette.push_back(n);
+	setIndex(i, m_palette.size() - 1);
+}
+
+void NodeStorage::setIndex(u32 i, u32 index)
+{
+	u32 bit = i * m_bits;
+	u8 mask = ((1 << m_bits) - 1) << (bit & 7);
+	u8 &byte = m_indices[bit >> 3];
+	byte = (byte & ~mask) | (index << (bit & 7));
+}
+
+void NodeStorage::widen(u8 bits)
+{
+	std::unique_ptr<u8[]> old_indices(m_indices.release());
+	u8 old_bits = m_bits;
+	m_indices.reset(new u8[nodecount * bits / 8]());
+	m_bits = bits;
+	if (old_bits == 0)
+		return;
+
+	for (u32 i = 0; i < nodecount; i++) {
+		u32 bit = i * old_bits;
+		setIndex(i, (old_indices[bit >> 3] >> (bit & 7)) & ((1 << old_bits) - 1));
+	}
+}
@@ -0,0 +1,102 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "constants.h"
+#include "mapnode.h"
+#include <memory>
+#include <vector>
+
+/*
+	The nodes of a mapblock.
+
+	They are kept either as an array of full MapNodes, or compact: as a
+	palette of the distinct nodes and a bit-packed palette index per node.
+	A block of a single node needs no indices at all, blocks of up to 256
+	distinct nodes need 1, 2, 4 or 8 bits per node.
+
+	Setting a node which does not fit into the palette of a compact block
+	turns it into the full array, only compact() makes it compact again.
+	Reading never changes the storage, so it is safe from several threads.
+*/
+class NodeStorage
+{
+public:
+	static const u32 nodecount = MAP_BLOCKSIZE * MAP_BLOCKSIZE * MAP_BLOCKSIZE;
+
+	// The full array of CONTENT_IGNORE
+	NodeStorage();
+	NodeStorage(const NodeStorage &other);
+	NodeStorage &operator=(const NodeStorage &other);
+
+	inline MapNode get(u32 i) const
+	{
+		if (m_full)
+			return m_full[i];
+		if (m_bits == 0)
+			return m_palette[0];
+		u32 bit = i * m_bits;
+		return m_palette[(m_indices[bit >> 3] >> (bit & 7)) & ((1 << m_bits) - 1)];
+	}
+
+	inline void set(u32 i, MapNode n)
+	{
+		if (m_full)
+			m_full[i] = n;
+		else
+			setCompact(i, n);
+	}
+
+	// Sets all nodes, keeping the storage full or compact
+	void fill(MapNode n);
+
+	bool isCompact() const { return !m_full; }
+
+	// Makes the storage the full array
+	MapNode *getFull();
+
+	// Makes the storage compact unless the nodes are too diverse
+	void compact();
+
+	// Copies all nodes into dst
+	void copyTo(MapNode *dst) const;
+
+	// Nodes possibly in a compact block, nullptr if it is not compact
+	const std::vector<MapNode> *getPalette() const
+	{
+		return m_full ? nullptr : &m_palette;
+	}
+
+	// Bytes used, including the object itself
+	size_t getMemoryUsage() const;
+
+private:
+	void setCompact(u32 i, MapNode n);
+	void setIndex(u32 i, u32 index);
+	// Repacks the indices with more bits per node
+	void widen(u8 bits);
+
+	std::unique_ptr<MapNode[]> m_full;
+
+	std::vector<MapNode> m_palette;
+	std::unique_ptr<u8[]> m_indices;
+	// Bits per palette index, 0 with a palette of one node
+	u8 m_bits = 0;
+};
@@ -60,6 +60,26 @@ class NodeTimerList
 	NodeTimerList() = default;
 	~NodeTimerList() = default;
 
+	// m_iterators has to point into the new m_timers
+	NodeTimerList(const NodeTimerList &other) :
+		m_timers(other.m_timers),
+		m_next_trigger_time(other.m_next_trigger_time),
+		m_time(other.m_time)
+	{
+		for (auto it = m_timers.begin(); it != m_timers.end(); ++it)
+			m_iterators.emplace(it->second.position, it);
+	}
+	NodeTimerList &operator=(const NodeTimerList &other)
+	{
+		// Swapping keeps the iterators valid
+		NodeTimerList copy(other);
+		m_timers.swap(copy.m_timers);
+		m_iterators.swap(copy.m_iterators);
+		m_next_trigger_time = copy.m_next_trigger_time;
+		m_time = copy.m_time;
+		return *this;
+	}
+
 	void serialize(std::ostream &os, u8 map_format_version) const;
 	void deSerialize(std::istream &is, u8 map_format_version);
 
@@ -26,17 +26,12 @@
 #include <cmath>
 #include "noise.h"
 #include <iostream>
-#include <cstring> // memset
+#include <cstring> // memset, memcpy
 #include "debug.h"
 #include "util/numeric.h"
 #include "util/string.h"
 #include "exceptions.h"
-
-#define NOISE_MAGIC_X    1619
-#define NOISE_MAGIC_Y    31337
-#define NOISE_MAGIC_Z    52591
-// Unsigned magic seed prevents undefined behavior.
-#define NOISE_MAGIC_SEED 1013U
+#include "noise_simd.h"
 
 FlagDesc flagdesc_noiseparams[] = {
 	{"defaults",    NOISE_FLAG_DEFAULTS},
@@ -365,6 +360,9 @@ Noise::~Noise()
 	delete[] persist_buf;
 	delete[] noise_buf;
 	delete[] result;
+	delete[] xinterp_buf;
+	delete[] xindex_buf;
+	delete[] xfrac_buf;
 }
 
 
@@ -383,12 +381,16 @@ void Noise::allocBuffers()
 	delete[] gradient_buf;
 	delete[] persist_buf;
 	delete[] result;
+	delete[] xindex_buf;
+	delete[] xfrac_buf;
 
 	try {
 		size_t bufsize = sx * sy * sz;
 		this->persist_buf  = NULL;
 		this->gradient_buf = new float[bufsize];
 		this->result       = new float[bufsize];
+		this->xindex_buf   = new u32[sx];
+		this->xfrac_buf    = new float[sx];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -456,8 +458,11 @@ void Noise::resizeNoiseBuf(bool is3d)
 	size_t nlz = is3d ? (size_t)std::ceil(num_noise_points_z) + 3 : 1;
 
 	delete[] noise_buf;
+	delete[] xinterp_buf;
+	xinterp_buf = nullptr;
 	try {
 		noise_buf = new float[nlx * nly * nlz];
+		xinterp_buf = new float[sx * nly * nlz];
 	} catch (std::bad_alloc &e) {
 		throw InvalidNoiseParamsException();
 	}
@@ -474,15 +479,42 @@ void Noise::resizeNoiseBuf(bool is3d)
  * Another optimization that could save half as many noise calls is to carry over
  * values from the previous noise lattice as midpoints in the new lattice for the
  * next octave.
+ *
+ * The interpolation is split into passes over whole rows so that it can use
+ * the SIMD kernels in noise_simd.cpp: every lattice row is first interpolated
+ * along X, then each output row is interpolated from the 2 (2D) or 4 (3D)
+ * X-interpolated rows around it.  The float operations are the same as
+ * those of biLinearInterpolation() and triLinearInterpolation().
  */
+void Noise::interpolateX(float u, float step_x, bool eased, u32 nlx, u32 rows)
+{
+	u32 i, noisex = 0;
+	for (i = 0; i != sx; i++) {
+		xindex_buf[i] = noisex;
+		xfrac_buf[i]  = eased ? easeCurve(u) : u;
+
+		u += step_x;
+		if (u >= 1.0) {
+			u -= 1.0;
+			noisex++;
+		}
+	}
+
+	for (i = 0; i != rows; i++) {
+		noise_simd::lerpGather(&xinterp_buf[i * sx], &noise_buf[i * nlx],
+			xindex_buf, xfrac_buf, sx);
+	}
+}
+
+
 #define idx(x, y) ((y) * nlx + (x))
 void Noise::gradientMap2D(
 		float x, float y,
 		float step_x, float step_y,
 		s32 seed)
 {
-	float v00, v01, v10, v11, u, v, orig_u;
-	u32 index, i, j, noisex, noisey;
+	float u, v;
+	u32 index, j, noisey;
 	u32 nlx, nly;
 	s32 x0, y0;
 
@@ -491,41 +523,23 @@ void Noise::gradientMap2D(
 	y0 = std::floor(y);
 	u = x - (float)x0;
 	v = y - (float)y0;
-	orig_u = u;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
-	index = 0;
 	for (j = 0; j != nly; j++)
-		for (i = 0; i != nlx; i++)
-			noise_buf[index++] = noise2d(x0 + i, y0 + j, seed);
+		noise_simd::lattice2d(&noise_buf[idx(0, j)], x0, y0 + j, seed, nlx);
 
 	//calculate interpolations
+	interpolateX(u, step_x, eased, nlx, nly);
+
 	index  = 0;
 	noisey = 0;
 	for (j = 0; j != sy; j++) {
-		v00 = noise_buf[idx(0, noisey)];
-		v10 = noise_buf[idx(1, noisey)];
-		v01 = noise_buf[idx(0, noisey + 1)];
-		v11 = noise_buf[idx(1, noisey + 1)];
-
-		u = orig_u;
-		noisex = 0;
-		for (i = 0; i != sx; i++) {
-			gradient_buf[index++] =
-				biLinearInterpolation(v00, v10, v01, v11, u, v, eased);
-
-			u += step_x;
-			if (u >= 1.0) {
-				u -= 1.0;
-				noisex++;
-				v00 = v10;
-				v01 = v11;
-				v10 = noise_buf[idx(noisex + 1, noisey)];
-				v11 = noise_buf[idx(noisex + 1, noisey + 1)];
-			}
-		}
+		noise_simd::lerp(&gradient_buf[index],
+			&xinterp_buf[noisey * sx], &xinterp_buf[(noisey + 1) * sx],
+			eased ? easeCurve(v) : v, sx);
+		index += sx;
 
 		v += step_y;
 		if (v >= 1.0) {
@@ -543,10 +557,8 @@ void Noise::gradientMap3D(
 		float step_x, float step_y, float step_z,
 		s32 seed)
 {
-	float v000, v010, v100, v110;
-	float v001, v011, v101, v111;
-	float u, v, w, orig_u, orig_v;
-	u32 index, i, j, k, noisex, noisey, noisez;
+	float u, v, w, orig_v;
+	u32 index, j, k, noisey, noisez;
 	u32 nlx, nly, nlz;
 	s32 x0, y0, z0;
 
@@ -558,59 +570,33 @@ void Noise::gradientMap3D(
 	u = x - (float)x0;
 	v = y - (float)y0;
 	w = z - (float)z0;
-	orig_u = u;
 	orig_v = v;
 
 	//calculate noise point lattice
 	nlx = (u32)(u + sx * step_x) + 2;
 	nly = (u32)(v + sy * step_y) + 2;
 	nlz = (u32)(w + sz * step_z) + 2;
-	index = 0;
 	for (k = 0; k != nlz; k++)
 		for (j = 0; j != nly; j++)
-			for (i = 0; i != nlx; i++)
-				noise_buf[index++] = noise3d(x0 + i, y0 + j, z0 + k, seed);
+			noise_simd::lattice3d(&noise_buf[idx(0, j, k)],
+				x0, y0 + j, z0 + k, seed, nlx);
 
 	//calculate interpolations
+	interpolateX(u, step_x, eased, nlx, nly * nlz);
+
 	index  = 0;
-	noisey = 0;
 	noisez = 0;
 	for (k = 0; k != sz; k++) {
+		float ew = eased ? easeCurve(w) : w;
 		v = orig_v;
 		noisey = 0;
 		for (j = 0; j != sy; j++) {
-			v000 = noise_buf[idx(0, noisey,     noisez)];
-			v100 = noise_buf[idx(1, noisey,     noisez)];
-			v010 = noise_buf[idx(0, noisey + 1, noisez)];
-			v110 = noise_buf[idx(1, noisey + 1, noisez)];
-			v001 = noise_buf[idx(0, noisey,     noisez + 1)];
-			v101 = noise_buf[idx(1, noisey,     noisez + 1)];
-			v011 = noise_buf[idx(0, noisey + 1, noisez + 1)];
-			v111 = noise_buf[idx(1, noisey + 1, noisez + 1)];
-
-			u = orig_u;
-			noisex = 0;
-			for (i = 0; i != sx; i++) {
-				gradient_buf[index++] = triLinearInterpolation(
-					v000, v100, v010, v110,
-					v001, v101, v011, v111,
-					u, v, w,
-					eased);
-
-				u += step_x;
-				if (u >= 1.0) {
-					u -= 1.0;
-					noisex++;
-					v000 = v100;
-					v010 = v110;
-					v100 = noise_buf[idx(noisex + 1, noisey,     noisez)];
-					v110 = noise_buf[idx(noisex + 1, noisey + 1, noisez)];
-					v001 = v101;
-					v011 = v111;
-					v101 = noise_buf[idx(noisex + 1, noisey,     noisez + 1)];
-					v111 = noise_buf[idx(noisex + 1, noisey + 1, noisez + 1)];
-				}
-			}
+			// Same layout as noise_buf, with rows of sx
+			const float *row = &xinterp_buf[(noisez * nly + noisey) * sx];
+			noise_simd::bilerp(&gradient_buf[index],
+				row, row + sx, row + nly * sx, row + (nly + 1) * sx,
+				eased ? easeCurve(v) : v, ew, sx);
+			index += sx;
 
 			v += step_y;
 			if (v >= 1.0) {
@@ -631,8 +617,13 @@ void Noise::gradientMap3D(
 
 float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 {
+	NoiseCache *cache = persistence_map ? NULL : NoiseCache::getThreadCache();
+	if (cache && cache->load(this, x, y))
+		return result;
+
 	float f = 1.0, g = 1.0;
 	size_t bufsize = sx * sy;
+	float orig_x = x, orig_y = y;
 
 	x /= np.spread.X;
 	y /= np.spread.Y;
@@ -662,6 +653,9 @@ float *Noise::perlinMap2D(float x, float y, float *persistence_map)
 			result[i] = result[i] * np.scale + np.offset;
 	}
 
+	if (cache)
+		cache->store(this, orig_x, orig_y);
+
 	return result;
 }
 
@@ -731,3 +725,96 @@ void Noise::updateResults(float g, float *gmap,
 		}
 	}
 }
+
+
+///////////////////////////////////////////////////////////////////////////////
+
+static thread_local NoiseCache *t_noise_cache = NULL;
+
+void NoiseCache::setThreadCache(NoiseCache *cache)
+{
+	t_noise_cache = cache;
+}
+
+
+NoiseCache *NoiseCache::getThreadCache()
+{
+	return t_noise_cache;
+}
+
+
+NoiseCache::Key::Key(const Noise *noise, float x, float y) :
+	np(noise->np),
+	seed(noise->seed),
+	x(x), y(y),
+	sx(noise->sx), sy(noise->sy)
+{
+}
+
+
+bool NoiseCache::Key::operator==(const Key &other) const
+{
+	return seed == other.seed && x == other.x && y == other.y &&
+		sx == other.sx && sy == other.sy &&
+		np.offset == other.np.offset && np.scale == other.np.scale &&
+		np.spread == other.np.spread && np.seed == other.np.seed &&
+		np.octaves == other.np.octaves && np.persist == other.np.persist &&
+		np.lacunarity == other.np.lacunarity && np.flags == other.np.flags;
+}
+
+
+size_t NoiseCache::KeyHash::operator()(const Key &key) const
+{
+	std::hash<float> fh;
+	size_t h = std::hash<s32>()(key.seed);
+	size_t values[] = {
+		fh(key.x), fh(key.y), key.sx, key.sy,
+		fh(key.np.offset), fh(key.np.scale),
+		fh(key.np.spread.X), fh(key.np.spread.Y), fh(key.np.spread.Z),
+		(size_t)key.np.seed, key.np.octaves,
+		fh(key.np.persist), fh(key.np.lacunarity), key.np.flags,
+	};
+	for (size_t v : values)
+		h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2);
+	return h;
+}
+
+
+bool NoiseCache::load(Noise *noise, float x, float y)
+{
+	auto it = m_index.find(Key(noise, x, y));
+	if (it == m_index.end()) {
+		m_misses++;
+		return false;
+	}
+
+	m_hits++;
+	m_maps.splice(m_maps.begin(), m_maps, it->second);
+	const std::vector<float> &cached = it->second->result;
+	memcpy(noise->result, cached.data(), sizeof(float) * cached.size());
+	return true;
+}
+
+
+void NoiseCache::store(const Noise *noise, float x, float y)
+{
+	if (m_max_maps == 0)
+		return;
+
+	Key key(noise, x, y);
+	if (m_index.find(key) != m_index.end())
+		return;
+
+	// Reuse the least recently used entry when full
+	if (m_maps.size() >= m_max_maps) {
+		m_index.erase(m_maps.back().key);
+		m_maps.splice(m_maps.begin(), m_maps, std::prev(m_maps.end()));
+		m_maps.front().key = key;
+	} else {
+		m_maps.push_front(Entry{key, {}});
+	}
+
+	m_maps.front().result.assign(noise->result,
+		noise->result + noise->sx * noise->sy);
+	m_index[key] = m_maps.begin();
+}
@@ -28,6 +28,9 @@
 #include "irr_v3d.h"
 #include "exceptions.h"
 #include "util/string.h"
+#include <list>
+#include <unordered_map>
+#include <vector>
 
 #if defined(RANDOM_MIN)
 #undef RANDOM_MIN
@@ -107,6 +110,13 @@ class PcgRandom {
 #define NOISE_FLAG_POINTBUFFER 0x08
 #define NOISE_FLAG_SIMPLEX     0x10
 
+// Hash multipliers of noise2d() and noise3d()
+#define NOISE_MAGIC_X    1619
+#define NOISE_MAGIC_Y    31337
+#define NOISE_MAGIC_Z    52591
+// Unsigned magic seed prevents undefined behavior.
+#define NOISE_MAGIC_SEED 1013U
+
 struct NoiseParams {
 	float offset = 0.0f;
 	float scale = 1.0f;
@@ -185,13 +195,75 @@ class Noise {
 	}
 
 private:
+	// Lattice values interpolated along X, one row of sx per lattice row
+	float *xinterp_buf = nullptr;
+	// Per X position: lattice column and (eased) fraction within it
+	u32 *xindex_buf = nullptr;
+	float *xfrac_buf = nullptr;
+
 	void allocBuffers();
 	void resizeNoiseBuf(bool is3d);
+	void interpolateX(float u, float step_x, bool eased, u32 nlx, u32 rows);
 	void updateResults(float g, float *gmap, const float *persistence_map,
 			size_t bufsize);
 
 };
 
+/*
+ * Keeps recently computed 2D noise maps for reuse.
+ *
+ * The 2D noise of mapchunks stacked on top of each other is the same, so
+ * while a cache is set for the thread, Noise::perlinMap2D() copies maps it
+ * has computed before from here.  Maps computed with a persistence map are
+ * not cached.  When full, the least recently used map is dropped.
+ *
+ * Not thread-safe, every thread needs its own.
+ */
+class NoiseCache {
+public:
+	NoiseCache(u32 max_maps) : m_max_maps(max_maps) {}
+
+	// Cache used by the calling thread, NULL for none
+	static void setThreadCache(NoiseCache *cache);
+	static NoiseCache *getThreadCache();
+
+	// Copies the map for noise at x, y to noise->result, if there is one
+	bool load(Noise *noise, float x, float y);
+	void store(const Noise *noise, float x, float y);
+
+	u32 getSize() const { return m_maps.size(); }
+	u64 getHits() const { return m_hits; }
+	u64 getMisses() const { return m_misses; }
+	void resetStats() { m_hits = m_misses = 0; }
+
+private:
+	struct Key {
+		NoiseParams np;
+		s32 seed;
+		float x, y;
+		u32 sx, sy;
+
+		Key(const Noise *noise, float x, float y);
+		bool operator==(const Key &other) const;
+	};
+
+	struct KeyHash {
+		size_t operator()(const Key &key) const;
+	};
+
+	struct Entry {
+		Key key;
+		std::vector<float> result;
+	};
+
+	const u32 m_max_maps;
+	// Most recently used first
+	std::list<Entry> m_maps;
+	std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> m_index;
+	u64 m_hits = 0;
+	u64 m_misses = 0;
+};
+
 float NoisePerlin2D(const NoiseParams *np, float x, float y, s32 seed);
 float NoisePerlin3D(const NoiseParams *np, float x, float y, float z, s32 seed);
 
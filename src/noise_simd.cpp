@@ -0,0 +1,392 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "noise_simd.h"
+#include "noise.h"
+#include <atomic>
+
+// SSE2 is part of x86-64, AVX2 is only used after checking for it
+#if defined(__x86_64__) || defined(_M_X64)
+	#define NOISE_SIMD_X86 1
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+	#endif
+#else
+	#define NOISE_SIMD_X86 0
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+	// Not "fma": contracting mul and add would change the results
+	#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+	#define TARGET_AVX2
+#endif
+
+namespace noise_simd
+{
+
+// See noise2d(), n is the sum of the position and seed terms
+static inline float hash(u32 n)
+{
+	n &= 0x7fffffff;
+	n = (n >> 13) ^ n;
+	n = (n * (n * n * 60493 + 19990303) + 1376312589) & 0x7fffffff;
+	return 1.f - (float)(int)n / 0x40000000;
+}
+
+/*
+	Scalar
+*/
+
+static void lattice_scalar(float *out, s32 x0, u32 base, u32 count)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = hash(NOISE_MAGIC_X * (u32)(x0 + i) + base);
+}
+
+static void lerpGather_scalar(float *out, const float *row, const u32 *index,
+	const float *t, u32 count)
+{
+	for (u32 i = 0; i != count; i++) {
+		float a = row[index[i]];
+		float b = row[index[i] + 1];
+		out[i] = a + (b - a) * t[i];
+	}
+}
+
+static void lerp_scalar(float *out, const float *a, const float *b, float t,
+	u32 count)
+{
+	for (u32 i = 0; i != count; i++)
+		out[i] = a[i] + (b[i] - a[i]) * t;
+}
+
+static void bilerp_scalar(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t, float s, u32 count)
+{
+	for (u32 i = 0; i != count; i++) {
+		float u = a[i] + (b[i] - a[i]) * t;
+		float v = c[i] + (d[i] - c[i]) * t;
+		out[i] = u + (v - u) * s;
+	}
+}
+
+#if NOISE_SIMD_X86
+
+/*
+	SSE2
+*/
+
+// _mm_mullo_epi32() needs SSE4.1
+static inline __m128i mullo_sse2(__m128i a, __m128i b)
+{
+	__m128i even = _mm_mul_epu32(a, b);
+	__m128i odd = _mm_mul_epu32(_mm_srli_si128(a, 4), _mm_srli_si128(b, 4));
+	return _mm_unpacklo_epi32(
+		_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+		_mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+static inline __m128 hash_sse2(__m128i n)
+{
+	const __m128i mask = _mm_set1_epi32(0x7fffffff);
+	n = _mm_and_si128(n, mask);
+	n = _mm_xor_si128(_mm_srli_epi32(n, 13), n);
+	__m128i m = mullo_sse2(mullo_sse2(n, n), _mm_set1_epi32(60493));
+	m = _mm_add_epi32(m, _mm_set1_epi32(19990303));
+	n = _mm_add_epi32(mullo_sse2(n, m), _mm_set1_epi32(1376312589));
+	n = _mm_and_si128(n, mask);
+	// Dividing by a power of two is exact, so is multiplying with its inverse
+	return _mm_sub_ps(_mm_set1_ps(1.f),
+		_mm_mul_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(1.f / 0x40000000)));
+}
+
+static void lattice_sse2(float *out, s32 x0, u32 base, u32 count)
+{
+	const __m128i magic = _mm_set1_epi32(NOISE_MAGIC_X);
+	const __m128i vbase = _mm_set1_epi32(base);
+	__m128i x = _mm_add_epi32(_mm_set1_epi32(x0), _mm_setr_epi32(0, 1, 2, 3));
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128i n = _mm_add_epi32(mullo_sse2(x, magic), vbase);
+		_mm_storeu_ps(out + i, hash_sse2(n));
+		x = _mm_add_epi32(x, _mm_set1_epi32(4));
+	}
+	lattice_scalar(out + i, x0 + i, base, count - i);
+}
+
+static void lerpGather_sse2(float *out, const float *row, const u32 *index,
+	const float *t, u32 count)
+{
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		const u32 *ix = index + i;
+		__m128 a = _mm_setr_ps(row[ix[0]], row[ix[1]], row[ix[2]], row[ix[3]]);
+		__m128 b = _mm_setr_ps(row[ix[0] + 1], row[ix[1] + 1],
+			row[ix[2] + 1], row[ix[3] + 1]);
+		__m128 vt = _mm_loadu_ps(t + i);
+		_mm_storeu_ps(out + i, _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), vt)));
+	}
+	lerpGather_scalar(out + i, row, index + i, t + i, count - i);
+}
+
+static void lerp_sse2(float *out, const float *a, const float *b, float t,
+	u32 count)
+{
+	const __m128 vt = _mm_set1_ps(t);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 vb = _mm_loadu_ps(b + i);
+		_mm_storeu_ps(out + i, _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt)));
+	}
+	lerp_scalar(out + i, a + i, b + i, t, count - i);
+}
+
+static void bilerp_sse2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t, float s, u32 count)
+{
+	const __m128 vt = _mm_set1_ps(t);
+	const __m128 vs = _mm_set1_ps(s);
+	u32 i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 va = _mm_loadu_ps(a + i);
+		__m128 vb = _mm_loadu_ps(b + i);
+		__m128 vc = _mm_loadu_ps(c + i);
+		__m128 vd = _mm_loadu_ps(d + i);
+		__m128 u = _mm_add_ps(va, _mm_mul_ps(_mm_sub_ps(vb, va), vt));
+		__m128 v = _mm_add_ps(vc, _mm_mul_ps(_mm_sub_ps(vd, vc), vt));
+		_mm_storeu_ps(out + i, _mm_add_ps(u, _mm_mul_ps(_mm_sub_ps(v, u), vs)));
+	}
+	bilerp_scalar(out + i, a + i, b + i, c + i, d + i, t, s, count - i);
+}
+
+/*
+	AVX2
+
+	The remainder is left to the SSE2 functions. Clear the upper halves of
+	the registers before, the compiler does not always do so before a tail
+	call and legacy SSE code is very slow while they are in use.
+*/
+
+TARGET_AVX2 static inline __m256 hash_avx2(__m256i n)
+{
+	const __m256i mask = _mm256_set1_epi32(0x7fffffff);
+	n = _mm256_and_si256(n, mask);
+	n = _mm256_xor_si256(_mm256_srli_epi32(n, 13), n);
+	__m256i m = _mm256_mullo_epi32(_mm256_mullo_epi32(n, n),
+		_mm256_set1_epi32(60493));
+	m = _mm256_add_epi32(m, _mm256_set1_epi32(19990303));
+	n = _mm256_add_epi32(_mm256_mullo_epi32(n, m),
+		_mm256_set1_epi32(1376312589));
+	n = _mm256_and_si256(n, mask);
+	return _mm256_sub_ps(_mm256_set1_ps(1.f),
+		_mm256_mul_ps(_mm256_cvtepi32_ps(n), _mm256_set1_ps(1.f / 0x40000000)));
+}
+
+TARGET_AVX2 static void lattice_avx2(float *out, s32 x0, u32 base, u32 count)
+{
+	const __m256i magic = _mm256_set1_epi32(NOISE_MAGIC_X);
+	const __m256i vbase = _mm256_set1_epi32(base);
+	__m256i x = _mm256_add_epi32(_mm256_set1_epi32(x0),
+		_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7));
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i n = _mm256_add_epi32(_mm256_mullo_epi32(x, magic), vbase);
+		_mm256_storeu_ps(out + i, hash_avx2(n));
+		x = _mm256_add_epi32(x, _mm256_set1_epi32(8));
+	}
+	_mm256_zeroupper();
+	lattice_sse2(out + i, x0 + i, base, count - i);
+}
+
+TARGET_AVX2 static void lerpGather_avx2(float *out, const float *row,
+	const u32 *index, const float *t, u32 count)
+{
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256i ix = _mm256_loadu_si256((const __m256i *)(index + i));
+		__m256 a = _mm256_i32gather_ps(row, ix, 4);
+		__m256 b = _mm256_i32gather_ps(row + 1, ix, 4);
+		__m256 vt = _mm256_loadu_ps(t + i);
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(a, _mm256_mul_ps(_mm256_sub_ps(b, a), vt)));
+	}
+	_mm256_zeroupper();
+	lerpGather_sse2(out + i, row, index + i, t + i, count - i);
+}
+
+TARGET_AVX2 static void lerp_avx2(float *out, const float *a, const float *b,
+	float t, u32 count)
+{
+	const __m256 vt = _mm256_set1_ps(t);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 vb = _mm256_loadu_ps(b + i);
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(vb, va), vt)));
+	}
+	_mm256_zeroupper();
+	lerp_sse2(out + i, a + i, b + i, t, count - i);
+}
+
+TARGET_AVX2 static void bilerp_avx2(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t, float s, u32 count)
+{
+	const __m256 vt = _mm256_set1_ps(t);
+	const __m256 vs = _mm256_set1_ps(s);
+	u32 i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 va = _mm256_loadu_ps(a + i);
+		__m256 vb = _mm256_loadu_ps(b + i);
+		__m256 vc = _mm256_loadu_ps(c + i);
+		__m256 vd = _mm256_loadu_ps(d + i);
+		__m256 u = _mm256_add_ps(va, _mm256_mul_ps(_mm256_sub_ps(vb, va), vt));
+		__m256 v = _mm256_add_ps(vc, _mm256_mul_ps(_mm256_sub_ps(vd, vc), vt));
+		_mm256_storeu_ps(out + i,
+			_mm256_add_ps(u, _mm256_mul_ps(_mm256_sub_ps(v, u), vs)));
+	}
+	_mm256_zeroupper();
+	bilerp_sse2(out + i, a + i, b + i, c + i, d + i, t, s, count - i);
+}
+
+#endif // NOISE_SIMD_X86
+
+/*
+	Dispatch
+*/
+
+struct Kernels
+{
+	void (*lattice)(float *out, s32 x0, u32 base, u32 count);
+	void (*lerpGather)(float *out, const float *row, const u32 *index,
+		const float *t, u32 count);
+	void (*lerp)(float *out, const float *a, const float *b, float t, u32 count);
+	void (*bilerp)(float *out, const float *a, const float *b,
+		const float *c, const float *d, float t, float s, u32 count);
+};
+
+// Indexed by Level
+static const Kernels s_kernels[] = {
+	{lattice_scalar, lerpGather_scalar, lerp_scalar, bilerp_scalar},
+#if NOISE_SIMD_X86
+	{lattice_sse2, lerpGather_sse2, lerp_sse2, bilerp_sse2},
+	{lattice_avx2, lerpGather_avx2, lerp_avx2, bilerp_avx2},
+#endif
+};
+
+static Level detectLevel()
+{
+#if NOISE_SIMD_X86
+#if defined(_MSC_VER)
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] >= 7) {
+		__cpuid(info, 1);
+		bool osxsave = info[2] & (1 << 27);
+		bool avx = info[2] & (1 << 28);
+		__cpuidex(info, 7, 0);
+		bool avx2 = info[1] & (1 << 5);
+		// The OS has to save the AVX registers
+		if (osxsave && avx && avx2 && (_xgetbv(0) & 6) == 6)
+			return LEVEL_AVX2;
+	}
+#elif defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return LEVEL_AVX2;
+#endif
+	return LEVEL_SSE2;
+#else
+	return LEVEL_SCALAR;
+#endif
+}
+
+static std::atomic<Level> &currentLevel()
+{
+	static std::atomic<Level> level(getMaxLevel());
+	return level;
+}
+
+static inline const Kernels &kernels()
+{
+	return s_kernels[currentLevel().load(std::memory_order_relaxed)];
+}
+
+Level getMaxLevel()
+{
+	static const Level level = detectLevel();
+	return level;
+}
+
+Level getLevel()
+{
+	return currentLevel().load();
+}
+
+void setLevel(Level level)
+{
+	currentLevel().store(level < getMaxLevel() ? level : getMaxLevel());
+}
+
+const char *getLevelName(Level level)
+{
+	switch (level) {
+	case LEVEL_SSE2:
+		return "sse2";
+	case LEVEL_AVX2:
+		return "avx2";
+	default:
+		return "scalar";
+	}
+}
+
+void lattice2d(float *out, s32 x0, s32 y, s32 seed, u32 count)
+{
+	u32 base = NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_SEED * (u32)seed;
+	kernels().lattice(out, x0, base, count);
+}
+
+void lattice3d(float *out, s32 x0, s32 y, s32 z, s32 seed, u32 count)
+{
+	u32 base = NOISE_MAGIC_Y * (u32)y + NOISE_MAGIC_Z * (u32)z
+		+ NOISE_MAGIC_SEED * (u32)seed;
+	kernels().lattice(out, x0, base, count);
+}
+
+void lerpGather(float *out, const float *row, const u32 *index, const float *t,
+	u32 count)
+{
+	kernels().lerpGather(out, row, index, t, count);
+}
+
+void lerp(float *out, const float *a, const float *b, float t, u32 count)
+{
+	kernels().lerp(out, a, b, t, count);
+}
+
+void bilerp(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t, float s, u32 count)
+{
+	kernels().bilerp(out, a, b, c, d, t, s, count);
+}
+
+}
@@ -0,0 +1,61 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+
+/*
+	Row kernels of Noise::gradientMap2D() and Noise::gradientMap3D().
+
+	The instruction set is picked at runtime. Every implementation does
+	the same float operations in the same order as the scalar one, so
+	the results are bit-identical on all of them.
+*/
+namespace noise_simd
+{
+
+enum Level {
+	LEVEL_SCALAR,
+	LEVEL_SSE2,
+	LEVEL_AVX2,
+};
+
+// Best level the CPU supports
+Level getMaxLevel();
+Level getLevel();
+// Level used from now on, capped at getMaxLevel(). For tests and benchmarks.
+void setLevel(Level level);
+const char *getLevelName(Level level);
+
+// out[i] = noise2d(x0 + i, y, seed)
+void lattice2d(float *out, s32 x0, s32 y, s32 seed, u32 count);
+// out[i] = noise3d(x0 + i, y, z, seed)
+void lattice3d(float *out, s32 x0, s32 y, s32 z, s32 seed, u32 count);
+
+// out[i] = lerp(row[index[i]], row[index[i] + 1], t[i])
+void lerpGather(float *out, const float *row, const u32 *index, const float *t,
+	u32 count);
+// out[i] = lerp(a[i], b[i], t)
+void lerp(float *out, const float *a, const float *b, float t, u32 count);
+// out[i] = lerp(lerp(a[i], b[i], t), lerp(c[i], d[i], t), s)
+void bilerp(float *out, const float *a, const float *b,
+	const float *c, const float *d, float t, float s, u32 count);
+
+}
@@ -0,0 +1,215 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "objectsnapshot.h"
+#include "constants.h"
+#include "util/numeric.h"
+#include "util/serialize.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#define POSITION_STEP (BS / 128.0f)
+#define ROTATION_STEP (360.0f / 65536.0f)
+
+enum ObjectSnapshotFlags : u8
+{
+	OSF_INTERPOLATE = 0x01,
+	OSF_END_POSITION = 0x02,
+	OSF_POSITION = 0x04,
+	OSF_POSITION_DELTA = 0x08,
+	OSF_VELOCITY = 0x10,
+	OSF_ACCELERATION = 0x20,
+	OSF_ROTATION = 0x40,
+	// Object is no longer known to the client, nothing follows
+	OSF_REMOVED = 0x80,
+};
+
+template <typename T>
+static T quantize(float value, float step)
+{
+	double q = std::round((double)value / step);
+	return (T)rangelim(q, (double)std::numeric_limits<T>::min(),
+		(double)std::numeric_limits<T>::max());
+}
+
+QuantizedObjectPosition::QuantizedObjectPosition(const ObjectPosition &pos) :
+	do_interpolate(pos.do_interpolate),
+	is_end_position(pos.is_end_position)
+{
+	for (int i = 0; i < 3; i++) {
+		position[i] = quantize<s32>(pos.position[i], POSITION_STEP);
+		velocity[i] = quantize<s16>(pos.velocity[i], POSITION_STEP);
+		acceleration[i] = quantize<s16>(pos.acceleration[i], POSITION_STEP);
+		rotation[i] = (u16)(u32)std::lround(
+			wrapDegrees_0_360(pos.rotation[i]) / ROTATION_STEP);
+	}
+}
+
+ObjectPosition QuantizedObjectPosition::get() const
+{
+	ObjectPosition pos;
+	for (int i = 0; i < 3; i++) {
+		pos.position[i] = position[i] * POSITION_STEP;
+		pos.velocity[i] = velocity[i] * POSITION_STEP;
+		pos.acceleration[i] = acceleration[i] * POSITION_STEP;
+		pos.rotation[i] = rotation[i] * ROTATION_STEP;
+	}
+	pos.do_interpolate = do_interpolate;
+	pos.is_end_position = is_end_position;
+	return pos;
+}
+
+bool QuantizedObjectPosition::operator==(const QuantizedObjectPosition &other) const
+{
+	return !memcmp(position, other.position, sizeof(position)) &&
+		!memcmp(velocity, other.velocity, sizeof(velocity)) &&
+		!memcmp(acceleration, other.acceleration, sizeof(acceleration)) &&
+		!memcmp(rotation, other.rotation, sizeof(rotation)) &&
+		do_interpolate == other.do_interpolate &&
+		is_end_position == other.is_end_position;
+}
+
+static void serialize_changes(std::ostream &os, u16 id,
+		const QuantizedObjectPosition &from, const QuantizedObjectPosition &to)
+{
+	u8 flags = 0;
+	if (to.do_interpolate)
+		flags |= OSF_INTERPOLATE;
+	if (to.is_end_position)
+		flags |= OSF_END_POSITION;
+
+	s32 delta[3];
+	bool small_delta = true;
+	for (int i = 0; i < 3; i++) {
+		delta[i] = (s32)((s64)to.position[i] - from.position[i]);
+		small_delta &= (s64)to.position[i] - from.position[i] ==
+			(s64)(s16)delta[i];
+	}
+	if (memcmp(to.position, from.position, sizeof(to.position)))
+		flags |= small_delta ? OSF_POSITION_DELTA : OSF_POSITION;
+	if (memcmp(to.velocity, from.velocity, sizeof(to.velocity)))
+		flags |= OSF_VELOCITY;
+	if (memcmp(to.acceleration, from.acceleration, sizeof(to.acceleration)))
+		flags |= OSF_ACCELERATION;
+	if (memcmp(to.rotation, from.rotation, sizeof(to.rotation)))
+		flags |= OSF_ROTATION;
+
+	writeU16(os, id);
+	writeU8(os, flags);
+	for (int i = 0; i < 3 && (flags & OSF_POSITION_DELTA); i++)
+		writeS16(os, delta[i]);
+	for (int i = 0; i < 3 && (flags & OSF_POSITION); i++)
+		writeS32(os, to.position[i]);
+	for (int i = 0; i < 3 && (flags & OSF_VELOCITY); i++)
+		writeS16(os, to.velocity[i]);
+	for (int i = 0; i < 3 && (flags & OSF_ACCELERATION); i++)
+		writeS16(os, to.acceleration[i]);
+	for (int i = 0; i < 3 && (flags & OSF_ROTATION); i++)
+		writeU16(os, to.rotation[i]);
+}
+
+u16 serializeObjectSnapshotDelta(std::ostream &os,
+		const ObjectSnapshot &baseline, const ObjectSnapshot &snapshot)
+{
+	static const QuantizedObjectPosition zero;
+	std::ostringstream objects(std::ios_base::binary);
+	u16 count = 0;
+	for (const auto &it : snapshot) {
+		auto base = baseline.find(it.first);
+		if (base == baseline.end()) {
+			serialize_changes(objects, it.first, zero, it.second);
+		} else if (base->second != it.second) {
+			serialize_changes(objects, it.first, base->second, it.second);
+		} else {
+			continue;
+		}
+		count++;
+	}
+	for (const auto &it : baseline) {
+		if (snapshot.find(it.first) != snapshot.end())
+			continue;
+		writeU16(objects, it.first);
+		writeU8(objects, OSF_REMOVED);
+		count++;
+	}
+
+	writeU16(os, count);
+	os << objects.str();
+	return count;
+}
+
+void deSerializeObjectSnapshotDelta(std::istream &is, ObjectSnapshot &snapshot,
+		std::vector<u16> *changed)
+{
+	u16 count = readU16(is);
+	for (u16 n = 0; n < count; n++) {
+		u16 id = readU16(is);
+		u8 flags = readU8(is);
+		if (flags & OSF_REMOVED) {
+			snapshot.erase(id);
+			continue;
+		}
+
+		QuantizedObjectPosition &pos = snapshot[id];
+		pos.do_interpolate = flags & OSF_INTERPOLATE;
+		pos.is_end_position = flags & OSF_END_POSITION;
+		for (int i = 0; i < 3 && (flags & OSF_POSITION_DELTA); i++)
+			pos.position[i] += readS16(is);
+		for (int i = 0; i < 3 && (flags & OSF_POSITION); i++)
+			pos.position[i] = readS32(is);
+		for (int i = 0; i < 3 && (flags & OSF_VELOCITY); i++)
+			pos.velocity[i] = readS16(is);
+		for (int i = 0; i < 3 && (flags & OSF_ACCELERATION); i++)
+			pos.acceleration[i] = readS16(is);
+		for (int i = 0; i < 3 && (flags & OSF_ROTATION); i++)
+			pos.rotation[i] = readU16(is);
+		changed->push_back(id);
+	}
+}
+
+/*
+	ObjectSnapshotHistory
+*/
+
+const ObjectSnapshot *ObjectSnapshotHistory::get(u16 seqnum) const
+{
+	if (seqnum == 0)
+		return &m_empty;
+	for (const auto &it : m_snapshots) {
+		if (it.first == seqnum)
+			return &it.second;
+	}
+	return nullptr;
+}
+
+void ObjectSnapshotHistory::add(u16 seqnum, ObjectSnapshot snapshot)
+{
+	if (m_snapshots.size() == MAX_SNAPSHOTS)
+		m_snapshots.pop_front();
+	m_snapshots.emplace_back(seqnum, std::move(snapshot));
+}
+
+void ObjectSnapshotHistory::forgetBefore(u16 seqnum)
+{
+	while (!m_snapshots.empty() &&
+			objectSnapshotNewer(seqnum, m_snapshots.front().first))
+		m_snapshots.pop_front();
+}
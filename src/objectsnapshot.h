@@ -0,0 +1,126 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "activeobject.h"
+#include "irrlichttypes.h"
+#include <deque>
+#include <iostream>
+#include <unordered_map>
+#include <vector>
+
+/*
+	ObjectPosition as sent with TOCLIENT_ACTIVE_OBJECT_POSITIONS.
+
+	Positions, velocities and accelerations are in steps of BS / 128,
+	rotations in steps of 360 / 65536 degrees.
+*/
+struct QuantizedObjectPosition
+{
+	QuantizedObjectPosition() = default;
+	explicit QuantizedObjectPosition(const ObjectPosition &pos);
+
+	ObjectPosition get() const;
+
+	bool operator==(const QuantizedObjectPosition &other) const;
+	bool operator!=(const QuantizedObjectPosition &other) const
+	{
+		return !(*this == other);
+	}
+
+	s32 position[3] = {};
+	s16 velocity[3] = {};
+	s16 acceleration[3] = {};
+	u16 rotation[3] = {};
+	bool do_interpolate = false;
+	bool is_end_position = false;
+};
+
+// Positions of the objects a client knows of, by object id
+typedef std::unordered_map<u16, QuantizedObjectPosition> ObjectSnapshot;
+
+/*
+	Writes the objects which differ between baseline and snapshot:
+		u16 count
+		for each object {
+			u16 id
+			u8 flags (OSF_*)
+			if OSF_POSITION_DELTA: s16[3] position - baseline position
+			else if OSF_POSITION: s32[3] position
+			if OSF_VELOCITY: s16[3] velocity
+			if OSF_ACCELERATION: s16[3] acceleration
+			if OSF_ROTATION: u16[3] rotation
+		}
+	Omitted values are the ones of the baseline, objects missing in the
+	baseline start from zero.
+	Returns the count.
+*/
+u16 serializeObjectSnapshotDelta(std::ostream &os,
+		const ObjectSnapshot &baseline, const ObjectSnapshot &snapshot);
+
+/*
+	Reads what serializeObjectSnapshotDelta() wrote into snapshot, which
+	has to be a copy of the baseline. The ids of objects which were changed
+	or added are appended to changed.
+*/
+void deSerializeObjectSnapshotDelta(std::istream &is, ObjectSnapshot &snapshot,
+		std::vector<u16> *changed);
+
+// Whether seqnum a comes after b, allowing them to wrap around
+inline bool objectSnapshotNewer(u16 a, u16 b)
+{
+	return a != b && (u16)(a - b) < 0x8000;
+}
+
+/*
+	Whether an acknowledgement of seqnum replaces the baseline acked, with
+	sent being the last snapshot sent. Baseline 0 is also the fallback
+	once the acknowledged one was forgotten, so it accepts every seqnum
+	up to sent regardless of the wraparound.
+*/
+inline bool objectSnapshotAckNewer(u16 seqnum, u16 acked, u16 sent)
+{
+	if (seqnum == 0 || objectSnapshotNewer(seqnum, sent))
+		return false;
+	return acked == 0 || objectSnapshotNewer(seqnum, acked);
+}
+
+/*
+	The last snapshots sent to or received from the other side, which may
+	be used as a baseline for the next ones. Sequence number 0 is the
+	empty snapshot, which is always there.
+*/
+class ObjectSnapshotHistory
+{
+public:
+	static const u32 MAX_SNAPSHOTS = 32;
+
+	// nullptr if the snapshot was forgotten
+	const ObjectSnapshot *get(u16 seqnum) const;
+	// Forgets the oldest one if there are too many
+	void add(u16 seqnum, ObjectSnapshot snapshot);
+	// Forgets the snapshots sent before seqnum
+	void forgetBefore(u16 seqnum);
+	void clear() { m_snapshots.clear(); }
+
+private:
+	std::deque<std::pair<u16, ObjectSnapshot>> m_snapshots;
+	ObjectSnapshot m_empty;
+};
@@ -25,6 +25,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "pathfinder.h"
 #include "map.h"
 #include "nodedef.h"
+#include "porting.h"
+#include <algorithm>
+#include <queue>
 
 //#define PATHFINDER_DEBUG
 //#define PATHFINDER_CALC_TIME
@@ -59,6 +62,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #define PATHFINDER_MAX_WAYPOINTS 700
 
+/** number of cached clusters per graph at which the cache is flushed */
+#define PATHFINDER_MAX_CACHED_CLUSTERS 8192
+/** number of cached intra-block edge lists per cluster */
+#define PATHFINDER_MAX_CLUSTER_SOURCES 64
+/** number of cached flow fields at which the cache is flushed */
+#define PATHFINDER_MAX_FLOW_FIELDS 64
+/** lifetime (ms) of flow fields built while parts of their area were missing */
+#define PATHFINDER_INCOMPLETE_FLOW_FIELD_TIME 2000
+
 /******************************************************************************/
 /* Class definitions                                                          */
 /******************************************************************************/
@@ -179,7 +191,9 @@ class Pathfinder {
 
 public:
 	Pathfinder() = delete;
-	Pathfinder(Map *map, const NodeDefManager *ndef) : m_map(map), m_ndef(ndef) {}
+	Pathfinder(Map *map, const NodeDefManager *ndef,
+			PathfinderCache *cache = nullptr) :
+		m_map(map), m_ndef(ndef), m_cache(cache) {}
 
 	~Pathfinder();
 
@@ -200,9 +214,49 @@ class Pathfinder {
 			unsigned int max_drop,
 			PathAlgorithm algo);
 
+	/**
+	 * evaluate paths from many sources to a common destination
+	 * using a single search
+	 * @param sources origins of the paths
+	 * @param destination end position of all paths
+	 * @param searchdistance maximum number of nodes to look in each direction
+	 * @param max_jump maximum number of blocks a path may jump up
+	 * @param max_drop maximum number of blocks a path may drop
+	 * @return one path per source, empty if there is none
+	 */
+	std::vector<std::vector<v3s16>> getPaths(
+			const std::vector<v3s16> &sources,
+			v3s16 destination,
+			unsigned int searchdistance,
+			unsigned int max_jump,
+			unsigned int max_drop);
+
+	/**
+	 * compute the flow field of a destination
+	 * @param destination end position of all paths
+	 * @param searchdistance maximum number of nodes to look in each direction
+	 * @param max_jump maximum number of blocks a path may jump up
+	 * @param max_drop maximum number of blocks a path may drop
+	 * @param field field to fill
+	 * @return true/false all MapBlocks of the search area were loaded
+	 */
+	bool getFlowField(v3s16 destination,
+			unsigned int searchdistance,
+			unsigned int max_jump,
+			unsigned int max_drop,
+			PathFlowField &field);
+
 private:
 	/* helper functions */
 
+	/**
+	 * set the search area and allocate the node container
+	 * @param minp minimum corner of the positions to search between
+	 * @param maxp maximum corner of the positions to search between
+	 * @param searchdistance maximum number of nodes to look in each direction
+	 */
+	void           setLimits(v3s16 minp, v3s16 maxp, unsigned int searchdistance);
+
 	/**
 	 * transform index pos to mappos
 	 * @param ipos an index position
@@ -281,6 +335,17 @@ class Pathfinder {
 	 */
 	bool          updateCostHeuristic(v3s16 isource, v3s16 idestination);
 
+	/**
+	 * Dijkstra search backwards from the destination until all nodes
+	 * marked as source have been reached
+	 * @param idestination end position (index pos)
+	 * @param num_sources number of nodes marked as source
+	 * @param reached if set, receives all reached nodes (index pos)
+	 * @return true/false all sources have been reached
+	 */
+	bool          updateCostReverse(v3s16 idestination, unsigned int num_sources,
+			std::vector<v3s16> *reached = nullptr);
+
 	/**
 	 * build a vector containing all nodes from destination to source;
 	 * to be called after the node costs have been processed
@@ -300,6 +365,73 @@ class Pathfinder {
 	 */
 	v3s16         walkDownwards(v3s16 pos, unsigned int max_down);
 
+	/* hierarchical pathfinding (PA_HIERARCHICAL) */
+
+	/** result of a search inside a single MapBlock */
+	struct ClusterSearchNode {
+		int   cost;                    /**< cost to move here from the source */
+		v3s16 parent;                  /**< previous node on the cheapest path */
+	};
+
+	/**
+	 * check if a node can be stood in (free, solid node below)
+	 * @param pos real world position
+	 * @return true/false
+	 */
+	bool          isSurfaceNode(v3s16 pos);
+
+	/**
+	 * get the limits used for cost calculation inside a MapBlock
+	 * @param blockpos position of the MapBlock
+	 * @return block area including space for jumps and drops
+	 */
+	core::aabbox3d<s16> getClusterLimits(v3s16 blockpos);
+
+	/**
+	 * get portal data of a MapBlock, building it if necessary
+	 * @param blockpos position of the MapBlock
+	 * @return cluster (cached if the surrounding blocks are loaded)
+	 */
+	PathCluster  &getCluster(v3s16 blockpos);
+
+	/**
+	 * find all exits of a MapBlock; contiguous moves across the same
+	 * border are merged into a single portal
+	 * @param blockpos position of the MapBlock
+	 * @param cluster cluster to fill
+	 */
+	void          buildCluster(v3s16 blockpos, PathCluster &cluster);
+
+	/**
+	 * Dijkstra search restricted to a single MapBlock
+	 * @param blockpos position of the MapBlock
+	 * @param source real position to start from
+	 * @param goal search stops once this position is reached
+	 * @param visited receives costs and parents of all reached nodes
+	 */
+	void          searchCluster(v3s16 blockpos, v3s16 source, v3s16 goal,
+			std::unordered_map<v3s16, ClusterSearchNode> &visited);
+
+	/**
+	 * get intra-block edges from a node to the exits of its MapBlock
+	 * @param blockpos position of the MapBlock
+	 * @param cluster cluster of the MapBlock
+	 * @param source real position inside the MapBlock
+	 * @return list of (exit index, cost)
+	 */
+	const std::vector<std::pair<u16, int>> &getClusterEdges(v3s16 blockpos,
+			PathCluster &cluster, v3s16 source);
+
+	/**
+	 * A* search over the portal graph, refined to a node path afterwards
+	 * @param source start position (real pos)
+	 * @param destination end position (real pos)
+	 * @param path receives the path from source to destination
+	 * @return true/false path to destination has been found
+	 */
+	bool          updateCostHierarchical(v3s16 source, v3s16 destination,
+			std::vector<v3s16> &path);
+
 	/* variables */
 	int m_max_index_x = 0;            /**< max index of search area in x direction  */
 	int m_max_index_y = 0;            /**< max index of search area in y direction  */
@@ -325,6 +457,14 @@ class Pathfinder {
 
 	const NodeDefManager *m_ndef = nullptr;
 
+	PathfinderCache *m_cache = nullptr;
+
+	/** cached clusters for the current max_jump/max_drop, if any */
+	PathfinderCache::ClusterMap *m_clusters = nullptr;
+
+	/** clusters which may not be cached (neighborhood not loaded) */
+	PathfinderCache::ClusterMap m_uncached_clusters;
+
 	friend class PathfinderCompareHeuristic;
 
 #ifdef PATHFINDER_DEBUG
@@ -411,12 +551,90 @@ std::vector<v3s16> get_path(Map* map, const NodeDefManager *ndef,
 		unsigned int searchdistance,
 		unsigned int max_jump,
 		unsigned int max_drop,
-		PathAlgorithm algo)
+		PathAlgorithm algo,
+		PathfinderCache *cache)
 {
-	return Pathfinder(map, ndef).getPath(source, destination,
+	return Pathfinder(map, ndef, cache).getPath(source, destination,
 				searchdistance, max_jump, max_drop, algo);
 }
 
+std::vector<std::vector<v3s16>> get_paths(Map *map, const NodeDefManager *ndef,
+		const std::vector<v3s16> &sources,
+		v3s16 destination,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop)
+{
+	return Pathfinder(map, ndef).getPaths(sources, destination,
+				searchdistance, max_jump, max_drop);
+}
+
+std::shared_ptr<const PathFlowField> get_flow_field(Map *map,
+		const NodeDefManager *ndef,
+		v3s16 destination,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop,
+		PathfinderCache *cache)
+{
+	PathfinderCache::FlowFieldKey key(destination, searchdistance,
+			max_jump, max_drop);
+	u64 now = porting::getTimeMs();
+	if (cache) {
+		auto it = cache->m_flow_fields.find(key);
+		if (it != cache->m_flow_fields.end()) {
+			if (it->second.expiry == 0 || now < it->second.expiry)
+				return it->second.field;
+			cache->m_flow_fields.erase(it);
+		}
+	}
+
+	auto field = std::make_shared<PathFlowField>();
+	bool complete = Pathfinder(map, ndef).getFlowField(destination,
+			searchdistance, max_jump, max_drop, *field);
+
+	if (cache) {
+		if (cache->m_flow_fields.size() >= PATHFINDER_MAX_FLOW_FIELDS)
+			cache->m_flow_fields.clear();
+		cache->m_flow_fields[key] = {field,
+				complete ? 0 : now + PATHFINDER_INCOMPLETE_FLOW_FIELD_TIME};
+	}
+	return field;
+}
+
+/******************************************************************************/
+void PathfinderCache::onMapEditEvent(const MapEditEvent &event)
+{
+	// metadata has no influence on walkability
+	if (event.type == MEET_BLOCK_NODE_METADATA_CHANGED ||
+			(m_graphs.empty() && m_flow_fields.empty()))
+		return;
+
+	for (auto it = m_flow_fields.begin(); it != m_flow_fields.end(); ) {
+		bool touched = false;
+		for (v3s16 blockpos : event.modified_blocks) {
+			if (it->second.field->coversBlock(blockpos)) {
+				touched = true;
+				break;
+			}
+		}
+		if (touched)
+			it = m_flow_fields.erase(it);
+		else
+			++it;
+	}
+
+	// portals and costs of a block depend on its neighbors, too
+	for (v3s16 blockpos : event.modified_blocks) {
+		for (auto &graph : m_graphs) {
+			for (s16 z = -1; z <= 1; z++)
+			for (s16 y = -1; y <= 1; y++)
+			for (s16 x = -1; x <= 1; x++)
+				graph.second.erase(blockpos + v3s16(x, y, z));
+		}
+	}
+}
+
 /******************************************************************************/
 PathCost::PathCost(const PathCost &b)
 {
@@ -628,35 +846,12 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	}
 
 	//calculate boundaries within we're allowed to search
-	int min_x = MYMIN(source.X, destination.X);
-	int max_x = MYMAX(source.X, destination.X);
-
-	int min_y = MYMIN(source.Y, destination.Y);
-	int max_y = MYMAX(source.Y, destination.Y);
-
-	int min_z = MYMIN(source.Z, destination.Z);
-	int max_z = MYMAX(source.Z, destination.Z);
-
-	m_limits.MinEdge.X = min_x - searchdistance;
-	m_limits.MinEdge.Y = min_y - searchdistance;
-	m_limits.MinEdge.Z = min_z - searchdistance;
-
-	m_limits.MaxEdge.X = max_x + searchdistance;
-	m_limits.MaxEdge.Y = max_y + searchdistance;
-	m_limits.MaxEdge.Z = max_z + searchdistance;
-
-	v3s16 diff = m_limits.MaxEdge - m_limits.MinEdge;
-
-	m_max_index_x = diff.X;
-	m_max_index_y = diff.Y;
-	m_max_index_z = diff.Z;
+	v3s16 minp(MYMIN(source.X, destination.X), MYMIN(source.Y, destination.Y),
+			MYMIN(source.Z, destination.Z));
+	v3s16 maxp(MYMAX(source.X, destination.X), MYMAX(source.Y, destination.Y),
+			MYMAX(source.Z, destination.Z));
+	setLimits(minp, maxp, searchdistance);
 
-	delete m_nodes_container;
-	if (diff.getLength() > 5) {
-		m_nodes_container = new MapGridNodeContainer(this);
-	} else {
-		m_nodes_container = new ArrayGridNodeContainer(this, diff);
-	}
 #ifdef PATHFINDER_DEBUG
 	printType();
 	printCost();
@@ -716,7 +911,14 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	startpos.source    = true;
 	startpos.totalcost = 0;
 
+	//a path inside a single block doesn't benefit from the portal graph
+	if (algo == PA_HIERARCHICAL &&
+			getNodeBlockPos(source) == getNodeBlockPos(destination)) {
+		algo = PA_PLAIN;
+	}
+
 	bool update_cost_retval = false;
+	std::vector<v3s16> path;
 
 	//calculate node costs
 	switch (algo) {
@@ -727,6 +929,14 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 		case PA_PLAIN:
 			update_cost_retval = updateCostHeuristic(StartIndex, EndIndex);
 			break;
+		case PA_HIERARCHICAL:
+			if (m_cache) {
+				m_clusters = &m_cache->m_graphs[std::make_pair(m_maxjump, m_maxdrop)];
+				if (m_clusters->size() > PATHFINDER_MAX_CACHED_CLUSTERS)
+					m_clusters->clear();
+			}
+			update_cost_retval = updateCostHierarchical(source, destination, path);
+			break;
 		default:
 			ERROR_TARGET << "Missing PathAlgorithm" << std::endl;
 			break;
@@ -739,23 +949,33 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 		printPathLen();
 #endif
 
-		//find path
-		std::vector<v3s16> index_path;
-		buildPath(index_path, EndIndex);
-		//Now we have a path of index positions,
-		//and it's in reverse.
-		//The "true" start or end position might be missing
-		//since those have been given special treatment.
+		if (algo != PA_HIERARCHICAL) {
+			//find path
+			std::vector<v3s16> index_path;
+			buildPath(index_path, EndIndex);
+			//Now we have a path of index positions,
+			//and it's in reverse.
+			//The "true" start or end position might be missing
+			//since those have been given special treatment.
 
 #ifdef PATHFINDER_DEBUG
-		std::cout << "Index path:" << std::endl;
-		printPath(index_path);
+			std::cout << "Index path:" << std::endl;
+			printPath(index_path);
 #endif
+			//convert all index positions to "normal" positions
+			//and bring them into the right order
+			path.reserve(index_path.size());
+			std::vector<v3s16>::reverse_iterator rit = index_path.rbegin();
+			for (; rit != index_path.rend(); ++rit) {
+				path.push_back(getIndexElement(*rit).pos);
+			}
+		}
+
 		//from here we'll make the final changes to the path
 		std::vector<v3s16> full_path;
 
 		//calculate required size
-		int full_path_size = index_path.size();
+		int full_path_size = path.size();
 		if (source != true_source) {
 			full_path_size++;
 		}
@@ -768,12 +988,7 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 		if (source != true_source) {
 			full_path.push_back(true_source);
 		}
-		//convert all index positions to "normal" positions and insert
-		//them into full_path in reverse
-		std::vector<v3s16>::reverse_iterator rit = index_path.rbegin();
-		for (; rit != index_path.rend(); ++rit) {
-			full_path.push_back(getIndexElement(*rit).pos);
-		}
+		full_path.insert(full_path.end(), path.begin(), path.end());
 		//manually add true_destination to end of path, if needed
 		if (destination != true_destination) {
 			full_path.push_back(true_destination);
@@ -812,6 +1027,272 @@ std::vector<v3s16> Pathfinder::getPath(v3s16 source,
 	return retval;
 }
 
+/******************************************************************************/
+std::vector<std::vector<v3s16>> Pathfinder::getPaths(
+		const std::vector<v3s16> &sources,
+		v3s16 destination,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop)
+{
+	std::vector<std::vector<v3s16>> retval(sources.size());
+	if (sources.empty())
+		return retval;
+
+	//initialization
+	m_maxjump = max_jump;
+	m_maxdrop = max_drop;
+	m_destination = destination;
+	m_min_target_distance = -1;
+	m_prefetch = false;
+
+	//the search area has to contain all sources
+	v3s16 minp = destination;
+	v3s16 maxp = destination;
+	for (v3s16 source : sources) {
+		minp.X = MYMIN(minp.X, source.X);
+		minp.Y = MYMIN(minp.Y, source.Y);
+		minp.Z = MYMIN(minp.Z, source.Z);
+		maxp.X = MYMAX(maxp.X, source.X);
+		maxp.Y = MYMAX(maxp.Y, source.Y);
+		maxp.Z = MYMAX(maxp.Z, source.Z);
+	}
+	setLimits(minp, maxp, searchdistance);
+
+	if (m_ndef->get(m_map->getNode(destination)).walkable) {
+		VERBOSE_TARGET << "Destination is walkable. " <<
+				"Pos: " << PP(destination) << std::endl;
+		return retval;
+	}
+
+	v3s16 true_destination = v3s16(destination);
+	destination = walkDownwards(destination, m_maxjump);
+
+	v3s16 EndIndex = getIndexPos(destination);
+	PathGridnode &endpos = getIndexElement(EndIndex);
+	if (!endpos.valid) {
+		VERBOSE_TARGET << "Invalid stoppos " <<
+				"Index: " << PP(EndIndex) <<
+				"Realpos: " << PP(getRealPos(EndIndex)) << std::endl;
+		return retval;
+	}
+	endpos.target = true;
+
+	//mark all valid sources; the search stops once all are reached
+	std::vector<v3s16> start_indices(sources.size());
+	std::vector<bool> start_valid(sources.size(), false);
+	unsigned int num_sources = 0;
+	for (size_t i = 0; i < sources.size(); i++) {
+		if (m_ndef->get(m_map->getNode(sources[i])).walkable)
+			continue;
+
+		start_indices[i] = getIndexPos(walkDownwards(sources[i], m_maxdrop));
+		PathGridnode &startpos = getIndexElement(start_indices[i]);
+		if (!startpos.valid)
+			continue;
+
+		start_valid[i] = true;
+		if (!startpos.source) {
+			startpos.source = true;
+			num_sources++;
+		}
+	}
+
+	if (num_sources == 0)
+		return retval;
+
+	updateCostReverse(EndIndex, num_sources);
+
+	for (size_t i = 0; i < sources.size(); i++) {
+		if (!start_valid[i] || !getIndexElement(start_indices[i]).is_closed)
+			continue;
+
+		std::vector<v3s16> &path = retval[i];
+		if (getIndexElement(start_indices[i]).pos != sources[i])
+			path.push_back(sources[i]);
+
+		//follow the directions towards the destination
+		v3s16 ipos = start_indices[i];
+		for (u32 waypoints = 0; ; waypoints++) {
+			if (waypoints > PATHFINDER_MAX_WAYPOINTS) {
+				ERROR_TARGET << "Pathfinder: getPaths: path is too long "
+						"(too many waypoints), aborting" << std::endl;
+				path.clear();
+				break;
+			}
+			PathGridnode &g_pos = getIndexElement(ipos);
+			path.push_back(g_pos.pos);
+			if (ipos == EndIndex) {
+				if (destination != true_destination)
+					path.push_back(true_destination);
+				break;
+			}
+			ipos += g_pos.sourcedir;
+		}
+	}
+
+	return retval;
+}
+
+/******************************************************************************/
+bool Pathfinder::getFlowField(v3s16 destination,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop,
+		PathFlowField &field)
+{
+	//initialization
+	m_maxjump = max_jump;
+	m_maxdrop = max_drop;
+	m_destination = destination;
+	m_min_target_distance = -1;
+	m_prefetch = false;
+
+	setLimits(destination, destination, searchdistance);
+
+	field.m_destination = destination;
+	field.m_max_drop = max_drop;
+	//the nodes below the search area are checked, too
+	field.m_block_area = core::aabbox3d<s16>(
+			getNodeBlockPos(m_limits.MinEdge - v3s16(0, 1, 0)),
+			getNodeBlockPos(m_limits.MaxEdge));
+
+	//loading a block doesn't cause a MapEditEvent, so a field built
+	//with parts of the area missing is only kept for a short time
+	bool complete = true;
+	const core::aabbox3d<s16> &area = field.m_block_area;
+	for (s16 z = area.MinEdge.Z; z <= area.MaxEdge.Z && complete; z++)
+	for (s16 y = area.MinEdge.Y; y <= area.MaxEdge.Y && complete; y++)
+	for (s16 x = area.MinEdge.X; x <= area.MaxEdge.X && complete; x++) {
+		if (!m_map->getBlockNoCreateNoEx(v3s16(x, y, z)))
+			complete = false;
+	}
+
+	if (m_ndef->get(m_map->getNode(destination)).walkable) {
+		VERBOSE_TARGET << "Destination is walkable. " <<
+				"Pos: " << PP(destination) << std::endl;
+		return complete;
+	}
+
+	v3s16 surface = walkDownwards(destination, m_maxjump);
+	v3s16 EndIndex = getIndexPos(surface);
+	PathGridnode &endpos = getIndexElement(EndIndex);
+	if (!endpos.valid) {
+		VERBOSE_TARGET << "Invalid stoppos " <<
+				"Index: " << PP(EndIndex) <<
+				"Realpos: " << PP(getRealPos(EndIndex)) << std::endl;
+		return complete;
+	}
+	endpos.target = true;
+
+	std::vector<v3s16> reached;
+	updateCostReverse(EndIndex, 0, &reached);
+
+	field.m_nodes.reserve(reached.size());
+	for (v3s16 ipos : reached) {
+		PathGridnode &g_pos = getIndexElement(ipos);
+		field.m_nodes[g_pos.pos] = {g_pos.totalcost, g_pos.pos + g_pos.sourcedir};
+	}
+	//a hovering destination is reached by a final jump
+	field.m_nodes[surface].next = destination;
+
+	return complete;
+}
+
+/******************************************************************************/
+const PathFlowField::Node *PathFlowField::findNode(v3s16 &pos) const
+{
+	for (int i = 0; i <= m_max_drop; i++) {
+		auto it = m_nodes.find(pos - v3s16(0, i, 0));
+		if (it != m_nodes.end()) {
+			pos.Y -= i;
+			return &it->second;
+		}
+	}
+	return nullptr;
+}
+
+/******************************************************************************/
+bool PathFlowField::getNextStep(v3s16 pos, v3s16 &next) const
+{
+	const Node *node = findNode(pos);
+	if (!node)
+		return false;
+
+	next = node->next;
+	return true;
+}
+
+/******************************************************************************/
+int PathFlowField::getCost(v3s16 pos) const
+{
+	const Node *node = findNode(pos);
+	return node ? node->cost : -1;
+}
+
+/******************************************************************************/
+std::vector<v3s16> PathFlowField::getPath(v3s16 pos) const
+{
+	std::vector<v3s16> path;
+	v3s16 surface = pos;
+	const Node *node = findNode(surface);
+	if (!node)
+		return path;
+
+	if (surface != pos)
+		path.push_back(pos);
+	path.push_back(surface);
+
+	//the destination points to itself or to the hovering destination
+	while (node->next != surface) {
+		if (path.size() > PATHFINDER_MAX_WAYPOINTS) {
+			ERROR_TARGET << "Pathfinder: PathFlowField::getPath: path is "
+					"too long (too many waypoints), aborting" << std::endl;
+			path.clear();
+			break;
+		}
+		surface = node->next;
+		path.push_back(surface);
+
+		auto it = m_nodes.find(surface);
+		if (it == m_nodes.end())
+			break;
+		node = &it->second;
+	}
+	return path;
+}
+
+/******************************************************************************/
+bool PathFlowField::coversBlock(v3s16 blockpos) const
+{
+	return m_block_area.isPointInside(blockpos);
+}
+
+/******************************************************************************/
+void Pathfinder::setLimits(v3s16 minp, v3s16 maxp, unsigned int searchdistance)
+{
+	m_limits.MinEdge.X = minp.X - searchdistance;
+	m_limits.MinEdge.Y = minp.Y - searchdistance;
+	m_limits.MinEdge.Z = minp.Z - searchdistance;
+
+	m_limits.MaxEdge.X = maxp.X + searchdistance;
+	m_limits.MaxEdge.Y = maxp.Y + searchdistance;
+	m_limits.MaxEdge.Z = maxp.Z + searchdistance;
+
+	v3s16 diff = m_limits.MaxEdge - m_limits.MinEdge;
+
+	m_max_index_x = diff.X;
+	m_max_index_y = diff.Y;
+	m_max_index_z = diff.Z;
+
+	delete m_nodes_container;
+	if (diff.getLength() > 5) {
+		m_nodes_container = new MapGridNodeContainer(this);
+	} else {
+		m_nodes_container = new ArrayGridNodeContainer(this, diff);
+	}
+}
+
 Pathfinder::~Pathfinder()
 {
 	delete m_nodes_container;
@@ -1199,6 +1680,83 @@ bool Pathfinder::updateCostHeuristic(v3s16 isource, v3s16 idestination)
 	return false;
 }
 
+/******************************************************************************/
+bool Pathfinder::updateCostReverse(v3s16 idestination, unsigned int num_sources,
+		std::vector<v3s16> *reached)
+{
+	// Dijkstra search starting at the destination. The cost of a node is
+	// the cost of moving from it to the destination and its sourcedir
+	// points to the next node on the way there.
+	// Moves are not symmetric (max_jump != max_drop), so for every node
+	// all neighbors which reach it by a single move have to be checked.
+
+	typedef std::pair<int, v3s16> OpenEntry;
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>,
+			std::greater<OpenEntry>> openList;
+
+	// the 4 cardinal directions
+	const static v3s16 directions[4] = {
+		v3s16(1,0, 0),
+		v3s16(-1,0, 0),
+		v3s16(0,0, 1),
+		v3s16(0,0,-1)
+	};
+
+	PathGridnode &d_pos = getIndexElement(idestination);
+	d_pos.totalcost = 0;
+	d_pos.is_open = true;
+	openList.emplace(0, idestination);
+
+	while (!openList.empty()) {
+		OpenEntry current = openList.top();
+		openList.pop();
+
+		PathGridnode &g_pos = getIndexElement(current.second);
+		// skip outdated entries
+		if (g_pos.is_closed || current.first > g_pos.totalcost)
+			continue;
+
+		g_pos.is_closed = true;
+		g_pos.is_open = false;
+		if (reached)
+			reached->push_back(current.second);
+		if (g_pos.source && --num_sources == 0)
+			return true;
+
+		for (v3s16 direction_flat : directions) {
+			for (int y_change = -m_maxdrop; y_change <= m_maxjump; y_change++) {
+				v3s16 neighbor = g_pos.pos - direction_flat - v3s16(0, y_change, 0);
+				v3s16 ineighbor = getIndexPos(neighbor);
+				if (!isValidIndex(ineighbor))
+					continue;
+
+				PathGridnode &n_pos = getIndexElement(ineighbor);
+				if (!n_pos.valid || n_pos.is_closed)
+					continue;
+
+				PathCost cost = n_pos.getCost(direction_flat);
+				if (!cost.updated) {
+					cost = calcCost(neighbor, direction_flat);
+					n_pos.setCost(direction_flat, cost);
+				}
+				// the move has to end exactly at the current node
+				if (!cost.valid || cost.y_change != y_change)
+					continue;
+
+				int new_cost = g_pos.totalcost + cost.value;
+				if (n_pos.totalcost < 0 || new_cost < n_pos.totalcost) {
+					n_pos.sourcedir = current.second - ineighbor;
+					n_pos.totalcost = new_cost;
+					n_pos.is_open = true;
+					openList.emplace(new_cost, ineighbor);
+				}
+			}
+		}
+	}
+	// not all sources are reachable within searchdistance
+	return num_sources == 0;
+}
+
 /******************************************************************************/
 bool Pathfinder::buildPath(std::vector<v3s16> &path, v3s16 ipos)
 {
@@ -1267,6 +1825,331 @@ v3s16 Pathfinder::walkDownwards(v3s16 pos, unsigned int max_down) {
 	return pos;
 }
 
+/******************************************************************************/
+bool Pathfinder::isSurfaceNode(v3s16 pos)
+{
+	MapNode current = m_map->getNode(pos);
+	if (current.param0 == CONTENT_IGNORE || m_ndef->get(current).walkable)
+		return false;
+
+	MapNode below = m_map->getNode(pos + v3s16(0, -1, 0));
+	return below.param0 != CONTENT_IGNORE && m_ndef->get(below).walkable;
+}
+
+/******************************************************************************/
+core::aabbox3d<s16> Pathfinder::getClusterLimits(v3s16 blockpos)
+{
+	s16 margin = MYMAX(m_maxjump, m_maxdrop) + 1;
+	v3s16 minp = blockpos * MAP_BLOCKSIZE;
+	v3s16 maxp = minp + v3s16(MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1);
+	return core::aabbox3d<s16>(minp - v3s16(1, margin, 1),
+			maxp + v3s16(1, margin, 1));
+}
+
+/******************************************************************************/
+PathCluster &Pathfinder::getCluster(v3s16 blockpos)
+{
+	if (m_clusters) {
+		auto it = m_clusters->find(blockpos);
+		if (it != m_clusters->end())
+			return it->second;
+	}
+	auto it = m_uncached_clusters.find(blockpos);
+	if (it != m_uncached_clusters.end())
+		return it->second;
+
+	// Blocks are loaded without MapEditEvents, so only cache clusters
+	// whose neighborhood can't change that way anymore
+	bool cacheable = m_clusters != nullptr;
+	for (s16 z = -1; z <= 1 && cacheable; z++)
+	for (s16 y = -1; y <= 1 && cacheable; y++)
+	for (s16 x = -1; x <= 1 && cacheable; x++) {
+		if (!m_map->getBlockNoCreateNoEx(blockpos + v3s16(x, y, z)))
+			cacheable = false;
+	}
+
+	PathCluster &cluster = cacheable ?
+			(*m_clusters)[blockpos] : m_uncached_clusters[blockpos];
+	buildCluster(blockpos, cluster);
+	return cluster;
+}
+
+/******************************************************************************/
+void Pathfinder::buildCluster(v3s16 blockpos, PathCluster &cluster)
+{
+	// the 4 cardinal directions
+	const static v3s16 directions[4] = {
+		v3s16(1,0, 0),
+		v3s16(-1,0, 0),
+		v3s16(0,0, 1),
+		v3s16(0,0,-1)
+	};
+
+	core::aabbox3d<s16> search_limits = m_limits;
+	m_limits = getClusterLimits(blockpos);
+
+	v3s16 minp = blockpos * MAP_BLOCKSIZE;
+	v3s16 maxp = minp + v3s16(MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1);
+	core::aabbox3d<s16> block_area(minp, maxp);
+
+	// moves leaving the block, grouped by direction and target block
+	std::map<std::pair<int, v3s16>, std::vector<PathPortal>> transitions;
+
+	v3s16 pos;
+	for (pos.Z = minp.Z; pos.Z <= maxp.Z; pos.Z++)
+	for (pos.Y = minp.Y; pos.Y <= maxp.Y; pos.Y++)
+	for (pos.X = minp.X; pos.X <= maxp.X; pos.X++) {
+		if (!isSurfaceNode(pos))
+			continue;
+
+		for (int i = 0; i < 4; i++) {
+			PathCost cost = calcCost(pos, directions[i]);
+			if (!cost.valid)
+				continue;
+
+			v3s16 target = pos + directions[i];
+			target.Y += cost.y_change;
+			if (block_area.isPointInside(target))
+				continue;
+
+			PathPortal portal;
+			portal.pos = pos;
+			portal.target = target;
+			portal.cost = cost.value;
+			transitions[std::make_pair(i, getNodeBlockPos(target))].push_back(portal);
+		}
+	}
+
+	m_limits = search_limits;
+
+	// Neighboring moves over the same border form one entrance;
+	// its middle is used as the portal (like HPA*)
+	for (auto &group : transitions) {
+		std::vector<PathPortal> &moves = group.second;
+		// moves along X are lined up in Z and the other way round
+		bool along_x = group.first.first < 2;
+		auto tangent = [along_x] (const PathPortal &p) {
+			return along_x ? p.pos.Z : p.pos.X;
+		};
+		std::sort(moves.begin(), moves.end(),
+				[&tangent] (const PathPortal &a, const PathPortal &b) {
+			if (tangent(a) != tangent(b))
+				return tangent(a) < tangent(b);
+			return a.pos.Y < b.pos.Y;
+		});
+
+		size_t run_start = 0;
+		for (size_t i = 1; i <= moves.size(); i++) {
+			if (i < moves.size() &&
+					tangent(moves[i]) - tangent(moves[i - 1]) <= 1 &&
+					std::abs(moves[i].pos.Y - moves[i - 1].pos.Y) <= 1)
+				continue;
+			cluster.exits.push_back(moves[(run_start + i - 1) / 2]);
+			run_start = i;
+		}
+	}
+}
+
+/******************************************************************************/
+void Pathfinder::searchCluster(v3s16 blockpos, v3s16 source, v3s16 goal,
+		std::unordered_map<v3s16, ClusterSearchNode> &visited)
+{
+	// the 4 cardinal directions
+	const static v3s16 directions[4] = {
+		v3s16(1,0, 0),
+		v3s16(-1,0, 0),
+		v3s16(0,0, 1),
+		v3s16(0,0,-1)
+	};
+
+	core::aabbox3d<s16> search_limits = m_limits;
+	m_limits = getClusterLimits(blockpos);
+
+	v3s16 minp = blockpos * MAP_BLOCKSIZE;
+	v3s16 maxp = minp + v3s16(MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1, MAP_BLOCKSIZE - 1);
+	core::aabbox3d<s16> block_area(minp, maxp);
+
+	typedef std::pair<int, v3s16> OpenEntry;
+	auto compare = [] (const OpenEntry &a, const OpenEntry &b) {
+		return a.first > b.first;
+	};
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>, decltype(compare)>
+			openList(compare);
+
+	visited[source] = {0, source};
+	openList.push(OpenEntry(0, source));
+
+	while (!openList.empty()) {
+		OpenEntry current = openList.top();
+		openList.pop();
+		if (current.first > visited[current.second].cost)
+			continue;
+		if (current.second == goal)
+			break;
+
+		for (v3s16 direction : directions) {
+			PathCost cost = calcCost(current.second, direction);
+			if (!cost.valid)
+				continue;
+
+			v3s16 neighbor = current.second + direction;
+			neighbor.Y += cost.y_change;
+			if (!block_area.isPointInside(neighbor))
+				continue;
+
+			int new_cost = current.first + cost.value;
+			auto it = visited.find(neighbor);
+			if (it != visited.end() && it->second.cost <= new_cost)
+				continue;
+			visited[neighbor] = {new_cost, current.second};
+			openList.push(OpenEntry(new_cost, neighbor));
+		}
+	}
+
+	m_limits = search_limits;
+}
+
+/******************************************************************************/
+const std::vector<std::pair<u16, int>> &Pathfinder::getClusterEdges(
+		v3s16 blockpos, PathCluster &cluster, v3s16 source)
+{
+	auto it = cluster.edges.find(source);
+	if (it != cluster.edges.end())
+		return it->second;
+
+	if (cluster.edges.size() >= PATHFINDER_MAX_CLUSTER_SOURCES)
+		cluster.edges.clear();
+
+	std::unordered_map<v3s16, ClusterSearchNode> visited;
+	// no goal, the whole reachable part of the block is needed
+	searchCluster(blockpos, source, v3s16(S16_MAX, S16_MAX, S16_MAX), visited);
+
+	std::vector<std::pair<u16, int>> &edges = cluster.edges[source];
+	for (size_t i = 0; i < cluster.exits.size(); i++) {
+		auto reached = visited.find(cluster.exits[i].pos);
+		if (reached != visited.end())
+			edges.emplace_back(i, reached->second.cost);
+	}
+	return edges;
+}
+
+/******************************************************************************/
+bool Pathfinder::updateCostHierarchical(v3s16 source, v3s16 destination,
+		std::vector<v3s16> &path)
+{
+	// A* search over portals. Nodes of the abstract graph are the start,
+	// the destination and the portal positions (and their targets).
+
+	struct AbstractNode {
+		int   cost;
+		v3s16 parent;
+		bool  is_closed;
+	};
+	std::unordered_map<v3s16, AbstractNode> nodes;
+
+	typedef std::pair<int, v3s16> OpenEntry;
+	auto compare = [] (const OpenEntry &a, const OpenEntry &b) {
+		return a.first > b.first;
+	};
+	std::priority_queue<OpenEntry, std::vector<OpenEntry>, decltype(compare)>
+			openList(compare);
+
+	auto relax = [&] (v3s16 from, v3s16 to, int cost) {
+		// the search distance limits the abstract graph, too
+		if (!m_limits.isPointInside(to))
+			return;
+		auto it = nodes.find(to);
+		if (it != nodes.end() && (it->second.is_closed || it->second.cost <= cost))
+			return;
+		nodes[to] = {cost, from, false};
+		openList.push(OpenEntry(cost + getXZManhattanDist(to), to));
+	};
+
+	v3s16 goal_block = getNodeBlockPos(destination);
+	nodes[source] = {0, source, false};
+	openList.push(OpenEntry(getXZManhattanDist(source), source));
+
+	bool found = false;
+	while (!openList.empty()) {
+		v3s16 current_pos = openList.top().second;
+		openList.pop();
+
+		AbstractNode &node = nodes[current_pos];
+		if (node.is_closed)
+			continue;
+		node.is_closed = true;
+		int current_cost = node.cost;
+
+		if (current_pos == destination) {
+			found = true;
+			break;
+		}
+
+		v3s16 blockpos = getNodeBlockPos(current_pos);
+		PathCluster &cluster = getCluster(blockpos);
+
+		// inside the block to all reachable exits
+		for (const std::pair<u16, int> &edge : getClusterEdges(blockpos, cluster, current_pos))
+			relax(current_pos, cluster.exits[edge.first].pos, current_cost + edge.second);
+
+		// through the exits at this position into the next block
+		for (const PathPortal &exit : cluster.exits) {
+			if (exit.pos == current_pos)
+				relax(current_pos, exit.target, current_cost + exit.cost);
+		}
+
+		// inside the destination block to the destination itself
+		if (blockpos == goal_block) {
+			std::unordered_map<v3s16, ClusterSearchNode> visited;
+			searchCluster(blockpos, current_pos, destination, visited);
+			auto reached = visited.find(destination);
+			if (reached != visited.end())
+				relax(current_pos, destination, current_cost + reached->second.cost);
+		}
+	}
+
+	if (!found) {
+		// no path found; all reachable portals within searchdistance have been exhausted
+		return false;
+	}
+
+	// collect the abstract path
+	std::vector<v3s16> abstract_path;
+	for (v3s16 pos = destination; ; pos = nodes[pos].parent) {
+		abstract_path.push_back(pos);
+		if (pos == source)
+			break;
+	}
+	std::reverse(abstract_path.begin(), abstract_path.end());
+
+	// refine it: moves between blocks are single steps already,
+	// moves inside a block are searched again at node level
+	path.push_back(source);
+	for (size_t i = 1; i < abstract_path.size(); i++) {
+		v3s16 from = abstract_path[i - 1];
+		v3s16 to = abstract_path[i];
+		v3s16 blockpos = getNodeBlockPos(from);
+		if (blockpos != getNodeBlockPos(to)) {
+			path.push_back(to);
+			continue;
+		}
+
+		std::unordered_map<v3s16, ClusterSearchNode> visited;
+		searchCluster(blockpos, from, to, visited);
+		if (visited.find(to) == visited.end()) {
+			ERROR_TARGET << "updateCostHierarchical: lost path inside block "
+					<< PP(blockpos) << std::endl;
+			return false;
+		}
+
+		size_t segment_start = path.size();
+		for (v3s16 pos = to; pos != from; pos = visited[pos].parent)
+			path.push_back(pos);
+		std::reverse(path.begin() + segment_start, path.end());
+	}
+	return true;
+}
+
 #ifdef PATHFINDER_DEBUG
 
 /******************************************************************************/
@@ -22,8 +22,13 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 /******************************************************************************/
 /* Includes                                                                   */
 /******************************************************************************/
+#include <map>
+#include <memory>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 #include "irr_v3d.h"
+#include "map.h"
 
 /******************************************************************************/
 /* Forward declarations                                                       */
@@ -31,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 class NodeDefManager;
 class Map;
+class Pathfinder;
 
 /******************************************************************************/
 /* Typedefs and macros                                                        */
@@ -47,9 +53,116 @@ typedef enum {
 typedef enum {
 	PA_DIJKSTRA,           /**< Dijkstra shortest path algorithm             */
 	PA_PLAIN,            /**< A* algorithm using heuristics to find a path */
-	PA_PLAIN_NP          /**< A* algorithm without prefetching of map data */
+	PA_PLAIN_NP,         /**< A* algorithm without prefetching of map data */
+	PA_HIERARCHICAL      /**< A* over cached per-MapBlock portals (HPA*)   */
 } PathAlgorithm;
 
+/** exit of a MapBlock: a move from a node inside the block to one outside */
+struct PathPortal {
+	v3s16 pos;                   /**< walkable node inside the block        */
+	v3s16 target;                /**< walkable node reached outside         */
+	int   cost = 0;              /**< cost of the move                      */
+};
+
+/** cached abstract graph data of a single MapBlock */
+struct PathCluster {
+	std::vector<PathPortal> exits;
+
+	/** lazily computed intra-block edges:
+	 *  source node -> (index into exits, cost) for every reachable exit */
+	std::unordered_map<v3s16, std::vector<std::pair<u16, int>>> edges;
+};
+
+/**
+ * Integration field of a destination: cost and next step towards the
+ * destination for every surface node which can reach it within the
+ * search area.
+ */
+class PathFlowField {
+public:
+	/**
+	 * get the next position on the way to the destination
+	 * @param pos current position, may hover up to max_drop nodes
+	 * @param next receives the next position
+	 * @return true/false pos is able to reach the destination
+	 */
+	bool getNextStep(v3s16 pos, v3s16 &next) const;
+
+	/**
+	 * get the cost of moving from pos to the destination
+	 * @param pos surface position
+	 * @return cost or -1 if the destination can't be reached
+	 */
+	int getCost(v3s16 pos) const;
+
+	/**
+	 * follow the field from pos to the destination
+	 * @param pos start position
+	 * @return path including pos, empty if there is none
+	 */
+	std::vector<v3s16> getPath(v3s16 pos) const;
+
+	/** check if nodes of a MapBlock were taken into account */
+	bool coversBlock(v3s16 blockpos) const;
+
+	v3s16 getDestination() const { return m_destination; }
+
+private:
+	friend class Pathfinder;
+
+	struct Node {
+		int   cost;                  /**< cost to reach the destination */
+		v3s16 next;                  /**< next position on the way      */
+	};
+
+	/** find the surface node at or up to m_max_drop nodes below pos */
+	const Node *findNode(v3s16 &pos) const;
+
+	v3s16 m_destination;
+	int   m_max_drop = 0;
+	core::aabbox3d<s16> m_block_area; /**< covered MapBlocks             */
+	std::unordered_map<v3s16, Node> m_nodes;
+};
+
+/**
+ * Cache of the block-level portal graph used by PA_HIERARCHICAL
+ * and of flow fields.
+ * Clusters are built on demand and dropped again when a MapEditEvent
+ * touches the block or one of its neighbors. Flow fields are dropped
+ * when a MapEditEvent touches any block they cover. Loading a block
+ * doesn't cause a MapEditEvent, so fields built while parts of their
+ * area were missing expire after a short time.
+ */
+class PathfinderCache : public MapEventReceiver {
+public:
+	void onMapEditEvent(const MapEditEvent &event) override;
+
+	/** drop all cached data */
+	void clear() { m_graphs.clear(); m_flow_fields.clear(); }
+
+private:
+	friend class Pathfinder;
+	friend std::shared_ptr<const PathFlowField> get_flow_field(Map *map,
+			const NodeDefManager *ndef, v3s16 destination,
+			unsigned int searchdistance, unsigned int max_jump,
+			unsigned int max_drop, PathfinderCache *cache);
+
+	/** clusters depend on the movement capabilities, so there is one
+	 *  graph per (max_jump, max_drop) pair */
+	typedef std::unordered_map<v3s16, PathCluster> ClusterMap;
+	std::map<std::pair<int, int>, ClusterMap> m_graphs;
+
+	/** (destination, searchdistance, max_jump, max_drop) */
+	typedef std::tuple<v3s16, unsigned int, unsigned int, unsigned int> FlowFieldKey;
+	struct CachedFlowField {
+		std::shared_ptr<const PathFlowField> field;
+		/** time (ms) at which a field built with unloaded blocks is
+		 *  rebuilt, 0 if the whole area was loaded */
+		u64 expiry;
+	};
+	std::map<FlowFieldKey, CachedFlowField> m_flow_fields;
+};
+
 /******************************************************************************/
 /* declarations                                                               */
 /******************************************************************************/
@@ -61,4 +174,22 @@ std::vector<v3s16> get_path(Map *map, const NodeDefManager *ndef,
 		unsigned int searchdistance,
 		unsigned int max_jump,
 		unsigned int max_drop,
-		PathAlgorithm algo);
+		PathAlgorithm algo,
+		PathfinderCache *cache = nullptr);
+
+/** find paths from many sources to one destination with a single search */
+std::vector<std::vector<v3s16>> get_paths(Map *map, const NodeDefManager *ndef,
+		const std::vector<v3s16> &sources,
+		v3s16 destination,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop);
+
+/** get the flow field of a destination, computing it if necessary */
+std::shared_ptr<const PathFlowField> get_flow_field(Map *map,
+		const NodeDefManager *ndef,
+		v3s16 destination,
+		unsigned int searchdistance,
+		unsigned int max_jump,
+		unsigned int max_drop,
+		PathfinderCache *cache = nullptr);
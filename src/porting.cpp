@@ -93,6 +93,13 @@ bool *signal_handler_killstatus()
 	return &g_killed;
 }
 
+bool g_trace_requested = false;
+
+bool *signal_handler_tracestatus()
+{
+	return &g_trace_requested;
+}
+
 #if !defined(_WIN32) // POSIX
 	#include <signal.h>
 
@@ -118,10 +125,16 @@ void signal_handler(int sig)
 	}
 }
 
+void trace_signal_handler(int sig)
+{
+	g_trace_requested = true;
+}
+
 void signal_handler_init(void)
 {
 	(void)signal(SIGINT, signal_handler);
 	(void)signal(SIGTERM, signal_handler);
+	(void)signal(SIGUSR1, trace_signal_handler);
 }
 
 #else // _WIN32
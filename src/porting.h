@@ -131,6 +131,9 @@ void signal_handler_init();
 // Returns a pointer to a bool.
 // When the bool is true, program should quit.
 bool * signal_handler_killstatus();
+// Returns a pointer to a bool.
+// When the bool is true, the engine trace should be written (SIGUSR1).
+bool * signal_handler_tracestatus();
 
 /*
 	Path of static data directory.
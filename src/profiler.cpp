@@ -17,113 +17,282 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 */
 
+#include <algorithm>
 #include "profiler.h"
 #include "porting.h"
+#include "log.h"
+#include "util/serialize.h"
+#include "util/string.h"
 
 static Profiler main_profiler;
 Profiler *g_profiler = &main_profiler;
+
+// Counter receiving the values of counters beyond the id limit
+static const Profiler::Id PROFILER_OVERFLOW_ID = 0;
+
 ScopeProfiler::ScopeProfiler(
 		Profiler *profiler, const std::string &name, ScopeProfilerType type) :
-		m_profiler(profiler),
-		m_name(name), m_type(type)
+		m_profiler(profiler), m_type(type)
+{
+	if (m_profiler) {
+		m_id = m_profiler->getId(name + " [ms]");
+		m_start_us = porting::getTimeUs();
+	}
+}
+
+ScopeProfiler::ScopeProfiler(
+		Profiler *profiler, const char *name, ScopeProfilerType type) :
+		m_profiler(profiler), m_type(type)
 {
-	m_name.append(" [ms]");
-	if (m_profiler)
-		m_timer = new TimeTaker(m_name, nullptr, PRECISION_MILLI);
+	if (m_profiler) {
+		m_id = m_profiler->getLiteralId(name, true);
+		m_start_us = porting::getTimeUs();
+	}
 }
 
 ScopeProfiler::~ScopeProfiler()
 {
-	if (!m_timer)
+	if (!m_profiler)
 		return;
 
-	float duration_ms = m_timer->stop(true);
-	float duration = duration_ms;
-	if (m_profiler) {
-		switch (m_type) {
-		case SPT_ADD:
-			m_profiler->add(m_name, duration);
-			break;
-		case SPT_AVG:
-			m_profiler->avg(m_name, duration);
-			break;
-		case SPT_GRAPH_ADD:
-			m_profiler->graphAdd(m_name, duration);
-			break;
-		}
+	u64 end_us = porting::getTimeUs();
+	if (m_profiler->isTracing())
+		m_profiler->traceSpan(m_id, m_start_us, end_us);
+
+	float duration = (end_us - m_start_us) / 1000.0f;
+	switch (m_type) {
+	case SPT_ADD:
+		m_profiler->add(m_id, duration);
+		break;
+	case SPT_AVG:
+		m_profiler->avg(m_id, duration);
+		break;
+	case SPT_GRAPH_ADD:
+		m_profiler->graphAdd(m_id, duration);
+		break;
 	}
-	delete m_timer;
+}
+
+Profiler::ThreadBuffer::~ThreadBuffer()
+{
+	for (auto &chunk : chunks)
+		delete[] chunk.load();
 }
 
 Profiler::Profiler()
 {
 	m_start_time = porting::getTimeMs();
+	getId("Profiler: too many counters");
+}
+
+Profiler::~Profiler()
+{
+	// Threads drop their buffers once they notice
+	for (auto &buffer : m_buffers)
+		buffer->orphaned = true;
 }
 
-void Profiler::add(const std::string &name, float value)
+Profiler::Id Profiler::getId(const std::string &name)
 {
 	MutexAutoLock lock(m_mutex);
+	auto it = m_ids.find(name);
+	if (it != m_ids.end())
+		return it->second;
+
+	if (m_counters.size() >= SLOT_CHUNK_SIZE * MAX_SLOT_CHUNKS)
+		return PROFILER_OVERFLOW_ID;
+
+	Id id = m_counters.size();
+	m_counters.emplace_back();
+	m_counters.back().name = name;
+	m_ids[name] = id;
+	return id;
+}
+
+Profiler::Id Profiler::getLiteralId(const char *name, bool scope)
+{
+	ThreadBuffer *buffer = getThreadBuffer();
+	auto &ids = scope ? buffer->scope_literal_ids : buffer->literal_ids;
+	auto it = ids.find(name);
+	if (it != ids.end())
+		return it->second;
+
+	Id id = getId(scope ? std::string(name) + " [ms]" : std::string(name));
+	ids[name] = id;
+	return id;
+}
+
+Profiler::ThreadBuffer *Profiler::getThreadBuffer()
+{
+	struct ThreadBuffers
 	{
-		/* No average shall have been used; mark add used as -2 */
-		std::map<std::string, int>::iterator n = m_avgcounts.find(name);
-		if (n == m_avgcounts.end()) {
-			m_avgcounts[name] = -2;
+		~ThreadBuffers()
+		{
+			for (auto &it : list)
+				it.second->in_use = false;
+		}
+
+		std::vector<std::pair<const Profiler *, std::shared_ptr<ThreadBuffer>>> list;
+	};
+	thread_local ThreadBuffers t_buffers;
+	thread_local const Profiler *t_last_profiler = nullptr;
+	thread_local ThreadBuffer *t_last_buffer = nullptr;
+
+	if (t_last_profiler == this && !t_last_buffer->orphaned.load(std::memory_order_relaxed))
+		return t_last_buffer;
+
+	// Forget the buffers of destroyed profilers, another one may live at
+	// the same address now
+	auto &list = t_buffers.list;
+	for (size_t i = 0; i < list.size();) {
+		if (list[i].second->orphaned) {
+			list[i] = std::move(list.back());
+			list.pop_back();
 		} else {
-			if (n->second == -1)
-				n->second = -2;
-			assert(n->second == -2);
+			i++;
 		}
 	}
-	{
-		std::map<std::string, float>::iterator n = m_data.find(name);
-		if (n == m_data.end())
-			m_data[name] = value;
-		else
-			n->second += value;
+
+	std::shared_ptr<ThreadBuffer> buffer;
+	for (auto &it : list) {
+		if (it.first == this)
+			buffer = it.second;
 	}
+
+	if (!buffer) {
+		MutexAutoLock lock(m_mutex);
+		// Take over the buffer of a finished thread if possible
+		for (auto &b : m_buffers) {
+			bool in_use = false;
+			if (b->in_use.compare_exchange_strong(in_use, true)) {
+				buffer = b;
+				break;
+			}
+		}
+		if (!buffer) {
+			buffer = std::make_shared<ThreadBuffer>();
+			m_buffers.push_back(buffer);
+		}
+		list.emplace_back(this, buffer);
+	}
+
+	t_last_profiler = this;
+	t_last_buffer = buffer.get();
+	return t_last_buffer;
 }
 
-void Profiler::avg(const std::string &name, float value)
+Profiler::Slot &Profiler::getSlot(Id id)
 {
-	MutexAutoLock lock(m_mutex);
-	int &count = m_avgcounts[name];
+	ThreadBuffer *buffer = getThreadBuffer();
+	std::atomic<Slot *> &chunk = buffer->chunks[id / SLOT_CHUNK_SIZE];
+	Slot *slots = chunk.load(std::memory_order_acquire);
+	if (!slots) {
+		slots = new Slot[SLOT_CHUNK_SIZE];
+		chunk.store(slots, std::memory_order_release);
+	}
+	return slots[id % SLOT_CHUNK_SIZE];
+}
+
+// Only the owning thread writes to a slot, so no read-modify-write is needed
+template <typename T>
+static inline void accumulate(std::atomic<T> &a, T value)
+{
+	a.store(a.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+void Profiler::add(Id id, float value)
+{
+	Slot &slot = getSlot(id);
+	accumulate<double>(slot.sum, value);
+	accumulate<u64>(slot.adds, 1);
+}
 
-	assert(count != -2);
-	count = MYMAX(count, 0) + 1;
-	m_data[name] += value;
+void Profiler::avg(Id id, float value)
+{
+	Slot &slot = getSlot(id);
+	accumulate<double>(slot.sum, value);
+	accumulate<u64>(slot.avgs, 1);
+}
+
+void Profiler::graphAdd(Id id, float value)
+{
+	Slot &slot = getSlot(id);
+	accumulate<double>(slot.graph_sum, value);
+	accumulate<u64>(slot.graph_adds, 1);
+}
+
+Profiler::Id Profiler::findId(const std::string &name) const
+{
+	auto it = m_ids.find(name);
+	return it != m_ids.end() ? it->second : PROFILER_OVERFLOW_ID;
+}
+
+Profiler::Totals Profiler::getTotals(Id id) const
+{
+	Totals totals;
+	for (const auto &buffer : m_buffers) {
+		const Slot *slots = buffer->chunks[id / SLOT_CHUNK_SIZE].load(
+				std::memory_order_acquire);
+		if (!slots)
+			continue;
+		const Slot &slot = slots[id % SLOT_CHUNK_SIZE];
+		totals.sum += slot.sum.load(std::memory_order_relaxed);
+		totals.adds += slot.adds.load(std::memory_order_relaxed);
+		totals.avgs += slot.avgs.load(std::memory_order_relaxed);
+		totals.graph_sum += slot.graph_sum.load(std::memory_order_relaxed);
+		totals.graph_adds += slot.graph_adds.load(std::memory_order_relaxed);
+	}
+	return totals;
+}
+
+bool Profiler::isListed(Counter &counter, const Totals &totals) const
+{
+	if (totals.adds + totals.avgs > counter.base.adds + counter.base.avgs)
+		counter.listed = true;
+	return counter.listed;
 }
 
 void Profiler::clear()
 {
 	MutexAutoLock lock(m_mutex);
-	for (auto &it : m_data) {
-		it.second = 0;
+	for (Id id = 0; id < m_counters.size(); id++) {
+		Counter &counter = m_counters[id];
+		Totals totals = getTotals(id);
+		isListed(counter, totals);
+		totals.graph_sum = counter.base.graph_sum;
+		totals.graph_adds = counter.base.graph_adds;
+		counter.base = totals;
 	}
-	m_avgcounts.clear();
 	m_start_time = porting::getTimeMs();
 }
 
 float Profiler::getValue(const std::string &name) const
 {
-	auto numerator = m_data.find(name);
-	if (numerator == m_data.end())
+	MutexAutoLock lock(m_mutex);
+	Id id = findId(name);
+	if (id == PROFILER_OVERFLOW_ID)
 		return 0.f;
 
-	auto denominator = m_avgcounts.find(name);
-	if (denominator != m_avgcounts.end()) {
-		if (denominator->second >= 1)
-			return numerator->second / denominator->second;
-	}
+	const Counter &counter = m_counters[id];
+	Totals totals = getTotals(id);
+	float value = totals.sum - counter.base.sum;
+	u64 count = totals.avgs - counter.base.avgs;
+	if (count >= 1)
+		return value / count;
 
-	return numerator->second;
+	return value;
 }
 
 int Profiler::getAvgCount(const std::string &name) const
 {
-	auto n = m_avgcounts.find(name);
+	MutexAutoLock lock(m_mutex);
+	Id id = findId(name);
+	if (id == PROFILER_OVERFLOW_ID)
+		return 1;
 
-	if (n != m_avgcounts.end() && n->second >= 1)
-		return n->second;
+	u64 count = getTotals(id).avgs - m_counters[id].base.avgs;
+	if (count >= 1)
+		return count;
 
 	return 1;
 }
@@ -164,10 +333,22 @@ void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
 {
 	MutexAutoLock lock(m_mutex);
 
+	// Values of the listed counters, sorted by name
+	GraphValues data;
+	for (Id id = 0; id < m_counters.size(); id++) {
+		Counter &counter = m_counters[id];
+		Totals totals = getTotals(id);
+		if (!isListed(counter, totals))
+			continue;
+
+		u64 count = totals.avgs - counter.base.avgs;
+		data[counter.name] = (totals.sum - counter.base.sum) / MYMAX(count, 1);
+	}
+
 	u32 minindex, maxindex;
-	paging(m_data.size(), page, pagecount, minindex, maxindex);
+	paging(data.size(), page, pagecount, minindex, maxindex);
 
-	for (const auto &i : m_data) {
+	for (const auto &i : data) {
 		if (maxindex == 0)
 			break;
 		maxindex--;
@@ -177,6 +358,148 @@ void Profiler::getPage(GraphValues &o, u32 page, u32 pagecount)
 			continue;
 		}
 
-		o[i.first] = i.second / getAvgCount(i.first);
+		o[i.first] = i.second;
+	}
+}
+
+void Profiler::graphGet(GraphValues &result)
+{
+	MutexAutoLock lock(m_mutex);
+	result.clear();
+	for (Id id = 0; id < m_counters.size(); id++) {
+		Counter &counter = m_counters[id];
+		Totals totals = getTotals(id);
+		if (totals.graph_adds == counter.base.graph_adds)
+			continue;
+
+		result[counter.name] = totals.graph_sum - counter.base.graph_sum;
+		counter.base.graph_sum = totals.graph_sum;
+		counter.base.graph_adds = totals.graph_adds;
+	}
+}
+
+void Profiler::remove(const std::string &name)
+{
+	MutexAutoLock lock(m_mutex);
+	Id id = findId(name);
+	if (id == PROFILER_OVERFLOW_ID)
+		return;
+
+	Counter &counter = m_counters[id];
+	Totals totals = getTotals(id);
+	totals.graph_sum = counter.base.graph_sum;
+	totals.graph_adds = counter.base.graph_adds;
+	counter.base = totals;
+	counter.listed = false;
+}
+
+/*
+	Tracing
+*/
+
+// Names of the threads which recorded spans, by trace thread number
+static std::mutex s_trace_threads_mutex;
+static std::vector<std::string> s_trace_threads;
+
+u32 Profiler::getTraceThread()
+{
+	thread_local u32 t_thread = 0;
+	if (t_thread == 0) {
+		std::lock_guard<std::mutex> lock(s_trace_threads_mutex);
+		s_trace_threads.push_back(g_logger.getThreadName());
+		t_thread = s_trace_threads.size();
+	}
+	return t_thread;
+}
+
+void Profiler::startTracing(size_t capacity)
+{
+	if (capacity == 0 || m_trace_events)
+		return;
+
+	m_trace_events.reset(new TraceEvent[capacity]);
+	m_trace_capacity = capacity;
+	m_tracing.store(true, std::memory_order_release);
+}
+
+void Profiler::traceSpan(Id id, u64 start_us, u64 end_us)
+{
+	u64 n = m_trace_next.fetch_add(1, std::memory_order_relaxed);
+	TraceEvent &event = m_trace_events[n % m_trace_capacity];
+
+	// Mark the event as being written while filling it in
+	event.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	event.start_us.store(start_us, std::memory_order_relaxed);
+	event.duration_us.store(end_us - start_us, std::memory_order_relaxed);
+	event.id.store(id, std::memory_order_relaxed);
+	event.thread.store(getTraceThread(), std::memory_order_relaxed);
+	event.seq.store(n + 1, std::memory_order_release);
+}
+
+size_t Profiler::writeTrace(std::ostream &os)
+{
+	if (!isTracing())
+		return 0;
+
+	struct Span
+	{
+		u64 start_us;
+		u32 duration_us;
+		Id id;
+		u32 thread;
+	};
+	std::vector<Span> spans;
+	spans.reserve(m_trace_capacity);
+	for (size_t i = 0; i < m_trace_capacity; i++) {
+		TraceEvent &event = m_trace_events[i];
+		u64 seq = event.seq.load(std::memory_order_acquire);
+		if (seq == 0)
+			continue;
+		Span span;
+		span.start_us = event.start_us.load(std::memory_order_relaxed);
+		span.duration_us = event.duration_us.load(std::memory_order_relaxed);
+		span.id = event.id.load(std::memory_order_relaxed);
+		span.thread = event.thread.load(std::memory_order_relaxed);
+		// Skip events overwritten while reading them
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (event.seq.load(std::memory_order_relaxed) != seq)
+			continue;
+		spans.push_back(span);
+	}
+	std::sort(spans.begin(), spans.end(), [] (const Span &a, const Span &b) {
+		return a.start_us < b.start_us;
+	});
+
+	std::vector<std::string> names;
+	{
+		MutexAutoLock lock(m_mutex);
+		for (const Counter &counter : m_counters) {
+			std::string name = counter.name;
+			if (str_ends_with(name, " [ms]"))
+				name.resize(name.size() - 5);
+			names.push_back(serializeJsonString(name));
+		}
+	}
+
+	os << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+	bool first = true;
+	{
+		std::lock_guard<std::mutex> lock(s_trace_threads_mutex);
+		for (size_t i = 0; i < s_trace_threads.size(); i++) {
+			os << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\","
+				<< "\"pid\":1,\"tid\":" << i + 1 << ",\"args\":{\"name\":"
+				<< serializeJsonString(s_trace_threads[i]) << "}}";
+			first = false;
+		}
+	}
+	for (const Span &span : spans) {
+		os << (first ? "" : ",") << "\n{\"name\":" << names[span.id]
+			<< ",\"ph\":\"X\",\"pid\":1,\"tid\":" << span.thread
+			<< ",\"ts\":" << span.start_us << ",\"dur\":" << span.duration_us << "}";
+		first = false;
 	}
+	os << "\n]}\n";
+
+	return spans.size();
 }
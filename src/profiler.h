@@ -20,10 +20,15 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include "irrlichttypes.h"
+#include <atomic>
 #include <cassert>
 #include <string>
 #include <map>
+#include <memory>
+#include <mutex>
 #include <ostream>
+#include <unordered_map>
+#include <vector>
 
 #include "threading/mutex_auto_lock.h"
 #include "util/timetaker.h"
@@ -35,15 +40,41 @@ extern Profiler *g_profiler;
 
 /*
 	Time profiler
+
+	Counters are interned to ids. Each thread accumulates into its own
+	buffer without locking, the buffers are merged when reading.
+	Hot code should look up the id once with getId(). The const char *
+	overloads cache the id per thread by the address of the name, so they
+	must only be given string literals.
+
+	Optionally the spans of all ScopeProfilers are recorded into a ring
+	buffer as well, which can be written out in the Chrome trace format
+	(chrome://tracing, ui.perfetto.dev).
 */
 
 class Profiler
 {
 public:
+	typedef u32 Id;
+
 	Profiler();
+	~Profiler();
+
+	// Registers the counter if it does not exist yet
+	Id getId(const std::string &name);
+
+	void add(Id id, float value);
+	void avg(Id id, float value);
+	void graphAdd(Id id, float value);
+
+	void add(const std::string &name, float value) { add(getId(name), value); }
+	void avg(const std::string &name, float value) { avg(getId(name), value); }
+	void graphAdd(const std::string &name, float value) { graphAdd(getId(name), value); }
+
+	void add(const char *name, float value) { add(getLiteralId(name, false), value); }
+	void avg(const char *name, float value) { avg(getLiteralId(name, false), value); }
+	void graphAdd(const char *name, float value) { graphAdd(getLiteralId(name, false), value); }
 
-	void add(const std::string &name, float value);
-	void avg(const std::string &name, float value);
 	void clear();
 
 	float getValue(const std::string &name) const;
@@ -56,36 +87,98 @@ class Profiler
 	int print(std::ostream &o, u32 page = 1, u32 pagecount = 1);
 	void getPage(GraphValues &o, u32 page, u32 pagecount);
 
+	void graphGet(GraphValues &result);
 
-	void graphAdd(const std::string &id, float value)
-	{
-		MutexAutoLock lock(m_mutex);
-		std::map<std::string, float>::iterator i =
-				m_graphvalues.find(id);
-		if(i == m_graphvalues.end())
-			m_graphvalues[id] = value;
-		else
-			i->second += value;
-	}
-	void graphGet(GraphValues &result)
-	{
-		MutexAutoLock lock(m_mutex);
-		result = m_graphvalues;
-		m_graphvalues.clear();
-	}
+	void remove(const std::string &name);
 
-	void remove(const std::string& name)
-	{
-		MutexAutoLock lock(m_mutex);
-		m_avgcounts.erase(name);
-		m_data.erase(name);
-	}
+	// Keeps the last `capacity` spans. Must be called before any thread
+	// records spans, and only once.
+	void startTracing(size_t capacity);
+	bool isTracing() const { return m_tracing.load(std::memory_order_acquire); }
+	void traceSpan(Id id, u64 start_us, u64 end_us);
+	// Returns the number of spans written
+	size_t writeTrace(std::ostream &os);
 
 private:
-	std::mutex m_mutex;
-	std::map<std::string, float> m_data;
-	std::map<std::string, int> m_avgcounts;
-	std::map<std::string, float> m_graphvalues;
+	friend class ScopeProfiler;
+
+	// Accumulated by one thread, only ever growing
+	struct Slot
+	{
+		std::atomic<double> sum{0};
+		std::atomic<u64> adds{0};
+		std::atomic<u64> avgs{0};
+		std::atomic<double> graph_sum{0};
+		std::atomic<u64> graph_adds{0};
+	};
+
+	static const u32 SLOT_CHUNK_SIZE = 256;
+	static const u32 MAX_SLOT_CHUNKS = 1024;
+
+	struct ThreadBuffer
+	{
+		~ThreadBuffer();
+
+		std::atomic<Slot *> chunks[MAX_SLOT_CHUNKS] = {};
+		// Owned by a running thread
+		std::atomic<bool> in_use{true};
+		// The profiler has been destroyed
+		std::atomic<bool> orphaned{false};
+		// Ids of string literals, only used by the owning thread
+		std::unordered_map<const char *, Id> literal_ids;
+		std::unordered_map<const char *, Id> scope_literal_ids;
+	};
+
+	// The totals of all threads, as seen by the reader
+	struct Totals
+	{
+		double sum = 0;
+		u64 adds = 0;
+		u64 avgs = 0;
+		double graph_sum = 0;
+		u64 graph_adds = 0;
+	};
+
+	// Reader state of a counter
+	struct Counter
+	{
+		std::string name;
+		// Totals at the last clear(), remove() or graphGet()
+		Totals base;
+		// Shown by print() even if unchanged since the last clear()
+		bool listed = false;
+	};
+
+	ThreadBuffer *getThreadBuffer();
+	Slot &getSlot(Id id);
+	Id getLiteralId(const char *name, bool scope);
+
+	// These expect m_mutex to be locked
+	Id findId(const std::string &name) const;
+	Totals getTotals(Id id) const;
+	bool isListed(Counter &counter, const Totals &totals) const;
+
+	// A recorded span, seq tells whether it is complete
+	struct TraceEvent
+	{
+		std::atomic<u64> seq{0};
+		std::atomic<u64> start_us{0};
+		std::atomic<u32> duration_us{0};
+		std::atomic<Id> id{0};
+		std::atomic<u32> thread{0};
+	};
+
+	static u32 getTraceThread();
+
+	std::unique_ptr<TraceEvent[]> m_trace_events;
+	size_t m_trace_capacity = 0;
+	std::atomic<u64> m_trace_next{0};
+	std::atomic<bool> m_tracing{false};
+
+	mutable std::mutex m_mutex;
+	std::unordered_map<std::string, Id> m_ids;
+	std::vector<Counter> m_counters;
+	std::vector<std::shared_ptr<ThreadBuffer>> m_buffers;
 	u64 m_start_time;
 };
 
@@ -95,15 +188,18 @@ enum ScopeProfilerType{
 	SPT_GRAPH_ADD
 };
 
+// Adds the time spent in the scope, in milliseconds, to "<name> [ms]"
 class ScopeProfiler
 {
 public:
 	ScopeProfiler(Profiler *profiler, const std::string &name,
 			ScopeProfilerType type = SPT_ADD);
+	ScopeProfiler(Profiler *profiler, const char *name,
+			ScopeProfilerType type = SPT_ADD);
 	~ScopeProfiler();
 private:
 	Profiler *m_profiler = nullptr;
-	std::string m_name;
-	TimeTaker *m_timer = nullptr;
+	Profiler::Id m_id = 0;
 	enum ScopeProfilerType m_type;
+	u64 m_start_us = 0;
 };
@@ -257,6 +257,48 @@ void ScriptApiEnv::on_emerge_area_completion(
 	}
 }
 
+void ScriptApiEnv::on_find_paths_completion(
+	const std::vector<std::vector<v3s16>> &paths, ScriptCallbackState *state)
+{
+	Server *server = getServer();
+
+	// Called from ServerEnvironment::step with envlock held
+
+	SCRIPTAPI_PRECHECKHEADER
+
+	int error_handler = PUSH_ERROR_HANDLER(L);
+
+	lua_rawgeti(L, LUA_REGISTRYINDEX, state->callback_ref);
+	luaL_checktype(L, -1, LUA_TFUNCTION);
+
+	lua_createtable(L, paths.size(), 0);
+	for (size_t i = 0; i < paths.size(); i++) {
+		if (paths[i].empty()) {
+			lua_pushboolean(L, false);
+		} else {
+			lua_createtable(L, paths[i].size(), 0);
+			for (size_t j = 0; j < paths[i].size(); j++) {
+				push_v3s16(L, paths[i][j]);
+				lua_rawseti(L, -2, j + 1);
+			}
+		}
+		lua_rawseti(L, -2, i + 1);
+	}
+
+	setOriginDirect(state->origin.c_str());
+
+	try {
+		PCALL_RES(lua_pcall(L, 1, 0, error_handler));
+	} catch (LuaError &e) {
+		// Note: don't throw here, we still need to run the cleanup code below
+		server->setAsyncFatalError(e);
+	}
+
+	lua_pop(L, 1); // Pop error handler
+
+	luaL_unref(L, LUA_REGISTRYINDEX, state->callback_ref);
+}
+
 void ScriptApiEnv::check_for_falling(v3s16 p)
 {
 	SCRIPTAPI_PRECHECKHEADER
@@ -44,6 +44,10 @@ class ScriptApiEnv : virtual public ScriptApiBase
 	void on_emerge_area_completion(v3s16 blockpos, int action,
 		ScriptCallbackState *state);
 
+	// Called after a batch queued from core.find_paths_async() has completed
+	void on_find_paths_completion(const std::vector<std::vector<v3s16>> &paths,
+		ScriptCallbackState *state);
+
 	void check_for_falling(v3s16 p);
 
 	// Called after liquid transform changes
@@ -241,6 +241,19 @@ void LuaEmergeAreaCallback(v3s16 blockpos, EmergeAction action, void *param)
 		delete state;
 }
 
+void LuaFindPathsCallback(std::vector<std::vector<v3s16>> *paths, void *param)
+{
+	ScriptCallbackState *state = (ScriptCallbackState *)param;
+	assert(state != NULL);
+
+	// Called from ServerEnvironment::step with envlock held.
+	// paths is NULL if the request was dropped on shutdown.
+	if (paths)
+		state->script->on_find_paths_completion(*paths, state);
+
+	delete state;
+}
+
 // Exported functions
 
 // set_node(pos, node)
@@ -1248,6 +1261,24 @@ int ModApiEnvMod::l_delete_area(lua_State *L)
 	return 1;
 }
 
+static PathAlgorithm read_path_algorithm(lua_State *L, int index)
+{
+	PathAlgorithm algo = PA_PLAIN_NP;
+	if (!lua_isnoneornil(L, index)) {
+		std::string algorithm = luaL_checkstring(L, index);
+
+		if (algorithm == "A*")
+			algo = PA_PLAIN;
+
+		if (algorithm == "Dijkstra")
+			algo = PA_DIJKSTRA;
+
+		if (algorithm == "HPA*")
+			algo = PA_HIERARCHICAL;
+	}
+	return algo;
+}
+
 // find_path(pos1, pos2, searchdistance,
 //     max_jump, max_drop, algorithm) -> table containing path
 int ModApiEnvMod::l_find_path(lua_State *L)
@@ -1259,19 +1290,10 @@ int ModApiEnvMod::l_find_path(lua_State *L)
 	unsigned int searchdistance = luaL_checkint(L, 3);
 	unsigned int max_jump       = luaL_checkint(L, 4);
 	unsigned int max_drop       = luaL_checkint(L, 5);
-	PathAlgorithm algo          = PA_PLAIN_NP;
-	if (!lua_isnoneornil(L, 6)) {
-		std::string algorithm = luaL_checkstring(L,6);
-
-		if (algorithm == "A*")
-			algo = PA_PLAIN;
-
-		if (algorithm == "Dijkstra")
-			algo = PA_DIJKSTRA;
-	}
+	PathAlgorithm algo          = read_path_algorithm(L, 6);
 
 	std::vector<v3s16> path = get_path(&env->getServerMap(), env->getGameDef()->ndef(), pos1, pos2,
-		searchdistance, max_jump, max_drop, algo);
+		searchdistance, max_jump, max_drop, algo, &env->getPathfinderCache());
 
 	if (!path.empty()) {
 		lua_createtable(L, path.size(), 0);
@@ -1289,6 +1311,82 @@ int ModApiEnvMod::l_find_path(lua_State *L)
 	return 0;
 }
 
+// find_path_step(pos, destination, searchdistance, max_jump, max_drop)
+// -> next position on the way to destination
+int ModApiEnvMod::l_find_path_step(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	v3s16 pos                   = read_v3s16(L, 1);
+	v3s16 destination           = read_v3s16(L, 2);
+	unsigned int searchdistance = luaL_checkint(L, 3);
+	unsigned int max_jump       = luaL_checkint(L, 4);
+	unsigned int max_drop       = luaL_checkint(L, 5);
+
+	std::shared_ptr<const PathFlowField> field = get_flow_field(
+		&env->getServerMap(), env->getGameDef()->ndef(), destination,
+		searchdistance, max_jump, max_drop, &env->getPathfinderCache());
+
+	v3s16 next;
+	if (!field->getNextStep(pos, next))
+		return 0;
+
+	push_v3s16(L, next);
+	return 1;
+}
+
+// find_paths_async(requests, callback)
+// requests = {{pos1=, pos2=, searchdistance=, max_jump=, max_drop=, algorithm=}, ...}
+// calls callback with a table of paths (false if none was found) later on
+int ModApiEnvMod::l_find_paths_async(lua_State *L)
+{
+	GET_ENV_PTR;
+
+	luaL_checktype(L, 1, LUA_TTABLE);
+	luaL_checktype(L, 2, LUA_TFUNCTION);
+
+	std::vector<PathRequest> requests;
+	size_t len = lua_objlen(L, 1);
+	requests.reserve(len);
+	for (size_t i = 1; i <= len; i++) {
+		lua_rawgeti(L, 1, i);
+		luaL_checktype(L, -1, LUA_TTABLE);
+		int table = lua_gettop(L);
+
+		PathRequest request;
+		lua_getfield(L, table, "pos1");
+		request.source = check_v3s16(L, -1);
+		lua_pop(L, 1);
+		lua_getfield(L, table, "pos2");
+		request.destination = check_v3s16(L, -1);
+		lua_pop(L, 1);
+		request.searchdistance = MYMAX(0,
+			getintfield_default(L, table, "searchdistance", 16));
+		request.max_jump = MYMAX(0, getintfield_default(L, table, "max_jump", 1));
+		request.max_drop = MYMAX(0, getintfield_default(L, table, "max_drop", 1));
+		lua_getfield(L, table, "algorithm");
+		request.algo = read_path_algorithm(L, -1);
+		lua_pop(L, 2);
+
+		requests.push_back(request);
+	}
+
+	lua_pushvalue(L, 2);
+	int callback_ref = luaL_ref(L, LUA_REGISTRYINDEX);
+
+	ScriptCallbackState *state = new ScriptCallbackState;
+	state->script       = getServer(L)->getScriptIface();
+	state->callback_ref = callback_ref;
+	state->args_ref     = LUA_NOREF;
+	state->refcount     = 0;
+	state->origin       = getScriptApiBase(L)->getOrigin();
+
+	env->getPathfinderQueue().enqueue(&env->getServerMap(),
+		std::move(requests), LuaFindPathsCallback, state);
+
+	return 0;
+}
+
 // spawn_tree(pos, treedef)
 int ModApiEnvMod::l_spawn_tree(lua_State *L)
 {
@@ -1454,6 +1552,8 @@ void ModApiEnvMod::Initialize(lua_State *L, int top)
 	API_FCT(clear_objects);
 	API_FCT(spawn_tree);
 	API_FCT(find_path);
+	API_FCT(find_path_step);
+	API_FCT(find_paths_async);
 	API_FCT(line_of_sight);
 	API_FCT(raycast);
 	API_FCT(transforming_liquid_add);
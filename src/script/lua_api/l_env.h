@@ -184,6 +184,13 @@ class ModApiEnvMod : public ModApiBase {
 	//     max_jump, max_drop, algorithm) -> table containing path
 	static int l_find_path(lua_State *L);
 
+	// find_path_step(pos, destination, searchdistance,
+	//     max_jump, max_drop) -> next position
+	static int l_find_path_step(lua_State *L);
+
+	// find_paths_async(requests, callback)
+	static int l_find_paths_async(lua_State *L);
+
 	// transforming_liquid_add(pos)
 	static int l_transforming_liquid_add(lua_State *L);
 
@@ -447,6 +447,17 @@ int ModApiServer::l_get_worldpath(lua_State *L)
 	return 1;
 }
 
+// write_trace()
+int ModApiServer::l_write_trace(lua_State *L)
+{
+	NO_MAP_LOCK_REQUIRED;
+	std::string path = getServer(L)->writeTrace();
+	if (path.empty())
+		return 0;
+	lua_pushstring(L, path.c_str());
+	return 1;
+}
+
 // sound_play(spec, parameters, [ephemeral])
 int ModApiServer::l_sound_play(lua_State *L)
 {
@@ -617,6 +628,7 @@ void ModApiServer::Initialize(lua_State *L, int top)
 	API_FCT(get_server_uptime);
 	API_FCT(get_server_max_lag);
 	API_FCT(get_worldpath);
+	API_FCT(write_trace);
 	API_FCT(is_singleplayer);
 
 	API_FCT(get_current_modname);
@@ -39,6 +39,9 @@ class ModApiServer : public ModApiBase
 	// get_worldpath()
 	static int l_get_worldpath(lua_State *L);
 
+	// write_trace()
+	static int l_write_trace(lua_State *L);
+
 	// is_singleplayer()
 	static int l_is_singleplayer(lua_State *L);
 
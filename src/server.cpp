@@ -21,6 +21,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <iostream>
 #include <queue>
 #include <algorithm>
+#include <ctime>
+#include <fstream>
 #include "network/connection.h"
 #include "network/networkprotocol.h"
 #include "network/serveropcodes.h"
@@ -65,6 +67,9 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "remoteplayer.h"
 #include "server/player_sao.h"
 #include "server/serverinventorymgr.h"
+#include "server/blockserializer.h"
+#include "server/serializedblockcache.h"
+#include "threading/thread_pool.h"
 #include "translation.h"
 #include "database/database-sqlite3.h"
 #if USE_POSTGRESQL
@@ -300,6 +305,13 @@ Server::Server(
 			"minetest_core_map_edit_events",
 			"Number of map edit events");
 
+	m_block_cache = std::make_unique<SerializedBlockCache>(
+			g_settings->getU32("serialized_block_cache_size") * 1024 * 1024,
+			m_metrics_backend.get());
+	m_block_serializer = std::make_unique<BlockSerializer>(this, m_block_cache.get());
+	m_block_select_thread_pool = std::make_unique<ThreadPool>("BlockSelect",
+			g_settings->getU16("num_block_select_threads"));
+
 	m_lag_gauge->set(g_settings->getFloat("dedicated_server_step"));
 }
 
@@ -368,6 +380,9 @@ Server::~Server()
 		delete m_thread;
 	}
 
+	// The queued block snapshots refer to the node definitions
+	m_block_serializer.reset();
+
 	// Write any changes before deletion.
 	if (m_mod_storage_database)
 		m_mod_storage_database->endSave();
@@ -511,6 +526,8 @@ void Server::init()
 	// Register us to receive map edit events
 	servermap->addEventReceiver(this);
 
+	m_block_serializer->startThreads();
+
 	m_env->loadMeta();
 
 	// Those settings can be overwritten in world.mt, they are
@@ -772,7 +789,7 @@ void Server::AsyncRunStep(bool initial_step)
 				if (!playersao)
 					continue;
 
-				SendActiveObjectRemoveAdd(client, playersao);
+				SendActiveObjectRemoveAdd(client, playersao, dtime);
 			}
 		}
 
@@ -818,9 +835,17 @@ void Server::AsyncRunStep(bool initial_step)
 			message_list->push_back(std::move(aom));
 		}
 
+		std::vector<u16> position_updates;
+		m_env->getActiveObjectPositionUpdates(position_updates);
+		count_unreliable += position_updates.size();
+
 		m_aom_buffer_counter[0]->increment(count_reliable);
 		m_aom_buffer_counter[1]->increment(count_unreliable);
 
+		// AO_CMD_UPDATE_POSITION for clients before protocol 42, made once
+		std::unordered_map<u16, std::string> legacy_positions;
+		const float update_interval = m_env->getSendRecommendedInterval();
+
 		{
 			ClientInterface::AutoLock clientlock(m_clients);
 			const RemoteClientMap &clients = m_clients.getClientList();
@@ -831,6 +856,19 @@ void Server::AsyncRunStep(bool initial_step)
 				unreliable_data.clear();
 				RemoteClient *client = client_it.second;
 				PlayerSAO *player = getPlayerSAO(client->peer_id);
+
+				// Send positions to players who do not see the attachment
+				auto sends_position = [&] (ServerActiveObject *sao) {
+					if (sao->getId() == player->getId())
+						return false;
+
+					// Do not send position updates for attached players
+					// as long the parent is known to the client
+					ServerActiveObject *parent = sao->getParent();
+					return !parent || client->m_known_objects.find(parent->getId()) ==
+						client->m_known_objects.end();
+				};
+
 				// Go through all objects in message buffer
 				for (const auto &buffered_message : buffered_messages) {
 					// If object does not exist or is not known by client, skip it
@@ -843,19 +881,6 @@ void Server::AsyncRunStep(bool initial_step)
 					std::vector<ActiveObjectMessage>* list = buffered_message.second;
 					// Go through every message
 					for (const ActiveObjectMessage &aom : *list) {
-						// Send position updates to players who do not see the attachment
-						if (aom.datastring[0] == AO_CMD_UPDATE_POSITION) {
-							if (sao->getId() == player->getId())
-								continue;
-
-							// Do not send position updates for attached players
-							// as long the parent is known to the client
-							ServerActiveObject *parent = sao->getParent();
-							if (parent && client->m_known_objects.find(parent->getId()) !=
-									client->m_known_objects.end())
-								continue;
-						}
-
 						// Add full new data to appropriate buffer
 						std::string &buffer = aom.reliable ? reliable_data : unreliable_data;
 						char idbuf[2];
@@ -866,6 +891,32 @@ void Server::AsyncRunStep(bool initial_step)
 						buffer.append(serializeString16(aom.datastring));
 					}
 				}
+
+				if (client->net_proto_version >= 42) {
+					SendActiveObjectPositions(client, sends_position, update_interval);
+				} else {
+					for (u16 id : position_updates) {
+						ServerActiveObject *sao = m_env->getActiveObject(id);
+						if (!sao || client->m_known_objects.find(id) ==
+								client->m_known_objects.end() || !sends_position(sao))
+							continue;
+
+						auto it = legacy_positions.find(id);
+						if (it == legacy_positions.end()) {
+							const ObjectPosition *pos = sao->getSentPosition();
+							std::string str = UnitSAO::generateUpdatePositionCommand(
+								pos->position, pos->velocity, pos->acceleration,
+								pos->rotation, pos->do_interpolate,
+								pos->is_end_position, update_interval);
+							it = legacy_positions.emplace(id,
+								serializeString16(str)).first;
+						}
+						char idbuf[2];
+						writeU16((u8*) idbuf, id);
+						unreliable_data.append(idbuf, sizeof(idbuf));
+						unreliable_data.append(it->second);
+					}
+				}
 				/*
 					reliable_data and unreliable_data are now ready.
 					Send them.
@@ -910,6 +961,15 @@ void Server::AsyncRunStep(bool initial_step)
 			MapEditEvent* event = m_unsent_map_edit_queue.front();
 			m_unsent_map_edit_queue.pop();
 
+			// Snapshots taken before the change must not be sent anymore,
+			// the clients waiting for them get the block again
+			for (const v3s16 &modified_block : event->modified_blocks) {
+				for (session_t peer_id : m_block_serializer->cancel(modified_block)) {
+					if (RemoteClient *client = getClientNoEx(peer_id))
+						client->SetBlockNotSent(modified_block);
+				}
+			}
+
 			// Players far away from the change are stored here.
 			// Instead of sending the changes, MapBlocks are set not sent
 			// for them.
@@ -988,6 +1048,23 @@ void Server::AsyncRunStep(bool initial_step)
 			sendMetadataChanged(node_meta_updates);
 	}
 
+	/*
+		Emerge the blocks near players first
+	*/
+	{
+		std::vector<v3s16> interest_points;
+		{
+			MutexAutoLock envlock(m_env_mutex);
+			for (RemotePlayer *player : m_env->getPlayers()) {
+				PlayerSAO *sao = player->getPlayerSAO();
+				if (sao)
+					interest_points.push_back(getNodeBlockPos(
+						floatToInt(sao->getBasePosition(), BS)));
+			}
+		}
+		m_emerge->updatePriorities(interest_points);
+	}
+
 	/*
 		Trigger emerge thread
 		Doing this every 2s is left over from old code, unclear if this is still needed.
@@ -1002,6 +1079,19 @@ void Server::AsyncRunStep(bool initial_step)
 		}
 	}
 
+	// Network buffers which had to come from the heap, not the pool
+	{
+		float &counter = m_packet_buffer_timer;
+		counter += dtime;
+		if (counter >= 1.0f) {
+			u64 allocations = PacketBuffer::getAllocationCount();
+			g_profiler->avg("Server: packet buffer allocations/s",
+				(allocations - m_packet_buffer_allocations) / counter);
+			m_packet_buffer_allocations = allocations;
+			counter = 0.0f;
+		}
+	}
+
 	// Save map, players and auth stuff
 	{
 		float &counter = m_savemap_timer;
@@ -1996,7 +2086,8 @@ void Server::SendPlayerFormspecPrepend(session_t peer_id)
 	Send(&pkt);
 }
 
-void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao)
+void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao,
+		float dtime)
 {
 	// Radius inside which objects are active
 	static thread_local const s16 radius =
@@ -2017,16 +2108,26 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 	if (my_radius <= 0)
 		my_radius = radius;
 
+	InterestManager &interest = client->m_object_interest;
+	interest.update(dtime, playersao, my_radius * BS);
+
 	std::queue<u16> removed_objects, added_objects;
 	m_env->getRemovedActiveObjects(playersao, my_radius, player_radius,
 		client->m_known_objects, removed_objects);
 	m_env->getAddedActiveObjects(playersao, my_radius, player_radius,
 		client->m_known_objects, added_objects);
 
+	// Add the most interesting objects first, the others wait for budget
+	std::vector<u16> added_ids;
+	added_ids.reserve(added_objects.size());
+	for (; !added_objects.empty(); added_objects.pop())
+		added_ids.push_back(added_objects.front());
+	interest.sortAdded(m_env, added_ids);
+
 	int removed_count = removed_objects.size();
-	int added_count   = added_objects.size();
+	int added_count   = 0;
 
-	if (removed_objects.empty() && added_objects.empty())
+	if (removed_objects.empty() && added_ids.empty())
 		return;
 
 	char buf[4];
@@ -2053,15 +2154,15 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		removed_objects.pop();
 	}
 
-	// Handle added objects
-	writeU16((u8*)buf, added_objects.size());
-	data.append(buf, 2);
-	while (!added_objects.empty()) {
+	// Handle added objects, the count is written after them
+	size_t added_count_pos = data.size();
+	data.append(2, '\0');
+	for (u16 id : added_ids) {
+		if (added_count > 0 && !interest.hasBudget())
+			break;
+
 		// Get object
-		u16 id = added_objects.front();
 		ServerActiveObject *obj = m_env->getActiveObject(id);
-		added_objects.pop();
-
 		if (!obj) {
 			warningstream << FUNCTION_NAME << ": NULL object id="
 				<< (int)id << std::endl;
@@ -2077,14 +2178,19 @@ void Server::SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersa
 		writeU8((u8*)buf, type);
 		data.append(buf, 1);
 
+		size_t size = data.size();
 		data.append(serializeString32(
 			obj->getClientInitializationData(client->net_proto_version)));
+		if (!interest.rate(obj).important)
+			interest.spend(data.size() - size + 3);
 
 		// Add to known objects
 		client->m_known_objects.insert(id);
 
 		obj->m_known_by_count++;
+		added_count++;
 	}
+	writeU16((u8*)&data[added_count_pos], added_count);
 
 	NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_REMOVE_ADD, data.size(), client->peer_id);
 	pkt.putRawString(data.c_str(), data.size());
@@ -2108,6 +2214,57 @@ void Server::SendActiveObjectMessages(session_t peer_id, const std::string &data
 			&pkt, reliable);
 }
 
+void Server::SendActiveObjectPositions(RemoteClient *client,
+		const std::function<bool(ServerActiveObject *)> &sends_position,
+		float update_interval)
+{
+	ObjectSnapshot snapshot;
+	for (u16 id : client->m_known_objects) {
+		ServerActiveObject *sao = m_env->getActiveObject(id);
+		if (!sao)
+			continue;
+		const ObjectPosition *pos = sao->getSentPosition();
+		if (pos && sends_position(sao))
+			snapshot.emplace(id, QuantizedObjectPosition(*pos));
+	}
+
+	// Send the changes since the last snapshot the client has for sure,
+	// until it acknowledges one which is newer
+	const ObjectSnapshot *baseline =
+		client->m_object_snapshots.get(client->m_object_snapshot_acked);
+	if (!baseline) {
+		client->m_object_snapshot_acked = 0;
+		baseline = client->m_object_snapshots.get(0);
+	}
+
+	// Objects which are not due or do not fit into the budget keep the
+	// position the client was sent last
+	InterestManager &interest = client->m_object_interest;
+	const ObjectSnapshot *previous =
+		client->m_object_snapshots.get(client->m_object_snapshot_sent);
+	if (previous)
+		interest.selectPositions(m_env, *previous, snapshot);
+
+	std::ostringstream os(std::ios_base::binary);
+	if (serializeObjectSnapshotDelta(os, *baseline, snapshot) == 0)
+		return;
+
+	u16 seqnum = client->m_object_snapshot_sent + 1;
+	if (seqnum == 0)
+		seqnum = 1;
+	client->m_object_snapshot_sent = seqnum;
+
+	const std::string &data = os.str();
+	NetworkPacket pkt(TOCLIENT_ACTIVE_OBJECT_POSITIONS, 8 + data.size(),
+		client->peer_id);
+	pkt << seqnum << client->m_object_snapshot_acked << update_interval;
+	pkt.putRawString(data);
+	Send(&pkt);
+	interest.spend(pkt.getSize());
+
+	client->m_object_snapshots.add(seqnum, std::move(snapshot));
+}
+
 void Server::SendCSMRestrictionFlags(session_t peer_id)
 {
 	NetworkPacket pkt(TOCLIENT_CSM_RESTRICTION_FLAGS,
@@ -2355,34 +2512,25 @@ void Server::sendMetadataChanged(const std::unordered_set<v3s16> &positions, flo
 }
 
 void Server::SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache)
+		u16 net_proto_version)
 {
-	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
-	std::string s, *sptr = nullptr;
-
-	if (cache) {
-		auto it = cache->find({block->getPos(), ver});
-		if (it != cache->end())
-			sptr = &it->second;
-	}
+	std::shared_ptr<const std::string> data = m_block_cache->get(block, ver);
 
 	// Serialize the block in the right format
-	if (!sptr) {
-		std::ostringstream os(std::ios_base::binary);
-		block->serialize(os, ver, false, net_compression_level);
-		block->serializeNetworkSpecific(os);
-		s = os.str();
-		sptr = &s;
+	if (!data) {
+		data = BlockSerializer::serialize(block, ver);
+		m_block_cache->put(block, ver, data);
 	}
 
-	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + sptr->size(), peer_id);
-	pkt << block->getPos();
-	pkt.putRawString(*sptr);
-	Send(&pkt);
+	SendBlockData(peer_id, block->getPos(), *data);
+}
 
-	// Store away in cache
-	if (cache && sptr == &s)
-		(*cache)[{block->getPos(), ver}] = std::move(s);
+void Server::SendBlockData(session_t peer_id, v3s16 blockpos, const std::string &data)
+{
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data.size(), peer_id);
+	pkt << blockpos;
+	pkt.putRawString(data);
+	Send(&pkt);
 }
 
 void Server::SendBlocks(float dtime)
@@ -2392,7 +2540,7 @@ void Server::SendBlocks(float dtime)
 
 	std::vector<PrioritySortedBlockTransfer> queue;
 
-	u32 total_sending = 0, unique_clients = 0;
+	u32 total_sending = 0;
 
 	{
 		ScopeProfiler sp2(g_profiler, "Server::SendBlocks(): Collect list");
@@ -2400,6 +2548,7 @@ void Server::SendBlocks(float dtime)
 		std::vector<session_t> clients = m_clients.getClientIDs();
 
 		ClientInterface::AutoLock clientlock(m_clients);
+		std::vector<std::pair<RemoteClient *, BlockSendViewer>> viewers;
 		for (const session_t client_id : clients) {
 			RemoteClient *client = m_clients.lockedGetClientNoEx(client_id, CS_Active);
 
@@ -2407,10 +2556,20 @@ void Server::SendBlocks(float dtime)
 				continue;
 
 			total_sending += client->getSendingCount();
-			const auto old_count = queue.size();
-			client->GetNextBlocks(m_env,m_emerge, dtime, queue);
-			unique_clients += queue.size() > old_count ? 1 : 0;
+			BlockSendViewer viewer;
+			if (client->GetBlockSendViewer(m_env, &viewer))
+				viewers.emplace_back(client, viewer);
 		}
+
+		// The map does not change while the environment is locked
+		const Map *map = &m_env->getMap();
+		std::vector<BlockSelection> selections(viewers.size());
+		m_block_select_thread_pool->parallelFor(viewers.size(), [&] (size_t i) {
+			viewers[i].first->SelectNextBlocks(viewers[i].second, map,
+					m_emerge, dtime, selections[i]);
+		});
+		for (BlockSelection &selection : selections)
+			selection.merge(queue);
 	}
 
 	// Sort.
@@ -2428,11 +2587,13 @@ void Server::SendBlocks(float dtime)
 	ScopeProfiler sp(g_profiler, "Server::SendBlocks(): Send to clients");
 	Map &map = m_env->getMap();
 
-	SerializedBlockCache cache, *cache_ptr = nullptr;
-	if (unique_clients > 1) {
-		// caching is pointless with a single client
-		cache_ptr = &cache;
-	}
+	// Blocks not in the cache are serialized on the block serializer threads,
+	// one snapshot serves all clients wanting the block
+	struct BlockSnapshotRequest {
+		MapBlock *block;
+		std::vector<session_t> peers;
+	};
+	std::map<std::pair<v3s16, u8>, BlockSnapshotRequest> snapshot_requests;
 
 	for (const PrioritySortedBlockTransfer &block_to_send : queue) {
 		if (total_sending >= max_blocks_to_send)
@@ -2447,12 +2608,26 @@ void Server::SendBlocks(float dtime)
 		if (!client)
 			continue;
 
-		SendBlockNoLock(block_to_send.peer_id, block, client->serialization_version,
-				client->net_proto_version, cache_ptr);
+		u8 ver = client->serialization_version;
+		if (!m_block_serializer->isAsync()) {
+			SendBlockNoLock(block_to_send.peer_id, block, ver,
+					client->net_proto_version);
+		} else if (auto data = m_block_cache->get(block, ver)) {
+			SendBlockData(block_to_send.peer_id, block_to_send.pos, *data);
+		} else {
+			BlockSnapshotRequest &request = snapshot_requests[{block_to_send.pos, ver}];
+			request.block = block;
+			request.peers.push_back(block_to_send.peer_id);
+		}
 
 		client->SentBlock(block_to_send.pos);
 		total_sending++;
 	}
+
+	for (auto &it : snapshot_requests) {
+		m_block_serializer->enqueue(it.second.block->createSnapshot(),
+				it.first.second, std::move(it.second.peers));
+	}
 }
 
 bool Server::SendBlock(session_t peer_id, const v3s16 &blockpos)
@@ -3788,6 +3963,29 @@ v3f Server::findSpawnPos()
 	return v3f(0.0f, 0.0f, 0.0f);
 }
 
+std::string Server::writeTrace()
+{
+	if (!g_profiler->isTracing()) {
+		errorstream << "Server: Tracing is disabled, "
+			"set profiler_trace_buffer_size to enable it" << std::endl;
+		return "";
+	}
+
+	std::string path = m_path_world + DIR_DELIM + "trace_" +
+		std::to_string(std::time(nullptr)) + ".json";
+	std::ofstream os(path, std::ios_base::binary);
+	size_t count = g_profiler->writeTrace(os);
+	os.close();
+	if (!os.good()) {
+		errorstream << "Server: Failed to write trace to " << path << std::endl;
+		return "";
+	}
+
+	actionstream << "Server: Wrote " << count << " trace spans to "
+		<< path << std::endl;
+	return path;
+}
+
 void Server::requestShutdown(const std::string &msg, bool reconnect, float delay)
 {
 	if (delay == 0.0f) {
@@ -3901,6 +4099,12 @@ void dedicated_server_loop(Server &server, bool &kill)
 				g_profiler->clear();
 			}
 		}
+
+		bool &trace_requested = *porting::signal_handler_tracestatus();
+		if (trace_requested) {
+			trace_requested = false;
+			server.writeTrace();
+		}
 	}
 
 	infostream << "Dedicated server quitting" << std::endl;
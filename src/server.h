@@ -44,6 +44,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <map>
 #include <vector>
 #include <unordered_set>
+#include <functional>
 
 class ChatEvent;
 struct ChatEventChat;
@@ -73,6 +74,9 @@ struct Lighting;
 class ServerThread;
 class ServerModManager;
 class ServerInventoryManager;
+class SerializedBlockCache;
+class BlockSerializer;
+class ThreadPool;
 struct PackedValue;
 
 enum ClientDeletionReason {
@@ -194,6 +198,7 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void handleCommand_FirstSrp(NetworkPacket* pkt);
 	void handleCommand_SrpBytesA(NetworkPacket* pkt);
 	void handleCommand_SrpBytesM(NetworkPacket* pkt);
+	void handleCommand_ActiveObjectPositionsAck(NetworkPacket *pkt);
 	void handleCommand_HaveMedia(NetworkPacket *pkt);
 
 	void ProcessData(NetworkPacket *pkt);
@@ -225,6 +230,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 
 	// request server to shutdown
 	void requestShutdown(const std::string &msg, bool reconnect, float delay = 0.0f);
+	// Writes the spans recorded by the profiler into the world directory.
+	// Returns the path, or an empty string on failure.
+	std::string writeTrace();
 
 	// Returns -1 if failed, sound handle on success
 	// Envlock
@@ -416,15 +424,6 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 		std::unordered_set<session_t> waiting_players;
 	};
 
-	// The standard library does not implement std::hash for pairs so we have this:
-	struct SBCHash {
-		size_t operator() (const std::pair<v3s16, u16> &p) const {
-			return std::hash<v3s16>()(p.first) ^ p.second;
-		}
-	};
-
-	typedef std::unordered_map<std::pair<v3s16, u16>, std::string, SBCHash> SerializedBlockCache;
-
 	void init();
 
 	void SendMovement(session_t peer_id);
@@ -484,9 +483,9 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 			float far_d_nodes = 100);
 
 	// Environment and Connection must be locked when called
-	// `cache` may only be very short lived! (invalidation not handeled)
 	void SendBlockNoLock(session_t peer_id, MapBlock *block, u8 ver,
-		u16 net_proto_version, SerializedBlockCache *cache = nullptr);
+		u16 net_proto_version);
+	void SendBlockData(session_t peer_id, v3s16 blockpos, const std::string &data);
 
 	// Sends blocks to clients (locks env and con on its own)
 	void SendBlocks(float dtime);
@@ -509,9 +508,14 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	void SendSpawnParticle(session_t peer_id, u16 protocol_version,
 		const ParticleParameters &p);
 
-	void SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao);
+	void SendActiveObjectRemoveAdd(RemoteClient *client, PlayerSAO *playersao,
+		float dtime);
 	void SendActiveObjectMessages(session_t peer_id, const std::string &datas,
 		bool reliable = true);
+	// Sends what changed since the last snapshot the client acknowledged
+	void SendActiveObjectPositions(RemoteClient *client,
+		const std::function<bool(ServerActiveObject *)> &sends_position,
+		float update_interval);
 	void SendCSMRestrictionFlags(session_t peer_id);
 
 	/*
@@ -573,6 +577,8 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	float m_masterserver_timer = 0.0f;
 	float m_emergethread_trigger_timer = 0.0f;
 	float m_savemap_timer = 0.0f;
+	float m_packet_buffer_timer = 0.0f;
+	u64 m_packet_buffer_allocations = 0;
 	IntervalLimiter m_map_timer_and_unload_interval;
 
 	// Environment
@@ -708,6 +714,13 @@ class Server : public con::PeerHandler, public MapEventReceiver,
 	// Global server metrics backend
 	std::unique_ptr<MetricsBackend> m_metrics_backend;
 
+	// Mapblocks serialized for sending, shared by all clients
+	std::unique_ptr<SerializedBlockCache> m_block_cache;
+	// Serializes uncached mapblocks off the server thread
+	std::unique_ptr<BlockSerializer> m_block_serializer;
+	// Selects the blocks to send for several clients at once
+	std::unique_ptr<ThreadPool> m_block_select_thread_pool;
+
 	// Server metrics
 	MetricCounterPtr m_uptime_counter;
 	MetricGaugePtr m_player_gauge;
@@ -18,9 +18,12 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 */
 
 #include <log.h>
+#include <algorithm>
+#include <cmath>
 #include "mapblock.h"
 #include "profiler.h"
 #include "activeobjectmgr.h"
+#include "util/numeric.h"
 
 namespace server
 {
@@ -38,6 +41,7 @@ void ActiveObjectMgr::clear(const std::function<bool(ServerActiveObject *, u16)>
 	// Remove references from m_active_objects
 	for (u16 i : objects_to_remove) {
 		m_active_objects.erase(i);
+		removeFromIndex(i);
 	}
 }
 
@@ -88,6 +92,7 @@ bool ActiveObjectMgr::registerObject(ServerActiveObject *obj)
 	}
 
 	m_active_objects[obj->getId()] = obj;
+	addToIndex(obj);
 
 	verbosestream << "Server::ActiveObjectMgr::addActiveObjectRaw(): "
 			<< "Added id=" << obj->getId() << "; there are now "
@@ -107,39 +112,130 @@ void ActiveObjectMgr::removeObject(u16 id)
 	}
 
 	m_active_objects.erase(id);
+	removeFromIndex(id);
 	delete obj;
 }
 
+v3s16 ActiveObjectMgr::getCellPos(const v3f &pos)
+{
+	const f32 cell_size = MAP_BLOCKSIZE * BS;
+	return v3s16(
+		(s16)rangelim(std::floor(pos.X / cell_size), S16_MIN, S16_MAX),
+		(s16)rangelim(std::floor(pos.Y / cell_size), S16_MIN, S16_MAX),
+		(s16)rangelim(std::floor(pos.Z / cell_size), S16_MIN, S16_MAX));
+}
+
+void ActiveObjectMgr::addToIndex(ServerActiveObject *obj)
+{
+	u16 id = obj->getId();
+	v3s16 cell = getCellPos(obj->getBasePosition());
+	m_cells[cell].push_back({id, obj});
+	m_object_cells[id] = cell;
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		m_player_ids.insert(id);
+}
+
+void ActiveObjectMgr::removeFromIndex(u16 id)
+{
+	auto cell_it = m_object_cells.find(id);
+	if (cell_it == m_object_cells.end())
+		return;
+
+	auto bucket_it = m_cells.find(cell_it->second);
+	if (bucket_it != m_cells.end()) {
+		std::vector<CellEntry> &bucket = bucket_it->second;
+		for (CellEntry &entry : bucket) {
+			if (entry.id == id) {
+				entry = bucket.back();
+				bucket.pop_back();
+				break;
+			}
+		}
+		if (bucket.empty())
+			m_cells.erase(bucket_it);
+	}
+
+	m_object_cells.erase(cell_it);
+	m_player_ids.erase(id);
+}
+
+void ActiveObjectMgr::updateObjectPosition(ServerActiveObject *obj)
+{
+	auto cell_it = m_object_cells.find(obj->getId());
+	// Not registered (yet)
+	if (cell_it == m_object_cells.end())
+		return;
+
+	// Most moves stay inside the same cell
+	if (cell_it->second == getCellPos(obj->getBasePosition()))
+		return;
+
+	removeFromIndex(obj->getId());
+	addToIndex(obj);
+}
+
+void ActiveObjectMgr::forEachObjectInCells(const v3f &minp, const v3f &maxp,
+		const std::function<void(ServerActiveObject *obj)> &cb)
+{
+	v3s16 cmin = getCellPos(minp);
+	v3s16 cmax = getCellPos(maxp);
+	u64 cell_count = (u64)(cmax.X - cmin.X + 1) * (cmax.Y - cmin.Y + 1) *
+			(cmax.Z - cmin.Z + 1);
+
+	// Huge query areas: walking the occupied cells is cheaper
+	if (cell_count > m_cells.size()) {
+		for (auto &bucket : m_cells) {
+			const v3s16 &c = bucket.first;
+			if (c.X < cmin.X || c.Y < cmin.Y || c.Z < cmin.Z ||
+					c.X > cmax.X || c.Y > cmax.Y || c.Z > cmax.Z)
+				continue;
+			for (const CellEntry &entry : bucket.second)
+				cb(entry.obj);
+		}
+		return;
+	}
+
+	v3s16 c;
+	for (c.Z = cmin.Z; c.Z <= cmax.Z; c.Z++)
+	for (c.Y = cmin.Y; c.Y <= cmax.Y; c.Y++)
+	for (c.X = cmin.X; c.X <= cmax.X; c.X++) {
+		auto bucket = m_cells.find(c);
+		if (bucket == m_cells.end())
+			continue;
+		for (const CellEntry &entry : bucket->second)
+			cb(entry.obj);
+	}
+}
+
 // clang-format on
 void ActiveObjectMgr::getObjectsInsideRadius(const v3f &pos, float radius,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
 	float r2 = radius * radius;
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	v3f extent(radius, radius, radius);
+	forEachObjectInCells(pos - extent, pos + extent, [&](ServerActiveObject *obj) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (objectpos.getDistanceFromSQ(pos) > r2)
-			continue;
+			return;
 
 		if (!include_obj_cb || include_obj_cb(obj))
 			result.push_back(obj);
-	}
+	});
 }
 
 void ActiveObjectMgr::getObjectsInArea(const aabb3f &box,
 		std::vector<ServerActiveObject *> &result,
 		std::function<bool(ServerActiveObject *obj)> include_obj_cb)
 {
-	for (auto &activeObject : m_active_objects) {
-		ServerActiveObject *obj = activeObject.second;
+	forEachObjectInCells(box.MinEdge, box.MaxEdge, [&](ServerActiveObject *obj) {
 		const v3f &objectpos = obj->getBasePosition();
 		if (!box.isPointInside(objectpos))
-			continue;
+			return;
 
 		if (!include_obj_cb || include_obj_cb(obj))
 			result.push_back(obj);
-	}
+	});
 }
 
 void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
@@ -147,37 +243,49 @@ void ActiveObjectMgr::getAddedActiveObjectsAroundPos(const v3f &player_pos, f32
 		std::queue<u16> &added_objects)
 {
 	/*
-		Go through the object list,
+		Go through the objects in the cells around player_pos,
 		- discard removed/deactivated objects,
 		- discard objects that are too far away,
 		- discard objects that are found in current_objects.
 		- add remaining objects to added_objects
 	*/
-	for (auto &ao_it : m_active_objects) {
-		u16 id = ao_it.first;
-
-		// Get object
-		ServerActiveObject *object = ao_it.second;
-		if (!object)
-			continue;
-
+	auto check_object = [&](ServerActiveObject *object) {
 		if (object->isGone())
-			continue;
+			return;
 
 		f32 distance_f = object->getBasePosition().getDistanceFrom(player_pos);
 		if (object->getType() == ACTIVEOBJECT_TYPE_PLAYER) {
 			// Discard if too far
 			if (distance_f > player_radius && player_radius != 0)
-				continue;
+				return;
 		} else if (distance_f > radius)
-			continue;
+			return;
 
 		// Discard if already on current_objects
+		u16 id = object->getId();
 		auto n = current_objects.find(id);
 		if (n != current_objects.end())
-			continue;
+			return;
 		// Add to added_objects
 		added_objects.push(id);
+	};
+
+	f32 query_radius = std::max(radius, player_radius);
+	v3f extent(query_radius, query_radius, query_radius);
+	forEachObjectInCells(player_pos - extent, player_pos + extent,
+			[&](ServerActiveObject *object) {
+		// Players are handled below if their range is unlimited
+		if (player_radius == 0 && object->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+			return;
+		check_object(object);
+	});
+
+	if (player_radius == 0) {
+		for (u16 id : m_player_ids) {
+			ServerActiveObject *object = getActiveObject(id);
+			if (object)
+				check_object(object);
+		}
 	}
 }
 
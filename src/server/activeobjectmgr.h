@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #pragma once
 
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 #include "../activeobjectmgr.h"
 #include "serveractiveobject.h"
@@ -45,5 +47,37 @@ class ActiveObjectMgr : public ::ActiveObjectMgr<ServerActiveObject>
 	void getAddedActiveObjectsAroundPos(const v3f &player_pos, f32 radius,
 			f32 player_radius, std::set<u16> &current_objects,
 			std::queue<u16> &added_objects);
+
+	// Must be called whenever the base position of a registered object changes
+	void updateObjectPosition(ServerActiveObject *obj);
+
+private:
+	/*
+		Spatial index: registered objects bucketed by the map block
+		their base position lies in, so that proximity queries only
+		have to look at the cells overlapping the queried area.
+	*/
+	static v3s16 getCellPos(const v3f &pos);
+
+	void addToIndex(ServerActiveObject *obj);
+	// Does not dereference the object, it may already be deleted
+	void removeFromIndex(u16 id);
+
+	// Calls cb for every object in the cells overlapping [minp, maxp].
+	// The caller has to do the exact position test.
+	void forEachObjectInCells(const v3f &minp, const v3f &maxp,
+			const std::function<void(ServerActiveObject *obj)> &cb);
+
+	struct CellEntry
+	{
+		u16 id;
+		ServerActiveObject *obj;
+	};
+
+	std::unordered_map<v3s16, std::vector<CellEntry>> m_cells;
+	// Cell each registered object is currently stored in
+	std::unordered_map<u16, v3s16> m_object_cells;
+	// Players are always sent when the player radius is unlimited
+	std::unordered_set<u16> m_player_ids;
 };
 } // namespace server
@@ -0,0 +1,187 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "blockserializer.h"
+#include "debug.h"
+#include "mapblock.h"
+#include "profiler.h"
+#include "server.h"
+#include "settings.h"
+#include "serializedblockcache.h"
+#include "network/networkpacket.h"
+#include "threading/thread.h"
+#include "util/numeric.h"
+#include <sstream>
+
+class BlockSerializerThread : public Thread
+{
+public:
+	BlockSerializerThread(BlockSerializer *serializer) :
+		Thread("BlockSerializer"),
+		m_serializer(serializer)
+	{}
+
+	void *run();
+
+private:
+	BlockSerializer *m_serializer;
+};
+
+void *BlockSerializerThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		BlockSerializer::Job *job = m_serializer->m_queue.pop_frontNoEx(100);
+		if (!job)
+			continue;
+
+		m_serializer->process(job);
+		BlockSerializer::deleteJob(job);
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
+
+BlockSerializer::BlockSerializer(Server *server, SerializedBlockCache *cache) :
+	m_server(server),
+	m_cache(cache)
+{
+}
+
+BlockSerializer::~BlockSerializer()
+{
+	stopThreads();
+
+	while (!m_queue.empty())
+		deleteJob(m_queue.pop_frontNoEx());
+	m_pending.clear();
+}
+
+void BlockSerializer::startThreads()
+{
+	if (!m_threads.empty())
+		return;
+
+	u16 num_threads = g_settings->getU16("num_block_send_threads");
+	for (u16 i = 0; i < num_threads; i++) {
+		BlockSerializerThread *thread = new BlockSerializerThread(this);
+		thread->start();
+		m_threads.push_back(thread);
+	}
+}
+
+void BlockSerializer::stopThreads()
+{
+	for (BlockSerializerThread *thread : m_threads)
+		thread->stop();
+	for (BlockSerializerThread *thread : m_threads) {
+		thread->wait();
+		delete thread;
+	}
+	m_threads.clear();
+}
+
+void BlockSerializer::enqueue(MapBlock *snapshot, u8 version,
+	std::vector<session_t> &&peers)
+{
+	Job *job = new Job{snapshot, version, std::move(peers)};
+	if (!isAsync()) {
+		process(job);
+		deleteJob(job);
+		return;
+	}
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		m_pending.emplace(snapshot->getPos(), job);
+	}
+	m_queue.push_back(job);
+}
+
+std::vector<session_t> BlockSerializer::cancel(v3s16 pos)
+{
+	std::vector<session_t> peers;
+	std::lock_guard<std::mutex> lock(m_pending_mutex);
+	auto range = m_pending.equal_range(pos);
+	for (auto it = range.first; it != range.second; ++it) {
+		Job *job = it->second;
+		if (job->cancelled)
+			continue;
+		job->cancelled = true;
+		peers.insert(peers.end(), job->peers.begin(), job->peers.end());
+	}
+	return peers;
+}
+
+std::shared_ptr<const std::string> BlockSerializer::serialize(MapBlock *block, u8 version)
+{
+	thread_local const int net_compression_level = rangelim(g_settings->getS16("map_compression_level_net"), -1, 9);
+
+	std::ostringstream os(std::ios_base::binary);
+	block->serialize(os, version, false, net_compression_level);
+	block->serializeNetworkSpecific(os);
+	return std::make_shared<const std::string>(os.str());
+}
+
+void BlockSerializer::process(Job *job)
+{
+	ScopeProfiler sp(g_profiler, "BlockSerializer: serialize and send", SPT_AVG);
+	{
+		std::lock_guard<std::mutex> lock(m_pending_mutex);
+		if (job->cancelled) {
+			removePending(job);
+			return;
+		}
+	}
+
+	std::shared_ptr<const std::string> data = serialize(job->snapshot, job->version);
+	m_cache->put(job->snapshot, job->version, data);
+
+	NetworkPacket pkt(TOCLIENT_BLOCKDATA, 2 + 2 + 2 + data->size());
+	pkt << job->snapshot->getPos();
+	pkt.putRawString(*data);
+
+	// Sent under the lock, so a later modification either cancels the job
+	// or happens after the data is on its way
+	std::lock_guard<std::mutex> lock(m_pending_mutex);
+	removePending(job);
+	if (job->cancelled)
+		return;
+	for (session_t peer_id : job->peers)
+		m_server->Send(peer_id, &pkt);
+}
+
+void BlockSerializer::removePending(Job *job)
+{
+	auto range = m_pending.equal_range(job->snapshot->getPos());
+	for (auto it = range.first; it != range.second; ++it) {
+		if (it->second == job) {
+			m_pending.erase(it);
+			return;
+		}
+	}
+}
+
+void BlockSerializer::deleteJob(Job *job)
+{
+	delete job->snapshot;
+	delete job;
+}
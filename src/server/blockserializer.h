@@ -0,0 +1,96 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "network/networkprotocol.h"
+#include "util/container.h"
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MapBlock;
+class SerializedBlockCache;
+class Server;
+class BlockSerializerThread;
+
+/*
+	Serializes and compresses mapblocks for sending on worker threads.
+
+	The server thread hands over snapshots of the blocks (see
+	MapBlock::createSnapshot()), so the environment lock is not held
+	while compressing. The finished data goes into the serialized block
+	cache and is sent directly to the connection.
+
+	A block modified while its job is queued has to be cancelled, or the
+	old snapshot would reach the clients after the change.
+*/
+class BlockSerializer
+{
+public:
+	BlockSerializer(Server *server, SerializedBlockCache *cache);
+	~BlockSerializer();
+
+	// Uses the num_block_send_threads setting
+	void startThreads();
+	void stopThreads();
+
+	// Without threads the blocks have to be serialized in place
+	bool isAsync() const { return !m_threads.empty(); }
+
+	// Takes ownership of the snapshot
+	void enqueue(MapBlock *snapshot, u8 version, std::vector<session_t> &&peers);
+
+	// Drops the jobs of a block which were not sent yet and returns
+	// the peers they were for, the block has to be sent to them again
+	std::vector<session_t> cancel(v3s16 pos);
+
+	static std::shared_ptr<const std::string> serialize(MapBlock *block, u8 version);
+
+private:
+	friend class BlockSerializerThread;
+
+	struct Job
+	{
+		MapBlock *snapshot;
+		u8 version;
+		std::vector<session_t> peers;
+		// Protected by m_pending_mutex
+		bool cancelled = false;
+	};
+
+	void process(Job *job);
+	// m_pending_mutex must be locked
+	void removePending(Job *job);
+	static void deleteJob(Job *job);
+
+	Server *m_server;
+	SerializedBlockCache *m_cache;
+
+	std::vector<BlockSerializerThread *> m_threads;
+	MutexedQueue<Job *> m_queue;
+
+	// Jobs in the queue or being processed, by block position
+	std::mutex m_pending_mutex;
+	std::unordered_multimap<v3s16, Job *> m_pending;
+};
@@ -0,0 +1,174 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "interestmanager.h"
+#include "player_sao.h"
+#include "serverenvironment.h"
+#include "settings.h"
+#include <algorithm>
+#include <cmath>
+
+// Objects nearer than this part of the send range are updated whenever
+// they move
+#define NEAR_RANGE 0.25f
+// Largest burst, in seconds of budget
+#define MAX_BURST 0.5f
+
+// Whether a is b or attached to it
+static bool is_attached_to(const ServerActiveObject *a, const ServerActiveObject *b)
+{
+	// Attachments can not form loops, but be safe
+	for (int depth = 0; a && depth < 16; depth++) {
+		if (a == b)
+			return true;
+		a = a->getParent();
+	}
+	return false;
+}
+
+InterestManager::InterestManager() :
+	m_budget_per_second(g_settings->getU32("active_object_send_budget")),
+	m_far_interval(std::max(g_settings->getFloat("active_object_far_send_interval"), 0.0f)),
+	m_budget(m_budget_per_second * MAX_BURST)
+{
+}
+
+void InterestManager::update(float dtime, const PlayerSAO *player, float radius)
+{
+	m_dtime = dtime;
+	if (m_budget_per_second > 0)
+		m_budget = std::min(m_budget + m_budget_per_second * dtime,
+			m_budget_per_second * MAX_BURST);
+
+	m_player = player;
+	m_position = player->getBasePosition();
+	m_look_dir = v3f(0, 0, 1);
+	m_look_dir.rotateYZBy(player->getLookPitch());
+	m_look_dir.rotateXZBy(player->getRotation().Y);
+	// The fov is vertical, in radians, the screen is wider. It is unknown
+	// until the client sent it.
+	float fov = player->getFov();
+	m_cos_view_angle = fov > 0.0f ? std::cos(std::min(fov * 0.8f, core::PI)) : -1.0f;
+	m_radius = std::max(radius, 1.0f);
+}
+
+InterestManager::Rating InterestManager::rate(const ServerActiveObject *obj) const
+{
+	Rating rating;
+	rating.important = is_attached_to(obj, m_player) || is_attached_to(m_player, obj);
+	if (rating.important) {
+		rating.priority = 1000.0f;
+		rating.interval = 0.0f;
+		return rating;
+	}
+
+	v3f dir = obj->getBasePosition() - m_position;
+	float distance = dir.getLength();
+	bool in_view = distance < BS || dir.dotProduct(m_look_dir) >= distance * m_cos_view_angle;
+	float d = distance / m_radius;
+
+	rating.priority = 1.0f / (0.1f + d);
+	if (!in_view)
+		rating.priority *= 0.25f;
+	if (obj->getType() == ACTIVEOBJECT_TYPE_PLAYER)
+		rating.priority *= 2.0f;
+
+	rating.interval = m_far_interval *
+		rangelim((d - NEAR_RANGE) / (1.0f - NEAR_RANGE), 0.0f, 1.0f);
+	if (!in_view)
+		rating.interval *= 2.0f;
+	return rating;
+}
+
+void InterestManager::sortAdded(ServerEnvironment *env, std::vector<u16> &ids) const
+{
+	std::vector<std::pair<float, u16>> rated;
+	rated.reserve(ids.size());
+	for (u16 id : ids) {
+		ServerActiveObject *obj = env->getActiveObject(id);
+		rated.emplace_back(obj ? rate(obj).priority : 0.0f, id);
+	}
+	std::stable_sort(rated.begin(), rated.end(),
+		[] (const std::pair<float, u16> &a, const std::pair<float, u16> &b) {
+			return a.first > b.first;
+		});
+	for (size_t i = 0; i < rated.size(); i++)
+		ids[i] = rated[i].second;
+}
+
+void InterestManager::spend(u32 bytes)
+{
+	if (m_budget_per_second > 0)
+		m_budget -= bytes;
+}
+
+void InterestManager::selectPositions(ServerEnvironment *env,
+		const ObjectSnapshot &previous, ObjectSnapshot &snapshot)
+{
+	// Objects which moved and are due, with their score
+	std::vector<std::pair<float, u16>> due;
+	for (auto &it : snapshot) {
+		auto prev = previous.find(it.first);
+		// New objects cost little more than their removal would
+		if (prev == previous.end() || prev->second == it.second) {
+			m_waiting.erase(it.first);
+			continue;
+		}
+
+		ServerActiveObject *obj = env->getActiveObject(it.first);
+		if (!obj)
+			continue;
+		Rating rating = rate(obj);
+		if (rating.important)
+			continue;
+		float &waiting = m_waiting[it.first];
+		waiting += m_dtime;
+		if (waiting < rating.interval) {
+			it.second = prev->second;
+			continue;
+		}
+		due.emplace_back(rating.priority * waiting, it.first);
+	}
+
+	// Forget objects the client no longer knows
+	for (auto it = m_waiting.begin(); it != m_waiting.end();) {
+		if (snapshot.find(it->first) == snapshot.end())
+			it = m_waiting.erase(it);
+		else
+			++it;
+	}
+
+	size_t count = due.size();
+	if (m_budget_per_second > 0)
+		count = std::min<size_t>(count, std::max(m_budget, 0.0f) / POSITION_SIZE);
+	if (count < due.size()) {
+		std::nth_element(due.begin(), due.begin() + count, due.end(),
+			[] (const std::pair<float, u16> &a, const std::pair<float, u16> &b) {
+				return a.first > b.first;
+			});
+	}
+
+	for (size_t i = 0; i < due.size(); i++) {
+		u16 id = due[i].second;
+		if (i < count)
+			m_waiting.erase(id);
+		else
+			snapshot[id] = previous.at(id);
+	}
+}
@@ -0,0 +1,93 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irr_v3d.h"
+#include "objectsnapshot.h"
+#include <unordered_map>
+#include <vector>
+
+class PlayerSAO;
+class ServerActiveObject;
+class ServerEnvironment;
+
+/*
+	Decides for one client which active objects are added first and how
+	often their positions are sent, within a budget of bytes per second.
+
+	Objects are rated by their distance to the player, whether they are in
+	the player's view and their importance: objects attached to the player
+	or the player is attached to bypass the budget, players come before
+	entities.
+*/
+class InterestManager
+{
+public:
+	struct Rating
+	{
+		// Higher goes first
+		float priority;
+		// Seconds between position updates
+		float interval;
+		// Not limited by the budget
+		bool important;
+	};
+
+	InterestManager();
+
+	// Sets the viewer of this step and refills the budget
+	void update(float dtime, const PlayerSAO *player, float radius);
+
+	Rating rate(const ServerActiveObject *obj) const;
+
+	// Most interesting first
+	void sortAdded(ServerEnvironment *env, std::vector<u16> &ids) const;
+
+	bool hasBudget() const { return m_budget_per_second == 0 || m_budget > 0.0f; }
+	void spend(u32 bytes);
+
+	/*
+		snapshot holds the current positions of the objects and gets the
+		ones to send. Objects which are not due yet or do not fit into the
+		budget keep their position of the previous snapshot.
+	*/
+	void selectPositions(ServerEnvironment *env, const ObjectSnapshot &previous,
+			ObjectSnapshot &snapshot);
+
+private:
+	// Bytes an object takes in TOCLIENT_ACTIVE_OBJECT_POSITIONS, usually
+	static const u32 POSITION_SIZE = 12;
+
+	const u32 m_budget_per_second;
+	const float m_far_interval;
+
+	float m_budget = 0.0f;
+	float m_dtime = 0.0f;
+
+	// The viewer
+	const PlayerSAO *m_player = nullptr;
+	v3f m_position;
+	v3f m_look_dir;
+	float m_cos_view_angle = 0.0f;
+	float m_radius = 1.0f;
+
+	// Seconds since the position of an object changed without being sent
+	std::unordered_map<u16, float> m_waiting;
+};
@@ -0,0 +1,365 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "liquidregion.h"
+#include "map.h"
+#include "mapblock.h"
+#include "nodedef.h"
+
+#define WATER_DROP_BOOST 4
+
+const static v3s16 liquid_6dirs[6] = {
+	// order: upper before same level before lower
+	v3s16( 0, 1, 0),
+	v3s16( 0, 0, 1),
+	v3s16( 1, 0, 0),
+	v3s16( 0, 0,-1),
+	v3s16(-1, 0, 0),
+	v3s16( 0,-1, 0)
+};
+
+enum NeighborType : u8 {
+	NEIGHBOR_UPPER,
+	NEIGHBOR_SAME_LEVEL,
+	NEIGHBOR_LOWER
+};
+
+struct NodeNeighbor {
+	MapNode n;
+	NeighborType t;
+	v3s16 p;
+
+	NodeNeighbor()
+		: n(CONTENT_AIR), t(NEIGHBOR_SAME_LEVEL)
+	{ }
+
+	NodeNeighbor(const MapNode &node, NeighborType n_type, const v3s16 &pos)
+		: n(node),
+		  t(n_type),
+		  p(pos)
+	{ }
+};
+
+LiquidRegion::LiquidRegion(Map *map, v3s16 blockpos) :
+	m_ndef(map->getNodeDefManager()),
+	m_blockpos(blockpos)
+{
+	u32 i = 0;
+	v3s16 d;
+	for (d.Z = -1; d.Z <= 1; d.Z++)
+	for (d.Y = -1; d.Y <= 1; d.Y++)
+	for (d.X = -1; d.X <= 1; d.X++)
+		m_blocks[i++] = map->getBlockNoCreateNoEx(blockpos + d);
+}
+
+MapNode LiquidRegion::getNode(v3s16 p) const
+{
+	v3s16 blockpos = getNodeBlockPos(p);
+	v3s16 d = blockpos - m_blockpos + 1;
+	MapBlock *block = m_blocks[d.Z * 9 + d.Y * 3 + d.X];
+	if (!block)
+		return {CONTENT_IGNORE};
+
+	v3s16 relpos = p - blockpos * MAP_BLOCKSIZE;
+	if (block == getBlock() && !m_changed.empty()) {
+		auto it = m_changed.find(relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+			relpos.Y * MAP_BLOCKSIZE + relpos.X);
+		if (it != m_changed.end())
+			return it->second;
+	}
+	return block->getNodeNoCheck(relpos);
+}
+
+void LiquidRegion::transform()
+{
+	if (!getBlock())
+		return;
+
+	for (v3s16 p : queue)
+		transformNode(p);
+}
+
+void LiquidRegion::transformNode(v3s16 p0)
+{
+	MapNode n0 = getNode(p0);
+
+	/*
+		Collect information about current node
+	 */
+	s8 liquid_level = -1;
+	// The liquid node which will be placed there if
+	// the liquid flows into this node.
+	content_t liquid_kind = CONTENT_IGNORE;
+	// The node which will be placed there if liquid
+	// can't flow into this node.
+	content_t floodable_node = CONTENT_AIR;
+	const ContentFeatures &cf = m_ndef->get(n0);
+	LiquidType liquid_type = cf.liquid_type;
+	switch (liquid_type) {
+		case LIQUID_SOURCE:
+			liquid_level = LIQUID_LEVEL_SOURCE;
+			liquid_kind = cf.liquid_alternative_flowing_id;
+			break;
+		case LIQUID_FLOWING:
+			liquid_level = (n0.param2 & LIQUID_LEVEL_MASK);
+			liquid_kind = n0.getContent();
+			break;
+		case LIQUID_NONE:
+			// if this node is 'floodable', it *could* be transformed
+			// into a liquid, otherwise, continue with the next node.
+			if (!cf.floodable)
+				return;
+			floodable_node = n0.getContent();
+			liquid_kind = CONTENT_AIR;
+			break;
+	}
+
+	/*
+		Collect information about the environment
+	 */
+	NodeNeighbor sources[6]; // surrounding sources
+	int num_sources = 0;
+	NodeNeighbor flows[6]; // surrounding flowing liquid nodes
+	int num_flows = 0;
+	NodeNeighbor airs[6]; // surrounding air
+	int num_airs = 0;
+	NodeNeighbor neutrals[6]; // nodes that are solid or another kind of liquid
+	int num_neutrals = 0;
+	bool flowing_down = false;
+	bool ignored_sources = false;
+	bool floating_node_above = false;
+	for (u16 i = 0; i < 6; i++) {
+		NeighborType nt = NEIGHBOR_SAME_LEVEL;
+		switch (i) {
+			case 0:
+				nt = NEIGHBOR_UPPER;
+				break;
+			case 5:
+				nt = NEIGHBOR_LOWER;
+				break;
+			default:
+				break;
+		}
+		v3s16 npos = p0 + liquid_6dirs[i];
+		NodeNeighbor nb(getNode(npos), nt, npos);
+		const ContentFeatures &cfnb = m_ndef->get(nb.n);
+		if (nt == NEIGHBOR_UPPER && cfnb.floats)
+			floating_node_above = true;
+		switch (cfnb.liquid_type) {
+			case LIQUID_NONE:
+				if (cfnb.floodable) {
+					airs[num_airs++] = nb;
+					// if the current node is a water source the neighbor
+					// should be enqueded for transformation regardless of whether the
+					// current node changes or not.
+					if (nb.t != NEIGHBOR_UPPER && liquid_type != LIQUID_NONE)
+						next.push_back(npos);
+					// if the current node happens to be a flowing node, it will start to flow down here.
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				} else {
+					neutrals[num_neutrals++] = nb;
+					if (nb.n.getContent() == CONTENT_IGNORE) {
+						// If node below is ignore prevent water from
+						// spreading outwards and otherwise prevent from
+						// flowing away as ignore node might be the source
+						if (nb.t == NEIGHBOR_LOWER)
+							flowing_down = true;
+						else
+							ignored_sources = true;
+					}
+				}
+				break;
+			case LIQUID_SOURCE:
+				// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+				if (liquid_kind == CONTENT_AIR)
+					liquid_kind = cfnb.liquid_alternative_flowing_id;
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					// Do not count bottom source, it will screw things up
+					if(nt != NEIGHBOR_LOWER)
+						sources[num_sources++] = nb;
+				}
+				break;
+			case LIQUID_FLOWING:
+				if (nb.t != NEIGHBOR_SAME_LEVEL ||
+					(nb.n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK) {
+					// if this node is not (yet) of a liquid type, choose the first liquid type we encounter
+					// but exclude falling liquids on the same level, they cannot flow here anyway
+					if (liquid_kind == CONTENT_AIR)
+						liquid_kind = cfnb.liquid_alternative_flowing_id;
+				}
+				if (cfnb.liquid_alternative_flowing_id != liquid_kind) {
+					neutrals[num_neutrals++] = nb;
+				} else {
+					flows[num_flows++] = nb;
+					if (nb.t == NEIGHBOR_LOWER)
+						flowing_down = true;
+				}
+				break;
+		}
+	}
+
+	/*
+		decide on the type (and possibly level) of the current node
+	 */
+	content_t new_node_content;
+	s8 new_node_level = -1;
+	s8 max_node_level = -1;
+
+	u8 range = m_ndef->get(liquid_kind).liquid_range;
+	if (range > LIQUID_LEVEL_MAX + 1)
+		range = LIQUID_LEVEL_MAX + 1;
+
+	if ((num_sources >= 2 && m_ndef->get(liquid_kind).liquid_renewable) || liquid_type == LIQUID_SOURCE) {
+		// liquid_kind will be set to either the flowing alternative of the node (if it's a liquid)
+		// or the flowing alternative of the first of the surrounding sources (if it's air), so
+		// it's perfectly safe to use liquid_kind here to determine the new node content.
+		new_node_content = m_ndef->get(liquid_kind).liquid_alternative_source_id;
+	} else if (num_sources >= 1 && sources[0].t != NEIGHBOR_LOWER) {
+		// liquid_kind is set properly, see above
+		max_node_level = new_node_level = LIQUID_LEVEL_MAX;
+		if (new_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+	} else if (ignored_sources && liquid_level >= 0) {
+		// Maybe there are neighboring sources that aren't loaded yet
+		// so prevent flowing away.
+		new_node_level = liquid_level;
+		new_node_content = liquid_kind;
+	} else {
+		// no surrounding sources, so get the maximum level that can flow into this node
+		for (u16 i = 0; i < num_flows; i++) {
+			u8 nb_liquid_level = (flows[i].n.param2 & LIQUID_LEVEL_MASK);
+			switch (flows[i].t) {
+				case NEIGHBOR_UPPER:
+					if (nb_liquid_level + WATER_DROP_BOOST > max_node_level) {
+						max_node_level = LIQUID_LEVEL_MAX;
+						if (nb_liquid_level + WATER_DROP_BOOST < LIQUID_LEVEL_MAX)
+							max_node_level = nb_liquid_level + WATER_DROP_BOOST;
+					} else if (nb_liquid_level > max_node_level) {
+						max_node_level = nb_liquid_level;
+					}
+					break;
+				case NEIGHBOR_LOWER:
+					break;
+				case NEIGHBOR_SAME_LEVEL:
+					if ((flows[i].n.param2 & LIQUID_FLOW_DOWN_MASK) != LIQUID_FLOW_DOWN_MASK &&
+							nb_liquid_level > 0 && nb_liquid_level - 1 > max_node_level)
+						max_node_level = nb_liquid_level - 1;
+					break;
+			}
+		}
+
+		u8 viscosity = m_ndef->get(liquid_kind).liquid_viscosity;
+		if (viscosity > 1 && max_node_level != liquid_level) {
+			// amount to gain, limited by viscosity
+			// must be at least 1 in absolute value
+			s8 level_inc = max_node_level - liquid_level;
+			if (level_inc < -viscosity || level_inc > viscosity)
+				new_node_level = liquid_level + level_inc/viscosity;
+			else if (level_inc < 0)
+				new_node_level = liquid_level - 1;
+			else if (level_inc > 0)
+				new_node_level = liquid_level + 1;
+			if (new_node_level != max_node_level)
+				must_reflow.push_back(p0);
+		} else {
+			new_node_level = max_node_level;
+		}
+
+		if (max_node_level >= (LIQUID_LEVEL_MAX + 1 - range))
+			new_node_content = liquid_kind;
+		else
+			new_node_content = floodable_node;
+
+	}
+
+	/*
+		check if anything has changed. if not, just continue with the next node.
+	 */
+	if (new_node_content == n0.getContent() &&
+			(m_ndef->get(n0.getContent()).liquid_type != LIQUID_FLOWING ||
+			((n0.param2 & LIQUID_LEVEL_MASK) == (u8)new_node_level &&
+			((n0.param2 & LIQUID_FLOW_DOWN_MASK) == LIQUID_FLOW_DOWN_MASK)
+			== flowing_down)))
+		return;
+
+	/*
+		check if there is a floating node above that needs to be updated.
+	 */
+	if (floating_node_above && new_node_content == CONTENT_AIR)
+		check_for_falling.push_back(p0);
+
+	/*
+		update the current node
+	 */
+	Change change;
+	change.p = p0;
+	change.old_node = n0;
+	if (m_ndef->get(new_node_content).liquid_type == LIQUID_FLOWING) {
+		// set level to last 3 bits, flowing down bit to 4th bit
+		n0.param2 = (flowing_down ? LIQUID_FLOW_DOWN_MASK : 0x00) | (new_node_level & LIQUID_LEVEL_MASK);
+	} else {
+		// set the liquid level and flow bits to 0
+		n0.param2 &= ~(LIQUID_LEVEL_MASK | LIQUID_FLOW_DOWN_MASK);
+	}
+
+	// change the node.
+	n0.setContent(new_node_content);
+	change.new_node = n0;
+	change.flood = floodable_node != CONTENT_AIR;
+
+	/*
+		enqueue neighbors for update if necessary
+	 */
+	change.next_count = 0;
+	switch (m_ndef->get(n0.getContent()).liquid_type) {
+		case LIQUID_SOURCE:
+		case LIQUID_FLOWING:
+			// make sure source flows into all neighboring nodes
+			for (u16 i = 0; i < num_flows; i++)
+				if (flows[i].t != NEIGHBOR_UPPER)
+					change.next[change.next_count++] = flows[i].p;
+			for (u16 i = 0; i < num_airs; i++)
+				if (airs[i].t != NEIGHBOR_UPPER)
+					change.next[change.next_count++] = airs[i].p;
+			break;
+		case LIQUID_NONE:
+			// this flow has turned to air; neighboring flows might need to do the same
+			for (u16 i = 0; i < num_flows; i++)
+				change.next[change.next_count++] = flows[i].p;
+			break;
+	}
+
+	changes.push_back(change);
+
+	// The nodes transformed later see this change, unless on_flood()
+	// still has to decide on it
+	if (!change.flood) {
+		ContentLightingFlags f0 = m_ndef->getLightingFlags(n0);
+		n0.setLight(LIGHTBANK_DAY, 0, f0);
+		n0.setLight(LIGHTBANK_NIGHT, 0, f0);
+		v3s16 relpos = p0 - m_blockpos * MAP_BLOCKSIZE;
+		m_changed[relpos.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE +
+			relpos.Y * MAP_BLOCKSIZE + relpos.X] = n0;
+	}
+}
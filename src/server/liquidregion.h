@@ -0,0 +1,97 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irr_v3d.h"
+#include "mapnode.h"
+#include "util/basic_macros.h"
+#include <unordered_map>
+#include <vector>
+
+class Map;
+class MapBlock;
+class NodeDefManager;
+
+/*
+	The queued transforming liquid nodes of one mapblock.
+
+	The mapblock and its neighbors are looked up when the region is
+	created. After that transform() may run on any thread while nothing
+	modifies the map: it only reads the blocks and keeps the changes to
+	itself, the map's thread makes them afterwards.
+
+	Regions of the same color never read each other's mapblock, so they
+	can be transformed at the same time.
+*/
+class LiquidRegion
+{
+public:
+	struct Change
+	{
+		v3s16 p;
+		MapNode old_node;
+		MapNode new_node;
+		// A floodable node is replaced, its on_flood() may cancel this
+		bool flood;
+		// Nodes to transform in the next step once the change is made
+		v3s16 next[6];
+		u8 next_count;
+	};
+
+	static const u8 COLOR_COUNT = 8;
+
+	LiquidRegion(Map *map, v3s16 blockpos);
+	DISABLE_CLASS_COPY(LiquidRegion);
+
+	static u8 getColor(v3s16 blockpos)
+	{
+		return (blockpos.X & 1) | (blockpos.Y & 1) << 1 | (blockpos.Z & 1) << 2;
+	}
+
+	v3s16 getBlockPos() const { return m_blockpos; }
+	MapBlock *getBlock() const { return m_blocks[13]; }
+
+	// Transforms every node of queue in order
+	void transform();
+
+	// Nodes to transform, all in the mapblock
+	std::vector<v3s16> queue;
+
+	// Results of transform()
+	std::vector<Change> changes;
+	// Nodes to transform in the next step whatever the changes
+	std::vector<v3s16> next;
+	// Nodes which have not reached their level due to viscosity
+	std::vector<v3s16> must_reflow;
+	// Nodes turned to air below a floating node
+	std::vector<v3s16> check_for_falling;
+
+private:
+	void transformNode(v3s16 p0);
+
+	MapNode getNode(v3s16 p) const;
+
+	const NodeDefManager *m_ndef;
+	v3s16 m_blockpos;
+	// The mapblock and its 26 neighbors, nullptr where not loaded
+	MapBlock *m_blocks[27];
+	// Changes made in the mapblock, by node index
+	std::unordered_map<u16, MapNode> m_changed;
+};
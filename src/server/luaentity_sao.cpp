@@ -152,7 +152,7 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 	// Each frame, parent position is copied if the object is attached, otherwise it's calculated normally
 	// If the object gets detached this comes into effect automatically from the last known origin
 	if (auto *parent = getParent()) {
-		m_base_position = parent->getBasePosition();
+		setBasePosition(parent->getBasePosition());
 		m_velocity = v3f(0,0,0);
 		m_acceleration = v3f(0,0,0);
 	} else {
@@ -171,11 +171,12 @@ void LuaEntitySAO::step(float dtime, bool send_recommended)
 			moveresult_p = &moveresult;
 
 			// Apply results
-			m_base_position = p_pos;
+			setBasePosition(p_pos);
 			m_velocity = p_velocity;
 			m_acceleration = p_acceleration;
 		} else {
-			m_base_position += (m_velocity + m_acceleration * 0.5f * dtime) * dtime;
+			setBasePosition(m_base_position +
+					(m_velocity + m_acceleration * 0.5f * dtime) * dtime);
 			m_velocity += dtime * m_acceleration;
 		}
 
@@ -366,7 +367,7 @@ void LuaEntitySAO::setPos(const v3f &pos)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	sendPosition(false, true);
 }
 
@@ -374,7 +375,7 @@ void LuaEntitySAO::moveTo(v3f pos, bool continuous)
 {
 	if(isAttached())
 		return;
-	m_base_position = pos;
+	setBasePosition(pos);
 	if(!continuous)
 		sendPosition(true, true);
 }
@@ -514,19 +515,14 @@ void LuaEntitySAO::sendPosition(bool do_interpolate, bool is_movement_end)
 	//m_last_sent_acceleration = m_acceleration;
 	m_last_sent_rotation = m_rotation;
 
-	float update_interval = m_env->getSendRecommendedInterval();
-
-	std::string str = generateUpdatePositionCommand(
-		m_base_position,
-		m_velocity,
-		m_acceleration,
-		m_rotation,
-		do_interpolate,
-		is_movement_end,
-		update_interval
-	);
-	// create message and add to list
-	m_messages_out.emplace(getId(), false, str);
+	ObjectPosition pos;
+	pos.position = m_base_position;
+	pos.velocity = m_velocity;
+	pos.acceleration = m_acceleration;
+	pos.rotation = m_rotation;
+	pos.do_interpolate = do_interpolate;
+	pos.is_end_position = is_movement_end;
+	sendPositionUpdate(pos);
 }
 
 bool LuaEntitySAO::getCollisionBox(aabb3f *toset) const
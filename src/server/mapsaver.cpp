@@ -0,0 +1,371 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "mapsaver.h"
+#include "database/database.h"
+#include "debug.h"
+#include "log.h"
+#include "mapblock.h"
+#include "porting.h"
+#include "profiler.h"
+#include "serialization.h"
+#include "threading/thread.h"
+#include "util/basic_macros.h"
+#include <sstream>
+
+// Blocks written in one database transaction
+#define MAP_SAVE_BATCH_SIZE 256
+// Block writes remembered for wasWrittenSince()
+#define MAP_SAVE_WRITE_HISTORY_SIZE 4096
+
+class MapSaverThread : public Thread
+{
+public:
+	MapSaverThread(MapSaver *saver) :
+		Thread("MapSaver"),
+		m_saver(saver)
+	{}
+
+	void *run();
+
+private:
+	MapSaver *m_saver;
+};
+
+void *MapSaverThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (m_saver->processBatch())
+		;
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
+
+MapSaver::MapSaver(MapDatabase *db, int compression_level, MetricsBackend *mb) :
+	m_db(db),
+	m_compression_level(compression_level)
+{
+	m_queue_size_gauge = mb->addGauge(
+		"minetest_map_save_queue_size", "Number of blocks waiting to be written");
+	m_stall_time_counter = mb->addCounter(
+		"minetest_map_save_stall_time",
+		"Time spent waiting for space in the save queue (in microseconds)");
+}
+
+MapSaver::~MapSaver()
+{
+	stop();
+}
+
+void MapSaver::start(u32 max_queue_size)
+{
+	if (m_thread || max_queue_size == 0)
+		return;
+
+	m_max_queue_size = max_queue_size;
+	m_thread = new MapSaverThread(this);
+	m_thread->start();
+}
+
+void MapSaver::stop()
+{
+	if (!m_thread)
+		return;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_queue_cv.notify_all();
+
+	// The thread exits once the queue is empty
+	m_thread->wait();
+	delete m_thread;
+	m_thread = nullptr;
+	m_stop = false;
+}
+
+void MapSaver::beginSave()
+{
+	if (isAsync())
+		return;
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->beginSave();
+}
+
+void MapSaver::endSave()
+{
+	if (isAsync())
+		return;
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->endSave();
+}
+
+bool MapSaver::saveBlock(MapBlock *block)
+{
+	if (!isAsync()) {
+		std::string data = serialize(block, m_compression_level);
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		bool success = m_db->saveBlock(block->getPos(), data);
+		noteWrite(block->getPos());
+		if (!success)
+			return false;
+		// We just wrote it to the disk so clear modified flag
+		block->resetModified();
+		return true;
+	}
+
+	std::shared_ptr<MapBlock> snapshot(block->createSnapshot(true));
+	// Serializing must not change the snapshot, it may be read twice
+	snapshot->getDayNightDiff();
+	block->resetModified();
+
+	v3s16 pos = block->getPos();
+	std::unique_lock<std::mutex> lock(m_mutex);
+	auto it = m_pending.find(pos);
+	if (it == m_pending.end()) {
+		if (m_pending.size() >= m_max_queue_size) {
+			u64 start_time = porting::getTimeUs();
+			m_space_cv.wait(lock, [this] {
+				return m_pending.size() < m_max_queue_size;
+			});
+			m_stall_time_counter->increment(porting::getTimeUs() - start_time);
+		}
+		it = m_pending.emplace(pos, Job{nullptr, 0, false}).first;
+	}
+
+	Job &job = it->second;
+	job.snapshot = std::move(snapshot);
+	job.seq = m_next_seq++;
+	if (!job.queued) {
+		m_order.push_back(pos);
+		job.queued = true;
+	}
+	m_queue_size_gauge->set(m_pending.size());
+	lock.unlock();
+	noteWrite(pos);
+
+	m_queue_cv.notify_one();
+	return true;
+}
+
+void MapSaver::flush()
+{
+	if (!isAsync())
+		return;
+
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_space_cv.wait(lock, [this] { return m_pending.empty(); });
+}
+
+void MapSaver::loadBlock(const v3s16 &pos, std::string *data)
+{
+	std::shared_ptr<MapBlock> snapshot;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_pending.find(pos);
+		if (it != m_pending.end())
+			snapshot = it->second.snapshot;
+	}
+
+	if (snapshot) {
+		*data = serialize(snapshot.get(), m_compression_level);
+		return;
+	}
+
+	// Entries are only removed after they were written
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->loadBlock(pos, data);
+}
+
+void MapSaver::loadBlocks(const std::vector<v3s16> &pos,
+	std::vector<std::string> *data)
+{
+	std::vector<std::shared_ptr<MapBlock>> snapshots(pos.size());
+	std::vector<v3s16> stored;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (size_t i = 0; i < pos.size(); i++) {
+			auto it = m_pending.find(pos[i]);
+			if (it != m_pending.end())
+				snapshots[i] = it->second.snapshot;
+			else
+				stored.push_back(pos[i]);
+		}
+	}
+
+	std::vector<std::string> stored_data;
+	if (!stored.empty()) {
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		m_db->loadBlocks(stored, &stored_data);
+	}
+
+	data->clear();
+	data->resize(pos.size());
+	for (size_t i = 0, j = 0; i < pos.size(); i++) {
+		if (snapshots[i])
+			(*data)[i] = serialize(snapshots[i].get(), m_compression_level);
+		else
+			(*data)[i] = std::move(stored_data[j++]);
+	}
+}
+
+bool MapSaver::deleteBlock(const v3s16 &pos)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pending.erase(pos);
+		m_queue_size_gauge->set(m_pending.size());
+	}
+	m_space_cv.notify_all();
+
+	// A write in progress is finished first, processBatch() skips
+	// this block from now on
+	bool success;
+	{
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		success = m_db->deleteBlock(pos);
+	}
+	noteWrite(pos);
+	return success;
+}
+
+void MapSaver::listAllLoadableBlocks(std::vector<v3s16> &dst)
+{
+	flush();
+
+	std::lock_guard<std::mutex> lock(m_db_mutex);
+	m_db->listAllLoadableBlocks(dst);
+}
+
+bool MapSaver::wasWrittenSince(const v3s16 &pos, u64 write_count)
+{
+	std::lock_guard<std::mutex> lock(m_written_mutex);
+	if (write_count < m_forgotten_write_count)
+		return true;
+	auto it = m_last_write.find(pos);
+	return it != m_last_write.end() && it->second > write_count;
+}
+
+void MapSaver::noteWrite(const v3s16 &pos)
+{
+	// After the data changed: a reader which got the count before this
+	// either read the new data or sees the write here
+	std::lock_guard<std::mutex> lock(m_written_mutex);
+	u64 count = ++m_write_count;
+	m_last_write[pos] = count;
+	m_write_history.emplace_back(pos, count);
+
+	if (m_write_history.size() > MAP_SAVE_WRITE_HISTORY_SIZE) {
+		const auto &oldest = m_write_history.front();
+		auto it = m_last_write.find(oldest.first);
+		if (it->second == oldest.second)
+			m_last_write.erase(it);
+		m_forgotten_write_count = oldest.second;
+		m_write_history.pop_front();
+	}
+}
+
+u32 MapSaver::getQueueSize()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_pending.size();
+}
+
+std::string MapSaver::serialize(MapBlock *block, int compression_level)
+{
+	// Format used for writing
+	u8 version = SER_FMT_VER_HIGHEST_WRITE;
+
+	/*
+		[0] u8 serialization version
+		[1] data
+	*/
+	std::ostringstream o(std::ios_base::binary);
+	o.write((char*) &version, 1);
+	block->serialize(o, version, true, compression_level);
+	return o.str();
+}
+
+bool MapSaver::isCurrent(const v3s16 &pos, u64 seq)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	auto it = m_pending.find(pos);
+	return it != m_pending.end() && it->second.seq == seq;
+}
+
+bool MapSaver::processBatch()
+{
+	std::vector<std::pair<v3s16, Job>> batch;
+	{
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_queue_cv.wait(lock, [this] { return m_stop || !m_order.empty(); });
+		if (m_order.empty())
+			return false;
+
+		while (!m_order.empty() && batch.size() < MAP_SAVE_BATCH_SIZE) {
+			v3s16 pos = m_order.front();
+			m_order.pop_front();
+			auto it = m_pending.find(pos);
+			if (it == m_pending.end() || !it->second.queued)
+				continue;
+			it->second.queued = false;
+			batch.emplace_back(pos, it->second);
+		}
+	}
+
+	ScopeProfiler sp(g_profiler, "MapSaver: write batch", SPT_AVG);
+
+	std::vector<std::string> data;
+	data.reserve(batch.size());
+	for (auto &it : batch)
+		data.push_back(serialize(it.second.snapshot.get(), m_compression_level));
+
+	{
+		std::lock_guard<std::mutex> lock(m_db_mutex);
+		m_db->beginSave();
+		for (size_t i = 0; i < batch.size(); i++) {
+			const v3s16 &pos = batch[i].first;
+			// Deleted, or a newer snapshot is queued
+			if (!isCurrent(pos, batch[i].second.seq))
+				continue;
+			if (!m_db->saveBlock(pos, data[i])) {
+				errorstream << "MapSaver: Failed to save block "
+					<< PP(pos) << std::endl;
+			}
+		}
+		m_db->endSave();
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		for (auto &it : batch) {
+			auto pending = m_pending.find(it.first);
+			if (pending != m_pending.end() && pending->second.seq == it.second.seq)
+				m_pending.erase(pending);
+		}
+		m_queue_size_gauge->set(m_pending.size());
+	}
+	m_space_cv.notify_all();
+
+	return true;
+}
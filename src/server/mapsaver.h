@@ -0,0 +1,138 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes_bloated.h"
+#include "util/metricsbackend.h"
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class MapBlock;
+class MapDatabase;
+class MapSaverThread;
+
+/*
+	Writes mapblocks to the map database on a background thread.
+
+	The server thread only takes a snapshot of each modified block (see
+	MapBlock::createSnapshot()), compression and the database writes
+	happen on the thread. At most max_queue_size blocks wait to be
+	written, saving more blocks blocks the caller until there is space.
+
+	While the thread runs every access to the database has to go through
+	here, so reads see the blocks which are still queued.
+	Without the thread blocks are written as they are saved.
+*/
+class MapSaver
+{
+public:
+	MapSaver(MapDatabase *db, int compression_level, MetricsBackend *mb);
+	// Writes the remaining blocks
+	~MapSaver();
+
+	void start(u32 max_queue_size);
+	// Writes the remaining blocks and stops the thread
+	void stop();
+
+	bool isAsync() const { return m_thread != nullptr; }
+
+	// Group the synchronous writes into one transaction
+	void beginSave();
+	void endSave();
+
+	// Marks the block as saved, the write may happen later.
+	// Returns false if writing failed right away.
+	bool saveBlock(MapBlock *block);
+	// Waits until all blocks queued so far are written
+	void flush();
+
+	void loadBlock(const v3s16 &pos, std::string *data);
+	// See MapDatabase::loadBlocks()
+	void loadBlocks(const std::vector<v3s16> &pos, std::vector<std::string> *data);
+	bool deleteBlock(const v3s16 &pos);
+	void listAllLoadableBlocks(std::vector<v3s16> &dst);
+
+	u32 getQueueSize();
+	// Changes whenever a block is saved or deleted, once the new data can be
+	// read. Take it before loading to check the data for being outdated.
+	u64 getWriteCount() const { return m_write_count.load(); }
+	// Whether the block was saved or deleted after getWriteCount() returned
+	// write_count. Can be true for other blocks if write_count is very old.
+	bool wasWrittenSince(const v3s16 &pos, u64 write_count);
+
+	static std::string serialize(MapBlock *block, int compression_level);
+
+private:
+	friend class MapSaverThread;
+
+	struct Job
+	{
+		std::shared_ptr<MapBlock> snapshot;
+		u64 seq;
+		// Whether the position is in m_order
+		bool queued;
+	};
+
+	// Writes one batch of queued blocks, returns false when stopping
+	bool processBatch();
+	bool isCurrent(const v3s16 &pos, u64 seq);
+	void noteWrite(const v3s16 &pos);
+
+	MapDatabase *m_db;
+	const int m_compression_level;
+
+	MapSaverThread *m_thread = nullptr;
+	u32 m_max_queue_size = 0;
+
+	// Protects the queue
+	std::mutex m_mutex;
+	std::condition_variable m_queue_cv;
+	std::condition_variable m_space_cv;
+	// Blocks waiting to be written, the newest snapshot of each
+	std::map<v3s16, Job> m_pending;
+	// Write order, may contain positions which were written already
+	std::deque<v3s16> m_order;
+	u64 m_next_seq = 1;
+	bool m_stop = false;
+
+	std::atomic<u64> m_write_count{0};
+
+	// Protects the write history
+	std::mutex m_written_mutex;
+	// Write count after the last write of each recently written block
+	std::unordered_map<v3s16, u64> m_last_write;
+	// The same in write order, the oldest entries are forgotten
+	std::deque<std::pair<v3s16, u64>> m_write_history;
+	// Writes up to this count are no longer in the history
+	u64 m_forgotten_write_count = 0;
+
+	// Serializes the database access of the thread and everyone else
+	std::mutex m_db_mutex;
+
+	MetricGaugePtr m_queue_size_gauge;
+	MetricCounterPtr m_stall_time_counter;
+};
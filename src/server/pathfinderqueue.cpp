@@ -0,0 +1,258 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "pathfinderqueue.h"
+#include <cstring>
+#include <map>
+#include <tuple>
+#include "debug.h"
+#include "gamedef.h"
+#include "log.h"
+#include "mapblock.h"
+#include "mapsector.h"
+#include "profiler.h"
+#include "settings.h"
+#include "threading/thread.h"
+#include "util/numeric.h"
+
+// Upper limit of MapBlocks copied for a single batch (16 KiB each)
+#define PATHFINDER_MAX_SNAPSHOT_BLOCKS 4096
+
+class PathfinderThread : public Thread
+{
+public:
+	PathfinderThread(PathfinderQueue *queue) :
+		Thread("Pathfinder"),
+		m_queue(queue)
+	{}
+
+	void *run();
+
+private:
+	PathfinderQueue *m_queue;
+};
+
+void *PathfinderThread::run()
+{
+	BEGIN_DEBUG_EXCEPTION_HANDLER
+
+	while (!stopRequested()) {
+		PathfinderQueue::Batch *batch = m_queue->m_pending.pop_frontNoEx(100);
+		if (!batch)
+			continue;
+
+		m_queue->processBatch(batch);
+		m_queue->m_finished.push_back(batch);
+	}
+
+	END_DEBUG_EXCEPTION_HANDLER
+
+	return nullptr;
+}
+
+/*
+	MapSnapshot
+*/
+
+u32 MapSnapshot::copyBlocks(Map *map, v3s16 bpmin, v3s16 bpmax)
+{
+	u32 count = 0;
+	for (s16 z = bpmin.Z; z <= bpmax.Z; z++)
+	for (s16 x = bpmin.X; x <= bpmax.X; x++) {
+		v2s16 p2d(x, z);
+		MapSector *sector = getSectorNoGenerateNoLock(p2d);
+		for (s16 y = bpmin.Y; y <= bpmax.Y; y++) {
+			if (m_block_count >= PATHFINDER_MAX_SNAPSHOT_BLOCKS)
+				return count;
+
+			if (sector && sector->getBlockNoCreateNoEx(y))
+				continue;
+
+			const MapBlock *src = map->getBlockNoCreateNoEx(v3s16(x, y, z));
+			if (!src)
+				continue;
+
+			if (!sector) {
+				sector = new MapSector(this, p2d, m_gamedef);
+				m_sectors[p2d] = sector;
+			}
+			MapBlock *block = sector->createBlankBlock(y);
+			block->copyNodesFrom(*src);
+			m_block_count++;
+			count++;
+		}
+	}
+	return count;
+}
+
+/*
+	PathfinderQueue
+*/
+
+PathfinderQueue::PathfinderQueue(IGameDef *gamedef) :
+	m_gamedef(gamedef)
+{
+}
+
+PathfinderQueue::~PathfinderQueue()
+{
+	stopThreads();
+
+	while (!m_pending.empty())
+		cancelBatch(m_pending.pop_frontNoEx());
+	while (!m_finished.empty())
+		cancelBatch(m_finished.pop_frontNoEx());
+}
+
+void PathfinderQueue::startThreads()
+{
+	if (!m_threads.empty())
+		return;
+
+	u16 num_threads = g_settings->getU16("num_pathfinder_threads");
+	for (u16 i = 0; i < num_threads; i++) {
+		PathfinderThread *thread = new PathfinderThread(this);
+		thread->start();
+		m_threads.push_back(thread);
+	}
+}
+
+void PathfinderQueue::stopThreads()
+{
+	for (PathfinderThread *thread : m_threads)
+		thread->stop();
+	for (PathfinderThread *thread : m_threads) {
+		thread->wait();
+		delete thread;
+	}
+	m_threads.clear();
+}
+
+void PathfinderQueue::enqueue(Map *map, std::vector<PathRequest> &&requests,
+	PathCompletionCallback callback, void *param)
+{
+	Batch *batch = new Batch;
+	batch->requests = std::move(requests);
+	batch->map = new MapSnapshot(m_gamedef);
+	batch->callback = callback;
+	batch->param = param;
+
+	// Copy everything the searches may look at, including the nodes
+	// below the search area
+	auto clamp_pos = [] (s32 x, s32 y, s32 z) {
+		const s32 limit = MAX_MAP_GENERATION_LIMIT;
+		return v3s16(rangelim(x, -limit, limit), rangelim(y, -limit, limit),
+			rangelim(z, -limit, limit));
+	};
+	for (const PathRequest &request : batch->requests) {
+		s32 d = MYMIN(request.searchdistance, (unsigned int)MAX_MAP_GENERATION_LIMIT);
+		v3s16 minp = clamp_pos(
+			MYMIN(request.source.X, request.destination.X) - d,
+			MYMIN(request.source.Y, request.destination.Y) - d - 1,
+			MYMIN(request.source.Z, request.destination.Z) - d);
+		v3s16 maxp = clamp_pos(
+			MYMAX(request.source.X, request.destination.X) + d,
+			MYMAX(request.source.Y, request.destination.Y) + d,
+			MYMAX(request.source.Z, request.destination.Z) + d);
+		batch->map->copyBlocks(map, getNodeBlockPos(minp), getNodeBlockPos(maxp));
+	}
+
+	if (batch->map->getBlockCount() >= PATHFINDER_MAX_SNAPSHOT_BLOCKS) {
+		warningstream << "PathfinderQueue: search area of "
+			<< batch->requests.size() << " requests is too large, "
+			<< "paths may be missing" << std::endl;
+	}
+
+	g_profiler->avg("Pathfinder: snapshot blocks", batch->map->getBlockCount());
+	m_pending.push_back(batch);
+}
+
+void PathfinderQueue::step()
+{
+	if (m_threads.empty()) {
+		while (!m_pending.empty()) {
+			Batch *batch = m_pending.pop_frontNoEx();
+			processBatch(batch);
+			m_finished.push_back(batch);
+		}
+	}
+
+	while (!m_finished.empty()) {
+		Batch *batch = m_finished.pop_frontNoEx();
+		if (batch->callback)
+			batch->callback(&batch->paths, batch->param);
+		delete batch->map;
+		delete batch;
+	}
+}
+
+std::vector<std::vector<v3s16>> PathfinderQueue::findPaths(Map *map,
+	const NodeDefManager *ndef, const std::vector<PathRequest> &requests)
+{
+	std::vector<std::vector<v3s16>> paths(requests.size());
+
+	// Group the requests by destination and movement parameters
+	typedef std::tuple<v3s16, unsigned int, unsigned int, unsigned int> GroupKey;
+	std::map<GroupKey, std::vector<size_t>> groups;
+	for (size_t i = 0; i < requests.size(); i++) {
+		const PathRequest &r = requests[i];
+		groups[GroupKey(r.destination, r.searchdistance, r.max_jump,
+			r.max_drop)].push_back(i);
+	}
+
+	for (const auto &group : groups) {
+		const std::vector<size_t> &indices = group.second;
+		const PathRequest &first = requests[indices.front()];
+
+		if (indices.size() == 1) {
+			paths[indices.front()] = get_path(map, ndef, first.source,
+				first.destination, first.searchdistance, first.max_jump,
+				first.max_drop, first.algo);
+			continue;
+		}
+
+		// One reverse search for the whole group
+		std::vector<v3s16> sources;
+		sources.reserve(indices.size());
+		for (size_t i : indices)
+			sources.push_back(requests[i].source);
+
+		std::vector<std::vector<v3s16>> group_paths = get_paths(map, ndef,
+			sources, first.destination, first.searchdistance, first.max_jump,
+			first.max_drop);
+		for (size_t j = 0; j < indices.size(); j++)
+			paths[indices[j]] = std::move(group_paths[j]);
+	}
+
+	return paths;
+}
+
+void PathfinderQueue::processBatch(Batch *batch)
+{
+	ScopeProfiler sp(g_profiler, "Pathfinder: process batch", SPT_AVG);
+	batch->paths = findPaths(batch->map, m_gamedef->ndef(), batch->requests);
+}
+
+void PathfinderQueue::cancelBatch(Batch *batch)
+{
+	if (batch->callback)
+		batch->callback(nullptr, batch->param);
+	delete batch->map;
+	delete batch;
+}
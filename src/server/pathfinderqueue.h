@@ -0,0 +1,112 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irr_v3d.h"
+#include "map.h"
+#include "pathfinder.h"
+#include "util/container.h"
+#include <vector>
+
+class IGameDef;
+class PathfinderThread;
+
+struct PathRequest
+{
+	v3s16 source;
+	v3s16 destination;
+	unsigned int searchdistance;
+	unsigned int max_jump;
+	unsigned int max_drop;
+	PathAlgorithm algo;
+};
+
+// paths is nullptr if the batch was cancelled
+typedef void (*PathCompletionCallback)(
+	std::vector<std::vector<v3s16>> *paths, void *param);
+
+/*
+	Read-only copy of the loaded MapBlocks of an area.
+	Path searches run on it without holding the environment lock.
+*/
+class MapSnapshot : public Map
+{
+public:
+	MapSnapshot(IGameDef *gamedef) : Map(gamedef) {}
+	~MapSnapshot() = default;
+
+	// Copies all loaded blocks between bpmin and bpmax which have not
+	// been copied yet. Returns the number of new blocks.
+	u32 copyBlocks(Map *map, v3s16 bpmin, v3s16 bpmax);
+
+	u32 getBlockCount() const { return m_block_count; }
+
+	bool maySaveBlocks() override { return false; }
+
+private:
+	u32 m_block_count = 0;
+};
+
+/*
+	Runs batches of path searches on worker threads.
+	Requests sharing the destination and movement parameters are served
+	by a single search. Results are delivered by step() on the server thread.
+*/
+class PathfinderQueue
+{
+public:
+	PathfinderQueue(IGameDef *gamedef);
+	~PathfinderQueue();
+
+	void startThreads();
+	void stopThreads();
+
+	// Must be called with the environment lock held
+	void enqueue(Map *map, std::vector<PathRequest> &&requests,
+		PathCompletionCallback callback, void *param);
+
+	// Runs the callbacks of all finished batches, must be called
+	// on the server thread with the environment lock held.
+	// Without worker threads pending batches are processed here.
+	void step();
+
+	// Searches all requests of a batch against map
+	static std::vector<std::vector<v3s16>> findPaths(Map *map,
+		const NodeDefManager *ndef, const std::vector<PathRequest> &requests);
+
+private:
+	friend class PathfinderThread;
+
+	struct Batch {
+		std::vector<PathRequest> requests;
+		std::vector<std::vector<v3s16>> paths;
+		MapSnapshot *map = nullptr;
+		PathCompletionCallback callback = nullptr;
+		void *param = nullptr;
+	};
+
+	void processBatch(Batch *batch);
+	void cancelBatch(Batch *batch);
+
+	IGameDef *m_gamedef;
+	std::vector<PathfinderThread *> m_threads;
+	MutexedQueue<Batch *> m_pending;
+	MutexedQueue<Batch *> m_finished;
+};
@@ -272,26 +272,16 @@ void PlayerSAO::step(float dtime, bool send_recommended)
 
 	if (m_position_not_sent) {
 		m_position_not_sent = false;
-		float update_interval = m_env->getSendRecommendedInterval();
-		v3f pos;
+		ObjectPosition pos;
 		// When attached, the position is only sent to clients where the
 		// parent isn't known
 		if (isAttached())
-			pos = m_last_good_position;
+			pos.position = m_last_good_position;
 		else
-			pos = m_base_position;
-
-		std::string str = generateUpdatePositionCommand(
-			pos,
-			v3f(0.0f, 0.0f, 0.0f),
-			v3f(0.0f, 0.0f, 0.0f),
-			m_rotation,
-			true,
-			false,
-			update_interval
-		);
-		// create message and add to list
-		m_messages_out.emplace(getId(), false, str);
+			pos.position = m_base_position;
+		pos.rotation = m_rotation;
+		pos.do_interpolate = true;
+		sendPositionUpdate(pos);
 	}
 
 	if (!m_physics_override_sent) {
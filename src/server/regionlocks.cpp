@@ -0,0 +1,74 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "regionlocks.h"
+#include "debug.h"
+
+static bool overlaps(const VoxelArea &a, const VoxelArea &b)
+{
+	return a.MinEdge.X <= b.MaxEdge.X && b.MinEdge.X <= a.MaxEdge.X &&
+		a.MinEdge.Y <= b.MaxEdge.Y && b.MinEdge.Y <= a.MaxEdge.Y &&
+		a.MinEdge.Z <= b.MaxEdge.Z && b.MinEdge.Z <= a.MaxEdge.Z;
+}
+
+bool RegionLocks::isFree(const VoxelArea &area) const
+{
+	for (const VoxelArea &locked : m_locked) {
+		if (overlaps(area, locked))
+			return false;
+	}
+	return true;
+}
+
+void RegionLocks::lock(const VoxelArea &area)
+{
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_unlocked_cv.wait(lock, [&] { return isFree(area); });
+	m_locked.push_back(area);
+}
+
+bool RegionLocks::tryLock(const VoxelArea &area)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (!isFree(area))
+		return false;
+	m_locked.push_back(area);
+	return true;
+}
+
+void RegionLocks::unlock(const VoxelArea &area)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto it = m_locked.begin();
+		for (; it != m_locked.end(); ++it) {
+			if (it->MinEdge == area.MinEdge && it->MaxEdge == area.MaxEdge)
+				break;
+		}
+		FATAL_ERROR_IF(it == m_locked.end(), "RegionLocks: region is not locked");
+		m_locked.erase(it);
+	}
+	m_unlocked_cv.notify_all();
+}
+
+size_t RegionLocks::getLockedCount()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_locked.size();
+}
@@ -0,0 +1,80 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "voxel.h"
+#include "util/basic_macros.h"
+#include <condition_variable>
+#include <mutex>
+#include <vector>
+
+/*
+	Table of locked map regions, in mapblock positions.
+
+	A region is locked by one owner at a time: locking waits while the
+	region overlaps one which is locked already. Regions which do not
+	overlap are locked concurrently.
+
+	Owners must not wait for a region while holding a lock the holders of
+	other regions may need (like the environment lock), or they deadlock.
+*/
+class RegionLocks
+{
+public:
+	RegionLocks() = default;
+	DISABLE_CLASS_COPY(RegionLocks);
+
+	void lock(const VoxelArea &area);
+	// Locks the region if that does not need waiting
+	bool tryLock(const VoxelArea &area);
+	void unlock(const VoxelArea &area);
+
+	size_t getLockedCount();
+
+private:
+	// Needs m_mutex held
+	bool isFree(const VoxelArea &area) const;
+
+	std::mutex m_mutex;
+	std::condition_variable m_unlocked_cv;
+	std::vector<VoxelArea> m_locked;
+};
+
+// Holds a region of a RegionLocks table for its lifetime
+class RegionLockGuard
+{
+public:
+	RegionLockGuard(RegionLocks *locks, const VoxelArea &area) :
+		m_locks(locks), m_area(area)
+	{
+		m_locks->lock(m_area);
+	}
+
+	~RegionLockGuard()
+	{
+		m_locks->unlock(m_area);
+	}
+
+	DISABLE_CLASS_COPY(RegionLockGuard);
+
+private:
+	RegionLocks *m_locks;
+	VoxelArea m_area;
+};
@@ -0,0 +1,109 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "serializedblockcache.h"
+#include "mapblock.h"
+
+SerializedBlockCache::SerializedBlockCache(size_t max_size, MetricsBackend *mb) :
+	m_max_size(max_size)
+{
+	m_hit_counter = mb->addCounter(
+		"minetest_core_block_cache_hits",
+		"Mapblock sends served from the serialized block cache");
+	m_miss_counter = mb->addCounter(
+		"minetest_core_block_cache_misses",
+		"Mapblock sends which had to serialize the block");
+	m_bytes_saved_counter = mb->addCounter(
+		"minetest_core_block_cache_bytes_saved",
+		"Compressed mapblock bytes served from the serialized block cache");
+	m_size_gauge = mb->addGauge(
+		"minetest_core_block_cache_size",
+		"Size of the serialized block cache (in bytes)");
+}
+
+std::shared_ptr<const std::string> SerializedBlockCache::get(
+	const MapBlock *block, u8 version)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	auto it = m_entries.find({block->getPos(), version});
+	if (it == m_entries.end()) {
+		m_miss_counter->increment();
+		return nullptr;
+	}
+
+	Entry &entry = it->second;
+	if (entry.modification_counter != block->getModificationCounter()) {
+		remove(it);
+		m_miss_counter->increment();
+		return nullptr;
+	}
+
+	m_lru.splice(m_lru.begin(), m_lru, entry.lru_it);
+	m_hit_counter->increment();
+	m_bytes_saved_counter->increment(entry.data->size());
+	return entry.data;
+}
+
+void SerializedBlockCache::put(const MapBlock *block, u8 version,
+	std::shared_ptr<const std::string> data)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	Key key{block->getPos(), version};
+	auto it = m_entries.find(key);
+	if (it != m_entries.end())
+		remove(it);
+
+	if (data->size() > m_max_size)
+		return;
+
+	m_lru.push_front(key);
+	m_size += data->size();
+	m_entries[key] = {block->getModificationCounter(), std::move(data),
+		m_lru.begin()};
+
+	while (m_size > m_max_size)
+		remove(m_entries.find(m_lru.back()));
+
+	m_size_gauge->set(m_size);
+}
+
+void SerializedBlockCache::clear()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+
+	m_entries.clear();
+	m_lru.clear();
+	m_size = 0;
+	m_size_gauge->set(0);
+}
+
+size_t SerializedBlockCache::getSize()
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_size;
+}
+
+void SerializedBlockCache::remove(std::unordered_map<Key, Entry, KeyHash>::iterator it)
+{
+	m_size -= it->second.data->size();
+	m_lru.erase(it->second.lru_it);
+	m_entries.erase(it);
+}
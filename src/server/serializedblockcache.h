@@ -0,0 +1,95 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include "irrlichttypes.h"
+#include "irr_v3d.h"
+#include "util/metricsbackend.h"
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+class MapBlock;
+
+/*
+	Size-bounded cache of MapBlocks serialized for the network, so a block
+	wanted by many clients is serialized and compressed only once.
+
+	Entries are keyed by block position and serialization version and
+	remember the modification counter of the block, so modified blocks are
+	never served from the cache. The least recently used entries are
+	dropped once the cache grows beyond its size.
+*/
+class SerializedBlockCache
+{
+public:
+	SerializedBlockCache(size_t max_size, MetricsBackend *mb);
+
+	// Returns nullptr if the block is not cached or has been modified since
+	std::shared_ptr<const std::string> get(const MapBlock *block, u8 version);
+	void put(const MapBlock *block, u8 version,
+		std::shared_ptr<const std::string> data);
+
+	void clear();
+	size_t getSize();
+
+private:
+	struct Key
+	{
+		v3s16 pos;
+		u8 version;
+
+		bool operator==(const Key &other) const
+		{
+			return pos == other.pos && version == other.version;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator()(const Key &key) const
+		{
+			return std::hash<v3s16>()(key.pos) ^ key.version;
+		}
+	};
+
+	struct Entry
+	{
+		u64 modification_counter;
+		std::shared_ptr<const std::string> data;
+		std::list<Key>::iterator lru_it;
+	};
+
+	void remove(std::unordered_map<Key, Entry, KeyHash>::iterator it);
+
+	std::mutex m_mutex;
+	std::unordered_map<Key, Entry, KeyHash> m_entries;
+	// Most recently used first
+	std::list<Key> m_lru;
+	size_t m_size = 0;
+	size_t m_max_size;
+
+	MetricCounterPtr m_hit_counter;
+	MetricCounterPtr m_miss_counter;
+	MetricCounterPtr m_bytes_saved_counter;
+	MetricGaugePtr m_size_gauge;
+};
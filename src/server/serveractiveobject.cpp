@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "inventory.h"
 #include "constants.h" // BS
 #include "log.h"
+#include "serverenvironment.h"
 
 ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 	ActiveObject(0),
@@ -30,6 +31,14 @@ ServerActiveObject::ServerActiveObject(ServerEnvironment *env, v3f pos):
 {
 }
 
+void ServerActiveObject::setBasePosition(v3f pos)
+{
+	bool changed = m_base_position != pos;
+	m_base_position = pos;
+	if (changed && m_env)
+		m_env->updateActiveObjectPosition(this);
+}
+
 float ServerActiveObject::getMinimumSavedMovement()
 {
 	return 2.0*BS;
@@ -74,6 +83,20 @@ void ServerActiveObject::dumpAOMessagesToQueue(std::queue<ActiveObjectMessage> &
 	}
 }
 
+bool ServerActiveObject::popPositionUpdate()
+{
+	bool updated = m_position_updated;
+	m_position_updated = false;
+	return updated;
+}
+
+void ServerActiveObject::sendPositionUpdate(const ObjectPosition &pos)
+{
+	m_sent_position = pos;
+	m_position_sent = true;
+	m_position_updated = true;
+}
+
 void ServerActiveObject::markForRemoval()
 {
 	if (!m_pending_removal) {
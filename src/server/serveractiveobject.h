@@ -83,7 +83,8 @@ class ServerActiveObject : public ActiveObject
 		Some simple getters/setters
 	*/
 	v3f getBasePosition() const { return m_base_position; }
-	void setBasePosition(v3f pos){ m_base_position = pos; }
+	// Also keeps the environment's object index up to date
+	void setBasePosition(v3f pos);
 	ServerEnvironment* getEnv(){ return m_env; }
 
 	/*
@@ -208,6 +209,12 @@ class ServerActiveObject : public ActiveObject
 
 	void dumpAOMessagesToQueue(std::queue<ActiveObjectMessage> &queue);
 
+	// Position last sent to clients, nullptr if none was sent yet
+	const ObjectPosition *getSentPosition() const
+	{ return m_position_sent ? &m_sent_position : nullptr; }
+	// Whether the position was sent again since the last call
+	bool popPositionUpdate();
+
 	/*
 		Number of players which know about this object. Object won't be
 		deleted until this is 0 to keep the id preserved for the right
@@ -271,4 +278,16 @@ class ServerActiveObject : public ActiveObject
 		Queue of messages to be sent to the client
 	*/
 	std::queue<ActiveObjectMessage> m_messages_out;
+
+	/*
+		Sends the position to the clients. Unlike messages it is not queued,
+		the server sends the latest position of the step, batched with the
+		ones of other objects.
+	*/
+	void sendPositionUpdate(const ObjectPosition &pos);
+
+private:
+	ObjectPosition m_sent_position;
+	bool m_position_sent = false;
+	bool m_position_updated = false;
 };
@@ -36,6 +36,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "util/basic_macros.h"
 #include "util/pointedthing.h"
 #include "threading/mutex_auto_lock.h"
+#include "threading/thread_pool.h"
 #include "filesys.h"
 #include "gameparams.h"
 #include "database/database-dummy.h"
@@ -407,6 +408,7 @@ ServerEnvironment::ServerEnvironment(ServerMap *map,
 	m_map(map),
 	m_script(script_iface),
 	m_server(server),
+	m_pathfinder_queue(server),
 	m_path_world(path_world),
 	m_rgen(seed())
 {
@@ -489,6 +491,14 @@ void ServerEnvironment::init()
 	m_player_database = openPlayerDatabase(player_backend_name, m_path_world, conf);
 	m_auth_database = openAuthDatabase(auth_backend_name, m_path_world, conf);
 
+	if (m_map)
+		m_map->addEventReceiver(&m_pathfinder_cache);
+
+	m_pathfinder_queue.startThreads();
+
+	m_abm_thread_pool.reset(new ThreadPool("ABM",
+		g_settings->getU16("num_abm_threads")));
+
 	if (m_map && m_script->has_on_mapblocks_changed()) {
 		m_map->addEventReceiver(&m_on_mapblocks_changed_receiver);
 		m_on_mapblocks_changed_receiver.receiving = true;
@@ -497,6 +507,8 @@ void ServerEnvironment::init()
 
 ServerEnvironment::~ServerEnvironment()
 {
+	m_pathfinder_queue.stopThreads();
+
 	// Clear active block list.
 	// This makes the next one delete all active objects.
 	m_active_blocks.clear();
@@ -771,8 +783,36 @@ struct ActiveABM
 class ABMHandler
 {
 private:
+	// A node an ABM has matched during the matching phase
+	struct ABMCandidate
+	{
+		u16 index;
+		content_t c;
+		const ActiveABM *aabm;
+	};
+
+	struct BlockABMs
+	{
+		v3s16 pos;
+		MapBlock *block;
+		// The block and its neighbors, indexed by neighborIndex()
+		MapBlock *neighbors[27];
+		u64 seed;
+		bool cached;
+		std::vector<ABMCandidate> candidates;
+	};
+
 	ServerEnvironment *m_env;
 	std::vector<std::vector<ActiveABM> *> m_aabms;
+	// true if any ABM has required neighbors
+	bool m_check_neighbors = false;
+	std::vector<BlockABMs> m_blocks;
+
+	static int neighborIndex(s16 x, s16 y, s16 z)
+	{
+		return (x + 1) + (y + 1) * 3 + (z + 1) * 9;
+	}
+
 public:
 	ABMHandler(std::vector<ABMWithState> &abms,
 		float dtime_s, ServerEnvironment *env,
@@ -821,6 +861,7 @@ class ABMHandler
 				ndef->getIds(required_neighbor_s, aabm.required_neighbors);
 			}
 			aabm.check_required_neighbors = !required_neighbors_s.empty();
+			m_check_neighbors |= aabm.check_required_neighbors;
 
 			// Trigger contents
 			const std::vector<std::string> &contents_s = abm->getTriggerContents();
@@ -870,29 +911,128 @@ class ABMHandler
 		wider += wider_unknown_count * wider / wider_known_count;
 		return active_object_count;
 	}
-	void apply(MapBlock *block, int &blocks_scanned, int &abms_run, int &blocks_cached)
+
+	/*
+		Matching phase: finds the nodes of each block which pass the
+		content, y limit, chance and neighbor checks of an ABM.
+		The blocks are spread over the thread pool, which only reads the
+		map. Nothing is triggered yet.
+	*/
+	void match(const std::vector<MapBlock *> &blocks,
+		const MapBlock::ContentFilter &filter, ThreadPool *pool)
 	{
+		m_blocks.clear();
+		m_blocks.resize(blocks.size());
+		for (size_t i = 0; i < blocks.size(); i++) {
+			m_blocks[i].pos = blocks[i]->getPos();
+			m_blocks[i].block = blocks[i];
+			m_blocks[i].cached = false;
+		}
 		if (m_aabms.empty())
 			return;
 
-		// Check the content type cache first
-		// to see whether there are any ABMs
-		// to be run at all for this block.
-		if (block->contents_cached) {
-			blocks_cached++;
-			bool run_abms = false;
-			for (content_t c : block->contents) {
-				if (c < m_aabms.size() && m_aabms[c]) {
-					run_abms = true;
-					break;
-				}
+		// Looking up blocks in the map is not thread-safe, so the
+		// neighbors are collected beforehand.
+		ServerMap *map = &m_env->getServerMap();
+		for (BlockABMs &b : m_blocks) {
+			b.seed = ((u64)myrand() << 32) | myrand();
+			for (s16 z = -1; z <= 1; z++)
+			for (s16 y = -1; y <= 1; y++)
+			for (s16 x = -1; x <= 1; x++) {
+				b.neighbors[neighborIndex(x, y, z)] = !m_check_neighbors ? nullptr :
+					map->getBlockNoCreateNoEx(b.block->getPos() + v3s16(x, y, z));
 			}
-			if (!run_abms)
-				return;
-		} else {
-			// Clear any caching
-			block->contents.clear();
+			b.neighbors[neighborIndex(0, 0, 0)] = b.block;
 		}
+
+		pool->parallelFor(m_blocks.size(), [&] (size_t i) {
+			matchBlock(m_blocks[i], filter);
+		});
+	}
+
+	void matchBlock(BlockABMs &b, const MapBlock::ContentFilter &filter)
+	{
+		MapBlock *block = b.block;
+		PcgRandom rand(b.seed);
+
+		// Only nodes which some ABM may be triggered by are looked at
+		const MapBlock::ContentIndex &index = block->getContentIndex(filter, &b.cached);
+
+		std::vector<u16> positions;
+		for (const auto &it : index) {
+			content_t c = it.first;
+			if (c < m_aabms.size() && m_aabms[c])
+				positions.insert(positions.end(), it.second.begin(), it.second.end());
+		}
+		std::sort(positions.begin(), positions.end());
+
+		for (u16 i : positions) {
+			v3s16 p0 = MapBlock::getNodePosFromIndex(i);
+			content_t c = block->getNodeNoCheck(p0).getContent();
+			v3s16 p = p0 + block->getPosRelative();
+			for (const ActiveABM &aabm : *m_aabms[c]) {
+				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
+					continue;
+
+				if (rand.next() % aabm.chance != 0)
+					continue;
+
+				if (aabm.check_required_neighbors &&
+						!findNeighbor(b, p0, aabm.required_neighbors))
+					continue;
+
+				b.candidates.push_back({i, c, &aabm});
+			}
+		}
+	}
+
+	bool findNeighbor(const BlockABMs &b, v3s16 p0,
+		const std::vector<content_t> &required_neighbors)
+	{
+		v3s16 p1;
+		for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
+		for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
+		for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
+		{
+			if(p1 == p0)
+				continue;
+			// Find the block the neighbor is in
+			v3s16 d(p1.X < 0 ? -1 : p1.X >= MAP_BLOCKSIZE ? 1 : 0,
+				p1.Y < 0 ? -1 : p1.Y >= MAP_BLOCKSIZE ? 1 : 0,
+				p1.Z < 0 ? -1 : p1.Z >= MAP_BLOCKSIZE ? 1 : 0);
+			MapBlock *block = b.neighbors[neighborIndex(d.X, d.Y, d.Z)];
+			// Unloaded neighbors count as CONTENT_IGNORE
+			content_t c = block ?
+				block->getNodeNoCheck(p1 - d * MAP_BLOCKSIZE).getContent() :
+				CONTENT_IGNORE;
+			if (CONTAINS(required_neighbors, c))
+				return true;
+		}
+		return false;
+	}
+
+	size_t getBlockCount() const { return m_blocks.size(); }
+
+	// Returns the i-th block, or nullptr if an ABM has deleted it since
+	MapBlock *getBlock(size_t i)
+	{
+		MapBlock *block = m_env->getServerMap().getBlockNoCreateNoEx(m_blocks[i].pos);
+		return block == m_blocks[i].block ? block : nullptr;
+	}
+
+	/*
+		Trigger phase: runs the ABMs matched in the i-th block, which
+		must still be loaded (see getBlock()).
+		Must be called on the server thread as it calls into Lua.
+	*/
+	void trigger(size_t i, int &blocks_scanned, int &abms_run, int &blocks_cached)
+	{
+		BlockABMs &b = m_blocks[i];
+		MapBlock *block = b.block;
+		if (b.cached)
+			blocks_cached++;
+		if (b.candidates.empty())
+			return;
 		blocks_scanned++;
 
 		ServerMap *map = &m_env->getServerMap();
@@ -901,81 +1041,27 @@ class ABMHandler
 		u32 active_object_count = this->countObjects(block, map, active_object_count_wider);
 		m_env->m_added_objects = 0;
 
-		v3s16 p0;
-		for(p0.X=0; p0.X<MAP_BLOCKSIZE; p0.X++)
-		for(p0.Y=0; p0.Y<MAP_BLOCKSIZE; p0.Y++)
-		for(p0.Z=0; p0.Z<MAP_BLOCKSIZE; p0.Z++)
-		{
+		for (const ABMCandidate &candidate : b.candidates) {
+			v3s16 p0 = MapBlock::getNodePosFromIndex(candidate.index);
 			MapNode n = block->getNodeNoCheck(p0);
-			content_t c = n.getContent();
-			// Cache content types as we go
-			if (!block->contents_cached && !block->do_not_cache_contents) {
-				block->contents.insert(c);
-				if (block->contents.size() > 64) {
-					// Too many different nodes... don't try to cache
-					block->do_not_cache_contents = true;
-					block->contents.clear();
-				}
-			}
-
-			if (c >= m_aabms.size() || !m_aabms[c])
+			// The node may have been changed by a previous ABM
+			if (n.getContent() != candidate.c)
 				continue;
 
 			v3s16 p = p0 + block->getPosRelative();
-			for (ActiveABM &aabm : *m_aabms[c]) {
-				if ((p.Y < aabm.min_y) || (p.Y > aabm.max_y))
-					continue;
-
-				if (myrand() % aabm.chance != 0)
-					continue;
 
-				// Check neighbors
-				if (aabm.check_required_neighbors) {
-					v3s16 p1;
-					for(p1.X = p0.X-1; p1.X <= p0.X+1; p1.X++)
-					for(p1.Y = p0.Y-1; p1.Y <= p0.Y+1; p1.Y++)
-					for(p1.Z = p0.Z-1; p1.Z <= p0.Z+1; p1.Z++)
-					{
-						if(p1 == p0)
-							continue;
-						content_t c;
-						if (block->isValidPosition(p1)) {
-							// if the neighbor is found on the same map block
-							// get it straight from there
-							const MapNode &n = block->getNodeNoCheck(p1);
-							c = n.getContent();
-						} else {
-							// otherwise consult the map
-							MapNode n = map->getNode(p1 + block->getPosRelative());
-							c = n.getContent();
-						}
-						if (CONTAINS(aabm.required_neighbors, c))
-							goto neighbor_found;
-					}
-					// No required neighbor found
-					continue;
-				}
-				neighbor_found:
-
-				abms_run++;
-				// Call all the trigger variations
-				aabm.abm->trigger(m_env, p, n);
-				aabm.abm->trigger(m_env, p, n,
-					active_object_count, active_object_count_wider);
-
-				// Count surrounding objects again if the abms added any
-				if(m_env->m_added_objects > 0) {
-					active_object_count = countObjects(block, map, active_object_count_wider);
-					m_env->m_added_objects = 0;
-				}
+			abms_run++;
+			// Call all the trigger variations
+			candidate.aabm->abm->trigger(m_env, p, n);
+			candidate.aabm->abm->trigger(m_env, p, n,
+				active_object_count, active_object_count_wider);
 
-				// Update and check node after possible modification
-				n = block->getNodeNoCheck(p0);
-				if (n.getContent() != c)
-					break;
+			// Count surrounding objects again if the abms added any
+			if(m_env->m_added_objects > 0) {
+				active_object_count = countObjects(block, map, active_object_count_wider);
+				m_env->m_added_objects = 0;
 			}
 		}
-		block->contents_cached = !block->do_not_cache_contents;
 	}
 };
 
@@ -1026,6 +1112,29 @@ void ServerEnvironment::activateBlock(MapBlock *block, u32 additional_dtime)
 void ServerEnvironment::addActiveBlockModifier(ActiveBlockModifier *abm)
 {
 	m_abms.emplace_back(abm);
+	m_abm_content_filter.reset();
+}
+
+const MapBlock::ContentFilter &ServerEnvironment::getABMContentFilter()
+{
+	if (m_abm_content_filter)
+		return m_abm_content_filter;
+
+	const NodeDefManager *ndef = m_server->ndef();
+	auto filter = std::make_shared<std::vector<bool>>();
+	for (ABMWithState &abmws : m_abms) {
+		for (const std::string &content_s : abmws.abm->getTriggerContents()) {
+			std::vector<content_t> ids;
+			ndef->getIds(content_s, ids);
+			for (content_t c : ids) {
+				if (c >= filter->size())
+					filter->resize(c + 1, false);
+				(*filter)[c] = true;
+			}
+		}
+	}
+	m_abm_content_filter = filter;
+	return m_abm_content_filter;
 }
 
 void ServerEnvironment::addLoadingBlockModifierDef(LoadingBlockModifierDef *lbm)
@@ -1332,6 +1441,14 @@ void ServerEnvironment::step(float dtime)
 		m_game_time_fraction_counter -= (float)inc_i;
 	}
 
+	/*
+		Deliver results of asynchronous path searches
+	*/
+	{
+		ScopeProfiler sp(g_profiler, "ServerEnv: pathfinder callbacks", SPT_AVG);
+		m_pathfinder_queue.step();
+	}
+
 	/*
 		Handle players
 	*/
@@ -1464,6 +1581,7 @@ void ServerEnvironment::step(float dtime)
 
 		// Initialize handling of ActiveBlockModifiers
 		ABMHandler abmhandler(m_abms, m_cache_abm_interval, this, true);
+		const MapBlock::ContentFilter &abm_filter = getABMContentFilter();
 
 		int blocks_scanned = 0;
 		int abms_run = 0;
@@ -1476,28 +1594,39 @@ void ServerEnvironment::step(float dtime)
 		std::copy(m_active_blocks.m_abm_list.begin(), m_active_blocks.m_abm_list.end(), output.begin());
 		std::shuffle(output.begin(), output.end(), m_rgen);
 
-		int i = 0;
-		// determine the time budget for ABMs
-		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
+		std::vector<MapBlock *> blocks;
+		blocks.reserve(output.size());
 		for (const v3s16 &p : output) {
 			MapBlock *block = m_map->getBlockNoCreateNoEx(p);
+			if (block)
+				blocks.push_back(block);
+		}
+
+		{
+			ScopeProfiler sp2(g_profiler, "SEnv: ABM match avg per interval", SPT_AVG);
+			abmhandler.match(blocks, abm_filter, m_abm_thread_pool.get());
+		}
+
+		ScopeProfiler sp3(g_profiler, "SEnv: ABM trigger avg per interval", SPT_AVG);
+		// determine the time budget for ABMs
+		u32 max_time_ms = m_cache_abm_interval * 1000 * m_cache_abm_time_budget;
+		for (size_t i = 0; i < abmhandler.getBlockCount(); i++) {
+			MapBlock *block = abmhandler.getBlock(i);
 			if (!block)
 				continue;
 
-			i++;
-
 			// Set current time as timestamp
 			block->setTimestampNoChangedFlag(m_game_time);
 
 			/* Handle ActiveBlockModifiers */
-			abmhandler.apply(block, blocks_scanned, abms_run, blocks_cached);
+			abmhandler.trigger(i, blocks_scanned, abms_run, blocks_cached);
 
 			u32 time_ms = timer.getTimerTime();
 
 			if (time_ms > max_time_ms) {
 				warningstream << "active block modifiers took "
-					  << time_ms << "ms (processed " << i << " of "
-					  << output.size() << " active blocks)" << std::endl;
+					  << time_ms << "ms (processed " << i + 1 << " of "
+					  << blocks.size() << " active blocks)" << std::endl;
 				break;
 			}
 		}
@@ -1541,6 +1670,8 @@ void ServerEnvironment::step(float dtime)
 			obj->step(dtime, send_recommended);
 			// Read messages from object
 			obj->dumpAOMessagesToQueue(m_active_object_messages);
+			if (obj->popPositionUpdate())
+				m_active_object_position_updates.push_back(obj->getId());
 		};
 		m_ao_manager.step(dtime, cb_state);
 
@@ -1764,6 +1895,12 @@ bool ServerEnvironment::getActiveObjectMessage(ActiveObjectMessage *dest)
 	return true;
 }
 
+void ServerEnvironment::getActiveObjectPositionUpdates(std::vector<u16> &ids)
+{
+	ids.clear();
+	ids.swap(m_active_object_position_updates);
+}
+
 void ServerEnvironment::getSelectedActiveObjects(
 	const core::line3d<f32> &shootline_on_map,
 	std::vector<PointedThing> &objects)
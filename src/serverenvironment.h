@@ -22,8 +22,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "activeobject.h"
 #include "environment.h"
 #include "map.h"
+#include "mapblock.h"
+#include "pathfinder.h"
 #include "settings.h"
 #include "server/activeobjectmgr.h"
+#include "server/pathfinderqueue.h"
 #include "util/numeric.h"
 #include "util/metricsbackend.h"
 #include <set>
@@ -41,6 +44,7 @@ struct StaticObject;
 class ServerActiveObject;
 class Server;
 class ServerScripting;
+class ThreadPool;
 
 /*
 	{Active, Loading} block modifier interface.
@@ -226,6 +230,10 @@ class ServerEnvironment final : public Environment
 
 	ServerMap & getServerMap();
 
+	PathfinderCache &getPathfinderCache() { return m_pathfinder_cache; }
+
+	PathfinderQueue &getPathfinderQueue() { return m_pathfinder_queue; }
+
 	//TODO find way to remove this fct!
 	ServerScripting* getScriptIface()
 	{ return m_script; }
@@ -267,6 +275,12 @@ class ServerEnvironment final : public Environment
 		return m_ao_manager.getActiveObject(id);
 	}
 
+	// Called by ServerActiveObject::setBasePosition
+	void updateActiveObjectPosition(ServerActiveObject *obj)
+	{
+		m_ao_manager.updateObjectPosition(obj);
+	}
+
 	/*
 		Add an active object to the environment.
 		Environment handles deletion of object.
@@ -310,6 +324,12 @@ class ServerEnvironment final : public Environment
 	*/
 	bool getActiveObjectMessage(ActiveObjectMessage *dest);
 
+	/*
+		Moves the ids of the objects which sent their position since the
+		last call to ids, see ServerActiveObject::getSentPosition().
+	*/
+	void getActiveObjectPositionUpdates(std::vector<u16> &ids);
+
 	virtual void getSelectedActiveObjects(
 		const core::line3d<f32> &shootline_on_map,
 		std::vector<PointedThing> &objects
@@ -329,6 +349,9 @@ class ServerEnvironment final : public Environment
 	void addActiveBlockModifier(ActiveBlockModifier *abm);
 	void addLoadingBlockModifierDef(LoadingBlockModifierDef *lbm);
 
+	// Content types which any ABM may be triggered by
+	const MapBlock::ContentFilter &getABMContentFilter();
+
 	/*
 		Other stuff
 		-------------------------------------------
@@ -465,10 +488,16 @@ class ServerEnvironment final : public Environment
 	server::ActiveObjectMgr m_ao_manager;
 	// on_mapblocks_changed map event receiver
 	OnMapblocksChangedReceiver m_on_mapblocks_changed_receiver;
+	// Block portal graph used by hierarchical pathfinding
+	PathfinderCache m_pathfinder_cache;
+	// Asynchronous path requests
+	PathfinderQueue m_pathfinder_queue;
 	// World path
 	const std::string m_path_world;
 	// Outgoing network message buffer for active objects
 	std::queue<ActiveObjectMessage> m_active_object_messages;
+	// Objects which sent their position
+	std::vector<u16> m_active_object_position_updates;
 	// Some timers
 	float m_send_recommended_timer = 0.0f;
 	IntervalLimiter m_object_management_interval;
@@ -490,6 +519,9 @@ class ServerEnvironment final : public Environment
 	u32 m_last_clear_objects_time = 0;
 	// Active block modifiers
 	std::vector<ABMWithState> m_abms;
+	MapBlock::ContentFilter m_abm_content_filter;
+	// Worker threads matching ABMs against the active blocks
+	std::unique_ptr<ThreadPool> m_abm_thread_pool;
 	LBMManager m_lbm_mgr;
 	// An interval for generally sending object positions and stuff
 	float m_recommended_send_interval = 0.1f;
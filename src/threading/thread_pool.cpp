@@ -0,0 +1,122 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "threading/thread_pool.h"
+#include "threading/thread.h"
+
+class ThreadPoolWorker : public Thread
+{
+public:
+	ThreadPoolWorker(const std::string &name, ThreadPool *pool) :
+		Thread(name),
+		m_pool(pool)
+	{}
+
+	void *run()
+	{
+		m_pool->workerLoop();
+		return nullptr;
+	}
+
+private:
+	ThreadPool *m_pool;
+};
+
+ThreadPool::ThreadPool(const std::string &name, unsigned int num_threads)
+{
+	for (unsigned int i = 0; i < num_threads; i++) {
+		ThreadPoolWorker *thread = new ThreadPoolWorker(name, this);
+		thread->start();
+		m_threads.push_back(thread);
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_stop = true;
+	}
+	m_job_cv.notify_all();
+
+	for (ThreadPoolWorker *thread : m_threads) {
+		thread->wait();
+		delete thread;
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)> &func)
+{
+	if (m_threads.empty() || count < 2) {
+		for (size_t i = 0; i < count; i++)
+			func(i);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_func = &func;
+		m_count = count;
+		m_next = 0;
+		m_generation++;
+	}
+	m_job_cv.notify_all();
+
+	work(&func, count);
+
+	// All items are taken now, wait for the workers still busy with theirs.
+	// Workers waking up later only find an exhausted loop.
+	std::unique_lock<std::mutex> lock(m_mutex);
+	m_done_cv.wait(lock, [this] { return m_busy == 0; });
+	m_func = nullptr;
+	m_count = 0;
+}
+
+void ThreadPool::workerLoop()
+{
+	unsigned int generation = 0;
+	std::unique_lock<std::mutex> lock(m_mutex);
+	while (true) {
+		m_job_cv.wait(lock, [&] {
+			return m_stop || m_generation != generation;
+		});
+		if (m_stop)
+			break;
+
+		generation = m_generation;
+		const std::function<void(size_t)> *func = m_func;
+		size_t count = m_count;
+		if (!func)
+			continue;
+
+		m_busy++;
+		lock.unlock();
+		work(func, count);
+		lock.lock();
+		if (--m_busy == 0)
+			m_done_cv.notify_all();
+	}
+}
+
+void ThreadPool::work(const std::function<void(size_t)> *func, size_t count)
+{
+	size_t i;
+	while ((i = m_next++) < count)
+		(*func)(i);
+}
@@ -0,0 +1,71 @@
+/*
+Minetest
+Copyright (C) 2010-2022 Minetest core development team
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class ThreadPoolWorker;
+
+/*
+	A fixed set of worker threads running data parallel loops.
+
+	parallelFor() blocks until the whole loop is done, the calling thread
+	takes part in the work. With zero worker threads everything runs on the
+	calling thread. parallelFor() must not be called by several threads
+	at once nor from within a loop body.
+*/
+class ThreadPool
+{
+public:
+	ThreadPool(const std::string &name, unsigned int num_threads);
+	~ThreadPool();
+
+	unsigned int getThreadCount() const { return m_threads.size(); }
+
+	// Calls func(i) once for every i in [0, count)
+	void parallelFor(size_t count, const std::function<void(size_t)> &func);
+
+private:
+	friend class ThreadPoolWorker;
+
+	void workerLoop();
+	void work(const std::function<void(size_t)> *func, size_t count);
+
+	std::vector<ThreadPoolWorker *> m_threads;
+
+	std::mutex m_mutex;
+	std::condition_variable m_job_cv;
+	std::condition_variable m_done_cv;
+
+	// The current loop, protected by m_mutex
+	const std::function<void(size_t)> *m_func = nullptr;
+	size_t m_count = 0;
+	unsigned int m_generation = 0;
+	// Workers currently working on the loop
+	unsigned int m_busy = 0;
+	bool m_stop = false;
+
+	std::atomic<size_t> m_next{0};
+};
@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "mock_activeobject.h"
+#include "objectsnapshot.h"
+#include <sstream>
 
 class TestActiveObject : public TestBase
 {
@@ -30,6 +32,7 @@ class TestActiveObject : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testAOAttributes();
+	void testObjectSnapshot();
 };
 
 static TestActiveObject g_test_instance;
@@ -37,6 +40,7 @@ static TestActiveObject g_test_instance;
 void TestActiveObject::runTests(IGameDef *gamedef)
 {
 	TEST(testAOAttributes);
+	TEST(testObjectSnapshot);
 }
 
 void TestActiveObject::testAOAttributes()
@@ -47,3 +51,72 @@ void TestActiveObject::testAOAttributes()
 	ao.setId(558);
 	UASSERT(ao.getId() == 558);
 }
+
+void TestActiveObject::testObjectSnapshot()
+{
+	ObjectPosition pos;
+	pos.position = v3f(1234.56f, -78.9f, 300000.0f);
+	pos.velocity = v3f(10.0f, 0.0f, -2.5f);
+	pos.rotation = v3f(-90.0f, 0.0f, 359.99f);
+	pos.do_interpolate = true;
+
+	ObjectPosition got = QuantizedObjectPosition(pos).get();
+	UASSERT(got.position.getDistanceFrom(pos.position) < 0.1f);
+	UASSERT(got.velocity.getDistanceFrom(pos.velocity) < 0.1f);
+	UASSERT(got.acceleration == v3f());
+	UASSERT(std::fabs(got.rotation.X - 270.0f) < 0.01f);
+	UASSERT(got.do_interpolate && !got.is_end_position);
+
+	ObjectSnapshot baseline, snapshot;
+	for (u16 id = 1; id <= 100; id++) {
+		pos.position.X = id * 10.0f;
+		baseline[id] = QuantizedObjectPosition(pos);
+	}
+
+	// Nothing changed
+	std::ostringstream os(std::ios_base::binary);
+	UASSERTEQ(u16, serializeObjectSnapshotDelta(os, baseline, baseline), 0);
+
+	// One object moved a bit, one far, one was removed and one added
+	snapshot = baseline;
+	pos.position = baseline[1].get().position + v3f(1.0f, 0.0f, 0.0f);
+	snapshot[1] = QuantizedObjectPosition(pos);
+	pos.position.Y += 10000.0f;
+	snapshot[2] = QuantizedObjectPosition(pos);
+	snapshot.erase(3);
+	snapshot[200] = QuantizedObjectPosition(pos);
+
+	os.str("");
+	UASSERTEQ(u16, serializeObjectSnapshotDelta(os, baseline, snapshot), 4);
+	// The moved object takes 9 bytes instead of 59 with AO_CMD_UPDATE_POSITION
+	UASSERT(os.str().size() < 2 + 9 + 15 + 3 + 33);
+
+	std::istringstream is(os.str(), std::ios_base::binary);
+	ObjectSnapshot received = baseline;
+	std::vector<u16> changed;
+	deSerializeObjectSnapshotDelta(is, received, &changed);
+	UASSERT(received == snapshot);
+	UASSERTEQ(size_t, changed.size(), 3);
+
+	// A baseline is kept until a newer one is acknowledged
+	ObjectSnapshotHistory history;
+	UASSERT(history.get(0) && history.get(0)->empty());
+	history.add(65535, baseline);
+	history.add(1, snapshot);
+	UASSERT(history.get(65535));
+	history.forgetBefore(1);
+	UASSERT(!history.get(65535));
+	UASSERT(history.get(1) && *history.get(1) == snapshot);
+	UASSERT(objectSnapshotNewer(1, 65535));
+	UASSERT(!objectSnapshotNewer(65535, 1));
+
+	// Acknowledgements across the wraparound
+	UASSERT(objectSnapshotAckNewer(1, 65535, 2));
+	UASSERT(!objectSnapshotAckNewer(65535, 1, 2));
+	UASSERT(!objectSnapshotAckNewer(3, 1, 2));
+	// After falling back to baseline 0 in the upper half of the range
+	UASSERT(objectSnapshotAckNewer(40000, 0, 40010));
+	UASSERT(objectSnapshotAckNewer(40010, 0, 40010));
+	UASSERT(!objectSnapshotAckNewer(40011, 0, 40010));
+	UASSERT(!objectSnapshotAckNewer(0, 0, 40010));
+}
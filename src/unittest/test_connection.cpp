@@ -41,6 +41,7 @@ class TestConnection : public TestBase {
 
 	void testNetworkPacketSerialize();
 	void testHelpers();
+	void testPacketBuffer();
 	void testConnectSendReceive();
 };
 
@@ -50,6 +51,7 @@ void TestConnection::runTests(IGameDef *gamedef)
 {
 	TEST(testNetworkPacketSerialize);
 	TEST(testHelpers);
+	TEST(testPacketBuffer);
 	TEST(testConnectSendReceive);
 }
 
@@ -142,7 +144,7 @@ void TestConnection::testHelpers()
 
 	//infostream<<"initial data1[0]="<<((u32)data1[0]&0xff)<<std::endl;
 
-	SharedBuffer<u8> p2 = con::makeReliablePacket(data1, seqnum);
+	PacketView p2 = con::makeReliablePacket(PacketView(*data1, 1), seqnum);
 
 	/*infostream<<"p2.getSize()="<<p2.getSize()<<", data1.getSize()="
 			<<data1.getSize()<<std::endl;
@@ -156,6 +158,48 @@ void TestConnection::testHelpers()
 	UASSERT(readU8(&p2[3]) == data1[0]);
 }
 
+void TestConnection::testPacketBuffer()
+{
+	u32 proto_id = 0x12345678;
+	Address a(127,0,0,1, 10);
+
+	NetworkPacket pkt(TOCLIENT_HP, 0);
+	pkt << (u16)1234;
+	PacketView wire = pkt.getWireData();
+	UASSERTEQ(u32, wire.getSize(), 4);
+	UASSERTEQ(u16, readU16(&wire[0]), TOCLIENT_HP);
+
+	// Headers go in front of the data shared with the packet
+	PacketView reliable = con::makeReliablePacket(wire, 7);
+	con::BufferedPacketPtr p = con::makePacket(a, reliable, proto_id, 1, 0);
+	UASSERT(&p->data[BASE_HEADER_SIZE + RELIABLE_HEADER_SIZE] == &wire[0]);
+	UASSERTEQ(u32, readU32(&p->data[0]), proto_id);
+	UASSERTEQ(u16, readU16(&p->data[8]), 7);
+	UASSERTEQ(u16, readU16(&p->data[12]), 1234);
+
+	// The headroom is taken, another packet of the same data gets a copy
+	PacketView reliable2 = con::makeReliablePacket(wire, 8);
+	UASSERT(&reliable2[RELIABLE_HEADER_SIZE] != &wire[0]);
+	UASSERTEQ(u16, readU16(&reliable2[1]), 8);
+	UASSERTEQ(u16, readU16(&reliable[1]), 7);
+
+	// Writing to the packet does not change what was queued
+	pkt << (u16)5678;
+	UASSERTEQ(u32, pkt.getSize(), 4);
+	UASSERTEQ(u16, readU16(&p->data[12]), 1234);
+
+	// Dropped buffers are reused
+	p.reset();
+	reliable = reliable2 = wire = PacketView();
+	pkt.clear();
+	u64 allocations = PacketBuffer::getAllocationCount();
+	for (int i = 0; i < 100; i++) {
+		PacketView view(1000);
+		view.getWritable()[0] = i;
+	}
+	UASSERT(PacketBuffer::getAllocationCount() <= allocations + 1);
+}
+
 
 void TestConnection::testConnectSendReceive()
 {
@@ -18,11 +18,26 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "test.h"
 
+#include <atomic>
 #include <cstdio>
+#include <set>
+#include <thread>
 #include <unordered_set>
 #include <unordered_map>
 #include "mapblock.h"
+#include "dummygamedef.h"
 #include "dummymap.h"
+#include "gamedef.h"
+#include "nodemetadata.h"
+#include "serialization.h"
+#include "database/database-dummy.h"
+#include "database/database-mmap.h"
+#include "database/database-sqlite3.h"
+#include "server/blockserializer.h"
+#include "server/liquidregion.h"
+#include "server/mapsaver.h"
+#include "server/regionlocks.h"
+#include "server/serializedblockcache.h"
 
 class TestMap : public TestBase
 {
@@ -36,6 +51,16 @@ class TestMap : public TestBase
 	void testForEachNodeInArea(IGameDef *gamedef);
 	void testForEachNodeInAreaBlank(IGameDef *gamedef);
 	void testForEachNodeInAreaEmpty(IGameDef *gamedef);
+	void testMapReadView(IGameDef *gamedef);
+	void testContentIndex(IGameDef *gamedef);
+	void testNodeStorage(IGameDef *gamedef);
+	void testSerializedBlockCache(IGameDef *gamedef);
+	void testBlockSnapshot(IGameDef *gamedef);
+	void testMapSaver(IGameDef *gamedef);
+	void testLoadBlocks();
+	void testMMapDatabase();
+	void testRegionLocks();
+	void testLiquidRegion();
 };
 
 static TestMap g_test_instance;
@@ -46,6 +71,16 @@ void TestMap::runTests(IGameDef *gamedef)
 	TEST(testForEachNodeInArea, gamedef);
 	TEST(testForEachNodeInAreaBlank, gamedef);
 	TEST(testForEachNodeInAreaEmpty, gamedef);
+	TEST(testMapReadView, gamedef);
+	TEST(testContentIndex, gamedef);
+	TEST(testNodeStorage, gamedef);
+	TEST(testSerializedBlockCache, gamedef);
+	TEST(testBlockSnapshot, gamedef);
+	TEST(testMapSaver, gamedef);
+	TEST(testLoadBlocks);
+	TEST(testMMapDatabase);
+	TEST(testRegionLocks);
+	TEST(testLiquidRegion);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -169,3 +204,474 @@ void TestMap::testForEachNodeInAreaEmpty(IGameDef *gamedef)
 		return true;
 	});
 }
+
+void TestMap::testMapReadView(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, v3s16(-1, -1, -1), v3s16(0, 1, 0));
+	map.setNode(v3s16(-3, 20, 5), MapNode(CONTENT_AIR));
+
+	MapReadView view(&map);
+	for (s16 z = -2; z <= 1; z++)
+	for (s16 y = -2; y <= 2; y++)
+	for (s16 x = -2; x <= 1; x++) {
+		v3s16 p(x, y, z);
+		UASSERT(view.getBlock(p) == map.getBlockNoCreateNoEx(p));
+	}
+	UASSERT(!view.getBlock(v3s16(0, 2, 0)));
+	UASSERT(!view.getBlock(v3s16(1, 0, 0)));
+
+	bool is_valid_position = false;
+	UASSERT(view.getNode(v3s16(-3, 20, 5), &is_valid_position).getContent() ==
+		CONTENT_AIR);
+	UASSERT(is_valid_position);
+	UASSERT(view.getNode(v3s16(-3, 20, 16), &is_valid_position).getContent() ==
+		CONTENT_IGNORE);
+	UASSERT(!is_valid_position);
+}
+
+void TestMap::testContentIndex(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.getData()[i] = MapNode(CONTENT_AIR);
+	block.setNode(v3s16(1, 2, 3), MapNode(t_CONTENT_WATER));
+	block.setNode(v3s16(4, 5, 6), MapNode(t_CONTENT_WATER));
+	block.setNode(v3s16(7, 8, 9), MapNode(t_CONTENT_STONE));
+
+	auto filter = std::make_shared<std::vector<bool>>(t_CONTENT_WATER + 1, false);
+	(*filter)[t_CONTENT_WATER] = true;
+	MapBlock::ContentFilter cfilter = filter;
+
+	auto positions = [&] (content_t c) {
+		std::set<v3s16> result;
+		const MapBlock::ContentIndex &index = block.getContentIndex(cfilter);
+		auto it = index.find(c);
+		if (it != index.end()) {
+			for (u16 i : it->second)
+				result.insert(MapBlock::getNodePosFromIndex(i));
+		}
+		return result;
+	};
+
+	bool cached = true;
+	const MapBlock::ContentIndex &index = block.getContentIndex(cfilter, &cached);
+	UASSERT(!cached);
+	UASSERTEQ(size_t, index.size(), 1);
+	UASSERT(positions(t_CONTENT_WATER) == std::set<v3s16>({v3s16(1, 2, 3), v3s16(4, 5, 6)}));
+
+	// setNode keeps the index up to date
+	block.setNode(v3s16(1, 2, 3), MapNode(t_CONTENT_STONE));
+	block.setNodeNoCheck(v3s16(15, 15, 15), MapNode(t_CONTENT_WATER));
+	block.getContentIndex(cfilter, &cached);
+	UASSERT(cached);
+	UASSERT(positions(t_CONTENT_WATER) == std::set<v3s16>({v3s16(4, 5, 6), v3s16(15, 15, 15)}));
+
+	block.setNode(v3s16(4, 5, 6), MapNode(CONTENT_AIR));
+	block.setNode(v3s16(15, 15, 15), MapNode(CONTENT_AIR));
+	UASSERT(block.getContentIndex(cfilter).empty());
+
+	// writing to the data directly drops the index
+	block.getData()[0] = MapNode(t_CONTENT_WATER);
+	block.getContentIndex(cfilter, &cached);
+	UASSERT(!cached);
+	UASSERT(positions(t_CONTENT_WATER) == std::set<v3s16>({v3s16(0, 0, 0)}));
+
+	// so does another filter
+	MapBlock::ContentFilter other = std::make_shared<std::vector<bool>>(*filter);
+	block.getContentIndex(other, &cached);
+	UASSERT(!cached);
+}
+
+void TestMap::testNodeStorage(IGameDef *gamedef)
+{
+	const u32 nodecount = NodeStorage::nodecount;
+	std::vector<MapNode> expected(nodecount, MapNode(CONTENT_AIR));
+	auto check = [&] (const NodeStorage &storage) {
+		for (u32 i = 0; i < nodecount; i++)
+			UASSERT(storage.get(i) == expected[i]);
+		std::vector<MapNode> copy(nodecount);
+		storage.copyTo(copy.data());
+		UASSERT(copy == expected);
+	};
+
+	// A uniform block needs no indices
+	NodeStorage storage;
+	storage.fill(MapNode(CONTENT_AIR));
+	size_t full_size = storage.getMemoryUsage();
+	storage.compact();
+	UASSERT(storage.isCompact());
+	UASSERTEQ(size_t, storage.getPalette()->size(), 1);
+	UASSERT(storage.getMemoryUsage() < full_size / 100);
+	check(storage);
+
+	// New nodes widen the indices
+	for (u32 i = 0; i < 20; i++) {
+		u32 index = i * 197 % nodecount;
+		expected[index] = MapNode(t_CONTENT_STONE, i, i % 3);
+		storage.set(index, expected[index]);
+		check(storage);
+	}
+	UASSERT(storage.isCompact());
+	UASSERTEQ(size_t, storage.getPalette()->size(), 21);
+
+	// Copies are deep
+	NodeStorage copy(storage);
+	storage.set(0, MapNode(t_CONTENT_WATER));
+	check(copy);
+	expected[0] = MapNode(t_CONTENT_WATER);
+	check(storage);
+
+	// Too many distinct nodes turn the storage full, without losing any
+	for (u32 i = 0; i < nodecount; i++) {
+		expected[i] = MapNode(t_CONTENT_STONE, i % 256, i / 256 % 2);
+		storage.set(i, expected[i]);
+	}
+	UASSERT(!storage.isCompact());
+	check(storage);
+	storage.compact();
+	UASSERT(!storage.isCompact());
+	UASSERT(storage.getPalette() == nullptr);
+
+	for (u32 i = 0; i < nodecount; i++)
+		expected[i] = MapNode(t_CONTENT_STONE, i % 256, 0);
+	storage.getFull();
+	for (u32 i = 0; i < nodecount; i++)
+		storage.set(i, expected[i]);
+	storage.compact();
+	UASSERT(storage.isCompact());
+	check(storage);
+	copy = storage;
+	check(copy);
+
+	// Compact blocks serialize like full ones
+	MapBlock block(nullptr, v3s16(0, 0, 0), gamedef);
+	MapBlock compact(nullptr, v3s16(0, 0, 0), gamedef);
+	for (u32 i = 0; i < nodecount; i++)
+		block.getData()[i] = MapNode(i % 7 ? CONTENT_AIR : t_CONTENT_STONE);
+	compact.copyNodesFrom(block);
+	compact.compactNodes();
+	UASSERT(compact.getNodeStorage().isCompact());
+	UASSERT(*BlockSerializer::serialize(&compact, SER_FMT_VER_HIGHEST_WRITE) ==
+		*BlockSerializer::serialize(&block, SER_FMT_VER_HIGHEST_WRITE));
+
+	// and index their contents alike
+	auto filter = std::make_shared<std::vector<bool>>(t_CONTENT_WATER + 1, false);
+	(*filter)[t_CONTENT_WATER] = true;
+	MapBlock::ContentFilter cfilter = filter;
+	UASSERT(compact.getContentIndex(cfilter).empty());
+	compact.setNode(v3s16(1, 2, 3), MapNode(t_CONTENT_WATER));
+	UASSERT(compact.getNodeStorage().isCompact());
+	UASSERTEQ(size_t, compact.getContentIndex(cfilter).at(t_CONTENT_WATER).size(), 1);
+}
+
+void TestMap::testSerializedBlockCache(IGameDef *gamedef)
+{
+	MetricsBackend mb;
+	SerializedBlockCache cache(100, &mb);
+	MapBlock block(nullptr, v3s16(1, 2, 3), gamedef);
+	MapBlock other(nullptr, v3s16(4, 5, 6), gamedef);
+
+	UASSERT(!cache.get(&block, 28));
+	auto data = std::make_shared<const std::string>(40, 'a');
+	cache.put(&block, 28, data);
+	UASSERT(cache.get(&block, 28) == data);
+	UASSERT(!cache.get(&block, 29));
+	UASSERTEQ(size_t, cache.getSize(), 40);
+
+	// Changes not sent to clients keep the entry
+	block.setTimestamp(1234);
+	block.raiseModified(MOD_STATE_WRITE_NEEDED, MOD_REASON_STATIC_DATA_ADDED);
+	UASSERT(cache.get(&block, 28) == data);
+
+	// Modifying the block drops the entry
+	block.setNode(v3s16(0, 0, 0), MapNode(t_CONTENT_STONE));
+	UASSERT(!cache.get(&block, 28));
+	UASSERTEQ(size_t, cache.getSize(), 0);
+
+	block.getData();
+	UASSERT(!cache.get(&block, 28));
+
+	// The least recently used entries are dropped first
+	cache.put(&block, 28, data);
+	cache.put(&block, 29, data);
+	UASSERT(cache.get(&block, 28));
+	cache.put(&other, 28, data);
+	UASSERTEQ(size_t, cache.getSize(), 80);
+	UASSERT(cache.get(&block, 28));
+	UASSERT(!cache.get(&block, 29));
+	UASSERT(cache.get(&other, 28));
+
+	// A new block in the same place never matches old entries
+	MapBlock reloaded(nullptr, v3s16(4, 5, 6), gamedef);
+	UASSERT(!cache.get(&reloaded, 28));
+
+	cache.clear();
+	UASSERTEQ(size_t, cache.getSize(), 0);
+}
+
+void TestMap::testBlockSnapshot(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(1, 2, 3), gamedef);
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.getData()[i] = MapNode(CONTENT_AIR);
+	block.setNode(v3s16(1, 2, 3), MapNode(t_CONTENT_STONE));
+	block.setIsUnderground(true);
+
+	NodeMetadata *meta = new NodeMetadata(gamedef->idef());
+	meta->setString("infotext", "hello");
+	meta->setString("secret", "hidden");
+	meta->markPrivate("secret", true);
+	block.m_node_metadata.set(v3s16(1, 2, 3), meta);
+
+	MapBlock *snapshot = block.createSnapshot();
+	UASSERT(snapshot->getPos() == block.getPos());
+	UASSERT(snapshot->getModificationCounter() == block.getModificationCounter());
+	UASSERT(*BlockSerializer::serialize(snapshot, SER_FMT_VER_HIGHEST_WRITE) ==
+		*BlockSerializer::serialize(&block, SER_FMT_VER_HIGHEST_WRITE));
+
+	// The metadata is a deep copy
+	meta->setString("infotext", "changed");
+	NodeMetadata *meta2 = snapshot->m_node_metadata.get(v3s16(1, 2, 3));
+	UASSERT(meta2 && meta2 != meta);
+	UASSERTEQ(std::string, meta2->getString("infotext"), "hello");
+	UASSERT(meta2->isPrivate("secret"));
+	delete snapshot;
+}
+
+void TestMap::testMapSaver(IGameDef *gamedef)
+{
+	MapBlock block(nullptr, v3s16(1, 2, 3), gamedef);
+	for (u32 i = 0; i < MapBlock::nodecount; i++)
+		block.getData()[i] = MapNode(CONTENT_AIR);
+	block.setNode(v3s16(1, 2, 3), MapNode(t_CONTENT_STONE));
+	block.setNodeTimer(NodeTimer(5.0f, 1.0f, v3s16(1, 2, 3)));
+	StaticObject obj;
+	obj.type = 1;
+	obj.data = "data";
+	block.m_static_objects.insert(0, obj);
+	block.setTimestamp(1234);
+
+	// Disk snapshots keep the data which is only saved
+	MapBlock *snapshot = block.createSnapshot(true);
+	std::string data = MapSaver::serialize(&block, -1);
+	UASSERT(MapSaver::serialize(snapshot, -1) == data);
+	delete snapshot;
+
+	MetricsBackend mb;
+	Database_Dummy db;
+	MapSaver saver(&db, -1, &mb);
+	saver.start(2);
+	UASSERT(saver.isAsync());
+
+	UASSERT(saver.saveBlock(&block));
+	UASSERTEQ(u32, block.getModified(), MOD_STATE_CLEAN);
+
+	// Queued blocks can be loaded before they are written
+	std::string loaded;
+	saver.loadBlock(block.getPos(), &loaded);
+	UASSERT(loaded == data);
+
+	saver.flush();
+	UASSERTEQ(u32, saver.getQueueSize(), 0);
+	loaded.clear();
+	db.loadBlock(block.getPos(), &loaded);
+	UASSERT(loaded == data);
+
+	// Writes are tracked per block
+	u64 write_count = saver.getWriteCount();
+	UASSERT(!saver.wasWrittenSince(block.getPos(), write_count));
+
+	// Deleting drops queued writes
+	block.setNode(v3s16(0, 0, 0), MapNode(t_CONTENT_STONE));
+	UASSERT(saver.saveBlock(&block));
+	UASSERT(saver.deleteBlock(block.getPos()));
+	UASSERT(saver.wasWrittenSince(block.getPos(), write_count));
+	UASSERT(!saver.wasWrittenSince(v3s16(0, 0, 0), write_count));
+	UASSERT(!saver.wasWrittenSince(block.getPos(), saver.getWriteCount()));
+	saver.stop();
+	loaded.clear();
+	saver.loadBlock(block.getPos(), &loaded);
+	UASSERT(loaded.empty());
+}
+
+void TestMap::testLoadBlocks()
+{
+	MapDatabaseSQLite3 sqlite_db(getTestTempDirectory());
+	Database_MMap mmap_db(getTestTempDirectory() + DIR_DELIM "loadblocks", false);
+	Database_Dummy dummy_db;
+	MapDatabase *databases[] = { &sqlite_db, &mmap_db, &dummy_db };
+
+	for (MapDatabase *db : databases) {
+		// More than one batch, with gaps and duplicates
+		std::vector<v3s16> positions;
+		for (s16 i = 0; i < 40; i++) {
+			v3s16 pos(i, -i, 2 * i);
+			positions.push_back(pos);
+			if (i % 3)
+				db->saveBlock(pos, "block" + itos(i));
+		}
+		positions.push_back(v3s16(1, -1, 2));
+		positions.push_back(v3s16(1000, 0, 0));
+
+		std::vector<std::string> blocks;
+		db->loadBlocks(positions, &blocks);
+		UASSERTEQ(size_t, blocks.size(), positions.size());
+		for (size_t i = 0; i < 40; i++)
+			UASSERT(blocks[i] == (i % 3 ? "block" + itos(i) : ""));
+		UASSERT(blocks[40] == "block1");
+		UASSERT(blocks[41].empty());
+	}
+}
+
+void TestMap::testMMapDatabase()
+{
+	std::string dir = getTestTempDirectory() + DIR_DELIM "mmap";
+	std::string data;
+	std::vector<v3s16> positions;
+
+	{
+		// Two blocks of 1000 bytes fit into a segment
+		Database_MMap db(dir, false, 2100);
+		for (s16 i = 0; i < 4; i++)
+			UASSERT(db.saveBlock(v3s16(i, 0, 0), std::string(1000, 'a' + i)));
+		UASSERTEQ(u32, db.getSegmentCount(), 2);
+
+		// Outdate the whole first segment
+		UASSERT(db.saveBlock(v3s16(0, 0, 0), std::string(1000, 'x')));
+		UASSERT(db.deleteBlock(v3s16(1, 0, 0)));
+		UASSERT(db.deleteBlock(v3s16(100, 0, 0)));
+		db.loadBlock(v3s16(1, 0, 0), &data);
+		UASSERT(data.empty());
+
+		UASSERTEQ(u32, db.getSegmentCount(), 3);
+		UASSERT(!db.compact(1.1f));
+		UASSERT(db.compact(0.9f));
+		UASSERTEQ(u32, db.getSegmentCount(), 2);
+
+		// Only half of the second one, the last one is never compacted
+		UASSERT(!db.compact(0.4f));
+		UASSERT(db.deleteBlock(v3s16(2, 0, 0)));
+		UASSERT(!db.compact(0.6f));
+		UASSERT(db.compact(0.4f));
+		UASSERTEQ(u32, db.getSegmentCount(), 1);
+		db.endSave();
+	}
+
+	// Reopening restores the index from the log
+	Database_MMap db(dir, false, 2100);
+	db.listAllLoadableBlocks(positions);
+	UASSERTEQ(size_t, positions.size(), 2);
+	db.loadBlock(v3s16(0, 0, 0), &data);
+	UASSERT(data == std::string(1000, 'x'));
+	db.loadBlock(v3s16(1, 0, 0), &data);
+	UASSERT(data.empty());
+	db.loadBlock(v3s16(2, 0, 0), &data);
+	UASSERT(data.empty());
+	db.loadBlock(v3s16(3, 0, 0), &data);
+	UASSERT(data == std::string(1000, 'd'));
+}
+
+void TestMap::testRegionLocks()
+{
+	RegionLocks locks;
+	VoxelArea a(v3s16(0, 0, 0), v3s16(4, 4, 4));
+	VoxelArea b(v3s16(4, 0, 0), v3s16(8, 4, 4));
+	VoxelArea c(v3s16(5, 0, 0), v3s16(9, 4, 4));
+
+	locks.lock(a);
+	// Overlapping regions wait, disjoint ones do not
+	UASSERT(!locks.tryLock(b));
+	UASSERT(locks.tryLock(c));
+	UASSERTEQ(size_t, locks.getLockedCount(), 2);
+	locks.unlock(c);
+
+	std::atomic<bool> locked(false);
+	std::thread thread([&] {
+		RegionLockGuard guard(&locks, b);
+		locked = true;
+	});
+	sleep_ms(50);
+	UASSERT(!locked);
+	locks.unlock(a);
+	thread.join();
+	UASSERT(locked);
+	UASSERTEQ(size_t, locks.getLockedCount(), 0);
+}
+
+void TestMap::testLiquidRegion()
+{
+	DummyGameDef gamedef;
+	NodeDefManager *ndef = gamedef.getWritableNodeDefManager();
+
+	ContentFeatures f;
+	f.name = "test:water_source";
+	f.liquid_type = LIQUID_SOURCE;
+	f.liquid_alternative_source = "test:water_source";
+	f.liquid_alternative_flowing = "test:water_flowing";
+	content_t c_source = ndef->set(f.name, f);
+	f.name = "test:water_flowing";
+	f.liquid_type = LIQUID_FLOWING;
+	f.param_type_2 = CPT2_FLOWINGLIQUID;
+	content_t c_flowing = ndef->set(f.name, f);
+	ndef->resolveCrossrefs();
+	f = ContentFeatures();
+	f.name = "test:stone";
+	content_t c_stone = ndef->set(f.name, f);
+
+	DummyMap map(&gamedef, v3s16(-1, -1, -1), v3s16(1, 1, 1));
+	for (s16 z = -16; z < 32; z++)
+	for (s16 y = -16; y < 32; y++)
+	for (s16 x = -16; x < 32; x++)
+		map.setNode(v3s16(x, y, z), MapNode(CONTENT_AIR));
+	// A source on a floor
+	for (s16 z = 0; z < 16; z++)
+	for (s16 x = 0; x < 16; x++)
+		map.setNode(v3s16(x, 4, z), MapNode(c_stone));
+	map.setNode(v3s16(5, 5, 5), MapNode(c_source));
+
+	// Regions next to each other have different colors
+	UASSERT(LiquidRegion::getColor(v3s16(0, 0, 0)) != LiquidRegion::getColor(v3s16(1, 0, 0)));
+	UASSERT(LiquidRegion::getColor(v3s16(0, 0, 0)) == LiquidRegion::getColor(v3s16(2, -2, 0)));
+	UASSERT(LiquidRegion::getColor(v3s16(-1, -1, -1)) == LiquidRegion::COLOR_COUNT - 1);
+
+	// A source keeps its node and queues the air beside it
+	{
+		LiquidRegion region(&map, v3s16(0, 0, 0));
+		region.queue.push_back(v3s16(5, 5, 5));
+		region.transform();
+		UASSERT(region.changes.empty());
+		UASSERTEQ(size_t, region.next.size(), 4);
+	}
+
+	// Nodes transformed later see the changes of earlier ones, the map
+	// stays as it was
+	{
+		LiquidRegion region(&map, v3s16(0, 0, 0));
+		region.queue.push_back(v3s16(6, 5, 5));
+		region.queue.push_back(v3s16(7, 5, 5));
+		region.transform();
+		UASSERTEQ(size_t, region.changes.size(), 2);
+		for (const LiquidRegion::Change &change : region.changes) {
+			UASSERT(!change.flood);
+			UASSERTEQ(content_t, change.old_node.getContent(), CONTENT_AIR);
+			UASSERTEQ(content_t, change.new_node.getContent(), c_flowing);
+			UASSERTEQ(content_t, map.getNode(change.p).getContent(), CONTENT_AIR);
+		}
+		UASSERTEQ(int, region.changes[0].new_node.param2 & LIQUID_LEVEL_MASK,
+			LIQUID_LEVEL_MAX);
+		UASSERTEQ(int, region.changes[1].new_node.param2 & LIQUID_LEVEL_MASK,
+			LIQUID_LEVEL_MAX - 1);
+		// The air beside it
+		UASSERTEQ(int, region.changes[0].next_count, 3);
+	}
+
+	// Nothing happens without the mapblock
+	{
+		LiquidRegion region(&map, v3s16(4, 0, 0));
+		region.queue.push_back(v3s16(70, 5, 5));
+		region.transform();
+		UASSERT(!region.getBlock());
+		UASSERT(region.changes.empty());
+		UASSERT(region.next.empty());
+	}
+}
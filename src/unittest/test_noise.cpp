@@ -22,6 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <cmath>
 #include "exceptions.h"
 #include "noise.h"
+#include "noise_simd.h"
+#include <cstring>
 
 class TestNoise : public TestBase {
 public:
@@ -41,6 +43,8 @@ class TestNoise : public TestBase {
 	void testNoise3dPoint();
 	void testNoise3dBulk();
 	void testNoiseInvalidParams();
+	void testNoiseSimd();
+	void testNoiseCache();
 
 	static const float expected_2d_results[10 * 10];
 	static const float expected_3d_results[10 * 10 * 10];
@@ -61,6 +65,8 @@ void TestNoise::runTests(IGameDef *gamedef)
 	TEST(testNoise3dPoint);
 	TEST(testNoise3dBulk);
 	TEST(testNoiseInvalidParams);
+	TEST(testNoiseSimd);
+	TEST(testNoiseCache);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -175,6 +181,88 @@ void TestNoise::testNoiseInvalidParams()
 	UASSERT(exception_thrown);
 }
 
+void TestNoise::testNoiseSimd()
+{
+	NoiseParams np_2d(4, 70, v3f(600, 600, 600), 82341, 5, 0.6, 2.0);
+	NoiseParams np_3d(0, 1, v3f(61, 61, 61), 52534, 3, 0.5, 2.0,
+		NOISE_FLAG_EASED);
+	Noise noise_2d(&np_2d, 1337, 80, 80);
+	Noise noise_3d(&np_3d, 1337, 80, 82, 80);
+
+	noise_simd::Level max_level = noise_simd::getMaxLevel();
+	noise_simd::setLevel(noise_simd::LEVEL_SCALAR);
+	std::vector<float> expected_2d(noise_2d.perlinMap2D(-32, 48),
+		noise_2d.result + 80 * 80);
+	std::vector<float> expected_3d(noise_3d.perlinMap3D(-32, -17, 48),
+		noise_3d.result + 80 * 82 * 80);
+
+	for (int level = noise_simd::LEVEL_SCALAR; level <= max_level; level++) {
+		noise_simd::setLevel((noise_simd::Level)level);
+
+		// Odd count for the remainder loops
+		float lattice[37];
+		noise_simd::lattice2d(lattice, -5, 1234, 7, 37);
+		for (u32 i = 0; i != 37; i++)
+			UASSERTEQ(float, lattice[i], noise2d(-5 + i, 1234, 7));
+		noise_simd::lattice3d(lattice, -5, 1234, -3, 7, 37);
+		for (u32 i = 0; i != 37; i++)
+			UASSERTEQ(float, lattice[i], noise3d(-5 + i, 1234, -3, 7));
+
+		// Must be the same bits, not just close
+		UASSERT(memcmp(noise_2d.perlinMap2D(-32, 48), expected_2d.data(),
+			expected_2d.size() * sizeof(float)) == 0);
+		UASSERT(memcmp(noise_3d.perlinMap3D(-32, -17, 48), expected_3d.data(),
+			expected_3d.size() * sizeof(float)) == 0);
+	}
+
+	noise_simd::setLevel(max_level);
+}
+
+void TestNoise::testNoiseCache()
+{
+	NoiseParams np(20, 40, v3f(50, 50, 50), 9, 5, 0.6, 2.0);
+	NoiseParams np_other = np;
+	np_other.persist = 0.5;
+	Noise noise(&np, 1337, 16, 16);
+	Noise noise_other(&np_other, 1337, 16, 16);
+
+	std::vector<float> expected(noise.perlinMap2D(32, 64),
+		noise.result + 16 * 16);
+
+	NoiseCache cache(2);
+	NoiseCache::setThreadCache(&cache);
+
+	noise.perlinMap2D(32, 64);
+	noise_other.perlinMap2D(32, 64);
+	UASSERTEQ(u64, cache.getMisses(), 2);
+	UASSERTEQ(u32, cache.getSize(), 2);
+
+	// Hit, the result must not depend on the previous contents
+	memset(noise.result, 0, sizeof(float) * 16 * 16);
+	noise.perlinMap2D(32, 64);
+	UASSERTEQ(u64, cache.getHits(), 1);
+	UASSERT(memcmp(noise.result, expected.data(),
+		expected.size() * sizeof(float)) == 0);
+
+	// Evicts noise_other, which was used least recently
+	noise.perlinMap2D(48, 64);
+	UASSERTEQ(u32, cache.getSize(), 2);
+	noise.perlinMap2D(32, 64);
+	UASSERTEQ(u64, cache.getHits(), 2);
+	noise_other.perlinMap2D(32, 64);
+	UASSERTEQ(u64, cache.getHits(), 2);
+	UASSERTEQ(u64, cache.getMisses(), 4);
+
+	// Not cached with a persistence map
+	float persistence[16 * 16];
+	for (float &p : persistence)
+		p = 0.5f;
+	noise.perlinMap2D(32, 64, persistence);
+	UASSERTEQ(u64, cache.getHits() + cache.getMisses(), 6);
+
+	NoiseCache::setThreadCache(NULL);
+}
+
 const float TestNoise::expected_2d_results[10 * 10] = {
 	19.11726, 18.49626, 16.48476, 15.02135, 14.75713, 16.26008, 17.54822,
 	18.06860, 18.57016, 18.48407, 18.49649, 17.89160, 15.94162, 14.54901,
@@ -0,0 +1,279 @@
+/*
+Minetest
+Copyright (C) 2022 Minetest Authors
+
+This program is free software; you can redistribute it and/or modify
+it under the terms of the GNU Lesser General Public License as published by
+the Free Software Foundation; either version 2.1 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU Lesser General Public License for more details.
+
+You should have received a copy of the GNU Lesser General Public License along
+with this program; if not, write to the Free Software Foundation, Inc.,
+51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+*/
+
+#include "test.h"
+
+#include "gamedef.h"
+#include "pathfinder.h"
+#include "dummymap.h"
+#include "server/pathfinderqueue.h"
+
+class TestPathfinder : public TestBase {
+public:
+	TestPathfinder() { TestManager::registerTestModule(this); }
+	const char *getName() { return "TestPathfinder"; }
+
+	void runTests(IGameDef *gamedef);
+
+	void testHierarchical(IGameDef *gamedef);
+	void testSharedSearch(IGameDef *gamedef);
+	void testQueue(IGameDef *gamedef);
+	void testFlowField(IGameDef *gamedef);
+
+private:
+	void checkPath(const std::vector<v3s16> &path, v3s16 source,
+			v3s16 destination, Map &map, const NodeDefManager *ndef);
+};
+
+static TestPathfinder g_test_instance;
+
+void TestPathfinder::runTests(IGameDef *gamedef)
+{
+	TEST(testHierarchical, gamedef);
+	TEST(testSharedSearch, gamedef);
+	TEST(testQueue, gamedef);
+	TEST(testFlowField, gamedef);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+// Stone floor at y = -1 with a wall at x = 0 which has a gap at z >= 21
+static void build_walled_floor(Map &map)
+{
+	for (s16 z = -32; z <= 31; z++)
+	for (s16 x = -32; x <= 31; x++) {
+		for (s16 y = -16; y <= 15; y++)
+			map.setNode(v3s16(x, y, z), MapNode(CONTENT_AIR));
+		map.setNode(v3s16(x, -1, z), MapNode(t_CONTENT_STONE));
+	}
+	for (s16 z = -32; z <= 20; z++)
+	for (s16 y = 0; y <= 2; y++)
+		map.setNode(v3s16(0, y, z), MapNode(t_CONTENT_STONE));
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void TestPathfinder::checkPath(const std::vector<v3s16> &path, v3s16 source,
+		v3s16 destination, Map &map, const NodeDefManager *ndef)
+{
+	UASSERT(!path.empty());
+	UASSERT(path.front() == source);
+	UASSERT(path.back() == destination);
+	for (size_t i = 1; i < path.size(); i++) {
+		v3s16 d = path[i] - path[i - 1];
+		// one cardinal step, jumps and drops of one node at most
+		UASSERTEQ(int, abs(d.X) + abs(d.Z), 1);
+		UASSERT(abs(d.Y) <= 1);
+		UASSERT(!ndef->get(map.getNode(path[i])).walkable);
+	}
+}
+
+void TestPathfinder::testHierarchical(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->ndef();
+	v3s16 bpmin(-2, -1, -2), bpmax(1, 0, 1);
+	DummyMap map(gamedef, bpmin, bpmax);
+
+	build_walled_floor(map);
+
+	PathfinderCache cache;
+	map.addEventReceiver(&cache);
+
+	v3s16 source(-20, 0, -20);
+	v3s16 destination(20, 0, -20);
+
+	std::vector<v3s16> plain = get_path(&map, ndef, source, destination,
+			64, 1, 1, PA_PLAIN);
+	std::vector<v3s16> path = get_path(&map, ndef, source, destination,
+			64, 1, 1, PA_HIERARCHICAL, &cache);
+	checkPath(path, source, destination, map, ndef);
+	// Portals are merged, so the path may be a bit longer than the optimum
+	UASSERT(path.size() >= plain.size());
+	UASSERT(path.size() <= plain.size() + plain.size() / 4);
+
+	// Cached portals give the same result
+	std::vector<v3s16> cached = get_path(&map, ndef, source, destination,
+			64, 1, 1, PA_HIERARCHICAL, &cache);
+	UASSERT(cached == path);
+
+	// Closing the gap must invalidate the cached portals
+	for (s16 z = 21; z <= 31; z++)
+	for (s16 y = 0; y <= 2; y++)
+		map.addNodeWithEvent(v3s16(0, y, z), MapNode(t_CONTENT_STONE));
+
+	path = get_path(&map, ndef, source, destination,
+			64, 1, 1, PA_HIERARCHICAL, &cache);
+	UASSERT(path.empty());
+
+	// Opening a passage next to the start is found again
+	map.removeNodeWithEvent(v3s16(0, 0, -20));
+	map.removeNodeWithEvent(v3s16(0, 1, -20));
+	path = get_path(&map, ndef, source, destination,
+			64, 1, 1, PA_HIERARCHICAL, &cache);
+	checkPath(path, source, destination, map, ndef);
+	plain = get_path(&map, ndef, source, destination,
+			64, 1, 1, PA_PLAIN);
+	UASSERTEQ(int, plain.size(), 41);
+	UASSERT(path.size() >= plain.size());
+	UASSERT(path.size() <= plain.size() * 2);
+
+	map.removeEventReceiver(&cache);
+}
+
+void TestPathfinder::testSharedSearch(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->ndef();
+	DummyMap map(gamedef, v3s16(-2, -1, -2), v3s16(1, 0, 1));
+	build_walled_floor(map);
+	// a step to jump on
+	map.setNode(v3s16(-10, 0, 10), MapNode(t_CONTENT_STONE));
+
+	v3s16 destination(20, 0, -20);
+	std::vector<v3s16> sources = {
+		v3s16(-20, 0, -20),
+		v3s16(-10, 1, 10),   // on top of the step
+		v3s16(25, 1, 0),     // hovering, drops down
+		v3s16(0, 0, 0),      // inside the wall
+		destination,
+	};
+
+	std::vector<std::vector<v3s16>> paths = get_paths(&map, ndef, sources,
+			destination, 64, 1, 1);
+	UASSERTEQ(size_t, paths.size(), sources.size());
+
+	checkPath(paths[0], sources[0], destination, map, ndef);
+	checkPath(paths[1], sources[1], destination, map, ndef);
+	UASSERT(!paths[2].empty());
+	UASSERT(paths[2].front() == sources[2]);
+	UASSERT(paths[2].back() == destination);
+	UASSERT(paths[3].empty());
+	UASSERTEQ(size_t, paths[4].size(), 1);
+
+	// same lengths as single searches on flat ground
+	std::vector<v3s16> single = get_path(&map, ndef, sources[0], destination,
+			64, 1, 1, PA_PLAIN);
+	UASSERTEQ(size_t, paths[0].size(), single.size());
+}
+
+static void store_paths(std::vector<std::vector<v3s16>> *paths, void *param)
+{
+	auto *result = (std::vector<std::vector<v3s16>> *)param;
+	if (paths)
+		*result = std::move(*paths);
+}
+
+void TestPathfinder::testQueue(IGameDef *gamedef)
+{
+	DummyMap map(gamedef, v3s16(-2, -1, -2), v3s16(1, 0, 1));
+	build_walled_floor(map);
+
+	std::vector<PathRequest> requests = {
+		{v3s16(-20, 0, -20), v3s16(20, 0, -20), 64, 1, 1, PA_PLAIN},
+		{v3s16(-20, 0, 20), v3s16(20, 0, -20), 64, 1, 1, PA_PLAIN},
+		{v3s16(-20, 0, 20), v3s16(-20, 0, -20), 64, 1, 1, PA_PLAIN},
+		{v3s16(-20, 0, 20), v3s16(0, 0, 0), 64, 1, 1, PA_PLAIN},
+	};
+	std::vector<std::vector<v3s16>> expected = PathfinderQueue::findPaths(
+			&map, gamedef->ndef(), requests);
+
+	// without worker threads the batch is processed by step()
+	std::vector<std::vector<v3s16>> result;
+	PathfinderQueue queue(gamedef);
+	queue.enqueue(&map, std::move(requests), store_paths, &result);
+
+	// the snapshot must not see later changes
+	map.setNode(v3s16(-20, 0, -19), MapNode(t_CONTENT_STONE));
+
+	UASSERT(result.empty());
+	queue.step();
+	UASSERTEQ(size_t, result.size(), 4);
+	UASSERT(result == expected);
+	UASSERTEQ(size_t, result[2].size(), 41);
+	UASSERT(result[3].empty());
+}
+
+void TestPathfinder::testFlowField(IGameDef *gamedef)
+{
+	const NodeDefManager *ndef = gamedef->ndef();
+	DummyMap map(gamedef, v3s16(-4, -3, -4), v3s16(3, 2, 3));
+
+	// the search area must be loaded completely for the field to be cached
+	for (s16 z = -64; z <= 63; z++)
+	for (s16 x = -64; x <= 63; x++) {
+		for (s16 y = 0; y <= 5; y++)
+			map.setNode(v3s16(x, y, z), MapNode(CONTENT_AIR));
+		map.setNode(v3s16(x, -1, z), MapNode(t_CONTENT_STONE));
+	}
+	for (s16 z = -64; z <= 20; z++)
+	for (s16 y = 0; y <= 2; y++)
+		map.setNode(v3s16(0, y, z), MapNode(t_CONTENT_STONE));
+
+	PathfinderCache cache;
+	map.addEventReceiver(&cache);
+
+	v3s16 destination(20, 1, 0); // hovering
+	std::shared_ptr<const PathFlowField> field = get_flow_field(&map, ndef,
+			destination, 40, 1, 1, &cache);
+	UASSERT(field->getDestination() == destination);
+
+	v3s16 sources[] = {v3s16(-15, 0, 0), v3s16(-5, 0, -30), v3s16(40, 1, 30)};
+	for (v3s16 source : sources) {
+		std::vector<v3s16> path = field->getPath(source);
+		std::vector<v3s16> plain = get_path(&map, ndef, source, destination,
+				40, 1, 1, PA_PLAIN);
+		UASSERT(!plain.empty());
+		UASSERTEQ(size_t, path.size(), plain.size());
+		UASSERT(path.front() == source);
+		UASSERT(path.back() == destination);
+
+		v3s16 next;
+		UASSERT(field->getNextStep(source, next));
+		UASSERT(next == path[source.Y == 0 ? 1 : 2]);
+	}
+
+	v3s16 next;
+	UASSERT(field->getNextStep(v3s16(20, 0, 0), next));
+	UASSERT(next == destination);
+	UASSERT(!field->getNextStep(v3s16(0, 0, 0), next));
+	UASSERTEQ(int, field->getCost(v3s16(19, 0, 0)), 1);
+
+	// cached until a covered block changes
+	UASSERT(get_flow_field(&map, ndef, destination, 40, 1, 1, &cache) == field);
+	map.addNodeWithEvent(v3s16(-60, 5, 60), MapNode(t_CONTENT_STONE));
+	UASSERT(get_flow_field(&map, ndef, destination, 40, 1, 1, &cache) == field);
+
+	// closing the gap leaves the western side without a way
+	for (s16 z = 21; z <= 63; z++)
+	for (s16 y = 0; y <= 2; y++)
+		map.addNodeWithEvent(v3s16(0, y, z), MapNode(t_CONTENT_STONE));
+	std::shared_ptr<const PathFlowField> updated = get_flow_field(&map, ndef,
+			destination, 40, 1, 1, &cache);
+	UASSERT(updated != field);
+	UASSERT(!updated->getNextStep(v3s16(-15, 0, 0), next));
+	UASSERT(updated->getNextStep(v3s16(40, 1, 30), next));
+
+	// the blocks below an underground destination are missing, the field
+	// is still cached for a while
+	v3s16 underground(0, -40, 0);
+	std::shared_ptr<const PathFlowField> incomplete = get_flow_field(&map, ndef,
+			underground, 8, 1, 1, &cache);
+	UASSERT(get_flow_field(&map, ndef, underground, 8, 1, 1, &cache) == incomplete);
+
+	map.removeEventReceiver(&cache);
+}
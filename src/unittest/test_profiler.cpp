@@ -20,6 +20,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "test.h"
 
 #include "profiler.h"
+#include "threading/thread_pool.h"
+#include <sstream>
 
 class TestProfiler : public TestBase
 {
@@ -30,6 +32,9 @@ class TestProfiler : public TestBase
 	void runTests(IGameDef *gamedef);
 
 	void testProfilerAverage();
+	void testProfilerClear();
+	void testProfilerThreads();
+	void testProfilerTrace();
 };
 
 static TestProfiler g_test_instance;
@@ -37,6 +42,9 @@ static TestProfiler g_test_instance;
 void TestProfiler::runTests(IGameDef *gamedef)
 {
 	TEST(testProfilerAverage);
+	TEST(testProfilerClear);
+	TEST(testProfilerThreads);
+	TEST(testProfilerTrace);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -71,3 +79,85 @@ void TestProfiler::testProfilerAverage()
 
 	UASSERT(p.getValue("Test2") == 123.57f);
 }
+
+void TestProfiler::testProfilerClear()
+{
+	Profiler p;
+	Profiler::GraphValues values;
+
+	p.add("Test1", 2.f);
+	p.add(p.getId("Test1"), 3.f);
+	UASSERT(p.getValue("Test1") == 5.f);
+	UASSERT(p.getAvgCount("Test1") == 1);
+
+	// Cleared counters are still listed
+	p.clear();
+	UASSERT(p.getValue("Test1") == 0.f);
+	p.getPage(values, 1, 1);
+	UASSERT(values.size() == 1 && values["Test1"] == 0.f);
+
+	// Removed ones are not, until they are used again
+	p.remove("Test1");
+	values.clear();
+	p.getPage(values, 1, 1);
+	UASSERT(values.empty());
+	p.add("Test1", 1.f);
+	UASSERT(p.getValue("Test1") == 1.f);
+
+	// Graph values are taken by graphGet
+	p.graphAdd("Graph", 1.f);
+	p.graphAdd("Graph", 2.f);
+	p.graphGet(values);
+	UASSERT(values.size() == 1 && values["Graph"] == 3.f);
+	p.graphGet(values);
+	UASSERT(values.empty());
+	UASSERT(p.getValue("Graph") == 0.f);
+
+	{
+		ScopeProfiler sp(&p, "Scope", SPT_AVG);
+	}
+	UASSERT(p.getAvgCount("Scope [ms]") == 1);
+}
+
+void TestProfiler::testProfilerThreads()
+{
+	Profiler p;
+	Profiler::Id id = p.getId("Threads");
+	ThreadPool pool("ProfilerTest", 4);
+
+	pool.parallelFor(1000, [&] (size_t i) {
+		p.avg(id, 2.f);
+		p.add("Threads add", 1.f);
+	});
+	UASSERT(p.getValue("Threads") == 2.f);
+	UASSERT(p.getAvgCount("Threads") == 1000);
+	UASSERT(p.getValue("Threads add") == 1000.f);
+}
+
+void TestProfiler::testProfilerTrace()
+{
+	Profiler p;
+	std::ostringstream os;
+
+	UASSERT(!p.isTracing());
+	{
+		ScopeProfiler sp(&p, "Untraced", SPT_AVG);
+	}
+	UASSERT(p.writeTrace(os) == 0);
+
+	// The ring buffer keeps the newest spans only
+	p.startTracing(2);
+	UASSERT(p.isTracing());
+	p.traceSpan(p.getId("Span1"), 10, 20);
+	p.traceSpan(p.getId("Span2"), 20, 30);
+	{
+		ScopeProfiler sp(&p, "Span \"3\"", SPT_AVG);
+	}
+	os.str("");
+	UASSERT(p.writeTrace(os) == 2);
+	std::string trace = os.str();
+	UASSERT(trace.find("\"traceEvents\"") != std::string::npos);
+	UASSERT(trace.find("\"Span1\"") == std::string::npos);
+	UASSERT(trace.find("\"Span2\"") != std::string::npos);
+	UASSERT(trace.find("\"Span \\\"3\\\"\"") != std::string::npos);
+}
@@ -23,6 +23,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <queue>
 
 #include "server/activeobjectmgr.h"
+#include "server/interestmanager.h"
+#include "server/player_sao.h"
 
 #include "profiler.h"
 
@@ -39,7 +41,10 @@ class TestServerActiveObjectMgr : public TestBase
 	void testRegisterObject();
 	void testRemoveObject();
 	void testGetObjectsInsideRadius();
+	void testGetObjectsInArea();
 	void testGetAddedActiveObjectsAroundPos();
+	void testUpdateObjectPosition();
+	void testInterestManager();
 };
 
 static TestServerActiveObjectMgr g_test_instance;
@@ -50,7 +55,10 @@ void TestServerActiveObjectMgr::runTests(IGameDef *gamedef)
 	TEST(testRegisterObject)
 	TEST(testRemoveObject)
 	TEST(testGetObjectsInsideRadius);
+	TEST(testGetObjectsInArea);
 	TEST(testGetAddedActiveObjectsAroundPos);
+	TEST(testUpdateObjectPosition);
+	TEST(testInterestManager);
 }
 
 void clearSAOMgr(server::ActiveObjectMgr *saomgr)
@@ -163,6 +171,38 @@ void TestServerActiveObjectMgr::testGetObjectsInsideRadius()
 	clearSAOMgr(&saomgr);
 }
 
+void TestServerActiveObjectMgr::testGetObjectsInArea()
+{
+	server::ActiveObjectMgr saomgr;
+	static const v3f sao_pos[] = {
+			v3f(10, 40, 10),
+			v3f(740, 100, -304),
+			v3f(-200, 100, -304),
+			v3f(740, -740, -304),
+			v3f(1500, -740, -304),
+	};
+
+	for (const auto &p : sao_pos) {
+		saomgr.registerObject(new MockServerActiveObject(nullptr, p));
+	}
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInArea(aabb3f(-50, -50, -50, 50, 50, 50), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(v3f(-250, 0, -400), v3f(800, 200, 50)),
+			result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 3);
+
+	result.clear();
+	saomgr.getObjectsInArea(aabb3f(-750000, -750000, -750000,
+			750000, 750000, 750000), result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 5);
+
+	clearSAOMgr(&saomgr);
+}
+
 void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 {
 	server::ActiveObjectMgr saomgr;
@@ -190,3 +230,72 @@ void TestServerActiveObjectMgr::testGetAddedActiveObjectsAroundPos()
 
 	clearSAOMgr(&saomgr);
 }
+
+void TestServerActiveObjectMgr::testUpdateObjectPosition()
+{
+	server::ActiveObjectMgr saomgr;
+	auto sao = new MockServerActiveObject(nullptr, v3f(10, 40, 10));
+	saomgr.registerObject(sao);
+
+	std::vector<ServerActiveObject *> result;
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+
+	// Move the object several map blocks away
+	sao->setBasePosition(v3f(1500, -740, -304));
+	saomgr.updateObjectPosition(sao);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(1500, -740, -300), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 1);
+	UASSERT(result[0] == sao);
+
+	// Removed objects must vanish from the index
+	saomgr.removeObject(sao->getId());
+	result.clear();
+	saomgr.getObjectsInsideRadius(v3f(1500, -740, -300), 50, result, nullptr);
+	UASSERTCMP(int, ==, result.size(), 0);
+
+	clearSAOMgr(&saomgr);
+}
+
+void TestServerActiveObjectMgr::testInterestManager()
+{
+	// At the origin, looking along +Z
+	PlayerSAO player(nullptr, nullptr, 1, false);
+	player.setFov(72.0f * core::DEGTORAD);
+
+	InterestManager interest;
+	interest.update(0.1f, &player, 100 * BS);
+	UASSERT(interest.rate(&player).important);
+
+	MockServerActiveObject near_front(nullptr, v3f(0, 0, 10 * BS));
+	MockServerActiveObject far_front(nullptr, v3f(0, 0, 90 * BS));
+	MockServerActiveObject near_behind(nullptr, v3f(0, 0, -10 * BS));
+	MockServerActiveObject far_behind(nullptr, v3f(0, 0, -90 * BS));
+
+	InterestManager::Rating nf = interest.rate(&near_front);
+	InterestManager::Rating ff = interest.rate(&far_front);
+	InterestManager::Rating nb = interest.rate(&near_behind);
+	InterestManager::Rating fb = interest.rate(&far_behind);
+	UASSERT(!nf.important && !ff.important && !nb.important && !fb.important);
+
+	// Nearer and in view goes first
+	UASSERT(nf.priority > ff.priority);
+	UASSERT(nf.priority > nb.priority);
+	UASSERT(ff.priority > fb.priority);
+
+	// Near objects are always updated, far ones less often
+	UASSERTEQ(float, nf.interval, 0.0f);
+	UASSERTEQ(float, nb.interval, 0.0f);
+	UASSERT(ff.interval > 0.0f);
+	UASSERT(fb.interval > ff.interval);
+
+	UASSERT(interest.hasBudget());
+	interest.spend(1000000);
+	UASSERT(!interest.hasBudget());
+}
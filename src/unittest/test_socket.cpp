@@ -22,6 +22,8 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "log.h"
 #include "settings.h"
 #include "network/socket.h"
+#include <string>
+#include <vector>
 
 class TestSocket : public TestBase {
 public:
@@ -37,6 +39,7 @@ class TestSocket : public TestBase {
 
 	void testIPv4Socket();
 	void testIPv6Socket();
+	void testBatch();
 
 	static const int port = 30003;
 };
@@ -46,6 +49,7 @@ static TestSocket g_test_instance;
 void TestSocket::runTests(IGameDef *gamedef)
 {
 	TEST(testIPv4Socket);
+	TEST(testBatch);
 
 	if (g_settings->getBool("enable_ipv6"))
 		TEST(testIPv6Socket);
@@ -147,3 +151,60 @@ void TestSocket::testIPv6Socket()
 				Address(&bytes, 0).getAddress6().s6_addr, 16) == 0);
 	}
 }
+
+void TestSocket::testBatch()
+{
+	Address address(0, 0, 0, 0, port);
+	Address bind_addr(0, 0, 0, 0, port);
+
+	std::string bind_str = g_settings->get("bind_address");
+	try {
+		bind_addr.Resolve(bind_str.c_str());
+
+		if (!bind_addr.isIPv6()) {
+			address = bind_addr;
+		}
+	} catch (ResolveError &e) {
+	}
+
+	UDPSocket socket(false);
+	socket.Bind(address);
+
+	Address destination(127, 0, 0, 1, port);
+	if (address != Address(0, 0, 0, 0, port))
+		destination = address;
+
+	// More than a batch, of different sizes
+	const int count = UDPSocket::BATCH_SIZE + 8;
+	std::vector<std::string> sent;
+	std::vector<UDPDatagram> datagrams;
+	for (int i = 0; i < count; i++)
+		sent.emplace_back(i + 1, 'a' + i % 26);
+	for (std::string &data : sent)
+		datagrams.push_back({destination, &data[0], (int)data.size()});
+
+	// A datagram of the wrong address family fails alone
+	IPv6AddressBytes bytes;
+	bytes.bytes[15] = 1;
+	datagrams.insert(datagrams.begin() + 3, {Address(&bytes, port), &sent[0][0], 1});
+	UASSERTEQ(int, socket.SendBatch(datagrams.data(), datagrams.size()), 1);
+
+	sleep_ms(50);
+
+	std::vector<std::string> received;
+	char buffers[8][256];
+	for (;;) {
+		UDPDatagram batch[8];
+		for (int i = 0; i < 8; i++)
+			batch[i] = {Address(), buffers[i], sizeof(buffers[i])};
+		int n = socket.ReceiveBatch(batch, 8);
+		if (n == 0)
+			break;
+		UASSERT(n <= 8);
+		for (int i = 0; i < n; i++) {
+			UASSERT(batch[i].address == destination);
+			received.emplace_back(buffers[i], batch[i].size);
+		}
+	}
+	UASSERT(received == sent);
+}
@@ -22,6 +22,7 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include <atomic>
 #include "threading/semaphore.h"
 #include "threading/thread.h"
+#include "threading/thread_pool.h"
 
 
 class TestThreading : public TestBase {
@@ -32,6 +33,7 @@ class TestThreading : public TestBase {
 
 	void testStartStopWait();
 	void testAtomicSemaphoreThread();
+	void testThreadPool();
 };
 
 static TestThreading g_test_instance;
@@ -40,6 +42,7 @@ void TestThreading::runTests(IGameDef *gamedef)
 {
 	TEST(testStartStopWait);
 	TEST(testAtomicSemaphoreThread);
+	TEST(testThreadPool);
 }
 
 class SimpleTestThread : public Thread {
@@ -156,3 +159,29 @@ void TestThreading::testAtomicSemaphoreThread()
 	UASSERT(val == num_threads * 0x10000);
 }
 
+
+
+void TestThreading::testThreadPool()
+{
+	static const u32 count = 10000;
+	std::vector<u32> hits(count);
+
+	for (unsigned int num_threads : {0, 1, 4}) {
+		ThreadPool pool("PoolTest", num_threads);
+		UASSERTEQ(unsigned int, pool.getThreadCount(), num_threads);
+
+		// Every index is visited exactly once, the pool is reusable
+		for (size_t i = 0; i != 5; i++) {
+			std::fill(hits.begin(), hits.end(), 0);
+			pool.parallelFor(count, [&] (size_t i) {
+				hits[i]++;
+			});
+			for (u32 h : hits)
+				UASSERT(h == 1);
+		}
+
+		pool.parallelFor(0, [] (size_t i) {
+			UASSERT(false);
+		});
+	}
+}
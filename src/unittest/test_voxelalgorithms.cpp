@@ -21,8 +21,10 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 
 #include "gamedef.h"
 #include "voxelalgorithms.h"
+#include "noise.h"
 #include "util/numeric.h"
 #include "dummymap.h"
+#include "threading/thread_pool.h"
 
 class TestVoxelAlgorithms : public TestBase {
 public:
@@ -33,6 +35,7 @@ class TestVoxelAlgorithms : public TestBase {
 
 	void testVoxelLineIterator();
 	void testLighting(IGameDef *gamedef);
+	void testLightVolume(IGameDef *gamedef);
 };
 
 static TestVoxelAlgorithms g_test_instance;
@@ -41,6 +44,7 @@ void TestVoxelAlgorithms::runTests(IGameDef *gamedef)
 {
 	TEST(testVoxelLineIterator);
 	TEST(testLighting, gamedef);
+	TEST(testLightVolume, gamedef);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -168,3 +172,144 @@ void TestVoxelAlgorithms::testLighting(IGameDef *gamedef)
 		UASSERTEQ(int, n.getParam1(), 153);
 	}
 }
+
+namespace {
+
+class LightingTestMap : public DummyMap
+{
+public:
+	LightingTestMap(IGameDef *gamedef, v3s16 bpmin, v3s16 bpmax,
+			ThreadPool *pool) :
+		DummyMap(gamedef, bpmin, bpmax), m_pool(pool)
+	{}
+
+	ThreadPool *getLightingThreadPool() override { return m_pool; }
+
+private:
+	ThreadPool *m_pool;
+};
+
+// Replaces about one in change_rate nodes of the area with random ones
+void randomizeNodes(Map *map, v3s16 bpmin, v3s16 bpmax, u64 seed,
+	u32 change_rate, bool use_volume)
+{
+	const content_t contents[] = {
+		CONTENT_AIR, CONTENT_AIR, CONTENT_AIR, CONTENT_AIR, CONTENT_AIR,
+		CONTENT_AIR, CONTENT_AIR, CONTENT_AIR, CONTENT_AIR, CONTENT_AIR,
+		t_CONTENT_STONE, t_CONTENT_STONE, t_CONTENT_STONE, t_CONTENT_STONE,
+		t_CONTENT_GRASS, t_CONTENT_WATER, t_CONTENT_WATER, t_CONTENT_TORCH,
+		t_CONTENT_LAVA,
+	};
+	PcgRandom pr(seed);
+	std::map<v3s16, MapBlock*> modified_blocks;
+	MMVManip vm(map);
+	vm.initialEmerge(bpmin, bpmax, false);
+	s32 volume = vm.m_area.getVolume();
+	for (s32 i = 0; i < volume; i++) {
+		if (pr.range(change_rate) == 0)
+			vm.m_data[i] = MapNode(contents[pr.range(ARRLEN(contents))]);
+	}
+	voxalgo::set_light_volume_enabled(use_volume);
+	voxalgo::blit_back_with_light(map, &vm, &modified_blocks);
+	voxalgo::set_light_volume_enabled(true);
+}
+
+void repairLight(Map *map, v3s16 blockpos, bool use_volume)
+{
+	std::map<v3s16, MapBlock*> modified_blocks;
+	voxalgo::set_light_volume_enabled(use_volume);
+	voxalgo::repair_block_light(map, map->getBlockNoCreateNoEx(blockpos),
+		&modified_blocks);
+	voxalgo::set_light_volume_enabled(true);
+}
+
+bool isLightEqual(Map *a, Map *b, v3s16 bpmin, v3s16 bpmax)
+{
+	const NodeDefManager *ndef = a->getNodeDefManager();
+	v3s16 bp;
+	for (bp.Z = bpmin.Z; bp.Z <= bpmax.Z; bp.Z++)
+	for (bp.Y = bpmin.Y; bp.Y <= bpmax.Y; bp.Y++)
+	for (bp.X = bpmin.X; bp.X <= bpmax.X; bp.X++) {
+		MapBlock *block_a = a->getBlockNoCreateNoEx(bp);
+		MapBlock *block_b = b->getBlockNoCreateNoEx(bp);
+		if (!block_a || !block_b) {
+			if (block_a != block_b)
+				return false;
+			continue;
+		}
+		if (block_a->getLightingComplete() != block_b->getLightingComplete())
+			return false;
+		const MapNode *data_a = block_a->getData();
+		const MapNode *data_b = block_b->getData();
+		for (u32 i = 0; i < MapBlock::nodecount; i++) {
+			ContentLightingFlags f = ndef->getLightingFlags(data_a[i]);
+			// spread_light() sets the raw light of light sources below
+			// their own light depending on the order it visits the nodes
+			// in, only their resulting light must be the same
+			if (f.light_source > 0) {
+				if (data_a[i].getLight(LIGHTBANK_DAY, f) !=
+						data_b[i].getLight(LIGHTBANK_DAY, f) ||
+						data_a[i].getLight(LIGHTBANK_NIGHT, f) !=
+						data_b[i].getLight(LIGHTBANK_NIGHT, f))
+					return false;
+			} else if (data_a[i].param1 != data_b[i].param1) {
+				return false;
+			}
+		}
+	}
+	return true;
+}
+
+}
+
+void TestVoxelAlgorithms::testLightVolume(IGameDef *gamedef)
+{
+	v3s16 bpmin(-2, -2, -2);
+	v3s16 bpmax(1, 1, 1);
+	ThreadPool pool("LightTest", 2);
+
+	for (u64 seed = 0; seed < 4; seed++) {
+		PcgRandom pr(seed);
+		// The spread_light() path and the flat array path
+		LightingTestMap legacy(gamedef, bpmin, bpmax, nullptr);
+		LightingTestMap volume(gamedef, bpmin, bpmax, &pool);
+
+		// A hole in the map, the blocks next to it get incomplete lighting
+		v3s16 hole(pr.range(bpmin.X, bpmax.X), pr.range(bpmin.Y, bpmax.Y), 1);
+		for (Map *map : {(Map *)&legacy, (Map *)&volume}) {
+			MapSector *sector = map->getSectorNoGenerate(v2s16(hole.X, hole.Z));
+			sector->deleteBlock(sector->getBlockNoCreateNoEx(hole.Y));
+		}
+
+		// Generate the world
+		randomizeNodes(&legacy, bpmin, bpmax, seed, 1, false);
+		randomizeNodes(&volume, bpmin, bpmax, seed, 1, true);
+		UASSERT(isLightEqual(&legacy, &volume, bpmin, bpmax));
+
+		// Change parts of it
+		for (int i = 0; i < 4; i++) {
+			v3s16 p1(pr.range(bpmin.X, bpmax.X), pr.range(bpmin.Y, bpmax.Y),
+				pr.range(bpmin.Z, bpmax.Z));
+			v3s16 p2(pr.range(bpmin.X, bpmax.X), pr.range(bpmin.Y, bpmax.Y),
+				pr.range(bpmin.Z, bpmax.Z));
+			VoxelArea a(p1);
+			a.addPoint(p2);
+			u64 change_seed = pr.next();
+			u32 change_rate = 1 + pr.range(50);
+			randomizeNodes(&legacy, a.MinEdge, a.MaxEdge, change_seed, change_rate, false);
+			randomizeNodes(&volume, a.MinEdge, a.MaxEdge, change_seed, change_rate, true);
+			UASSERT(isLightEqual(&legacy, &volume, bpmin, bpmax));
+		}
+
+		// Repair some blocks
+		for (int i = 0; i < 4; i++) {
+			v3s16 p(pr.range(bpmin.X, bpmax.X), pr.range(bpmin.Y, bpmax.Y),
+				pr.range(bpmin.Z, bpmax.Z));
+			if (p == hole)
+				continue;
+			repairLight(&legacy, p, false);
+			repairLight(&volume, p, true);
+			UASSERT(isLightEqual(&legacy, &volume, bpmin, bpmax));
+		}
+	}
+}
@@ -21,6 +21,11 @@ with this program; if not, write to the Free Software Foundation, Inc.,
 #include "nodedef.h"
 #include "mapblock.h"
 #include "map.h"
+#include "threading/thread_pool.h"
+#include <functional>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 namespace voxalgo
 {
@@ -298,21 +303,21 @@ void unspread_light(Map *map, const NodeDefManager *nodemgr, LightBank bank,
 			// If the neighbor has at least as much light as this node, then
 			// it won't lose its light, since it should have been added to
 			// from_nodes earlier, so its light would be zero.
-			if (neighbor_f.light_propagates && neighbor_light < current_light) {
+			if (neighbor_f.light_propagates && neighbor_light < current_light &&
+					neighbor_light > 0) {
 				// Unlight, but only if the node has light.
-				if (neighbor_light > 0) {
-					neighbor.setLight(bank, 0, neighbor_f);
-					neighbor_block->setNodeNoCheck(neighbor_rel_pos, neighbor);
-					from_nodes.push(neighbor_light, neighbor_rel_pos,
-						neighbor_block_pos, neighbor_block, i);
-					// The current node was modified earlier, so its block
-					// is in modified_blocks.
-					if (current.block != neighbor_block) {
-						modified_blocks[neighbor_block_pos] = neighbor_block;
-					}
+				neighbor.setLight(bank, 0, neighbor_f);
+				neighbor_block->setNodeNoCheck(neighbor_rel_pos, neighbor);
+				from_nodes.push(neighbor_light, neighbor_rel_pos,
+					neighbor_block_pos, neighbor_block, i);
+				// The current node was modified earlier, so its block
+				// is in modified_blocks.
+				if (current.block != neighbor_block) {
+					modified_blocks[neighbor_block_pos] = neighbor_block;
 				}
 			} else {
-				// The neighbor can light up this node.
+				// The neighbor can light up this node. A light source
+				// without raw light would not be unlit, so it counts too.
 				if (neighbor_light < neighbor_f.light_source) {
 					neighbor_light = neighbor_f.light_source;
 				}
@@ -937,6 +942,376 @@ const VoxelArea block_pad[] = {
 	VoxelArea(v3s16(0, 0, 0), v3s16(0, 15, 15))    //X-
 };
 
+/*!
+ * Calls func(i) for each i in [0, count), on the threads of the pool if
+ * there is one.
+ */
+static void parallel_for(ThreadPool *pool, size_t count,
+	const std::function<void(size_t)> &func)
+{
+	if (pool) {
+		pool->parallelFor(count, func);
+		return;
+	}
+	for (size_t i = 0; i < count; i++)
+		func(i);
+}
+
+static bool light_volume_enabled = true;
+
+void set_light_volume_enabled(bool enabled)
+{
+	light_volume_enabled = enabled;
+}
+
+/*!
+ * The light of a cuboid of map blocks, copied to flat arrays with one node
+ * of border around it.
+ *
+ * Light is spread inside the cuboid without looking up map blocks or node
+ * definitions. The nodes whose light leaves the cuboid are handed over to
+ * spread_light(), which continues on the map. The result is the same as
+ * if every node of the cuboid was spread with spread_light().
+ */
+class LightVolume {
+public:
+	LightVolume(Map *map, mapblock_v3 minblock, mapblock_v3 maxblock,
+		ThreadPool *pool);
+
+	/*!
+	 * Spreads the light of every node in the cuboid.
+	 * Both light banks are spread at the same time.
+	 */
+	void spread();
+
+	/*!
+	 * Writes the light back to the map blocks.
+	 *
+	 * \param relight the nodes whose light spreads out of the cuboid are
+	 * added to this, the first queue is for day light
+	 * \param modified_blocks the blocks whose light changed are added to this
+	 */
+	void finish(ReLightQueue relight[2],
+		std::map<v3s16, MapBlock*> *modified_blocks);
+
+private:
+	enum : u8 {
+		// The lowest four bits are the light source
+		CELL_SOURCE = 0x0f,
+		CELL_PROPAGATES = 0x10,
+		CELL_HAS_LIGHT = 0x20,
+		// Around the cuboid. Light is not spread into it here.
+		CELL_BORDER = 0x40,
+		// In a block which is not loaded
+		CELL_ABSENT = 0x80,
+	};
+
+	inline u8 emission(const std::vector<u8> &light, u32 i) const
+	{
+		return MYMAX(light[i], (u8)(m_cells[i] & CELL_SOURCE));
+	}
+
+	//! Index of a block in m_blocks, the cuboid and its neighbors
+	inline size_t blockIndex(mapblock_v3 pos) const
+	{
+		v3s16 p = pos - m_minblock + v3s16(1, 1, 1);
+		return (p.Z * m_blocks_extent.Y + p.Y) * m_blocks_extent.X + p.X;
+	}
+
+	inline bool isInside(mapblock_v3 pos) const
+	{
+		return pos.X >= m_minblock.X && pos.X <= m_maxblock.X &&
+			pos.Y >= m_minblock.Y && pos.Y <= m_maxblock.Y &&
+			pos.Z >= m_minblock.Z && pos.Z <= m_maxblock.Z;
+	}
+
+	void load(size_t block_index);
+	void scanSources(size_t bank, std::vector<u32> sources[LIGHT_SUN + 1]);
+	void spreadBank(size_t bank);
+	void finishBank(size_t bank, ReLightQueue &relight);
+	bool store(size_t block_index);
+
+	const NodeDefManager *m_ndef;
+	ThreadPool *m_pool;
+	mapblock_v3 m_minblock;
+	mapblock_v3 m_maxblock;
+
+	std::vector<MapBlock *> m_blocks;
+	v3s16 m_blocks_extent;
+
+	//! Nodes of the cuboid and its border
+	VoxelArea m_area;
+	//! Index offsets of the neighbors, see neighbor_dirs
+	s32 m_offsets[6];
+	//! CELL_* flags of each node
+	std::vector<u8> m_cells;
+	//! Raw light of each node, for each bank
+	std::vector<u8> m_light[2];
+	//! m_light before spreading
+	std::vector<u8> m_initial[2];
+};
+
+LightVolume::LightVolume(Map *map, mapblock_v3 minblock, mapblock_v3 maxblock,
+	ThreadPool *pool) :
+	m_ndef(map->getNodeDefManager()),
+	m_pool(pool),
+	m_minblock(minblock),
+	m_maxblock(maxblock),
+	m_area(minblock * MAP_BLOCKSIZE - v3s16(1, 1, 1),
+		(maxblock + v3s16(1, 1, 1)) * MAP_BLOCKSIZE)
+{
+	// Look up the blocks here, the map is not safe to use from the pool
+	m_blocks_extent = maxblock - minblock + v3s16(3, 3, 3);
+	m_blocks.resize(m_blocks_extent.X * m_blocks_extent.Y * m_blocks_extent.Z);
+	mapblock_v3 bp;
+	for (bp.Z = minblock.Z - 1; bp.Z <= maxblock.Z + 1; bp.Z++)
+	for (bp.Y = minblock.Y - 1; bp.Y <= maxblock.Y + 1; bp.Y++)
+	for (bp.X = minblock.X - 1; bp.X <= maxblock.X + 1; bp.X++)
+		m_blocks[blockIndex(bp)] = map->getBlockNoCreateNoEx(bp);
+
+	for (direction d = 0; d < 6; d++) {
+		const v3s16 &dir = neighbor_dirs[d];
+		m_offsets[d] = m_area.index(dir) - m_area.index(v3s16(0, 0, 0));
+	}
+
+	s32 volume = m_area.getVolume();
+	m_cells.assign(volume, CELL_ABSENT);
+	m_light[0].assign(volume, 0);
+	m_light[1].assign(volume, 0);
+
+	parallel_for(m_pool, m_blocks.size(), [this] (size_t i) { load(i); });
+
+	m_initial[0] = m_light[0];
+	m_initial[1] = m_light[1];
+}
+
+void LightVolume::load(size_t block_index)
+{
+	MapBlock *block = m_blocks[block_index];
+	if (!block)
+		return;
+
+	mapblock_v3 bp = block->getPos();
+	u8 border = isInside(bp) ? 0 : CELL_BORDER;
+	v3s16 offset = block->getPosRelative();
+	// Part of the block in the cuboid and its border
+	v3s16 bmax = offset + (MAP_BLOCKSIZE - 1);
+	VoxelArea a(
+		v3s16(MYMAX(offset.X, m_area.MinEdge.X), MYMAX(offset.Y, m_area.MinEdge.Y),
+			MYMAX(offset.Z, m_area.MinEdge.Z)),
+		v3s16(MYMIN(bmax.X, m_area.MaxEdge.X), MYMIN(bmax.Y, m_area.MaxEdge.Y),
+			MYMIN(bmax.Z, m_area.MaxEdge.Z)));
+	// Reading does not change the storage of the nodes
+	const NodeStorage &nodes = block->getNodeStorage();
+
+	v3s16 p;
+	for (p.Z = a.MinEdge.Z; p.Z <= a.MaxEdge.Z; p.Z++)
+	for (p.Y = a.MinEdge.Y; p.Y <= a.MaxEdge.Y; p.Y++) {
+		p.X = a.MinEdge.X;
+		u32 i = m_area.index(p);
+		v3s16 rel = p - offset;
+		u32 j = rel.Z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + rel.Y * MAP_BLOCKSIZE + rel.X;
+		for (; p.X <= a.MaxEdge.X; p.X++, i++, j++) {
+			MapNode n = nodes.get(j);
+			ContentLightingFlags f = m_ndef->getLightingFlags(n);
+			m_cells[i] = f.light_source | border |
+				(f.light_propagates ? CELL_PROPAGATES : 0) |
+				(f.has_light ? CELL_HAS_LIGHT : 0);
+			m_light[0][i] = n.getLightRaw(LIGHTBANK_DAY, f);
+			m_light[1][i] = n.getLightRaw(LIGHTBANK_NIGHT, f);
+		}
+	}
+}
+
+/*!
+ * Adds the nodes of the cuboid which can light up a neighbor to sources,
+ * by their light.
+ */
+void LightVolume::scanSources(size_t bank, std::vector<u32> sources[LIGHT_SUN + 1])
+{
+	const u8 *light = m_light[bank].data();
+	const u8 *cells = m_cells.data();
+	v3s16 nmin = m_minblock * MAP_BLOCKSIZE;
+	v3s16 nmax = (m_maxblock + v3s16(1, 1, 1)) * MAP_BLOCKSIZE - v3s16(1, 1, 1);
+	u32 width = nmax.X - nmin.X + 1;
+
+	for (s16 z = nmin.Z; z <= nmax.Z; z++)
+	for (s16 y = nmin.Y; y <= nmax.Y; y++) {
+		u32 row = m_area.index(nmin.X, y, z);
+		u32 x = 0;
+#ifdef __SSE2__
+		// A node is a source if one of its neighbors propagates light
+		// and is darker than the node's light minus one. Sixteen nodes
+		// of a row are checked at once, most rows have no source at all.
+		const __m128i source_mask = _mm_set1_epi8(CELL_SOURCE);
+		const __m128i propagates = _mm_set1_epi8(CELL_PROPAGATES);
+		const __m128i one = _mm_set1_epi8(1);
+		const __m128i zero = _mm_setzero_si128();
+		for (; x + 16 <= width; x += 16) {
+			u32 i = row + x;
+			__m128i e = _mm_max_epu8(
+				_mm_loadu_si128((const __m128i *)(light + i)),
+				_mm_and_si128(_mm_loadu_si128((const __m128i *)(cells + i)),
+					source_mask));
+			__m128i spreading = _mm_subs_epu8(e, one);
+			__m128i need = zero;
+			for (s32 offset : m_offsets) {
+				__m128i n_light = _mm_loadu_si128(
+					(const __m128i *)(light + i + offset));
+				__m128i n_cells = _mm_loadu_si128(
+					(const __m128i *)(cells + i + offset));
+				__m128i n_propagates = _mm_cmpeq_epi8(
+					_mm_and_si128(n_cells, propagates), propagates);
+				need = _mm_or_si128(need, _mm_and_si128(n_propagates,
+					_mm_subs_epu8(spreading, n_light)));
+			}
+			int mask = ~_mm_movemask_epi8(_mm_cmpeq_epi8(need, zero)) & 0xffff;
+			for (u32 k = 0; mask != 0; k++, mask >>= 1) {
+				if (mask & 1)
+					sources[emission(m_light[bank], i + k)].push_back(i + k);
+			}
+		}
+#endif
+		for (; x < width; x++) {
+			u32 i = row + x;
+			u8 e = emission(m_light[bank], i);
+			if (e <= 1)
+				continue;
+			for (s32 offset : m_offsets) {
+				u32 n = i + offset;
+				if ((cells[n] & CELL_PROPAGATES) && light[n] < e - 1) {
+					sources[e].push_back(i);
+					break;
+				}
+			}
+		}
+	}
+}
+
+void LightVolume::spreadBank(size_t bank)
+{
+	std::vector<u8> &light = m_light[bank];
+	// Nodes to spread from, by their light
+	std::vector<u32> queue[LIGHT_SUN + 1];
+	scanSources(bank, queue);
+
+	// Light only decreases while spreading, so each level is done once
+	for (u8 level = LIGHT_SUN; level > 1; level--) {
+		u8 spreading = level - 1;
+		std::vector<u32> &nodes = queue[level];
+		for (u32 i : nodes) {
+			// Spread from a higher level already
+			if (emission(light, i) > level)
+				continue;
+			for (s32 offset : m_offsets) {
+				u32 n = i + offset;
+				if ((m_cells[n] & (CELL_PROPAGATES | CELL_BORDER)) != CELL_PROPAGATES ||
+						light[n] >= spreading)
+					continue;
+				light[n] = spreading;
+				queue[spreading].push_back(n);
+			}
+		}
+		nodes.clear();
+	}
+}
+
+void LightVolume::spread()
+{
+	parallel_for(m_pool, 2, [this] (size_t bank) { spreadBank(bank); });
+}
+
+void LightVolume::finishBank(size_t bank, ReLightQueue &relight)
+{
+	const std::vector<u8> &light = m_light[bank];
+	const std::vector<u8> &initial = m_initial[bank];
+	LightBank b = banks[bank];
+
+	mapblock_v3 bp;
+	for (bp.Z = m_minblock.Z; bp.Z <= m_maxblock.Z; bp.Z++)
+	for (bp.Y = m_minblock.Y; bp.Y <= m_maxblock.Y; bp.Y++)
+	for (bp.X = m_minblock.X; bp.X <= m_maxblock.X; bp.X++) {
+		MapBlock *block = m_blocks[blockIndex(bp)];
+		if (!block)
+			continue;
+		v3s16 offset = block->getPosRelative();
+		for (direction d = 0; d < 6; d++) {
+			mapblock_v3 other_pos = bp + neighbor_dirs[d];
+			bool missing = m_blocks[blockIndex(other_pos)] == NULL;
+			if (!missing && isInside(other_pos))
+				continue;
+			bool incomplete = false;
+			const VoxelArea &a = block_borders[d];
+			relative_v3 rel;
+			for (rel.Z = a.MinEdge.Z; rel.Z <= a.MaxEdge.Z; rel.Z++)
+			for (rel.Y = a.MinEdge.Y; rel.Y <= a.MaxEdge.Y; rel.Y++)
+			for (rel.X = a.MinEdge.X; rel.X <= a.MaxEdge.X; rel.X++) {
+				u32 i = m_area.index(rel + offset);
+				if (missing) {
+					// Like spread_light(), which tries every node that
+					// had light to spread or got light
+					incomplete |= emission(initial, i) > 1 ||
+						light[i] > initial[i];
+				} else {
+					u8 e = emission(light, i);
+					u32 n = i + m_offsets[d];
+					if ((m_cells[n] & CELL_PROPAGATES) && light[n] + 1 < e)
+						relight.push(e, rel, bp, block, 6);
+				}
+			}
+			if (incomplete)
+				block->setLightingComplete(b, d, false);
+		}
+	}
+}
+
+bool LightVolume::store(size_t block_index)
+{
+	MapBlock *block = m_blocks[block_index];
+	if (!block || !isInside(block->getPos()))
+		return false;
+
+	// Blocks without changes keep their node storage
+	MapNode *data = nullptr;
+	v3s16 offset = block->getPosRelative();
+	for (s16 z = 0; z < MAP_BLOCKSIZE; z++)
+	for (s16 y = 0; y < MAP_BLOCKSIZE; y++) {
+		u32 i = m_area.index(offset + v3s16(0, y, z));
+		u32 j = z * MAP_BLOCKSIZE * MAP_BLOCKSIZE + y * MAP_BLOCKSIZE;
+		for (s16 x = 0; x < MAP_BLOCKSIZE; x++, i++, j++) {
+			if (!(m_cells[i] & CELL_HAS_LIGHT) ||
+					(m_light[0][i] == m_initial[0][i] &&
+					m_light[1][i] == m_initial[1][i]))
+				continue;
+			if (!data)
+				data = block->getData();
+			data[j].param1 = m_light[0][i] | (m_light[1][i] << 4);
+		}
+	}
+	return data != nullptr;
+}
+
+void LightVolume::finish(ReLightQueue relight[2],
+	std::map<v3s16, MapBlock*> *modified_blocks)
+{
+	for (size_t bank = 0; bank < 2; bank++)
+		finishBank(bank, relight[bank]);
+
+	std::vector<u8> modified(m_blocks.size());
+	parallel_for(m_pool, m_blocks.size(), [&] (size_t i) {
+		modified[i] = store(i);
+	});
+
+	for (size_t i = 0; i < m_blocks.size(); i++) {
+		if (!modified[i])
+			continue;
+		MapBlock *block = m_blocks[i];
+		block->raiseModified(MOD_STATE_WRITE_NEEDED,
+			MOD_REASON_SET_NODE_NO_CHECK);
+		(*modified_blocks)[block->getPos()] = block;
+	}
+}
+
 /*!
  * The common part of bulk light updates - it is always executed.
  * The procedure takes the nodes that should be unlit, and the
@@ -971,45 +1346,12 @@ void finish_bulk_light_update(Map *map, mapblock_v3 minblock,
 			*modified_blocks);
 	}
 
-	// --- STEP 2: Get all newly inserted light sources
-
-	// For each block:
-	v3s16 blockpos;
-	v3s16 relpos;
-	for (blockpos.X = minblock.X; blockpos.X <= maxblock.X; blockpos.X++)
-	for (blockpos.Y = minblock.Y; blockpos.Y <= maxblock.Y; blockpos.Y++)
-	for (blockpos.Z = minblock.Z; blockpos.Z <= maxblock.Z; blockpos.Z++) {
-		MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
-		if (!block)
-			// Skip not existing blocks
-			continue;
-		// For each node in the block:
-		for (relpos.X = 0; relpos.X < MAP_BLOCKSIZE; relpos.X++)
-		for (relpos.Z = 0; relpos.Z < MAP_BLOCKSIZE; relpos.Z++)
-		for (relpos.Y = 0; relpos.Y < MAP_BLOCKSIZE; relpos.Y++) {
-			MapNode node = block->getNodeNoCheck(relpos.X, relpos.Y, relpos.Z);
-			ContentLightingFlags f = ndef->getLightingFlags(node);
-
-			// For each light bank
-			for (size_t b = 0; b < 2; b++) {
-				LightBank bank = banks[b];
-				u8 light = f.has_light ?
-					node.getLight(bank, f):
-					f.light_source;
-				if (light > 1)
-					relight[b].push(light, relpos, blockpos, block, 6);
-			} // end of banks
-		} // end of nodes
-	} // end of blocks
-
-	// --- STEP 3: do light spreading
+	// --- STEP 2: Initialize the light of the nodes found while unlighting
 
-	// For each light bank:
 	for (size_t b = 0; b < 2; b++) {
 		LightBank bank = banks[b];
 		// Sunlight is already initialized.
 		u8 maxlight = (b == 0) ? LIGHT_MAX : LIGHT_SUN;
-		// Initialize light values for light spreading.
 		for (u8 i = 0; i <= maxlight; i++) {
 			const std::vector<ChangingLight> &lights = relight[b].lights[i];
 			for (std::vector<ChangingLight>::const_iterator it = lights.begin();
@@ -1019,9 +1361,48 @@ void finish_bulk_light_update(Map *map, mapblock_v3 minblock,
 				it->block->setNodeNoCheck(it->rel_position, n);
 			}
 		}
-		// Spread lights.
-		spread_light(map, ndef, bank, relight[b], *modified_blocks);
 	}
+
+	// --- STEP 3: Spread the light of all nodes in the area
+
+	if (light_volume_enabled) {
+		// Inside the area; what leaves it is added to relight
+		LightVolume volume(map, minblock, maxblock, map->getLightingThreadPool());
+		volume.spread();
+		volume.finish(relight, modified_blocks);
+	} else {
+		// For each block:
+		v3s16 blockpos;
+		v3s16 relpos;
+		for (blockpos.X = minblock.X; blockpos.X <= maxblock.X; blockpos.X++)
+		for (blockpos.Y = minblock.Y; blockpos.Y <= maxblock.Y; blockpos.Y++)
+		for (blockpos.Z = minblock.Z; blockpos.Z <= maxblock.Z; blockpos.Z++) {
+			MapBlock *block = map->getBlockNoCreateNoEx(blockpos);
+			if (!block)
+				// Skip not existing blocks
+				continue;
+			// For each node in the block:
+			for (relpos.X = 0; relpos.X < MAP_BLOCKSIZE; relpos.X++)
+			for (relpos.Z = 0; relpos.Z < MAP_BLOCKSIZE; relpos.Z++)
+			for (relpos.Y = 0; relpos.Y < MAP_BLOCKSIZE; relpos.Y++) {
+				MapNode node = block->getNodeNoCheck(relpos.X, relpos.Y, relpos.Z);
+				ContentLightingFlags f = ndef->getLightingFlags(node);
+
+				// For each light bank
+				for (size_t b = 0; b < 2; b++) {
+					LightBank bank = banks[b];
+					u8 light = f.has_light ?
+						node.getLight(bank, f):
+						f.light_source;
+					if (light > 1)
+						relight[b].push(light, relpos, blockpos, block, 6);
+				} // end of banks
+			} // end of nodes
+		} // end of blocks
+	}
+
+	for (size_t b = 0; b < 2; b++)
+		spread_light(map, ndef, banks[b], relight[b], *modified_blocks);
 }
 
 void blit_back_with_light(Map *map, MMVManip *vm,
@@ -79,6 +79,14 @@ void blit_back_with_light(Map *map, MMVManip *vm,
 void repair_block_light(Map *map, MapBlock *block,
 	std::map<v3s16, MapBlock*> *modified_blocks);
 
+/*!
+ * Selects how blit_back_with_light() and repair_block_light() spread the
+ * light inside the updated blocks: on flat arrays, possibly on the
+ * lighting threads of the map (the default), or node by node on the map.
+ * The results are the same. For tests and benchmarks.
+ */
+void set_light_volume_enabled(bool enabled);
+
 /*!
  * This class iterates trough voxels that intersect with
  * a line. The collision detection does not see nodeboxes,